@@ -0,0 +1,428 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * Sample banks (the "tape library").  See kite_bank.h.
+ *
+ * Every open bank is kept in a list, so opening a path that is already open
+ * (with the same channel count for raw files) just hands out the same bank
+ * again.  The list is only touched by
+ * KiteOpenBank() and KiteCloseBank() (never by the real-time functions), and
+ * a mutex keeps instances being created on different threads from tripping
+ * over each other.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kite_bank.h"
+#include "kite_wav.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// ask for the whole file to be read in when it is mapped, so run() doesn't
+// wait on the disk the first time it touches a page (Linux only)
+#ifdef MAP_POPULATE
+#define BANK_MAP_FLAGS (MAP_SHARED | MAP_POPULATE)
+#else
+#define BANK_MAP_FLAGS MAP_SHARED
+#endif
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+// the banks that are open right now
+static KiteBank * open_banks = NULL;
+static pthread_mutex_t open_banks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// maps one file and fills in its entry; returns KITE_ERROR to leave it out
+static int MapFile(const char * path, unsigned long raw_channels,
+                   KiteBankEntry * entry);
+
+// adds a mapped file to the bank's index
+static int AddEntry(KiteBank * bank, const KiteBankEntry * entry);
+
+// unmaps every file of a bank and frees it
+static void FreeBank(KiteBank * bank);
+
+// returns ON if a file name ends in one of the extensions the bank reads
+static short IsSoundFileName(const char * name);
+
+// finds the file a bank-wide frame number falls in
+static const KiteBankEntry * FindEntry(const KiteBank * bank,
+                                       unsigned long frame);
+
+
+//---------------
+//-- FUNCTIONS --
+//---------------
+
+
+/*
+ * Opens a bank.  'path' is either one sound file, or a directory, in which
+ * case every sound file directly inside it goes in the bank, in file name
+ * order (so the same seed always picks the same pieces).  Returns NULL if
+ * there is nothing usable there.
+ */
+KiteBank * KiteOpenBank(const char * path, unsigned long raw_channels)
+{
+    char full_path[PATH_MAX];
+    KiteBankEntry entry;
+    struct stat status;
+
+    if (!path || raw_channels == 0 || !realpath(path, full_path) ||
+        stat(full_path, &status) != 0)
+        return NULL;
+
+    pthread_mutex_lock(&open_banks_lock);
+
+    // share the bank if it's already open with the same channel count (the
+    // same files read with another one are another bank)
+    KiteBank * bank = NULL;
+    for (bank = open_banks; bank; bank = bank->next)
+    {
+        if (strcmp(bank->path, full_path) == 0 &&
+            bank->raw_channels == raw_channels)
+        {
+            ++bank->references;
+            pthread_mutex_unlock(&open_banks_lock);
+            return bank;
+        }
+    }
+
+    bank = (KiteBank *) calloc(1, sizeof (KiteBank));
+    if (!bank || !(bank->path = strdup(full_path)))
+    {
+        free(bank);
+        pthread_mutex_unlock(&open_banks_lock);
+        return NULL;
+    }
+
+    if (S_ISDIR(status.st_mode))
+    {
+        struct dirent ** names = NULL;
+        int count = scandir(full_path, &names, NULL, alphasort);
+        int i = 0;
+
+        for (i = 0; i < count; ++i)
+        {
+            char file_path[PATH_MAX];
+            if (IsSoundFileName(names[i]->d_name) &&
+                strlen(full_path) + strlen(names[i]->d_name) + 2 <=
+                sizeof (file_path))
+            {
+                strcpy(file_path, full_path);
+                strcat(file_path, "/");
+                strcat(file_path, names[i]->d_name);
+                if (MapFile(file_path, raw_channels, &entry) == KITE_OK &&
+                    AddEntry(bank, &entry) != KITE_OK)
+                    munmap(entry.mapping, entry.mapping_size);
+            }
+            free(names[i]);
+        }
+        free(names);
+    }
+    else if (MapFile(full_path, raw_channels, &entry) == KITE_OK &&
+             AddEntry(bank, &entry) != KITE_OK)
+        munmap(entry.mapping, entry.mapping_size);
+
+    if (bank->total_frames == 0)
+    {
+        FreeBank(bank);
+        pthread_mutex_unlock(&open_banks_lock);
+        return NULL;
+    }
+
+    bank->raw_channels = raw_channels;
+    bank->references = 1;
+    bank->next = open_banks;
+    open_banks = bank;
+
+    pthread_mutex_unlock(&open_banks_lock);
+    return bank;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Lets go of a bank.  The last one to let go unmaps it.
+ */
+void KiteCloseBank(KiteBank * bank)
+{
+    if (!bank)
+        return;
+
+    pthread_mutex_lock(&open_banks_lock);
+
+    if (--bank->references == 0)
+    {
+        KiteBank ** link = &open_banks;
+        while (*link && *link != bank)
+            link = &(*link)->next;
+        if (*link)
+            *link = bank->next;
+        FreeBank(bank);
+    }
+
+    pthread_mutex_unlock(&open_banks_lock);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Cuts 'total_samples' samples worth of tape out of the bank.  Each piece
+ * is as long as one of Kite's sub-blocks (0.25 to 2 seconds, unless the
+ * rules say otherwise, and drawn from the rules' table of lengths like
+ * KitePickBlock() draws them), starts at a random place anywhere in the bank
+ * (so longer files get picked more often), never runs past the end of its
+ * file, and is reversed as often as Kite's sub-blocks are.
+ *
+ * Like KiteGeneratePlan(), this doesn't allocate anything for a plan that
+ * was reserved for 'total_samples' samples with KiteReservePlan() (unless
+ * the bank is full of files shorter than the shortest sub-block).
+ */
+int KiteGenerateBankPlan(KitePlan * plan, KiteRandom * rng,
+                         const KiteCutRules * rules, const KiteBank * bank,
+                         unsigned long total_samples)
+{
+    plan->segment_count = 0;
+    plan->total_samples = 0;
+
+    if (total_samples == 0 || !bank || bank->total_frames == 0)
+        return KITE_ERROR;
+
+    unsigned long min_length = rules->min_block_start;
+    unsigned long max_length = rules->max_block_end - rules->min_block_start;
+
+    unsigned long out_index = 0;
+    while (out_index < total_samples)
+    {
+        unsigned long length = KitePickLength(rng, &rules->lengths,
+                                              min_length, max_length);
+        unsigned long start = KiteRandomNaturalNumber(rng, 0,
+                                                      bank->total_frames - 1);
+        short reverse = KitePickReverse(rng, rules);
+
+        // don't run past the end of the output, or the end of the file
+        const KiteBankEntry * entry = FindEntry(bank, start);
+        unsigned long entry_end = entry->first_frame + entry->frame_count;
+        if (length > total_samples - out_index)
+            length = total_samples - out_index;
+        if (length > entry->frame_count)
+            length = entry->frame_count;
+        if (start + length > entry_end)
+            start = entry_end - length;
+
+        if (KiteGrowPlan(plan, plan->segment_count + 1) != KITE_OK)
+            return KITE_ERROR;
+        KiteSegment * segment = &plan->segments[plan->segment_count++];
+        segment->source_start = start;
+        segment->dest_start = out_index;
+        segment->length = length;
+        segment->reverse = reverse;
+        out_index += length;
+    }
+
+    plan->total_samples = total_samples;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Copies every segment of the plan straight out of the mapped files into
+ * the output buffers.  Output channel c gets channel (c mod the file's
+ * channel count) of the file, so mono files go to every channel.
+ */
+void KiteExecuteBankPlan(const KitePlan * plan, const KiteBank * bank,
+                         float * const * outputs, unsigned long channels)
+{
+    unsigned long i = 0;
+    unsigned long channel = 0;
+
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
+        const KiteBankEntry * entry = FindEntry(bank, segment->source_start);
+        const float * frames = entry->frames +
+                (segment->source_start - entry->first_frame) *
+                entry->channels;
+
+        for (channel = 0; channel < channels; ++channel)
+            KiteGatherSamples(outputs[channel] + segment->dest_start,
+                              frames + channel % entry->channels,
+                              segment->length, segment->reverse,
+                              entry->channels);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Maps a file read-only and works out where its samples are.  WAV files
+ * must hold 32-bit floats (starting on a 4-byte boundary, which is where
+ * every WAV writer puts them); anything that isn't a WAV file at all is
+ * taken to be raw interleaved floats with 'raw_channels' channels.
+ */
+static int MapFile(const char * path, unsigned long raw_channels,
+                   KiteBankEntry * entry)
+{
+    struct stat status;
+    KiteSoundLayout layout;
+
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+        return KITE_ERROR;
+    if (fstat(file, &status) != 0 || !S_ISREG(status.st_mode) ||
+        status.st_size <= 0)
+    {
+        close(file);
+        return KITE_ERROR;
+    }
+
+    void * mapping = mmap(NULL, (size_t) status.st_size, PROT_READ,
+                          BANK_MAP_FLAGS, file, 0);
+    // the mapping stays good after the file is closed
+    close(file);
+    if (mapping == MAP_FAILED)
+        return KITE_ERROR;
+
+    unsigned long size = (unsigned long) status.st_size;
+    memset(entry, 0, sizeof (KiteBankEntry));
+    entry->mapping = mapping;
+    entry->mapping_size = size;
+
+    // a WAV file the engine can't read is refused, not played as raw floats
+    KiteSoundLayout raw_layout;
+    raw_layout.format = KITE_FORMAT_FLOAT32;
+    raw_layout.channels = raw_channels;
+    raw_layout.sample_rate = 0;
+    if (KiteReadSoundLayout((const unsigned char *) mapping, size,
+                            &raw_layout, &layout) != KITE_OK ||
+        layout.format != KITE_FORMAT_FLOAT32 || layout.channels == 0 ||
+        layout.data_offset % sizeof (float) != 0)
+    {
+        munmap(mapping, size);
+        return KITE_ERROR;
+    }
+    entry->frames = (const float *) ((const unsigned char *) mapping +
+                                     layout.data_offset);
+    entry->channels = layout.channels;
+    entry->frame_count = layout.data_size /
+            (sizeof (float) * layout.channels);
+
+    if (entry->frame_count == 0)
+    {
+        munmap(mapping, size);
+        return KITE_ERROR;
+    }
+
+    // the segments are read straight through, so read ahead
+    madvise(mapping, size, MADV_WILLNEED);
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Adds a file to the end of the bank's index.
+ */
+static int AddEntry(KiteBank * bank, const KiteBankEntry * entry)
+{
+    KiteBankEntry * entries = (KiteBankEntry *)
+            realloc(bank->entries,
+                    (bank->entry_count + 1) * sizeof (KiteBankEntry));
+    if (!entries)
+        return KITE_ERROR;
+
+    bank->entries = entries;
+    entries[bank->entry_count] = *entry;
+    entries[bank->entry_count].first_frame = bank->total_frames;
+    bank->total_frames += entry->frame_count;
+    ++bank->entry_count;
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+static void FreeBank(KiteBank * bank)
+{
+    unsigned long i = 0;
+
+    for (i = 0; i < bank->entry_count; ++i)
+        munmap(bank->entries[i].mapping, bank->entries[i].mapping_size);
+    free(bank->entries);
+    free(bank->path);
+    free(bank);
+}
+
+//-----------------------------------------------------------------------------
+
+
+static short IsSoundFileName(const char * name)
+{
+    const char * extension = strrchr(name, '.');
+
+    if (!extension || extension == name)
+        return OFF;
+    return strcasecmp(extension, ".wav") == 0 ||
+           strcasecmp(extension, ".raw") == 0 ||
+           strcasecmp(extension, ".f32") == 0 ? ON : OFF;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Binary search for the last file starting at or before 'frame'.
+ */
+static const KiteBankEntry * FindEntry(const KiteBank * bank,
+                                       unsigned long frame)
+{
+    unsigned long low = 0;
+    unsigned long high = bank->entry_count - 1;
+
+    while (low < high)
+    {
+        unsigned long middle = (low + high + 1) / 2;
+        if (bank->entries[middle].first_frame <= frame)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    return &bank->entries[low];
+}
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * Sample banks (the "tape library")
+ *
+ * The sound effects on "Mr. Kite" were cut from a library of prerecorded
+ * tape, not from whatever was coming down the wire.  A KiteBank is that
+ * library: a sound file, or a directory of them, memory-mapped and indexed
+ * once when it is opened.  Plans made with KiteGenerateBankPlan() draw their
+ * segments from anywhere in the bank, and KiteExecuteBankPlan() copies them
+ * straight out of the mapping into the output buffers.  Nothing is read
+ * from disk or copied anywhere else while audio is running.
+ *
+ * Banks are shared: opening the same path again with the same channel count
+ * for raw files (from any number of plugin instances) returns the same bank
+ * with its reference count raised, and it is unmapped when the last user
+ * closes it.  The pages are shared with the operating system's file cache,
+ * so several processes using the same bank don't use any more memory
+ * either.
+ *
+ * A bank holds 32-bit float samples only: WAV files in float format, and raw
+ * files (ending in .raw or .f32) of interleaved floats.  Files in other
+ * formats are left out of the index.
+ */
+
+#ifndef KITE_BANK_H
+#define KITE_BANK_H
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include "kite_engine.h"
+
+
+//-----------
+//-- TYPES --
+//-----------
+
+/*
+ * One sound file in a bank.  The frames are numbered across the whole bank
+ * as if the files were spliced end to end, in file name order; a plan's
+ * source_start values are these bank-wide numbers.
+ */
+typedef struct
+{
+    // the samples (interleaved frames) inside the mapping
+    const float * frames;
+    unsigned long frame_count;
+    unsigned long channels;
+    // the bank-wide number of this file's first frame
+    unsigned long first_frame;
+    // the whole mapped file, for unmapping it
+    void * mapping;
+    unsigned long mapping_size;
+} KiteBankEntry;
+
+/*
+ * A sample bank.  Only kite_bank.c changes one once it is open.
+ */
+typedef struct KiteBank
+{
+    char * path;
+    // the channel count raw files were read with
+    unsigned long raw_channels;
+    KiteBankEntry * entries;
+    unsigned long entry_count;
+    unsigned long total_frames;
+    // the number of KiteOpenBank() calls not yet closed
+    unsigned long references;
+    // the next open bank (see kite_bank.c)
+    struct KiteBank * next;
+} KiteBank;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// maps and indexes a file or directory of files (or shares the bank if it
+// is already open with the same 'raw_channels').  Raw files are taken to
+// have 'raw_channels' channels
+KiteBank * KiteOpenBank(const char * path, unsigned long raw_channels);
+
+// lets go of a bank, unmapping it if nobody else is using it
+void KiteCloseBank(KiteBank * bank);
+
+// draws 'total_samples' samples worth of segments from anywhere in the bank
+int KiteGenerateBankPlan(KitePlan * plan, KiteRandom * rng,
+                         const KiteCutRules * rules, const KiteBank * bank,
+                         unsigned long total_samples);
+
+// copies the plan's segments out of the bank into planar output buffers
+void KiteExecuteBankPlan(const KitePlan * plan, const KiteBank * bank,
+                         float * const * outputs, unsigned long channels);
+
+#endif
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,745 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * The Kite render cache.  See kite_cache.h for the big picture.
+ *
+ * Every entry is one file in the cache directory, named after its key:
+ * "<key>.plan" for segment tables and "<key>.render" for rendered samples.
+ * New entries are written to a temporary file and renamed into place, so a
+ * reader (maybe in another process) never sees half an entry.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "kite_cache.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// the XXH64 primes
+#define PRIME_1 0x9E3779B185EBCA87ULL
+#define PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME_3 0x165667B19E3779F9ULL
+#define PRIME_4 0x85EBCA77C2B2AE63ULL
+#define PRIME_5 0x27D4EB2F165667C5ULL
+
+// the first 8 bytes of a cached segment table file, and of a cached render
+#define PLAN_MAGIC "KITEPLN2"
+#define RENDER_MAGIC "KITEREN1"
+// the header of a segment table entry is the magic, the total sample count,
+// the segment count and the hash of the segments; a render's is the magic
+// and the hash of the samples
+#define PLAN_HEADER_BYTES 32
+#define RENDER_HEADER_BYTES 16
+// the bytes of one stored segment (four 64-bit numbers)
+#define SEGMENT_BYTES 32
+
+// longest file name the cache creates (16 hex digits plus an extension)
+#define ENTRY_NAME_LENGTH 32
+
+
+//------------------------
+//-- STRUCT DEFINITIONS --
+//------------------------
+
+/*
+ * A cache file found while looking for something to evict.
+ */
+typedef struct
+{
+    char name[ENTRY_NAME_LENGTH];
+    uint64_t size;
+    struct timespec last_used;
+} CacheEntry;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// builds the path of a cache entry
+static char * EntryPath(const KiteCache * cache, uint64_t key,
+                        const char * extension);
+
+// reads a whole cache entry into a new buffer, touching it on success
+static unsigned char * ReadEntry(KiteCache * cache, uint64_t key,
+                                 const char * extension, size_t * size);
+
+// writes a cache entry, then evicts old entries if over the size limit
+static int WriteEntry(KiteCache * cache, uint64_t key, const char * extension,
+                      const void * header, size_t header_size,
+                      const void * data, size_t data_size);
+
+// throws out least recently used entries until under the size limit
+static void EvictEntries(KiteCache * cache);
+
+// hashes the table of sub-block lengths of some cut rules
+static uint64_t LengthsKey(const KiteLengthTable * lengths);
+
+
+//---------------
+//-- FUNCTIONS --
+//---------------
+
+
+static uint64_t RotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t Read64(const unsigned char * bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, 8);
+    return value;
+}
+
+static uint64_t Read32(const unsigned char * bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, 4);
+    return value;
+}
+
+static uint64_t HashRound(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * PRIME_2;
+    accumulator = RotateLeft(accumulator, 31);
+    return accumulator * PRIME_1;
+}
+
+static uint64_t HashMerge(uint64_t hash, uint64_t accumulator)
+{
+    hash ^= HashRound(0, accumulator);
+    return hash * PRIME_1 + PRIME_4;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Hashes a block of memory with Yann Collet's XXH64 (the same results as the
+ * reference xxHash code on a little-endian machine).  It chews through 32
+ * bytes per step, so hashing an input costs about as much as reading it.
+ */
+uint64_t KiteHash(const void * data, size_t size, uint64_t seed)
+{
+    const unsigned char * bytes = (const unsigned char *) data;
+    const unsigned char * end = bytes + size;
+    uint64_t hash = 0;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + PRIME_1 + PRIME_2;
+        uint64_t v2 = seed + PRIME_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME_1;
+
+        while (bytes + 32 <= end)
+        {
+            v1 = HashRound(v1, Read64(bytes));
+            v2 = HashRound(v2, Read64(bytes + 8));
+            v3 = HashRound(v3, Read64(bytes + 16));
+            v4 = HashRound(v4, Read64(bytes + 24));
+            bytes += 32;
+        }
+
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) +
+                RotateLeft(v4, 18);
+        hash = HashMerge(hash, v1);
+        hash = HashMerge(hash, v2);
+        hash = HashMerge(hash, v3);
+        hash = HashMerge(hash, v4);
+    }
+    else
+        hash = seed + PRIME_5;
+
+    hash += (uint64_t) size;
+
+    while (bytes + 8 <= end)
+    {
+        hash ^= HashRound(0, Read64(bytes));
+        hash = RotateLeft(hash, 27) * PRIME_1 + PRIME_4;
+        bytes += 8;
+    }
+    if (bytes + 4 <= end)
+    {
+        hash ^= Read32(bytes) * PRIME_1;
+        hash = RotateLeft(hash, 23) * PRIME_2 + PRIME_3;
+        bytes += 4;
+    }
+    while (bytes < end)
+    {
+        hash ^= (*bytes) * PRIME_5;
+        hash = RotateLeft(hash, 11) * PRIME_1;
+        ++bytes;
+    }
+
+    // mix the last bits all over the hash
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The key of a segment table.  A plan doesn't depend on the input samples at
+ * all, only on how many of them there are.  The sample rate only matters
+ * through the cut rules, which are in samples.
+ */
+uint64_t KitePlanKey(uint64_t seed, const KiteCutRules * rules,
+                     unsigned long total_samples)
+{
+    uint64_t fields[8];
+
+    fields[0] = KITE_CACHE_VERSION;
+    fields[1] = 0x706C616E;     // "plan", so plan and render keys never meet
+    fields[2] = seed;
+    fields[3] = rules->min_block_start;
+    fields[4] = rules->max_block_end;
+    fields[5] = rules->reverse_modulus;
+    fields[6] = rules->reverse_threshold;
+    fields[7] = total_samples;
+
+    return KiteHash(fields, sizeof (fields), LengthsKey(&rules->lengths));
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The key of a rendered output.  'input_hash' is KiteHash() of the input
+ * samples, which also covers their count.
+ */
+uint64_t KiteRenderKey(uint64_t input_hash, uint64_t seed,
+                       const KiteCutRules * rules, unsigned long frame_size)
+{
+    uint64_t fields[9];
+
+    fields[0] = KITE_CACHE_VERSION;
+    fields[1] = 0x72656E64;     // "rend"
+    fields[2] = input_hash;
+    fields[3] = seed;
+    fields[4] = rules->min_block_start;
+    fields[5] = rules->max_block_end;
+    fields[6] = rules->reverse_modulus;
+    fields[7] = rules->reverse_threshold;
+    fields[8] = frame_size;
+
+    return KiteHash(fields, sizeof (fields), LengthsKey(&rules->lengths));
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The hash of a table of sub-block lengths, which the plan and render keys
+ * are seeded with.  The even spread (no table) hashes to 0, so the keys of
+ * everything cached before there were tables stay the same.
+ */
+static uint64_t LengthsKey(const KiteLengthTable * lengths)
+{
+    uint64_t key = 0;
+
+    if (lengths->count == 0)
+        return 0;
+    key = KiteHash(lengths->keep, lengths->count * sizeof (uint32_t),
+                   lengths->count);
+    return KiteHash(lengths->alias, lengths->count * sizeof (uint32_t), key);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Opens a cache directory, creating it if it isn't there yet.
+ */
+int KiteOpenCache(KiteCache * cache, const char * directory,
+                  uint64_t max_bytes)
+{
+    memset(cache, 0, sizeof (KiteCache));
+
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+        return KITE_ERROR;
+
+    cache->directory = strdup(directory);
+    if (!cache->directory)
+        return KITE_ERROR;
+    cache->max_bytes = max_bytes;
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Reads the totals in the stats file.  'fd' must be locked by the caller.
+ */
+static void ReadStats(int fd, unsigned long * hits, unsigned long * misses,
+                      unsigned long * evictions)
+{
+    char text[128];
+    ssize_t length = pread(fd, text, sizeof (text) - 1, 0);
+
+    *hits = 0;
+    *misses = 0;
+    *evictions = 0;
+    if (length <= 0)
+        return;
+
+    text[length] = '\0';
+    sscanf(text, "hits %lu misses %lu evictions %lu", hits, misses,
+           evictions);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Adds this process' statistics to the totals in the directory's stats file
+ * (under a lock, since other processes may share the cache), and frees the
+ * cache's memory.
+ */
+void KiteCloseCache(KiteCache * cache)
+{
+    if (!cache->directory)
+        return;
+
+    char * path = malloc(strlen(cache->directory) + 8);
+    if (path)
+    {
+        sprintf(path, "%s/stats", cache->directory);
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd >= 0)
+        {
+            unsigned long hits = 0;
+            unsigned long misses = 0;
+            unsigned long evictions = 0;
+            char text[128];
+
+            flock(fd, LOCK_EX);
+            ReadStats(fd, &hits, &misses, &evictions);
+            int length = snprintf(text, sizeof (text),
+                                  "hits %lu misses %lu evictions %lu\n",
+                                  hits + cache->hits,
+                                  misses + cache->misses,
+                                  evictions + cache->evictions);
+            if (ftruncate(fd, 0) == 0 && pwrite(fd, text, length, 0) < 0)
+                length = 0;
+            flock(fd, LOCK_UN);
+            close(fd);
+        }
+        free(path);
+    }
+
+    free(cache->directory);
+    memset(cache, 0, sizeof (KiteCache));
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Reads the totals in the stats file plus this process' own counts.
+ */
+void KiteCacheTotals(const KiteCache * cache, unsigned long * hits,
+                     unsigned long * misses, unsigned long * evictions)
+{
+    *hits = 0;
+    *misses = 0;
+    *evictions = 0;
+
+    char * path = malloc(strlen(cache->directory) + 8);
+    if (path)
+    {
+        sprintf(path, "%s/stats", cache->directory);
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0)
+        {
+            flock(fd, LOCK_SH);
+            ReadStats(fd, hits, misses, evictions);
+            flock(fd, LOCK_UN);
+            close(fd);
+        }
+        free(path);
+    }
+
+    *hits += cache->hits;
+    *misses += cache->misses;
+    *evictions += cache->evictions;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Looks up a segment table.  On a hit, the plan's table is replaced by the
+ * cached one and KITE_OK is returned.  An entry that is cut short, has been
+ * changed since it was stored (its hash doesn't match), or doesn't make a
+ * plan KiteCheckPlan() accepts counts as a miss, and leaves the plan empty.
+ */
+int KiteCacheLoadPlan(KiteCache * cache, uint64_t key, KitePlan * plan)
+{
+    size_t size = 0;
+    unsigned char * file = ReadEntry(cache, key, "plan", &size);
+    if (!file)
+        return KITE_ERROR;
+
+    uint64_t header[4];
+    uint64_t count = 0;
+    short good = OFF;
+    if (size >= PLAN_HEADER_BYTES)
+    {
+        memcpy(header, file, PLAN_HEADER_BYTES);
+        count = header[2];
+        if (memcmp(file, PLAN_MAGIC, 8) == 0 &&
+            (size - PLAN_HEADER_BYTES) % SEGMENT_BYTES == 0 &&
+            (size - PLAN_HEADER_BYTES) / SEGMENT_BYTES == count &&
+            KiteHash(file + PLAN_HEADER_BYTES, size - PLAN_HEADER_BYTES,
+                     0) == header[3] &&
+            KiteGrowPlan(plan, count) == KITE_OK)
+            good = ON;
+    }
+
+    unsigned long i = 0;
+    for (i = 0; good && i < count; ++i)
+    {
+        uint64_t fields[4];
+        memcpy(fields, file + PLAN_HEADER_BYTES + i * SEGMENT_BYTES,
+               SEGMENT_BYTES);
+        plan->segments[i].source_start = fields[0];
+        plan->segments[i].dest_start = fields[1];
+        plan->segments[i].length = fields[2];
+        plan->segments[i].reverse = fields[3] ? ON : OFF;
+    }
+    if (good)
+    {
+        plan->segment_count = count;
+        plan->total_samples = header[1];
+        if (KiteCheckPlan(plan) != KITE_OK)
+        {
+            plan->segment_count = 0;
+            plan->total_samples = 0;
+            good = OFF;
+        }
+    }
+    free(file);
+
+    if (!good)
+    {
+        // a damaged entry counts as a miss
+        --cache->hits;
+        ++cache->misses;
+        return KITE_ERROR;
+    }
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Stores a segment table.
+ */
+int KiteCacheStorePlan(KiteCache * cache, uint64_t key, const KitePlan * plan)
+{
+    uint64_t header[4];
+    size_t size = plan->segment_count * SEGMENT_BYTES;
+    uint64_t * fields = malloc(size > 0 ? size : 1);
+    if (!fields)
+        return KITE_ERROR;
+
+    unsigned long i = 0;
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        fields[i * 4] = plan->segments[i].source_start;
+        fields[i * 4 + 1] = plan->segments[i].dest_start;
+        fields[i * 4 + 2] = plan->segments[i].length;
+        fields[i * 4 + 3] = plan->segments[i].reverse;
+    }
+
+    memcpy(header, PLAN_MAGIC, 8);
+    header[1] = plan->total_samples;
+    header[2] = plan->segment_count;
+    header[3] = KiteHash(fields, size, 0);
+
+    int result = WriteEntry(cache, key, "plan", header, sizeof (header),
+                            fields, size);
+    free(fields);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Looks up a rendered output.  The entry only counts as a hit if it holds
+ * exactly the expected number of bytes, and they still hash to what they
+ * did when they were stored; 'output' is only written on a hit.
+ */
+int KiteCacheLoadRender(KiteCache * cache, uint64_t key, void * output,
+                        size_t size)
+{
+    size_t cached_size = 0;
+    unsigned char * file = ReadEntry(cache, key, "render", &cached_size);
+    if (!file)
+        return KITE_ERROR;
+
+    uint64_t hash = 0;
+    if (cached_size == RENDER_HEADER_BYTES + size)
+        memcpy(&hash, file + 8, sizeof (hash));
+    if (cached_size != RENDER_HEADER_BYTES + size ||
+        memcmp(file, RENDER_MAGIC, 8) != 0 ||
+        KiteHash(file + RENDER_HEADER_BYTES, size, 0) != hash)
+    {
+        --cache->hits;
+        ++cache->misses;
+        free(file);
+        return KITE_ERROR;
+    }
+
+    memcpy(output, file + RENDER_HEADER_BYTES, size);
+    free(file);
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Stores a rendered output, after a header with its hash (see
+ * KiteCacheLoadRender()).
+ */
+int KiteCacheStoreRender(KiteCache * cache, uint64_t key, const void * output,
+                         size_t size)
+{
+    uint64_t header[2];
+
+    memcpy(header, RENDER_MAGIC, 8);
+    header[1] = KiteHash(output, size, 0);
+    return WriteEntry(cache, key, "render", header, sizeof (header), output,
+                      size);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Builds "<directory>/<key>.<extension>" in a new buffer.
+ */
+static char * EntryPath(const KiteCache * cache, uint64_t key,
+                        const char * extension)
+{
+    char * path = malloc(strlen(cache->directory) + ENTRY_NAME_LENGTH + 2);
+    if (path)
+        sprintf(path, "%s/%016llx.%s", cache->directory,
+                (unsigned long long) key, extension);
+    return path;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Reads a whole entry.  Counts a hit or a miss, and on a hit sets the file's
+ * times to now, which moves it to the back of the eviction line.
+ */
+static unsigned char * ReadEntry(KiteCache * cache, uint64_t key,
+                                 const char * extension, size_t * size)
+{
+    char * path = EntryPath(cache, key, extension);
+    if (!path)
+        return NULL;
+
+    unsigned char * buffer = NULL;
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &info) == 0)
+    {
+        buffer = malloc(info.st_size > 0 ? info.st_size : 1);
+        if (buffer && read(fd, buffer, info.st_size) != info.st_size)
+        {
+            free(buffer);
+            buffer = NULL;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (buffer)
+    {
+        ++cache->hits;
+        *size = info.st_size;
+        utimensat(AT_FDCWD, path, NULL, 0);
+    }
+    else
+        ++cache->misses;
+
+    free(path);
+    return buffer;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Writes an entry (an optional header followed by the data) to a temporary
+ * file and renames it into place.  Entries bigger than the whole cache are
+ * not stored at all.
+ */
+static int WriteEntry(KiteCache * cache, uint64_t key, const char * extension,
+                      const void * header, size_t header_size,
+                      const void * data, size_t data_size)
+{
+    if (header_size + data_size > cache->max_bytes)
+        return KITE_ERROR;
+
+    char * path = EntryPath(cache, key, extension);
+    char * temp_path = malloc(strlen(cache->directory) + 64);
+    if (!path || !temp_path)
+    {
+        free(path);
+        free(temp_path);
+        return KITE_ERROR;
+    }
+    sprintf(temp_path, "%s/.tmp.%ld.%016llx", cache->directory,
+            (long) getpid(), (unsigned long long) key);
+
+    int result = KITE_ERROR;
+    FILE * write_file = fopen(temp_path, "wb");
+    if (write_file)
+    {
+        if ((header_size == 0 ||
+             fwrite(header, 1, header_size, write_file) == header_size) &&
+            (data_size == 0 ||
+             fwrite(data, 1, data_size, write_file) == data_size))
+            result = KITE_OK;
+        if (fclose(write_file) != 0)
+            result = KITE_ERROR;
+    }
+
+    if (result == KITE_OK && rename(temp_path, path) != 0)
+        result = KITE_ERROR;
+    if (result != KITE_OK)
+        unlink(temp_path);
+
+    free(path);
+    free(temp_path);
+
+    if (result == KITE_OK)
+        EvictEntries(cache);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Sorts cache entries oldest first.
+ */
+static int CompareEntryAge(const void * a, const void * b)
+{
+    const CacheEntry * first = (const CacheEntry *) a;
+    const CacheEntry * second = (const CacheEntry *) b;
+
+    if (first->last_used.tv_sec != second->last_used.tv_sec)
+        return first->last_used.tv_sec < second->last_used.tv_sec ? -1 : 1;
+    if (first->last_used.tv_nsec != second->last_used.tv_nsec)
+        return first->last_used.tv_nsec < second->last_used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Adds up the size of every entry in the directory, and if that is over the
+ * limit, deletes entries starting with the least recently used one.
+ */
+static void EvictEntries(KiteCache * cache)
+{
+    DIR * directory = opendir(cache->directory);
+    if (!directory)
+        return;
+
+    CacheEntry * entries = NULL;
+    unsigned long count = 0;
+    unsigned long capacity = 0;
+    uint64_t total = 0;
+    struct dirent * item = NULL;
+
+    while ((item = readdir(directory)) != NULL)
+    {
+        const char * dot = strrchr(item->d_name, '.');
+        struct stat info;
+
+        // only look at entries (this skips "stats" and temporary files)
+        if (!dot || dot == item->d_name ||
+            strlen(item->d_name) >= ENTRY_NAME_LENGTH ||
+            (strcmp(dot, ".plan") != 0 && strcmp(dot, ".render") != 0))
+            continue;
+        if (fstatat(dirfd(directory), item->d_name, &info, 0) != 0)
+            continue;
+
+        if (count == capacity)
+        {
+            unsigned long new_capacity = capacity ? capacity * 2 : 64;
+            CacheEntry * grown = realloc(entries,
+                                         new_capacity * sizeof (CacheEntry));
+            if (!grown)
+                break;
+            entries = grown;
+            capacity = new_capacity;
+        }
+
+        strcpy(entries[count].name, item->d_name);
+        entries[count].size = info.st_size;
+        entries[count].last_used = info.st_mtim;
+        total += info.st_size;
+        ++count;
+    }
+
+    if (total > cache->max_bytes)
+    {
+        qsort(entries, count, sizeof (CacheEntry), CompareEntryAge);
+
+        unsigned long i = 0;
+        for (i = 0; i < count && total > cache->max_bytes; ++i)
+        {
+            if (unlinkat(dirfd(directory), entries[i].name, 0) == 0)
+            {
+                total -= entries[i].size;
+                ++cache->evictions;
+            }
+        }
+    }
+
+    free(entries);
+    closedir(directory);
+}
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * The Kite render cache.
+ *
+ * With a seed, Kite is deterministic: the same input, seed, sample rate and
+ * parameters always give the same output.  So instead of running the engine
+ * again for a request it has already seen, the result can be kept in a
+ * directory on disk and looked up by a hash of everything that went into it.
+ *
+ * Two kinds of results can be cached: segment tables (plans, which only
+ * depend on the seed, sample rate and length), and rendered sample data.
+ * The directory is kept under a size limit by throwing out the least
+ * recently used entries (a hit "touches" its file, so the file times give
+ * the LRU order).
+ */
+
+#ifndef KITE_CACHE_H
+#define KITE_CACHE_H
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stddef.h>
+#include <stdint.h>
+#include "kite_engine.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// bump this whenever the engine's output for a given seed (or the way
+// entries are stored) changes, so old cache entries stop matching
+#define KITE_CACHE_VERSION 2
+
+
+//-----------
+//-- TYPES --
+//-----------
+
+/*
+ * An open cache directory and its hit/miss statistics.  The statistics count
+ * this process' lookups; KiteCloseCache() adds them to the totals kept in
+ * the directory's "stats" file.
+ */
+typedef struct
+{
+    char * directory;
+    uint64_t max_bytes;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} KiteCache;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// fast (non-cryptographic) 64-bit hash of a block of memory (XXH64)
+uint64_t KiteHash(const void * data, size_t size, uint64_t seed);
+
+// the cache key of a segment table
+uint64_t KitePlanKey(uint64_t seed, const KiteCutRules * rules,
+                     unsigned long total_samples);
+
+// the cache key of a rendered output
+uint64_t KiteRenderKey(uint64_t input_hash, uint64_t seed,
+                       const KiteCutRules * rules, unsigned long frame_size);
+
+// opens (creating if needed) a cache directory limited to 'max_bytes'
+int KiteOpenCache(KiteCache * cache, const char * directory,
+                  uint64_t max_bytes);
+
+// saves the statistics and frees the memory held by the cache
+void KiteCloseCache(KiteCache * cache);
+
+// reads a cached segment table into 'plan'
+int KiteCacheLoadPlan(KiteCache * cache, uint64_t key, KitePlan * plan);
+
+// stores a segment table
+int KiteCacheStorePlan(KiteCache * cache, uint64_t key, const KitePlan * plan);
+
+// reads a cached render of exactly 'size' bytes into 'output'
+int KiteCacheLoadRender(KiteCache * cache, uint64_t key, void * output,
+                        size_t size);
+
+// stores a render
+int KiteCacheStoreRender(KiteCache * cache, uint64_t key, const void * output,
+                         size_t size);
+
+// reads the total statistics of the cache directory (including this process)
+void KiteCacheTotals(const KiteCache * cache, unsigned long * hits,
+                     unsigned long * misses, unsigned long * evictions);
+
+#endif
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,979 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * Kite render daemon
+ *
+ * Offline Kite (kite_offline) is one process per sound file, so a job system
+ * that renders lots of short files pays for starting a program, and for cold
+ * caches, every time.  This is the same renderer as a long-running process:
+ * it listens on a Unix domain socket, and a pool of worker threads, each
+ * with its own plan already allocated, renders the jobs sent to it.
+ *
+ * A job is one line of text:
+ *
+ *     input output [seed=N] [min=S] [max=S] [reverse=P] [lengths=N]
+ *                  [format=f32|s16|s24|f16] [channels=N] [rate=N]
+ *
+ * The input and output are file paths, or POSIX shared memory objects
+ * written as shm:/name, so a client can hand over a sound without touching
+ * the disk.  They are treated the way kite_offline treats its files (WAV
+ * headers are read and copied, anything else is raw samples described by
+ * format, channels and rate), so the same job gives the same output as
+ * kite_offline with the same options.  Unlike kite_offline, the output is
+ * written straight from the mapped input, so it can't be the input.  The
+ * answer is one line:
+ *
+ *     ok frames=N wait_us=N map_us=N render_us=N total_us=N
+ *
+ * (how long the line waited for a worker, how long opening the input and
+ * output took, how long cutting and moving the samples took, and the whole
+ * job), or "error" and what went wrong.  The line "stats" gets the number
+ * of jobs so far and their average and longest total_us.  A connection can
+ * send any number of lines.
+ *
+ * The main thread watches every open connection (with poll()), and hands a
+ * connection to a worker only once a line has come in on it.  The worker
+ * answers that one line and gives the connection back, so a client that
+ * sits idle (or sends slowly) never holds up a worker, and the lines of
+ * busy connections take turns.
+ *
+ * 'kite_daemon -q socket line...' sends lines to a running daemon and
+ * prints the answers, for trying it out and for scripts.  With no lines,
+ * it sends the lines of its standard input.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "kite_engine.h"
+#include "kite_wav.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// the longest job line (and answer) there can be, and the longest reason
+// a job line is turned down
+#define LINE_LENGTH 4096
+#define ERROR_LENGTH 256
+// the most connections open at once (more are turned away)
+#define MAX_CONNECTIONS 256
+// what a connection slot is doing: nothing, waiting for a line (watched by
+// the main thread), or waiting for or with a worker
+#define CONNECTION_FREE 0
+#define CONNECTION_IDLE 1
+#define CONNECTION_BUSY 2
+// the most worker threads, and how many there are if -t isn't given and
+// the system won't say how many processors it has
+#define MAX_WORKERS 256
+#define DEFAULT_WORKERS 4
+// what the workers' plans are made ready for when they start: a minute of
+// 48 kHz sound, so most jobs never allocate (longer ones grow the plan,
+// which then stays that big)
+#define WARM_SAMPLE_RATE 48000
+#define WARM_SECONDS 60
+// the prefix of a shared memory object's name in a job
+#define SHM_PREFIX "shm:"
+
+
+//-----------
+//-- TYPES --
+//-----------
+
+/*
+ * One render job, as read from a line.  The names point into the line.
+ */
+typedef struct
+{
+    const char * input;
+    const char * output;
+    uint64_t seed;
+    double min_seconds;
+    double max_seconds;
+    double reverse_chance;
+    // one of the KITE_LENGTHS_... shapes
+    int length_shape;
+    // only used for raw inputs
+    KiteSampleFormat raw_format;
+    unsigned long raw_channels;
+    unsigned long raw_sample_rate;
+} KiteJob;
+
+/*
+ * A worker thread, and the plan and generator it keeps from job to job.
+ */
+typedef struct
+{
+    pthread_t thread;
+    KitePlan plan;
+    KiteRandom rng;
+} KiteWorker;
+
+/*
+ * An open connection, and what has come in on it but hasn't been answered
+ * yet.  Its state and place in the queue are only changed with the queue
+ * locked; the rest belongs to whoever has it (see CONNECTION_...).
+ */
+typedef struct
+{
+    int socket;
+    int state;
+    // when it was last queued for a worker
+    struct timeval queued;
+    char buffer[LINE_LENGTH];
+    unsigned long buffered;
+} KiteConnection;
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+/*
+ * Every connection slot, the connections with a line waiting for a worker
+ * (a ring, which never fills, since a connection is only in it once), and
+ * the lock and condition the workers wait on for them.
+ */
+static KiteConnection connections[MAX_CONNECTIONS];
+static KiteConnection * queue[MAX_CONNECTIONS];
+static unsigned long queue_first = 0;
+static unsigned long queue_count = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+
+// written to by a worker giving a connection back, so the main thread
+// starts watching it again
+static int wake_pipe[2];
+
+// the latency statistics of every job so far
+static unsigned long job_count = 0;
+static unsigned long failed_count = 0;
+static double total_microseconds = 0.0;
+static unsigned long longest_microseconds = 0;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// set by the signal handler to stop accepting connections
+static volatile sig_atomic_t stopping = 0;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// prints how to use the program
+void PrintUsage(const char * program);
+
+// listens on 'path' and hands lines to 'worker_count' workers
+int Serve(const char * path, unsigned long worker_count);
+
+// takes a new connection, unless every slot is in use
+void AcceptConnection(int listener);
+
+// puts a connection with a line in at the back of the queue (with the
+// queue locked)
+void QueueConnection(KiteConnection * connection);
+
+// sends each line (or the lines of standard input) to the daemon listening
+// on 'path' and prints the answers
+int SendJobs(const char * path, char * const * lines, int line_count);
+
+// a worker thread: answers lines from the queue, one at a time
+void * RunWorker(void * argument);
+
+// answers the next line sent over a connection, then gives it back
+void ServeLine(KiteWorker * worker, KiteConnection * connection);
+
+// gives a connection back to the main thread (or queues it again if it
+// already has another line), or closes it
+void ReleaseConnection(KiteConnection * connection, short hung_up);
+
+// reads a job line into 'job'
+int ParseJob(char * line, KiteJob * job, char * error);
+
+// renders one job, and puts the answer in 'answer'
+void RenderJob(KiteWorker * worker, const KiteJob * job,
+               unsigned long wait_microseconds, char * answer);
+
+// maps an input (file or shared memory object) for reading
+unsigned char * MapInput(const char * name, unsigned long * size,
+                         struct stat * status);
+
+// creates an output (file or shared memory object) of 'size' bytes and maps
+// it for writing, unless it is the input
+unsigned char * MapOutput(const char * name, unsigned long size,
+                          const struct stat * input_status,
+                          const char ** error);
+
+// the number of microseconds from 'start' to 'end'
+unsigned long Microseconds(const struct timeval * start,
+                           const struct timeval * end);
+
+// sets the flag that stops Serve()
+void Stop(int signal_number);
+
+
+//----------
+//-- MAIN --
+//----------
+int main(int argc, char * argv[])
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long worker_count = processors > 0 ? (unsigned long) processors :
+            DEFAULT_WORKERS;
+    short send = OFF;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "t:q")) != -1)
+    {
+        switch (option)
+        {
+            case 't':
+                worker_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'q':
+                send = ON;
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 1 || (!send && argc - optind != 1))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    if (send)
+        return SendJobs(argv[optind], argv + optind + 1, argc - optind - 1);
+
+    if (worker_count == 0)
+        worker_count = 1;
+    if (worker_count > MAX_WORKERS)
+        worker_count = MAX_WORKERS;
+    return Serve(argv[optind], worker_count);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Prints how to use the program.
+ */
+void PrintUsage(const char * program)
+{
+    fprintf(stderr, "Usage: %s [-t threads] socket\n", program);
+    fprintf(stderr, "       %s -q socket line...\n", program);
+    fprintf(stderr, "  the first form runs the daemon (one worker thread");
+    fprintf(stderr, " per processor by default),\n  the second sends job");
+    fprintf(stderr, " lines to it (or the lines of standard input)\n");
+    fprintf(stderr, "  and prints the answers.  A job line is\n");
+    fprintf(stderr, "  input output [seed=N] [min=S] [max=S] [reverse=P]");
+    fprintf(stderr, " [lengths=N]\n  [format=F] [channels=N] [rate=N]");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  (see kite_offline; inputs and outputs may be");
+    fprintf(stderr, " shm:/name for shared memory)\n");
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Starts the workers, then accepts connections on a Unix domain socket at
+ * 'path' and watches them, queueing each one for the workers when a line
+ * comes in on it, until SIGINT or SIGTERM.  Each worker's plan is allocated
+ * for a minute of sound before anything is accepted, so the first jobs
+ * don't pay for it.
+ */
+int Serve(const char * path, unsigned long worker_count)
+{
+    static KiteWorker workers[MAX_WORKERS];
+    static struct pollfd watched[MAX_CONNECTIONS + 2];
+    static KiteConnection * watched_connections[MAX_CONNECTIONS + 2];
+    KiteCutRules shortest;
+    struct sockaddr_un address;
+    struct sigaction action;
+    unsigned long i = 0;
+
+    if (strlen(path) >= sizeof (address.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 1;
+    }
+
+    // a worker never waits to write to the pipe (if it is full, the main
+    // thread has plenty of wakes to read already)
+    if (pipe(wake_pipe) != 0 ||
+        fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK) != 0)
+    {
+        fprintf(stderr, "Could not make a pipe: %s\n", strerror(errno));
+        return 1;
+    }
+
+    KiteMakeCutRules(&shortest, WARM_SAMPLE_RATE,
+                     KITE_SHORTEST_SEGMENT_SECONDS,
+                     KITE_SHORTEST_SEGMENT_SECONDS, 0.0);
+    for (i = 0; i < worker_count; ++i)
+    {
+        if (KiteInitPlan(&workers[i].plan, 0) != KITE_OK ||
+            KiteReservePlan(&workers[i].plan, &shortest,
+                            WARM_SAMPLE_RATE * WARM_SECONDS) != KITE_OK ||
+            pthread_create(&workers[i].thread, NULL, RunWorker,
+                           &workers[i]) != 0)
+        {
+            fprintf(stderr, "Could not start worker %lu.\n", i);
+            return 1;
+        }
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr *) &address, sizeof (address)) != 0 ||
+        listen(listener, MAX_CONNECTIONS) != 0)
+    {
+        fprintf(stderr, "Could not listen on %s: %s\n", path,
+                strerror(errno));
+        return 1;
+    }
+
+    // no SA_RESTART, so a signal breaks poll() out of its wait
+    memset(&action, 0, sizeof (action));
+    action.sa_handler = Stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Listening on %s with %lu workers.\n", path,
+            worker_count);
+    while (!stopping)
+    {
+        // the listener, the wake pipe and every idle connection (only the
+        // main thread makes a connection busy, so the idle ones stay idle
+        // until poll() returns)
+        unsigned long count = 2;
+        watched[0].fd = listener;
+        watched[1].fd = wake_pipe[0];
+        pthread_mutex_lock(&queue_lock);
+        for (i = 0; i < MAX_CONNECTIONS; ++i)
+        {
+            if (connections[i].state == CONNECTION_IDLE)
+            {
+                watched[count].fd = connections[i].socket;
+                watched_connections[count++] = &connections[i];
+            }
+        }
+        pthread_mutex_unlock(&queue_lock);
+        for (i = 0; i < count; ++i)
+            watched[i].events = POLLIN;
+
+        if (poll(watched, count, -1) < 0)
+            continue;
+
+        if (watched[1].revents)
+        {
+            char wakes[256];
+            if (read(wake_pipe[0], wakes, sizeof (wakes)) < 0)
+                continue;
+        }
+
+        // a connection that hung up is queued too, so a worker closes it
+        pthread_mutex_lock(&queue_lock);
+        for (i = 2; i < count; ++i)
+        {
+            if (watched[i].revents)
+                QueueConnection(watched_connections[i]);
+        }
+        pthread_mutex_unlock(&queue_lock);
+
+        if (watched[0].revents & POLLIN)
+            AcceptConnection(listener);
+    }
+
+    // the workers are left to the end of the process; their jobs are
+    // written straight into the outputs, so there is nothing to flush
+    close(listener);
+    unlink(path);
+    fprintf(stderr, "Stopped after %lu jobs.\n", job_count);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Accepts a connection into a free slot, where the main thread starts
+ * watching it for lines.  If every slot is in use, it is closed straight
+ * away.
+ */
+void AcceptConnection(int listener)
+{
+    unsigned long i = 0;
+
+    int descriptor = accept(listener, NULL, NULL);
+    if (descriptor < 0)
+        return;
+
+    pthread_mutex_lock(&queue_lock);
+    for (i = 0; i < MAX_CONNECTIONS; ++i)
+    {
+        if (connections[i].state == CONNECTION_FREE)
+        {
+            connections[i].socket = descriptor;
+            connections[i].buffered = 0;
+            connections[i].state = CONNECTION_IDLE;
+            pthread_mutex_unlock(&queue_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&queue_lock);
+    close(descriptor);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Marks a connection busy and puts it at the back of the queue for the
+ * next free worker.  The queue must be locked.
+ */
+void QueueConnection(KiteConnection * connection)
+{
+    connection->state = CONNECTION_BUSY;
+    gettimeofday(&connection->queued, NULL);
+    queue[(queue_first + queue_count) % MAX_CONNECTIONS] = connection;
+    ++queue_count;
+    pthread_cond_signal(&queue_ready);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Sends each line to the daemon over one connection, and prints the answer
+ * to each.  With no lines, the lines of standard input are sent instead, as
+ * they come (empty ones are skipped).  Returns 1 if the daemon can't be reached or any answer is an
+ * error.
+ */
+int SendJobs(const char * path, char * const * lines, int line_count)
+{
+    struct sockaddr_un address;
+    char line[LINE_LENGTH];
+    char answer[LINE_LENGTH];
+    int result = 0;
+    int i = 0;
+
+    if (strlen(path) >= sizeof (address.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 1;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if (connection < 0 ||
+        connect(connection, (struct sockaddr *) &address,
+                sizeof (address)) != 0)
+    {
+        fprintf(stderr, "Could not connect to %s: %s\n", path,
+                strerror(errno));
+        if (connection >= 0)
+            close(connection);
+        return 1;
+    }
+
+    FILE * answers = fdopen(connection, "r");
+    for (i = 0; answers; ++i)
+    {
+        const char * next = i < line_count ? lines[i] : NULL;
+        if (line_count == 0 && fgets(line, sizeof (line), stdin))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            next = line;
+        }
+        if (!next)
+            break;
+        // the daemon doesn't answer empty lines
+        if (next[0] == '\0')
+            continue;
+
+        if (dprintf(connection, "%s\n", next) < 0 ||
+            !fgets(answer, sizeof (answer), answers))
+        {
+            fprintf(stderr, "The daemon hung up.\n");
+            result = 1;
+            break;
+        }
+        fputs(answer, stdout);
+        if (strncmp(answer, "ok", 2) != 0 && strncmp(answer, "stats", 5) != 0)
+            result = 1;
+    }
+
+    if (answers)
+        fclose(answers);
+    else
+        close(connection);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * A worker thread.  It takes the connection that has waited longest,
+ * answers one line sent over it, and goes back for another, forever.
+ */
+void * RunWorker(void * argument)
+{
+    KiteWorker * worker = (KiteWorker *) argument;
+
+    while (1)
+    {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_count == 0)
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        KiteConnection * connection = queue[queue_first];
+        queue_first = (queue_first + 1) % MAX_CONNECTIONS;
+        --queue_count;
+        pthread_mutex_unlock(&queue_lock);
+
+        ServeLine(worker, connection);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Answers the next line sent over a connection.  If the whole line isn't in
+ * yet, whatever has come in is read first (the main thread only queues a
+ * connection once there is something to read, so this doesn't wait); if
+ * that still isn't a whole line, the connection goes back to wait for the
+ * rest.  A client that hangs up gets its last, unfinished line answered
+ * too, and a line longer than LINE_LENGTH is an error that closes the
+ * connection.
+ */
+void ServeLine(KiteWorker * worker, KiteConnection * connection)
+{
+    char line[LINE_LENGTH];
+    char answer[LINE_LENGTH];
+    char error[ERROR_LENGTH];
+    struct timeval now;
+    short hung_up = OFF;
+    KiteJob job;
+
+    gettimeofday(&now, NULL);
+    unsigned long wait_microseconds = Microseconds(&connection->queued, &now);
+
+    char * end = memchr(connection->buffer, '\n', connection->buffered);
+    if (!end)
+    {
+        ssize_t received = recv(connection->socket,
+                                connection->buffer + connection->buffered,
+                                LINE_LENGTH - connection->buffered, 0);
+        if (received <= 0)
+        {
+            hung_up = ON;
+            if (connection->buffered == 0)
+            {
+                ReleaseConnection(connection, hung_up);
+                return;
+            }
+            end = connection->buffer + connection->buffered;
+        }
+        else
+        {
+            connection->buffered += received;
+            end = memchr(connection->buffer, '\n', connection->buffered);
+        }
+
+        if (!end && connection->buffered == LINE_LENGTH)
+        {
+            dprintf(connection->socket, "error line too long\n");
+            ReleaseConnection(connection, ON);
+            return;
+        }
+        if (!end)
+        {
+            ReleaseConnection(connection, OFF);
+            return;
+        }
+    }
+
+    // take the line out of the buffer
+    unsigned long length = end - connection->buffer;
+    memcpy(line, connection->buffer, length);
+    line[length] = '\0';
+    if (length < connection->buffered)
+        ++length;
+    connection->buffered -= length;
+    memmove(connection->buffer, connection->buffer + length,
+            connection->buffered);
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] != '\0')
+    {
+        if (strcmp(line, "stats") == 0)
+        {
+            pthread_mutex_lock(&stats_lock);
+            snprintf(answer, sizeof (answer),
+                     "stats jobs=%lu failed=%lu average_us=%.0f "
+                     "longest_us=%lu", job_count, failed_count,
+                     job_count ? total_microseconds / job_count : 0.0,
+                     longest_microseconds);
+            pthread_mutex_unlock(&stats_lock);
+        }
+        else if (ParseJob(line, &job, error) != KITE_OK)
+            snprintf(answer, sizeof (answer), "error %s", error);
+        else
+            RenderJob(worker, &job, wait_microseconds, answer);
+
+        if (dprintf(connection->socket, "%s\n", answer) < 0)
+            hung_up = ON;
+    }
+
+    ReleaseConnection(connection, hung_up);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Done with a connection for now.  If the client hung up it is closed and
+ * its slot freed; if another whole line is already in, it goes to the back
+ * of the queue (so other connections get their turn first); otherwise the
+ * main thread is woken up to watch it again.
+ */
+void ReleaseConnection(KiteConnection * connection, short hung_up)
+{
+    if (hung_up)
+        close(connection->socket);
+
+    pthread_mutex_lock(&queue_lock);
+    if (hung_up)
+        connection->state = CONNECTION_FREE;
+    else if (memchr(connection->buffer, '\n', connection->buffered))
+        QueueConnection(connection);
+    else
+    {
+        connection->state = CONNECTION_IDLE;
+        if (write(wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+            fprintf(stderr, "Could not wake the main thread.\n");
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Splits a job line into its input, output and options (the line is cut up
+ * in place).  Anything that isn't given gets kite_offline's default.
+ * Returns KITE_ERROR, with the reason in 'error', if the line makes no
+ * sense.
+ */
+int ParseJob(char * line, KiteJob * job, char * error)
+{
+    struct timeval current_time;
+    char * save = NULL;
+    char * word = NULL;
+
+    gettimeofday(&current_time, NULL);
+    job->input = NULL;
+    job->output = NULL;
+    job->seed = (uint64_t) (current_time.tv_usec * current_time.tv_sec);
+    job->min_seconds = KITE_DEFAULT_MIN_SECONDS;
+    job->max_seconds = KITE_DEFAULT_MAX_SECONDS;
+    job->reverse_chance = KITE_DEFAULT_REVERSE_CHANCE;
+    job->length_shape = KITE_LENGTHS_EVEN;
+    job->raw_format = KITE_FORMAT_FLOAT32;
+    job->raw_channels = 1;
+    job->raw_sample_rate = 44100;
+
+    for (word = strtok_r(line, " \t", &save); word;
+         word = strtok_r(NULL, " \t", &save))
+    {
+        char * value = strchr(word, '=');
+        if (!value)
+        {
+            if (!job->input)
+                job->input = word;
+            else if (!job->output)
+                job->output = word;
+            else
+            {
+                snprintf(error, ERROR_LENGTH, "too many names: %s", word);
+                return KITE_ERROR;
+            }
+            continue;
+        }
+
+        *value++ = '\0';
+        if (strcmp(word, "seed") == 0)
+            job->seed = strtoull(value, NULL, 10);
+        else if (strcmp(word, "min") == 0)
+            job->min_seconds = strtod(value, NULL);
+        else if (strcmp(word, "max") == 0)
+            job->max_seconds = strtod(value, NULL);
+        else if (strcmp(word, "reverse") == 0)
+            job->reverse_chance = strtod(value, NULL);
+        else if (strcmp(word, "lengths") == 0)
+            job->length_shape = atoi(value);
+        else if (strcmp(word, "channels") == 0)
+            job->raw_channels = strtoul(value, NULL, 10);
+        else if (strcmp(word, "rate") == 0)
+            job->raw_sample_rate = strtoul(value, NULL, 10);
+        else if (strcmp(word, "format") != 0 ||
+                 KiteParseFormat(value, &job->raw_format) != KITE_OK)
+        {
+            snprintf(error, ERROR_LENGTH, "unknown option %s=%s", word,
+                     value);
+            return KITE_ERROR;
+        }
+    }
+
+    if (!job->output)
+    {
+        snprintf(error, ERROR_LENGTH, "a job needs an input and an output");
+        return KITE_ERROR;
+    }
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Renders one job the way kite_offline would: the output starts out as a
+ * copy of the input (header and all), and the sample data is shuffled over
+ * it.  The worker's plan is reused, so it only allocates for a job longer
+ * than any it has done before.  The answer (with the job's timings, see the
+ * top of this file) goes in 'answer', and into the statistics.
+ */
+void RenderJob(KiteWorker * worker, const KiteJob * job,
+               unsigned long wait_microseconds, char * answer)
+{
+    struct timeval start;
+    struct timeval mapped;
+    struct timeval rendered;
+    struct stat input_status;
+    KiteSoundLayout raw_layout;
+    KiteSoundLayout layout;
+    KiteCutRules rules;
+    unsigned long input_size = 0;
+    unsigned long total_frames = 0;
+    unsigned char * output = NULL;
+    const char * error = NULL;
+
+    gettimeofday(&start, NULL);
+    unsigned char * input = MapInput(job->input, &input_size, &input_status);
+    if (!input)
+        error = "could not read the input";
+
+    // use the WAV header if there is one, otherwise the whole input is
+    // samples
+    raw_layout.format = job->raw_format;
+    raw_layout.channels = job->raw_channels;
+    raw_layout.sample_rate = job->raw_sample_rate;
+    if (!error && KiteReadSoundLayout(input, input_size, &raw_layout,
+                                      &layout) != KITE_OK)
+        error = "unsupported WAV format";
+    unsigned long frame_size = error ? 0 :
+            KiteFormatSize(layout.format) * layout.channels;
+    if (!error && (frame_size == 0 || layout.sample_rate == 0))
+        error = "bad format, channel count or sample rate";
+
+    if (!error)
+        output = MapOutput(job->output, input_size, &input_status, &error);
+    gettimeofday(&mapped, NULL);
+
+    if (!error)
+    {
+        memcpy(output, input, input_size);
+        total_frames = layout.data_size / frame_size;
+        KiteMakeCutRules(&rules, layout.sample_rate, job->min_seconds,
+                         job->max_seconds, job->reverse_chance);
+        KitePresetLengths(&rules.lengths, job->length_shape);
+        KiteSeedRandom(&worker->rng, job->seed);
+        if (total_frames > 0)
+        {
+            if (KiteGeneratePlan(&worker->plan, &worker->rng, &rules,
+                                 total_frames) != KITE_OK)
+                error = "out of memory";
+            else
+                KiteExecutePlan(&worker->plan, output + layout.data_offset,
+                                input + layout.data_offset, frame_size);
+        }
+    }
+
+    if (output)
+        munmap(output, input_size > 0 ? input_size : 1);
+    if (input)
+        munmap(input, input_size > 0 ? input_size : 1);
+    gettimeofday(&rendered, NULL);
+
+    unsigned long total = wait_microseconds + Microseconds(&start, &rendered);
+    if (error)
+        snprintf(answer, LINE_LENGTH, "error %s", error);
+    else
+        snprintf(answer, LINE_LENGTH, "ok frames=%lu wait_us=%lu map_us=%lu "
+                 "render_us=%lu total_us=%lu", total_frames,
+                 wait_microseconds, Microseconds(&start, &mapped),
+                 Microseconds(&mapped, &rendered), total);
+
+    pthread_mutex_lock(&stats_lock);
+    ++job_count;
+    if (error)
+        ++failed_count;
+    total_microseconds += total;
+    if (total > longest_microseconds)
+        longest_microseconds = total;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Maps a whole file, or a shared memory object named shm:/name, for
+ * reading, and fills in 'status' (so the output can be told apart from
+ * it).  An empty one still gets a (one byte, anonymous) mapping, so NULL
+ * always means it couldn't be read.
+ */
+unsigned char * MapInput(const char * name, unsigned long * size,
+                         struct stat * status)
+{
+    void * memory = MAP_FAILED;
+    int descriptor = -1;
+
+    if (strncmp(name, SHM_PREFIX, strlen(SHM_PREFIX)) == 0)
+        descriptor = shm_open(name + strlen(SHM_PREFIX), O_RDONLY, 0);
+    else
+        descriptor = open(name, O_RDONLY);
+    if (descriptor < 0)
+        return NULL;
+
+    if (fstat(descriptor, status) == 0)
+    {
+        *size = (unsigned long) status->st_size;
+        if (*size > 0)
+            memory = mmap(NULL, *size, PROT_READ, MAP_SHARED, descriptor, 0);
+        else
+            memory = mmap(NULL, 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+    }
+    close(descriptor);
+
+    return memory == MAP_FAILED ? NULL : (unsigned char *) memory;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Creates (or empties) a file, or a shared memory object named shm:/name,
+ * makes it 'size' bytes long and maps it for writing.  The input is still
+ * mapped, and the output is written straight from it, so if they are the
+ * same file (the same name, a hard link or a symbolic link to it) nothing
+ * is touched: it is opened without being emptied first, and turned down
+ * if it has the input's device and inode numbers.  Returns NULL, with the
+ * reason in 'error', if there is no output.
+ */
+unsigned char * MapOutput(const char * name, unsigned long size,
+                          const struct stat * input_status,
+                          const char ** error)
+{
+    struct stat status;
+    void * memory = MAP_FAILED;
+    int descriptor = -1;
+
+    *error = "could not write the output";
+    if (strncmp(name, SHM_PREFIX, strlen(SHM_PREFIX)) == 0)
+        descriptor = shm_open(name + strlen(SHM_PREFIX), O_RDWR | O_CREAT,
+                              0600);
+    else
+        descriptor = open(name, O_RDWR | O_CREAT, 0644);
+    if (descriptor < 0)
+        return NULL;
+
+    if (fstat(descriptor, &status) != 0)
+    {
+        close(descriptor);
+        return NULL;
+    }
+    if (status.st_dev == input_status->st_dev &&
+        status.st_ino == input_status->st_ino)
+    {
+        *error = "the output is the input";
+        close(descriptor);
+        return NULL;
+    }
+
+    if (ftruncate(descriptor, 0) == 0 &&
+        ftruncate(descriptor, (off_t) size) == 0)
+    {
+        if (size > 0)
+            memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          descriptor, 0);
+        else
+            memory = mmap(NULL, 1, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    close(descriptor);
+
+    if (memory == MAP_FAILED)
+        return NULL;
+    *error = NULL;
+    return (unsigned char *) memory;
+}
+
+//-----------------------------------------------------------------------------
+
+
+unsigned long Microseconds(const struct timeval * start,
+                           const struct timeval * end)
+{
+    long seconds = end->tv_sec - start->tv_sec;
+    long microseconds = end->tv_usec - start->tv_usec;
+    long total = seconds * 1000000 + microseconds;
+
+    return total > 0 ? (unsigned long) total : 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+void Stop(int signal_number)
+{
+    stopping = 1;
+}
+
+// ------------------------------- EOF ----------------------------------------
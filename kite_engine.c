@@ -0,0 +1,2510 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * The Kite engine: segment plan generation and the sample moving kernels.
+ * See kite_engine.h for the big picture.
+ *
+ * The plan generator follows the same steps as run_Kite() (see
+ * kite_run.pseudo), but instead of reversing and overwriting the input buffer
+ * in place, it keeps track of which input samples are still unused as a list
+ * of runs (the "virtual tape").  Cutting a sub-block out of the tape and
+ * moving the end of the tape into the hole only edits that list, so the input
+ * is never written to and the cuts come out as a table of input ranges.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "kite_engine.h"
+
+// the cut point search and the metering copy use SSE (4 floats at a time)
+// when it is there
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+// and storing 16-bit samples uses SSE2
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// half-precision floats use F16C, which is compiled in on any x86 (see
+// KiteUseHalfInstructions()) and only used if the CPU running it has it
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KITE_HALF_INSTRUCTIONS
+#endif
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// reverse chances are rounded to a whole number of 1/REVERSE_RESOLUTIONs
+// (it is a multiple of 3, so the default 1/3 comes out exactly)
+#define REVERSE_RESOLUTION 60000
+
+// the most groups of 4 floats KiteCopyMeteredSamples() adds up in single
+// precision before moving the totals over to the doubles
+#define METER_RUN 1024
+
+// the smallest tile KiteTuneTiles() picks, whatever the cache looks like
+#define MIN_TILE_BYTES 4096
+
+// what a 16-bit and a 24-bit sample of 1.0 are stored as (so -1 to 1 is
+// symmetric)
+#define SHORT_SCALE 32767.0f
+#define INT24_SCALE 8388607.0
+
+// the number of buckets of the KITE_LENGTHS_... shapes, and how much less
+// likely each bucket is than the one before it, going away from the end
+// the shape favours
+#define PRESET_LENGTH_BUCKETS 16
+#define PRESET_LENGTH_FALLOFF 0.75
+#define PRESET_EXTREMES_FALLOFF 0.6
+
+// keep[] of a column that is never its alias (see KiteLengthTable)
+#define ALWAYS_KEEP 0xFFFFFFFFu
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+// the tile size KiteTuneTiles() picked (0 until it has been called)
+static unsigned long tuned_tile_bytes = 0;
+
+// ON if half-precision floats are converted with the F16C instructions,
+// OFF if in plain C (-1 until the first conversion picks)
+static short half_instructions = -1;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// makes room for at least 'needed' runs in both tape buffers
+static int GrowTape(KitePlan * plan, unsigned long needed);
+
+// cuts the plan's tape into sub-blocks, appending them to the segment table
+// from output sample 'out_index' on
+static int CutTape(KitePlan * plan, KiteRandom * rng,
+                   const KiteCutRules * rules,
+                   unsigned long samples_remaining, unsigned long out_index);
+
+// makes sure a segment starts at output sample 'position' (cutting the one
+// that holds it in two if needed), and returns its index
+static int SplitSegment(KitePlan * plan, unsigned long position,
+                        unsigned long * index);
+
+// turns the order of segments 'first' to 'last' (not included) around
+static void ReverseSegments(KiteSegment * segments, unsigned long first,
+                            unsigned long last);
+
+// ON if two segments send the same input sample to every output sample
+// they both cover
+static short SameMapping(const KiteSegment * a, const KiteSegment * b);
+
+// appends the part of 'tape' from tape position 'from' up to (but not
+// including) 'to' onto the end of 'destination'
+static unsigned long SliceTape(const KiteRun * tape, unsigned long run_count,
+                               unsigned long from, unsigned long to,
+                               KiteRun * destination,
+                               unsigned long destination_count);
+
+// copies 'count' frames of 'words' 32-bit words each, last frame first
+// ('source' points at the last frame)
+static void CopyFramesReversed(unsigned char * destination,
+                               const unsigned char * source,
+                               unsigned long count, unsigned long words);
+
+// sorts runs by their start (in place, without allocating)
+static void SortRuns(KiteRun * runs, unsigned long count);
+
+// puts the plan's segments into input order in its tape, and returns ON if
+// they use every input sample exactly once
+static short SortSources(KitePlan * plan);
+
+// finds the piece (in input order) holding input sample 'position'
+static unsigned long FindPiece(const KiteRun * pieces, unsigned long count,
+                               unsigned long position);
+
+// finds the quietest place to cut from 'lowest' to 'highest', nearest to
+// 'cut' if there is a tie
+static unsigned long FindQuietestCut(const float * const * channels,
+                                     unsigned long channel_count,
+                                     unsigned long stride, unsigned long cut,
+                                     unsigned long lowest,
+                                     unsigned long highest);
+
+// a float as a half-precision float (rounded to the nearest one) and back
+static uint16_t FloatToHalf(float value);
+static float HalfToFloat(uint16_t half);
+
+// ON if half-precision floats are converted with the F16C instructions
+static short UseHalfInstructions(void);
+
+#if defined(KITE_HALF_INSTRUCTIONS)
+// the F16C loops for whole groups of 8 samples; they return how many
+// samples they did
+static unsigned long EncodeHalves(uint16_t * destination,
+                                  const float * source, unsigned long count)
+        __attribute__((target("avx,f16c")));
+static unsigned long DecodeHalves(float * destination,
+                                  const uint16_t * source, unsigned long count)
+        __attribute__((target("avx,f16c")));
+#endif
+
+// puts 'count' frames of 'channels' floats in the opposite order, in place
+static void ReverseFrames(float * frames, unsigned long count,
+                          unsigned long channels);
+
+
+//---------------
+//-- FUNCTIONS --
+//---------------
+
+
+/*
+ * Returns the number of bytes in one sample of the given format.
+ */
+unsigned long KiteFormatSize(KiteSampleFormat format)
+{
+    switch (format)
+    {
+        case KITE_FORMAT_FLOAT32:
+            return 4;
+        case KITE_FORMAT_INT16:
+            return 2;
+        case KITE_FORMAT_INT24:
+            return 3;
+        case KITE_FORMAT_FLOAT16:
+            return 2;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Seeds the generator.  The seed is scrambled first (with a SplitMix64 step)
+ * so that seeds close to each other, like 1, 2, 3..., still give unrelated
+ * sequences, and so the state is never 0 (xorshift gets stuck on 0).
+ */
+void KiteSeedRandom(KiteRandom * rng, uint64_t seed)
+{
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+
+    rng->state = z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Returns the next number from a xorshift64* generator.  It is tiny, fast and
+ * (unlike random()) keeps its state in the caller's struct, so every Kite has
+ * its own reproducible sequence.
+ */
+uint64_t KiteRandomNext(KiteRandom * rng)
+{
+    uint64_t x = rng->state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Gets a random unsigned long integer between the bounds (including both of
+ * them), just like GetRandomNaturalNumber() in sb_kite.c.
+ */
+unsigned long KiteRandomNaturalNumber(KiteRandom * rng,
+                                      unsigned long lower_bound,
+                                      unsigned long upper_bound)
+{
+    unsigned long rand_num = 0;
+    // reduce the random number to between 0 and the size of the range
+    rand_num = (unsigned long)
+            (KiteRandomNext(rng) % (upper_bound - lower_bound + 1));
+    // force the random number to at least the lower bound
+    rand_num += lower_bound;
+
+    return rand_num;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Works out the cut rules for sub-blocks from 'min_seconds' to 'max_seconds'
+ * long at 'sample_rate', reversed with a chance of 'reverse_chance'.  With
+ * the defaults (KITE_DEFAULT_MIN_SECONDS and so on) these are exactly the
+ * numbers run_Kite() always used, so the same seed still gives the same
+ * cuts.  Out of range settings are pulled back in:
+ *
+ *   - sub-blocks are at least KITE_SHORTEST_SEGMENT_SECONDS (and 1 sample)
+ *     long, so a plan reserved for the shortest ones always has room.
+ *   - the longest sub-block is longer than the shortest, or the planner
+ *     couldn't pick a random end position at all.
+ *   - the reverse chance is from 0 to 1, to 1/REVERSE_RESOLUTION.
+ */
+void KiteMakeCutRules(KiteCutRules * rules, unsigned long sample_rate,
+                      double min_seconds, double max_seconds,
+                      double reverse_chance)
+{
+    if (!(min_seconds >= KITE_SHORTEST_SEGMENT_SECONDS))
+        min_seconds = KITE_SHORTEST_SEGMENT_SECONDS;
+    if (!(max_seconds >= min_seconds))
+        max_seconds = min_seconds;
+    if (!(reverse_chance >= 0.0))
+        reverse_chance = 0.0;
+    if (reverse_chance > 1.0)
+        reverse_chance = 1.0;
+
+    // set the minimum index of the random sub-blocks
+    rules->min_block_start = (unsigned long) (min_seconds * sample_rate);
+    // a sub-block needs at least one sample
+    if (rules->min_block_start == 0)
+        rules->min_block_start = 1;
+    // set the maximum index of the random sub-block
+    rules->max_block_end = rules->min_block_start +
+            (unsigned long) (max_seconds * sample_rate);
+    if (rules->max_block_end < 2 * rules->min_block_start + 1)
+        rules->max_block_end = 2 * rules->min_block_start + 1;
+
+    /*
+     * the chance as a fraction in lowest terms.  The default 1/3 comes out
+     * as 1 in 3, which draws the same random numbers as the old
+     * "GetRandomNaturalNumber(0, 2) == 0".
+     */
+    uint64_t threshold = (uint64_t) (reverse_chance * REVERSE_RESOLUTION +
+                                     0.5);
+    uint64_t modulus = REVERSE_RESOLUTION;
+    uint64_t a = threshold;
+    uint64_t b = modulus;
+    while (b != 0)
+    {
+        uint64_t remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    rules->reverse_threshold = threshold / a;
+    rules->reverse_modulus = modulus / a;
+
+    // every length equally likely, as always
+    rules->lengths.count = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The cut rules Kite has always used: sub-blocks from 0.25 to 2 seconds
+ * long, one in three of them reversed.
+ */
+void KiteDefaultCutRules(KiteCutRules * rules, unsigned long sample_rate)
+{
+    KiteMakeCutRules(rules, sample_rate, KITE_DEFAULT_MIN_SECONDS,
+                     KITE_DEFAULT_MAX_SECONDS, KITE_DEFAULT_REVERSE_CHANCE);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Compiles the weights of 'count' buckets of sub-block lengths (the first
+ * bucket being the shortest lengths) into an alias table, with Vose's
+ * method: the weights are scaled so they average 1, then a bucket under 1
+ * fills the rest of its column with part of a bucket over 1, until every
+ * column is full.  It takes O(count) time and allocates nothing, so it can
+ * be done on the audio thread.  A 'count' of 0 makes the even spread.
+ * Returns KITE_ERROR, leaving the table even, if there are too many
+ * buckets or the weights are negative, not numbers, or all 0.
+ */
+int KiteMakeLengthTable(KiteLengthTable * table, const double * weights,
+                        unsigned long count)
+{
+    double scaled[KITE_MAX_LENGTH_BUCKETS];
+    // the buckets under and over the average weight
+    unsigned long small[KITE_MAX_LENGTH_BUCKETS];
+    unsigned long large[KITE_MAX_LENGTH_BUCKETS];
+    unsigned long small_count = 0;
+    unsigned long large_count = 0;
+    double total = 0.0;
+    unsigned long i = 0;
+
+    table->count = 0;
+    if (count == 0)
+        return KITE_OK;
+    if (count > KITE_MAX_LENGTH_BUCKETS)
+        return KITE_ERROR;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (!(weights[i] >= 0.0))
+            return KITE_ERROR;
+        total += weights[i];
+    }
+    if (!(total > 0.0) || total > 1e300)
+        return KITE_ERROR;
+
+    for (i = 0; i < count; ++i)
+    {
+        scaled[i] = weights[i] * count / total;
+        table->keep[i] = ALWAYS_KEEP;
+        table->alias[i] = i;
+        if (scaled[i] < 1.0)
+            small[small_count++] = i;
+        else
+            large[large_count++] = i;
+    }
+
+    while (small_count > 0 && large_count > 0)
+    {
+        unsigned long under = small[--small_count];
+        unsigned long over = large[--large_count];
+
+        table->keep[under] = (uint32_t) (scaled[under] * 4294967296.0);
+        table->alias[under] = over;
+
+        // what is left of the bigger bucket goes back on one of the lists
+        scaled[over] = (scaled[over] + scaled[under]) - 1.0;
+        if (scaled[over] < 0.0)
+            scaled[over] = 0.0;
+        if (scaled[over] < 1.0)
+            small[small_count++] = over;
+        else
+            large[large_count++] = over;
+    }
+
+    /*
+     * whatever is left on either list is (but for rounding) exactly 1, and
+     * keeps its whole column, which it was set up to do above.
+     */
+    table->count = count;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fills in the alias table of one of the KITE_LENGTHS_... shapes.  The
+ * weights fall off geometrically from the end of the range the shape
+ * favours, so the longest pieces of KITE_LENGTHS_SHORT are still possible,
+ * just rare.  An unknown shape is taken to be KITE_LENGTHS_EVEN.
+ */
+void KitePresetLengths(KiteLengthTable * table, int shape)
+{
+    double weights[PRESET_LENGTH_BUCKETS];
+    double falloff = 1.0;
+    double extreme = 1.0;
+    unsigned long i = 0;
+
+    if (shape <= KITE_LENGTHS_EVEN || shape >= KITE_LENGTH_SHAPES)
+    {
+        table->count = 0;
+        return;
+    }
+
+    for (i = 0; i < PRESET_LENGTH_BUCKETS; ++i)
+    {
+        weights[i] = falloff;
+        falloff *= PRESET_LENGTH_FALLOFF;
+    }
+
+    if (shape == KITE_LENGTHS_LONG)
+    {
+        for (i = 0; i < PRESET_LENGTH_BUCKETS / 2; ++i)
+        {
+            double holder = weights[i];
+            weights[i] = weights[PRESET_LENGTH_BUCKETS - 1 - i];
+            weights[PRESET_LENGTH_BUCKETS - 1 - i] = holder;
+        }
+    }
+    else if (shape == KITE_LENGTHS_EXTREMES)
+    {
+        for (i = 0; i < PRESET_LENGTH_BUCKETS; ++i)
+            weights[i] = 0.0;
+        for (i = 0; i < PRESET_LENGTH_BUCKETS; ++i)
+        {
+            weights[i] += extreme;
+            weights[PRESET_LENGTH_BUCKETS - 1 - i] += extreme;
+            extreme *= PRESET_EXTREMES_FALLOFF;
+        }
+    }
+
+    KiteMakeLengthTable(table, weights, PRESET_LENGTH_BUCKETS);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Draws a sub-block length from 'shortest' to 'longest' (both included).
+ * With an even table this is just KiteRandomNaturalNumber().  Otherwise one
+ * 64-bit random number does everything: the top half, multiplied by the
+ * number of columns, picks a column (the whole part of the product) and
+ * where in it the length falls (the fraction), and the bottom half is the
+ * coin that decides between the column's bucket and its alias.  The
+ * lengths in a bucket are equally likely.  (The range has to be under 2^32
+ * samples, which is a day at 44.1 kHz.)
+ */
+unsigned long KitePickLength(KiteRandom * rng, const KiteLengthTable * table,
+                             unsigned long shortest, unsigned long longest)
+{
+    if (table->count == 0)
+        return KiteRandomNaturalNumber(rng, shortest, longest);
+
+    uint64_t rand_num = KiteRandomNext(rng);
+    uint64_t spot = (rand_num >> 32) * table->count;
+    unsigned long column = (unsigned long) (spot >> 32);
+    uint32_t coin = (uint32_t) rand_num;
+    uint64_t bucket = column;
+    if (coin >= table->keep[column])
+        bucket = table->alias[column];
+
+    // how far through the range the length is, in 1/2^32s
+    uint64_t fraction = ((bucket << 32) | (uint32_t) spot) / table->count;
+    uint64_t span = longest - shortest + 1;
+
+    return shortest + (unsigned long) ((fraction * span) >> 32);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Picks the start and end positions (both included) of the next sub-block to
+ * cut out of the first 'samples_remaining' samples of the tape.  This is the
+ * big if/else if/else of run_Kite(), and draws the random numbers in the
+ * same order.
+ *
+ * NOTE: as in kite_run.pseudo, the random end position never goes past the
+ * last remaining sample, and if there isn't a minimum length's worth of tape
+ * left after the random start position, the sub-block simply runs to the end
+ * of the tape.
+ *
+ * If the rules have a table of lengths, the end position is the start plus
+ * a length drawn from it instead, between the same shortest and longest
+ * lengths the even end position allows (and cut off at the end of the
+ * tape the same way).  An even table draws exactly what it always did.
+ */
+void KitePickBlock(KiteRandom * rng, const KiteCutRules * rules,
+                   unsigned long samples_remaining,
+                   unsigned long * block_start, unsigned long * block_end)
+{
+    const unsigned long MAX_BLOCK_END = rules->max_block_end;
+    const unsigned long MIN_BLOCK_START = rules->min_block_start;
+    // random number upper and lower bounds
+    unsigned long rand_num_lower_bound = MIN_BLOCK_START;
+    unsigned long rand_num_upper_bound = MAX_BLOCK_END;
+
+    // take the whole remaining tape if it is too short to cut in two
+    if (samples_remaining <= MIN_BLOCK_START * 2)
+    {
+        *block_start = 0;
+        *block_end = samples_remaining - 1;
+    }
+
+    // take a random sized piece off the end of the tape if the tape ends
+    // before the maximum cutoff point
+    else if (samples_remaining <= MAX_BLOCK_END)
+    {
+        rand_num_upper_bound = samples_remaining - MIN_BLOCK_START;
+        *block_start = KiteRandomNaturalNumber(rng, rand_num_lower_bound,
+                                               rand_num_upper_bound);
+        *block_end = samples_remaining - 1;
+    }
+
+    // get random start and end positions for the sub-block
+    else
+    {
+        *block_start = KiteRandomNaturalNumber(rng, rand_num_lower_bound,
+                                               rand_num_upper_bound);
+        if (rules->lengths.count > 0)
+        {
+            *block_end = *block_start - 1 +
+                    KitePickLength(rng, &rules->lengths, MIN_BLOCK_START + 1,
+                                   MAX_BLOCK_END - MIN_BLOCK_START);
+            if (*block_end > samples_remaining - 1)
+                *block_end = samples_remaining - 1;
+        }
+        else
+        {
+            rand_num_lower_bound = *block_start + MIN_BLOCK_START;
+            if (samples_remaining < (*block_start + MAX_BLOCK_END -
+                                     MIN_BLOCK_START))
+                rand_num_upper_bound = samples_remaining - 1;
+            else
+                rand_num_upper_bound = *block_start + MAX_BLOCK_END -
+                    MIN_BLOCK_START - 1;
+
+            if (rand_num_lower_bound > rand_num_upper_bound)
+                *block_end = samples_remaining - 1;
+            else
+                *block_end = KiteRandomNaturalNumber(rng,
+                        rand_num_lower_bound, rand_num_upper_bound);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Flips the (weighted) coin that decides whether a sub-block is reversed.
+ * By default it comes up reversed one time in three (33% chance of reversal
+ * vs. 67% chance of not, see run_Kite()).
+ */
+short KitePickReverse(KiteRandom * rng, const KiteCutRules * rules)
+{
+    if (KiteRandomNaturalNumber(rng, 0, rules->reverse_modulus - 1) <
+        rules->reverse_threshold)
+        return ON;
+    return OFF;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Sets up an empty plan.  'segment_capacity' can be 0, in which case the
+ * segment table is allocated the first time a plan is generated.
+ */
+int KiteInitPlan(KitePlan * plan, unsigned long segment_capacity)
+{
+    memset(plan, 0, sizeof (KitePlan));
+
+    if (GrowTape(plan, 4) != KITE_OK)
+        return KITE_ERROR;
+    if (segment_capacity > 0 &&
+        KiteGrowPlan(plan, segment_capacity) != KITE_OK)
+    {
+        KiteFreePlan(plan);
+        return KITE_ERROR;
+    }
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Frees the memory held by a plan (but not the KitePlan struct itself).
+ */
+void KiteFreePlan(KitePlan * plan)
+{
+    free(plan->segments);
+    free(plan->tape);
+    free(plan->spare_tape);
+    memset(plan, 0, sizeof (KitePlan));
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Allocates enough room that KiteGeneratePlan() will not need to allocate
+ * anything for a buffer of 'total_samples' samples cut by 'rules' (or by any
+ * rules with sub-blocks at least as long).  Real-time users call this up
+ * front (e.g. when instantiated) with their largest buffer size.
+ *
+ * Every pass of the planner cuts at least a minimum sub-block, except for
+ * the last pass and at most one short pass where the sub-block runs into the
+ * end of the tape.  A pass makes at most 3 new cuts in the tape (at the
+ * start and end of the sub-block, and where the end of the tape gets moved
+ * into the hole), and every segment is a piece of tape between two cuts, so
+ * there can be at most 3 segments per pass (plus the uncut tape).
+ */
+int KiteReservePlan(KitePlan * plan, const KiteCutRules * rules,
+                    unsigned long total_samples)
+{
+    unsigned long passes = total_samples / rules->min_block_start + 2;
+    unsigned long segments = 3 * passes + 1;
+    // there can never be more segments than samples
+    if (segments > total_samples)
+        segments = total_samples;
+
+    if (GrowTape(plan, segments + 3) != KITE_OK)
+        return KITE_ERROR;
+    return KiteGrowPlan(plan, segments);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Cuts 'total_samples' samples of tape into sub-blocks, and writes the
+ * resulting segment table into the plan.  This is the loop of run_Kite()
+ * (see kite_run.pseudo and CutTape()), done on the virtual tape instead of
+ * the samples.
+ */
+int KiteGeneratePlan(KitePlan * plan, KiteRandom * rng,
+                     const KiteCutRules * rules, unsigned long total_samples)
+{
+    plan->segment_count = 0;
+    plan->total_samples = 0;
+
+    if (total_samples == 0)
+        return KITE_ERROR;
+
+    // the tape starts out as the whole input, in order
+    plan->tape[0].start = 0;
+    plan->tape[0].length = total_samples;
+    plan->tape_length = 1;
+
+    if (CutTape(plan, rng, rules, total_samples, 0) != KITE_OK)
+        return KITE_ERROR;
+
+    plan->total_samples = total_samples;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Moves every cut the plan makes in the input to the quietest point within
+ * 'window' samples of it (see FindQuietestCut()), so the splices land on or
+ * near zero crossings instead of clicking.  The segments stay a
+ * rearrangement of the whole input; they just get a little longer or
+ * shorter, and the output positions are worked out again.
+ *
+ * The input is cut into pieces (the segments), so the cuts are the
+ * segments' source starts.  To know how far a cut can move without
+ * swallowing a piece, the pieces are sorted into input order (using the
+ * tape as scratch space, so nothing is allocated for a reserved plan).  The
+ * search is capped at KITE_MAX_SNAP_WINDOW samples each way, so the cost is
+ * at most segments x window.
+ *
+ * Sample i of a channel is channels[channel][i * stride], so planar buffers
+ * have a stride of 1, and interleaved ones pass a pointer to each channel's
+ * first sample and the number of channels as the stride.
+ */
+int KiteSnapPlan(KitePlan * plan, const float * const * channels,
+                 unsigned long channel_count, unsigned long stride,
+                 unsigned long window)
+{
+    unsigned long count = plan->segment_count;
+    unsigned long i = 0;
+
+    if (window == 0 || count < 2 || channel_count == 0)
+        return KITE_OK;
+    if (window > KITE_MAX_SNAP_WINDOW)
+        window = KITE_MAX_SNAP_WINDOW;
+    if (GrowTape(plan, count) != KITE_OK)
+        return KITE_ERROR;
+
+    // the pieces in input order (the length field holds the segment number)
+    KiteRun * pieces = plan->tape;
+    for (i = 0; i < count; ++i)
+    {
+        pieces[i].start = plan->segments[i].source_start;
+        pieces[i].length = i;
+    }
+    SortRuns(pieces, count);
+
+    /*
+     * move the cuts from left to right.  A cut has to stay after the
+     * (already moved) cut before it and before the cut after it, so no piece
+     * ends up empty.
+     */
+    for (i = 1; i < count; ++i)
+    {
+        unsigned long cut = pieces[i].start;
+        unsigned long next = i + 1 < count ? pieces[i + 1].start :
+                plan->total_samples;
+        unsigned long lowest = pieces[i - 1].start + 1;
+        unsigned long highest = next - 1;
+
+        if (cut > window && cut - window > lowest)
+            lowest = cut - window;
+        if (cut + window < highest)
+            highest = cut + window;
+
+        pieces[i].start = FindQuietestCut(channels, channel_count, stride,
+                                          cut, lowest, highest);
+    }
+
+    // give the segments their new starts and lengths
+    for (i = 0; i < count; ++i)
+    {
+        unsigned long next = i + 1 < count ? pieces[i + 1].start :
+                plan->total_samples;
+        KiteSegment * segment = &plan->segments[pieces[i].length];
+
+        segment->source_start = pieces[i].start;
+        segment->length = next - pieces[i].start;
+    }
+
+    // and lay them out in the output again
+    unsigned long out_index = 0;
+    for (i = 0; i < count; ++i)
+    {
+        plan->segments[i].dest_start = out_index;
+        out_index += plan->segments[i].length;
+    }
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Cuts output samples 'range_start' to 'range_end' (not included) of an
+ * existing plan again, with a different generator (a new seed), and leaves
+ * the rest of the plan exactly as it was.  This is for editors: after a
+ * change to part of a long shuffle, only that part has to be worked out
+ * again, and KiteExecutePlanChanges() only has to copy what changed.
+ *
+ * The input samples the range was made of become the tape, put back into
+ * input order first (so running this over the whole plan gives the same
+ * cuts as KiteGeneratePlan() with the same generator), and are cut up by
+ * the planner's loop as usual.  The plan stays a rearrangement of its
+ * input.  The segments on the edges of the range are split where the range
+ * starts and ends, so the plan may grow by a few segments, and this
+ * allocates if it outgrows what was reserved.
+ */
+int KiteRegeneratePlan(KitePlan * plan, KiteRandom * rng,
+                       const KiteCutRules * rules, unsigned long range_start,
+                       unsigned long range_end)
+{
+    unsigned long first = 0;
+    unsigned long last = 0;
+    unsigned long old_count = 0;
+    unsigned long new_count = 0;
+    unsigned long i = 0;
+
+    if (range_start >= range_end || range_end > plan->total_samples)
+        return KITE_ERROR;
+
+    // the segments making up the range, once its edges are cut
+    if (SplitSegment(plan, range_start, &first) != KITE_OK ||
+        SplitSegment(plan, range_end, &last) != KITE_OK)
+        return KITE_ERROR;
+    if (GrowTape(plan, last - first + 3) != KITE_OK)
+        return KITE_ERROR;
+
+    // their input samples, in input order, make the new tape
+    for (i = first; i < last; ++i)
+    {
+        plan->spare_tape[i - first].start = plan->segments[i].source_start;
+        plan->spare_tape[i - first].length = plan->segments[i].length;
+    }
+    SortRuns(plan->spare_tape, last - first);
+    plan->tape_length = SliceTape(plan->spare_tape, last - first, 0,
+                                  range_end - range_start, plan->tape, 0);
+
+    // cut it up onto the end of the segment table
+    old_count = plan->segment_count;
+    if (CutTape(plan, rng, rules, range_end - range_start,
+                range_start) != KITE_OK)
+    {
+        plan->segment_count = old_count;
+        return KITE_ERROR;
+    }
+    new_count = plan->segment_count - old_count;
+
+    /*
+     * and move the new segments into the place of the old ones: turning
+     * the segments after the range (plus the new ones) around, and then
+     * each part back, puts the new ones first.  Then everything is slid
+     * down over the old segments.
+     */
+    ReverseSegments(plan->segments, last, plan->segment_count);
+    ReverseSegments(plan->segments, last, last + new_count);
+    ReverseSegments(plan->segments, last + new_count, plan->segment_count);
+    memmove(plan->segments + first, plan->segments + last,
+            (plan->segment_count - last) * sizeof (KiteSegment));
+    plan->segment_count -= last - first;
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * After a plan has been changed (by KiteRegeneratePlan(), or by being
+ * replaced with another plan for the same input), this brings an output
+ * made with the old plan up to date by copying only the output samples the
+ * new plan gets from somewhere else.  The two segment tables are walked
+ * side by side in output order, so the unchanged parts of the output cost a
+ * comparison per segment instead of a copy per sample.  Returns the number
+ * of samples copied.
+ */
+unsigned long KiteExecutePlanChanges(const KitePlan * old_plan,
+                                     const KitePlan * new_plan,
+                                     void * destination, const void * source,
+                                     unsigned long frame_size)
+{
+    unsigned char * dest = (unsigned char *) destination;
+    const unsigned char * src = (const unsigned char *) source;
+    unsigned long old_index = 0;
+    unsigned long new_index = 0;
+    unsigned long position = 0;
+    unsigned long copied = 0;
+
+    // if the outputs aren't the same length, everything has changed
+    if (old_plan->total_samples != new_plan->total_samples)
+    {
+        KiteExecutePlan(new_plan, destination, source, frame_size);
+        return new_plan->total_samples;
+    }
+
+    while (new_index < new_plan->segment_count)
+    {
+        const KiteSegment * segment = &new_plan->segments[new_index];
+        unsigned long segment_end = segment->dest_start + segment->length;
+        unsigned long end = segment_end;
+        short changed = ON;
+
+        // the old segment covering 'position' (if any)
+        while (old_index < old_plan->segment_count &&
+               old_plan->segments[old_index].dest_start +
+               old_plan->segments[old_index].length <= position)
+            ++old_index;
+        if (old_index < old_plan->segment_count)
+        {
+            const KiteSegment * old_segment = &old_plan->segments[old_index];
+            unsigned long old_end = old_segment->dest_start +
+                    old_segment->length;
+
+            if (old_end < end)
+                end = old_end;
+            changed = !SameMapping(old_segment, segment);
+        }
+
+        // copy the changed part ('position' to 'end') of the new segment
+        if (changed)
+        {
+            unsigned long source_start = segment->reverse ?
+                    segment->source_start + (segment_end - end) :
+                    segment->source_start + (position - segment->dest_start);
+            KiteCopySamples(dest + position * frame_size,
+                            src + source_start * frame_size, end - position,
+                            segment->reverse, frame_size);
+            copied += end - position;
+        }
+
+        position = end;
+        if (position == segment_end)
+            ++new_index;
+    }
+
+    return copied;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Copies the segment table of one plan into another (the tape scratch space
+ * is not copied).  This only allocates if 'destination' doesn't have room,
+ * so a plan reserved with KiteReservePlan() can take a copy in real time.
+ */
+int KiteCopyPlan(KitePlan * destination, const KitePlan * source)
+{
+    if (KiteGrowPlan(destination, source->segment_count) != KITE_OK)
+        return KITE_ERROR;
+
+    if (source->segment_count > 0)
+        memcpy(destination->segments, source->segments,
+               source->segment_count * sizeof (KiteSegment));
+    destination->segment_count = source->segment_count;
+    destination->total_samples = source->total_samples;
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Checks that a segment table which came from somewhere else (like a saved
+ * session) is safe to execute: the segments must fill the output from start
+ * to end, in order, and every one must read from inside the input.
+ * It does not check that every input sample is used exactly once.
+ */
+int KiteCheckPlan(const KitePlan * plan)
+{
+    unsigned long next_dest = 0;
+    unsigned long i = 0;
+
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
+
+        if (segment->length == 0 || segment->dest_start != next_dest)
+            return KITE_ERROR;
+        if (segment->source_start > plan->total_samples ||
+            segment->length > plan->total_samples - segment->source_start)
+            return KITE_ERROR;
+        next_dest += segment->length;
+    }
+    if (next_dest != plan->total_samples)
+        return KITE_ERROR;
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Copies 'count' frames from source to destination.  If 'reverse' is ON, the
+ * frames come out in the opposite order (the bytes inside each frame are
+ * kept in order, so the samples stay intact).
+ *
+ * The common frame sizes get their own loops so the compiler can move each
+ * frame as one 16/32/64-bit value (or two, for 4-channel float frames)
+ * instead of byte by byte.  Other interleaved float frames (3, 6, 8
+ * channels...) are moved 32 bits at a time.
+ */
+void KiteCopySamples(void * destination, const void * source,
+                     unsigned long count, short reverse,
+                     unsigned long frame_size)
+{
+    unsigned char * dest = (unsigned char *) destination;
+    const unsigned char * src = (const unsigned char *) source;
+    unsigned long i = 0;
+
+    if (count == 0)
+        return;
+
+    if (!reverse)
+    {
+        memcpy(dest, src, count * frame_size);
+        return;
+    }
+
+    // point at the last frame of the source
+    src += (count - 1) * frame_size;
+
+    switch (frame_size)
+    {
+        case 2:
+            for (i = 0; i < count; ++i)
+            {
+                uint16_t frame;
+                memcpy(&frame, src - i * 2, 2);
+                memcpy(dest + i * 2, &frame, 2);
+            }
+            break;
+        case 3:
+            for (i = 0; i < count; ++i)
+            {
+                dest[i * 3] = src[-(long) (i * 3)];
+                dest[i * 3 + 1] = src[1 - (long) (i * 3)];
+                dest[i * 3 + 2] = src[2 - (long) (i * 3)];
+            }
+            break;
+        case 4:
+            for (i = 0; i < count; ++i)
+            {
+                uint32_t frame;
+                memcpy(&frame, src - i * 4, 4);
+                memcpy(dest + i * 4, &frame, 4);
+            }
+            break;
+        case 8:
+            for (i = 0; i < count; ++i)
+            {
+                uint64_t frame;
+                memcpy(&frame, src - i * 8, 8);
+                memcpy(dest + i * 8, &frame, 8);
+            }
+            break;
+        case 16:
+            for (i = 0; i < count; ++i)
+            {
+                uint64_t frame[2];
+                memcpy(frame, src - i * 16, 16);
+                memcpy(dest + i * 16, frame, 16);
+            }
+            break;
+        default:
+            if (frame_size % 4 == 0)
+                CopyFramesReversed(dest, src, count, frame_size / 4);
+            else
+                for (i = 0; i < count; ++i)
+                    memcpy(dest + i * frame_size, src - i * frame_size,
+                           frame_size);
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Copies 'count' float samples that are 'stride' samples apart in the source
+ * (one channel of interleaved frames) into a row in the destination,
+ * optionally last to first.  With a stride of 1 this is just
+ * KiteCopySamples().
+ */
+void KiteGatherSamples(float * destination, const float * source,
+                       unsigned long count, short reverse,
+                       unsigned long stride)
+{
+    unsigned long i = 0;
+
+    if (stride == 1)
+    {
+        KiteCopySamples(destination, source, count, reverse, sizeof (float));
+        return;
+    }
+
+    if (!reverse)
+    {
+        for (i = 0; i < count; ++i)
+            destination[i] = source[i * stride];
+    }
+    else
+    {
+        for (i = 0; i < count; ++i)
+            destination[i] = source[(count - 1 - i) * stride];
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Builds the output by copying every segment of the plan from the source.
+ * The source is only read, and must not overlap the destination.
+ */
+void KiteExecutePlan(const KitePlan * plan, void * destination,
+                     const void * source, unsigned long frame_size)
+{
+    unsigned char * dest = (unsigned char *) destination;
+    const unsigned char * src = (const unsigned char *) source;
+    unsigned long i = 0;
+
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
+        KiteCopySamples(dest + segment->dest_start * frame_size,
+                        src + segment->source_start * frame_size,
+                        segment->length, segment->reverse, frame_size);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Gets a stream ready to read the output of a plan from its first frame.
+ * Nothing is copied or allocated; the stream only remembers where it is in
+ * the segment table.
+ */
+void KiteStartStream(KiteStream * stream, const KitePlan * plan,
+                     const void * source, unsigned long frame_size)
+{
+    stream->plan = plan;
+    stream->source = (const unsigned char *) source;
+    stream->frame_size = frame_size;
+    stream->format = KITE_FORMAT_FLOAT32;
+    stream->channels = 0;
+    stream->segment = 0;
+    stream->offset = 0;
+    stream->position = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Gets a stream ready to read the output of a plan from a source kept as
+ * half-precision, 16-bit or 24-bit samples (see KiteEncodeSamples()), which
+ * takes half (or three quarters) of the memory and cache of floats.
+ * KiteReadStream() hands out floats, turning only the frames it reads back
+ * into floats as it goes.
+ */
+void KiteStartCompactStream(KiteStream * stream, const KitePlan * plan,
+                            const void * source, unsigned long channels,
+                            KiteSampleFormat format)
+{
+    KiteStartStream(stream, plan, source, channels * KiteFormatSize(format));
+    stream->format = format;
+    stream->channels = channels;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Moves a stream to output frame 'position' (the end of the output is
+ * allowed, and just ends the stream).  The segments are in output order, so
+ * the one holding the frame is found with a binary search.
+ */
+int KiteSeekStream(KiteStream * stream, unsigned long position)
+{
+    const KitePlan * plan = stream->plan;
+    unsigned long low = 0;
+    unsigned long high = plan->segment_count;
+
+    if (position > plan->total_samples)
+        return KITE_ERROR;
+
+    // find the last segment starting at or before 'position'
+    while (high - low > 1)
+    {
+        unsigned long middle = low + (high - low) / 2;
+        if (plan->segments[middle].dest_start <= position)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    if (position == plan->total_samples)
+    {
+        stream->segment = plan->segment_count;
+        stream->offset = 0;
+    }
+    else
+    {
+        stream->segment = low;
+        stream->offset = position - plan->segments[low].dest_start;
+    }
+    stream->position = position;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Copies the next 'frames' frames of the plan's output into 'destination'
+ * (fewer if the output ends first), the same frames KiteExecutePlan() would
+ * have put there.  A reversed segment that is split across two reads is
+ * read from its far end, so both halves come out as they would have in one
+ * piece.  A compact stream's frames are turned into floats on the way (a
+ * reversed piece is turned first, then put in reverse order where it
+ * landed).  Returns the number of frames copied.
+ */
+unsigned long KiteReadStream(KiteStream * stream, void * destination,
+                             unsigned long frames)
+{
+    const KitePlan * plan = stream->plan;
+    const unsigned long frame_size = stream->frame_size;
+    const unsigned long channels = stream->channels;
+    const short compact = stream->format != KITE_FORMAT_FLOAT32;
+    // the size of a frame in 'destination'
+    const unsigned long out_frame_size = compact ?
+            channels * sizeof (float) : frame_size;
+    unsigned char * dest = (unsigned char *) destination;
+    unsigned long copied = 0;
+
+    while (copied < frames && stream->segment < plan->segment_count)
+    {
+        const KiteSegment * segment = &plan->segments[stream->segment];
+        unsigned long count = segment->length - stream->offset;
+        if (count > frames - copied)
+            count = frames - copied;
+
+        // the first source frame of this piece of the segment
+        unsigned long first = segment->source_start + stream->offset;
+        if (segment->reverse)
+            first = segment->source_start + segment->length -
+                    stream->offset - count;
+
+        if (compact)
+        {
+            float * out = (float *) (dest + copied * out_frame_size);
+            KiteDecodeSamples(out, stream->source + first * frame_size,
+                              count * channels, stream->format);
+            if (segment->reverse)
+                ReverseFrames(out, count, channels);
+        }
+        else
+            KiteCopySamples(dest + copied * frame_size,
+                            stream->source + first * frame_size, count,
+                            segment->reverse, frame_size);
+
+        copied += count;
+        stream->offset += count;
+        if (stream->offset == segment->length)
+        {
+            ++stream->segment;
+            stream->offset = 0;
+        }
+    }
+
+    stream->position += copied;
+    return copied;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Stores 'count' floats as half-precision floats, 16-bit or 24-bit samples,
+ * to keep a lot of sound (several seconds of history for hundreds of Kites,
+ * say) in less memory.  Half-precision floats keep about 3 significant
+ * digits (an error of at most 1 part in 2048, about -66 dB) at any level;
+ * 16-bit samples clip at -1 and 1 and are off by at most 1/65534 (about
+ * -96 dB of full scale), and 24-bit ones by at most 1/16777214 (about
+ * -144 dB).  All of them round to the nearest value.  8 samples at a time
+ * are done with F16C (if the CPU has it, see KiteUseHalfInstructions()) or
+ * SSE2 when they are there (24-bit samples are always done one at a time).
+ * 32-bit floats are just copied.
+ */
+void KiteEncodeSamples(void * destination, const float * source,
+                       unsigned long count, KiteSampleFormat format)
+{
+    uint16_t * dest = (uint16_t *) destination;
+    unsigned long i = 0;
+
+    if (format == KITE_FORMAT_FLOAT32)
+    {
+        memcpy(destination, source, count * sizeof (float));
+        return;
+    }
+
+    if (format == KITE_FORMAT_INT24)
+    {
+        unsigned char * bytes = (unsigned char *) destination;
+        for (i = 0; i < count; ++i)
+        {
+            // the same clipping as the 16-bit samples
+            float value = source[i] < 1.0f ? source[i] : 1.0f;
+            value = value > -1.0f ? value : -1.0f;
+            uint32_t sample = (uint32_t) (int32_t) lrint(value * INT24_SCALE);
+            bytes[3 * i] = (unsigned char) sample;
+            bytes[3 * i + 1] = (unsigned char) (sample >> 8);
+            bytes[3 * i + 2] = (unsigned char) (sample >> 16);
+        }
+        return;
+    }
+
+    if (format == KITE_FORMAT_FLOAT16)
+    {
+#if defined(KITE_HALF_INSTRUCTIONS)
+        if (UseHalfInstructions())
+            i = EncodeHalves(dest, source, count);
+#endif
+        for (; i < count; ++i)
+            dest[i] = FloatToHalf(source[i]);
+        return;
+    }
+
+#if defined(__SSE2__)
+    const __m128 top = _mm_set1_ps(1.0f);
+    const __m128 bottom = _mm_set1_ps(-1.0f);
+    const __m128 scale = _mm_set1_ps(SHORT_SCALE);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 low = _mm_loadu_ps(source + i);
+        __m128 high = _mm_loadu_ps(source + i + 4);
+        low = _mm_max_ps(_mm_min_ps(low, top), bottom);
+        high = _mm_max_ps(_mm_min_ps(high, top), bottom);
+        _mm_storeu_si128((__m128i *) (dest + i),
+                         _mm_packs_epi32(
+                                 _mm_cvtps_epi32(_mm_mul_ps(low, scale)),
+                                 _mm_cvtps_epi32(_mm_mul_ps(high, scale))));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        // the same clipping as the SSE loop (which sends NaN to 1)
+        float value = source[i] < 1.0f ? source[i] : 1.0f;
+        value = value > -1.0f ? value : -1.0f;
+        dest[i] = (uint16_t) (int16_t) lrintf(value * SHORT_SCALE);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Turns 'count' samples stored by KiteEncodeSamples() back into floats.
+ */
+void KiteDecodeSamples(float * destination, const void * source,
+                       unsigned long count, KiteSampleFormat format)
+{
+    const uint16_t * src = (const uint16_t *) source;
+    unsigned long i = 0;
+
+    if (format == KITE_FORMAT_FLOAT32)
+    {
+        memcpy(destination, source, count * sizeof (float));
+        return;
+    }
+
+    if (format == KITE_FORMAT_INT24)
+    {
+        const unsigned char * bytes = (const unsigned char *) source;
+        for (i = 0; i < count; ++i)
+        {
+            // the top byte goes in the top of a 32-bit number, and the
+            // arithmetic shift brings it down with its sign
+            int32_t sample = (int32_t) ((uint32_t) bytes[3 * i] << 8 |
+                                        (uint32_t) bytes[3 * i + 1] << 16 |
+                                        (uint32_t) bytes[3 * i + 2] << 24) >> 8;
+            destination[i] = (float) (sample / INT24_SCALE);
+        }
+        return;
+    }
+
+    if (format == KITE_FORMAT_FLOAT16)
+    {
+#if defined(KITE_HALF_INSTRUCTIONS)
+        if (UseHalfInstructions())
+            i = DecodeHalves(destination, src, count);
+#endif
+        for (; i < count; ++i)
+            destination[i] = HalfToFloat(src[i]);
+        return;
+    }
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / SHORT_SCALE);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i samples = _mm_loadu_si128((const __m128i *) (src + i));
+        // each 16-bit sample goes in the top of a 32-bit lane, and the
+        // arithmetic shift brings it down with its sign
+        __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples),
+                                     16);
+        __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples),
+                                      16);
+        _mm_storeu_ps(destination + i,
+                      _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+        _mm_storeu_ps(destination + i + 4,
+                      _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+    }
+#endif
+    for (; i < count; ++i)
+        destination[i] = (float) (int16_t) src[i] * (1.0f / SHORT_SCALE);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Picks how KiteEncodeSamples() and KiteDecodeSamples() convert
+ * half-precision floats: with the CPU's F16C instructions if 'on' is ON and
+ * the CPU has them, and in plain C otherwise.  Both give exactly the same
+ * numbers.  The first conversion picks F16C by itself if it can, so this is
+ * only needed to turn it off (to test the plain C, say).  Returns ON if the
+ * instructions will be used.
+ */
+short KiteUseHalfInstructions(short on)
+{
+    short use = OFF;
+
+#if defined(KITE_HALF_INSTRUCTIONS)
+    __builtin_cpu_init();
+    use = on && __builtin_cpu_supports("f16c") ? ON : OFF;
+#endif
+    __atomic_store_n(&half_instructions, use, __ATOMIC_RELAXED);
+    return use;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Picks the tile size for KiteExecutePlans() and KiteExecutePlanTiled()
+ * from the size of the CPU's level 2 cache (or level 1, if that's all the
+ * system will tell), so a tile of source and the destinations it goes to
+ * fit in it with room to spare: a quarter of the cache.  If the system
+ * doesn't say, KITE_TILE_BYTES is used.  sysconf() may read files, so this
+ * is done before any audio runs (KiteCreate() does it).
+ */
+void KiteTuneTiles(void)
+{
+    long cache_size = -1;
+    unsigned long bytes = KITE_TILE_BYTES;
+
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+#if defined(_SC_LEVEL1_DCACHE_SIZE)
+    if (cache_size <= 0)
+        cache_size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+#endif
+    if (cache_size > 0)
+        bytes = (unsigned long) cache_size / 4;
+    if (bytes < MIN_TILE_BYTES)
+        bytes = MIN_TILE_BYTES;
+
+    __atomic_store_n(&tuned_tile_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Returns the tile size KiteTuneTiles() picked, or KITE_TILE_BYTES if it
+ * hasn't been called.
+ */
+unsigned long KiteTileBytes(void)
+{
+    unsigned long bytes = __atomic_load_n(&tuned_tile_bytes,
+                                          __ATOMIC_RELAXED);
+    return bytes ? bytes : KITE_TILE_BYTES;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * KiteExecutePlan() for several channels kept in separate buffers, all cut
+ * with the same plan.  Running the plan once per channel streams every
+ * segment through the cache once per channel.  Instead, the output is made
+ * one tile of 'tile_frames' frames at a time (0 picks KiteTileBytes() worth
+ * of all the channels' sources and destinations), and every channel's part
+ * of a tile is copied before moving on to the next, so the segment table
+ * is walked only once and each channel's reads and writes stay in the
+ * cache.  The parts of a reversed segment are read from its far end, as in
+ * KiteReadStream().  The sources must not overlap any destination.
+ */
+void KiteExecutePlanTiled(const KitePlan * plan, void * const * destinations,
+                          const void * const * sources,
+                          unsigned long channels, unsigned long frame_size,
+                          unsigned long tile_frames)
+{
+    unsigned long segment = 0;
+    unsigned long offset = 0;
+    unsigned long position = 0;
+    unsigned long channel = 0;
+
+    if (channels == 0 || frame_size == 0)
+        return;
+    if (tile_frames == 0)
+        tile_frames = KiteTileBytes() / (2 * channels * frame_size);
+    if (tile_frames == 0)
+        tile_frames = 1;
+
+    while (segment < plan->segment_count)
+    {
+        unsigned long tile_end = plan->total_samples - position >
+                tile_frames ? position + tile_frames : plan->total_samples;
+
+        // copy the parts of the segments inside the tile, every channel
+        while (position < tile_end && segment < plan->segment_count)
+        {
+            const KiteSegment * piece = &plan->segments[segment];
+            unsigned long count = piece->length - offset;
+            if (count > tile_end - position)
+                count = tile_end - position;
+            unsigned long first = piece->reverse ?
+                    piece->source_start + piece->length - offset - count :
+                    piece->source_start + offset;
+
+            for (channel = 0; channel < channels; ++channel)
+                KiteCopySamples((unsigned char *) destinations[channel] +
+                                position * frame_size,
+                                (const unsigned char *) sources[channel] +
+                                first * frame_size, count, piece->reverse,
+                                frame_size);
+
+            position += count;
+            offset += count;
+            if (offset == piece->length)
+            {
+                ++segment;
+                offset = 0;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fan-out: makes several shuffles of the same source at once, one per plan
+ * (all for the same number of samples), into 'destinations'.  Calling
+ * KiteExecutePlan() once per plan would read the whole source over again
+ * for every plan.  Instead, the source is gone through one tile of
+ * 'tile_frames' frames at a time (0 picks KiteTileBytes() worth), and
+ * each tile is copied out to every destination while it is still in the
+ * CPU's cache, so the source is read from memory about once no matter how
+ * many plans there are.
+ *
+ * To find the segments that read from a tile, each plan's segments are
+ * sorted into input order in its tape (like KiteSnapPlan() does), so this
+ * only allocates if a plan's tape is too small.  That only works if every
+ * plan uses every input sample exactly once, as generated (and snapped)
+ * plans do; if one doesn't, the plans are just executed one at a time.
+ * The source must not overlap any of the destinations.
+ */
+int KiteExecutePlans(KitePlan * const * plans, unsigned long plan_count,
+                     void * const * destinations, const void * source,
+                     unsigned long frame_size, unsigned long tile_frames)
+{
+    const unsigned char * src = (const unsigned char *) source;
+    unsigned long total_samples = 0;
+    unsigned long tile_start = 0;
+    unsigned long i = 0;
+    short tiled = ON;
+
+    if (plan_count == 0 || frame_size == 0)
+        return KITE_OK;
+    total_samples = plans[0]->total_samples;
+
+    for (i = 0; i < plan_count; ++i)
+    {
+        if (GrowTape(plans[i], plans[i]->segment_count) != KITE_OK)
+            return KITE_ERROR;
+        if (plans[i]->total_samples != total_samples ||
+            !SortSources(plans[i]))
+            tiled = OFF;
+    }
+    if (!tiled)
+    {
+        for (i = 0; i < plan_count; ++i)
+            KiteExecutePlan(plans[i], destinations[i], source, frame_size);
+        return KITE_OK;
+    }
+
+    if (tile_frames == 0)
+        tile_frames = KiteTileBytes() / frame_size;
+    if (tile_frames == 0)
+        tile_frames = 1;
+
+    for (tile_start = 0; tile_start < total_samples; tile_start += tile_frames)
+    {
+        unsigned long tile_end = total_samples - tile_start > tile_frames ?
+                tile_start + tile_frames : total_samples;
+
+        for (i = 0; i < plan_count; ++i)
+        {
+            const KitePlan * plan = plans[i];
+            unsigned char * dest = (unsigned char *) destinations[i];
+            unsigned long piece = FindPiece(plan->tape, plan->segment_count,
+                                            tile_start);
+
+            // copy the part of every piece that falls inside the tile
+            for (; piece < plan->segment_count &&
+                   plan->tape[piece].start < tile_end; ++piece)
+            {
+                const KiteSegment * segment =
+                        &plan->segments[plan->tape[piece].length];
+                unsigned long segment_end = segment->source_start +
+                        segment->length;
+                unsigned long first = segment->source_start > tile_start ?
+                        segment->source_start : tile_start;
+                unsigned long last = segment_end < tile_end ? segment_end :
+                        tile_end;
+                // where that part lands in the output (a reversed segment's
+                // last input sample is its first output sample)
+                unsigned long offset = segment->reverse ?
+                        segment_end - last : first - segment->source_start;
+
+                KiteCopySamples(dest + (segment->dest_start + offset) *
+                                frame_size,
+                                src + first * frame_size, last - first,
+                                segment->reverse, frame_size);
+            }
+        }
+    }
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Adds 'count' frames of 'channels' float samples each, times 'gain', to the
+ * destination (for run_adding()).  Unlike copying, this needs to know the
+ * samples are floats.  Like KiteCopySamples(), reversing keeps the samples
+ * inside each frame in order.
+ */
+void KiteAddSamples(float * destination, const float * source,
+                    unsigned long count, short reverse,
+                    unsigned long channels, float gain)
+{
+    unsigned long i = 0;
+    unsigned long channel = 0;
+
+    if (!reverse)
+    {
+        for (i = 0; i < count * channels; ++i)
+            destination[i] += gain * source[i];
+    }
+    else if (channels == 1)
+    {
+        for (i = 0; i < count; ++i)
+            destination[i] += gain * source[count - 1 - i];
+    }
+    else
+    {
+        for (i = 0; i < count; ++i)
+        {
+            const float * frame = source + (count - 1 - i) * channels;
+            for (channel = 0; channel < channels; ++channel)
+                destination[i * channels + channel] += gain * frame[channel];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Mixes every segment of the plan from the source into the destination.
+ * Each frame is 'channels' floats (1 for a planar buffer).
+ */
+void KiteExecutePlanAdding(const KitePlan * plan, float * destination,
+                           const float * source, unsigned long channels,
+                           float gain)
+{
+    unsigned long i = 0;
+
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
+        KiteAddSamples(destination + segment->dest_start * channels,
+                       source + segment->source_start * channels,
+                       segment->length, segment->reverse, channels, gain);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Meters 'frames' frames of 'channels' floats each: every channel's largest
+ * absolute sample goes into peaks[channel] (if it is bigger than what is
+ * already there), and the sum of its squared samples is added to
+ * sums[channel].  The order of the frames doesn't matter.
+ */
+void KiteMeterSamples(const float * samples, unsigned long frames,
+                      unsigned long channels, float * peaks, double * sums)
+{
+    unsigned long i = 0;
+    unsigned long channel = 0;
+
+    for (i = 0; i < frames; ++i)
+    {
+        for (channel = 0; channel < channels; ++channel)
+        {
+            float sample = samples[i * channels + channel];
+            if (fabsf(sample) > peaks[channel])
+                peaks[channel] = fabsf(sample);
+            sums[channel] += (double) sample * sample;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * KiteCopySamples() for 'frames' frames of 'channels' floats, metering them
+ * (as KiteMeterSamples() does) on the way through, so a meter doesn't have
+ * to read the output again afterwards.
+ *
+ * With SSE, and 1, 2 or 4 channels, every group of 4 floats is loaded once,
+ * stored (turned around first if the segment is reversed), and metered while
+ * it is still in a register.  Since 4 is a multiple of the channel count,
+ * lane j of every group always holds channel j % channels.  The sums are
+ * kept in single precision for METER_RUN groups at a time, then added to
+ * the doubles.  Other channel counts are copied and then metered.
+ */
+void KiteCopyMeteredSamples(float * destination, const float * source,
+                            unsigned long frames, short reverse,
+                            unsigned long channels, float * peaks,
+                            double * sums)
+{
+    unsigned long count = frames * channels;
+    unsigned long i = 0;
+
+#if defined(__SSE__)
+    if (channels == 1 || channels == 2 || channels == 4)
+    {
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 peak = _mm_setzero_ps();
+        __m128 sum = _mm_setzero_ps();
+        float lanes[4];
+        unsigned long groups = 0;
+        unsigned long lane = 0;
+
+        for (i = 0; i + 4 <= count; i += 4)
+        {
+            __m128 group = _mm_loadu_ps(source + i);
+
+            if (!reverse)
+                _mm_storeu_ps(destination + i, group);
+            else if (channels == 1)
+                _mm_storeu_ps(destination + count - i - 4,
+                              _mm_shuffle_ps(group, group,
+                                             _MM_SHUFFLE(0, 1, 2, 3)));
+            else if (channels == 2)
+                _mm_storeu_ps(destination + count - i - 4,
+                              _mm_shuffle_ps(group, group,
+                                             _MM_SHUFFLE(1, 0, 3, 2)));
+            else
+                _mm_storeu_ps(destination + count - i - 4, group);
+
+            peak = _mm_max_ps(peak, _mm_andnot_ps(sign, group));
+            sum = _mm_add_ps(sum, _mm_mul_ps(group, group));
+
+            if (++groups == METER_RUN)
+            {
+                _mm_storeu_ps(lanes, sum);
+                for (lane = 0; lane < 4; ++lane)
+                    sums[lane % channels] += lanes[lane];
+                sum = _mm_setzero_ps();
+                groups = 0;
+            }
+        }
+
+        _mm_storeu_ps(lanes, sum);
+        for (lane = 0; lane < 4; ++lane)
+            sums[lane % channels] += lanes[lane];
+        _mm_storeu_ps(lanes, peak);
+        for (lane = 0; lane < 4; ++lane)
+        {
+            if (lanes[lane] > peaks[lane % channels])
+                peaks[lane % channels] = lanes[lane];
+        }
+
+        // the last few samples (less than 4, and always whole frames)
+        if (i < count)
+        {
+            unsigned long left = (count - i) / channels;
+            KiteCopySamples(reverse ? destination : destination + i,
+                            source + i, left, reverse,
+                            channels * sizeof (float));
+            KiteMeterSamples(source + i, left, channels, peaks, sums);
+        }
+        return;
+    }
+#endif
+
+    KiteCopySamples(destination, source, frames, reverse,
+                    channels * sizeof (float));
+    KiteMeterSamples(source, frames, channels, peaks, sums);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * KiteExecutePlan() for frames of 'channels' floats, metering every channel
+ * into 'peaks' and 'sums' as it goes (see KiteCopyMeteredSamples()).  The
+ * output holds the same samples as the input, only moved, so this meters
+ * both at once.
+ */
+void KiteExecutePlanMetered(const KitePlan * plan, float * destination,
+                            const float * source, unsigned long channels,
+                            float * peaks, double * sums)
+{
+    unsigned long i = 0;
+
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
+        KiteCopyMeteredSamples(destination + segment->dest_start * channels,
+                               source + segment->source_start * channels,
+                               segment->length, segment->reverse, channels,
+                               peaks, sums);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Doubles the segment table until it has room for 'needed' segments.
+ */
+int KiteGrowPlan(KitePlan * plan, unsigned long needed)
+{
+    if (needed <= plan->segment_capacity)
+        return KITE_OK;
+
+    unsigned long capacity = plan->segment_capacity ?
+            plan->segment_capacity : 16;
+    while (capacity < needed)
+        capacity *= 2;
+
+    KiteSegment * segments = (KiteSegment *)
+            realloc(plan->segments, capacity * sizeof (KiteSegment));
+    if (!segments)
+        return KITE_ERROR;
+
+    plan->segments = segments;
+    plan->segment_capacity = capacity;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The planner's loop: cuts the 'samples_remaining' samples of tape in the
+ * plan's tape into sub-blocks, and appends them to the segment table as
+ * output samples 'out_index' onwards.
+ */
+static int CutTape(KitePlan * plan, KiteRandom * rng,
+                   const KiteCutRules * rules,
+                   unsigned long samples_remaining, unsigned long out_index)
+{
+    // where the output of this cut ends
+    unsigned long out_end = out_index + samples_remaining;
+    // index points for the sub-blocks of random sizes
+    unsigned long block_start_position = 0;
+    unsigned long block_end_position = 0;
+
+    while (out_index < out_end)
+    {
+        // a pass adds at most 2 runs to the tape
+        if (GrowTape(plan, plan->tape_length + 3) != KITE_OK)
+            return KITE_ERROR;
+
+        KitePickBlock(rng, rules, samples_remaining, &block_start_position,
+                      &block_end_position);
+        short reverse = KitePickReverse(rng, rules);
+
+        /*
+         * find out which input samples the sub-block is made of (using the
+         * spare tape as scratch space), and add them to the segment table.
+         * A reversed sub-block plays its runs last to first.
+         */
+        unsigned long block_runs = SliceTape(plan->tape, plan->tape_length,
+                                             block_start_position,
+                                             block_end_position + 1,
+                                             plan->spare_tape, 0);
+        if (KiteGrowPlan(plan, plan->segment_count + block_runs) != KITE_OK)
+            return KITE_ERROR;
+        unsigned long i = 0;
+        for (i = 0; i < block_runs; ++i)
+        {
+            KiteRun * run = &plan->spare_tape[reverse ? block_runs - 1 - i :
+                                              i];
+            KiteSegment * segment = &plan->segments[plan->segment_count++];
+
+            segment->source_start = run->start;
+            segment->dest_start = out_index;
+            segment->length = run->length;
+            segment->reverse = reverse;
+            out_index += run->length;
+        }
+
+        /*
+         * cut the sub-block out of the tape, and fill the hole with the same
+         * number of samples from the end of the tape (or, if there aren't
+         * that many samples after the sub-block, with everything after it).
+         */
+        unsigned long samples_copied = block_end_position -
+                block_start_position + 1;
+        unsigned long new_length = SliceTape(plan->tape, plan->tape_length, 0,
+                                             block_start_position,
+                                             plan->spare_tape, 0);
+        if (samples_remaining - samples_copied > block_end_position)
+        {
+            new_length = SliceTape(plan->tape, plan->tape_length,
+                                   samples_remaining - samples_copied,
+                                   samples_remaining, plan->spare_tape,
+                                   new_length);
+            new_length = SliceTape(plan->tape, plan->tape_length,
+                                   block_end_position + 1,
+                                   samples_remaining - samples_copied,
+                                   plan->spare_tape, new_length);
+        }
+        else
+            new_length = SliceTape(plan->tape, plan->tape_length,
+                                   block_end_position + 1, samples_remaining,
+                                   plan->spare_tape, new_length);
+
+        // the spare tape is now the real tape
+        KiteRun * holder = plan->tape;
+        plan->tape = plan->spare_tape;
+        plan->spare_tape = holder;
+        plan->tape_length = new_length;
+
+        samples_remaining -= samples_copied;
+    }
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Makes sure a segment of the plan starts at output sample 'position', and
+ * puts its index in 'index' (the segment count, if 'position' is the end of
+ * the output).  If 'position' is in the middle of a segment, the segment is
+ * cut in two there: the part that plays first stays, and the rest becomes
+ * a new segment right after it.  For a reversed segment, the part that
+ * plays first is the end of its input samples.
+ */
+static int SplitSegment(KitePlan * plan, unsigned long position,
+                        unsigned long * index)
+{
+    unsigned long low = 0;
+    unsigned long high = plan->segment_count;
+
+    // binary search for the last segment starting at or before 'position'
+    while (high - low > 1)
+    {
+        unsigned long middle = low + (high - low) / 2;
+        if (plan->segments[middle].dest_start <= position)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    if (plan->segment_count == 0 || position >= plan->total_samples)
+    {
+        *index = plan->segment_count;
+        return KITE_OK;
+    }
+    if (plan->segments[low].dest_start == position)
+    {
+        *index = low;
+        return KITE_OK;
+    }
+
+    if (KiteGrowPlan(plan, plan->segment_count + 1) != KITE_OK)
+        return KITE_ERROR;
+    memmove(plan->segments + low + 2, plan->segments + low + 1,
+            (plan->segment_count - low - 1) * sizeof (KiteSegment));
+    ++plan->segment_count;
+
+    KiteSegment * front = &plan->segments[low];
+    KiteSegment * back = &plan->segments[low + 1];
+    unsigned long front_length = position - front->dest_start;
+
+    *back = *front;
+    back->dest_start = position;
+    back->length = front->length - front_length;
+    front->length = front_length;
+    if (front->reverse)
+        front->source_start += back->length;
+    else
+        back->source_start += front_length;
+
+    *index = low + 1;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Turns the order of segments 'first' to 'last' (not included) around, in
+ * place.
+ */
+static void ReverseSegments(KiteSegment * segments, unsigned long first,
+                            unsigned long last)
+{
+    while (last > first + 1)
+    {
+        --last;
+        KiteSegment holder = segments[first];
+        segments[first] = segments[last];
+        segments[last] = holder;
+        ++first;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Checks whether two segments send the same input sample to every output
+ * sample they both cover.  A forward segment sends input sample
+ * source_start + (p - dest_start) to output sample p, and a reversed one
+ * sends source_start + length - 1 - (p - dest_start), so the two agree
+ * everywhere if they go the same way and those formulas have the same
+ * constant part.
+ */
+static short SameMapping(const KiteSegment * a, const KiteSegment * b)
+{
+    if (a->reverse != b->reverse)
+        return OFF;
+    if (a->reverse)
+        return a->source_start + a->length + a->dest_start ==
+                b->source_start + b->length + b->dest_start;
+    return a->source_start + b->dest_start == b->source_start + a->dest_start;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Doubles both tape buffers until they have room for 'needed' runs.
+ */
+static int GrowTape(KitePlan * plan, unsigned long needed)
+{
+    if (needed <= plan->tape_capacity)
+        return KITE_OK;
+
+    unsigned long capacity = plan->tape_capacity ? plan->tape_capacity : 4;
+    while (capacity < needed)
+        capacity *= 2;
+
+    KiteRun * tape = (KiteRun *)
+            realloc(plan->tape, capacity * sizeof (KiteRun));
+    if (!tape)
+        return KITE_ERROR;
+    plan->tape = tape;
+
+    KiteRun * spare_tape = (KiteRun *)
+            realloc(plan->spare_tape, capacity * sizeof (KiteRun));
+    if (!spare_tape)
+        return KITE_ERROR;
+    plan->spare_tape = spare_tape;
+
+    plan->tape_capacity = capacity;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Appends tape positions 'from' to 'to' (not included) onto 'destination',
+ * which already holds 'destination_count' runs, and returns the new run
+ * count.  A run that carries straight on from the previous one in the input
+ * is merged into it, so the tape doesn't fill up with needless cuts.
+ */
+static unsigned long SliceTape(const KiteRun * tape, unsigned long run_count,
+                               unsigned long from, unsigned long to,
+                               KiteRun * destination,
+                               unsigned long destination_count)
+{
+    // tape position of the start of the current run
+    unsigned long position = 0;
+    unsigned long i = 0;
+
+    for (i = 0; i < run_count && position < to; ++i)
+    {
+        unsigned long run_end = position + tape[i].length;
+
+        if (run_end > from)
+        {
+            // the part of this run that falls inside [from, to)
+            unsigned long first = from > position ? from : position;
+            unsigned long last = to < run_end ? to : run_end;
+            unsigned long start = tape[i].start + (first - position);
+            unsigned long length = last - first;
+
+            if (destination_count > 0 &&
+                destination[destination_count - 1].start +
+                destination[destination_count - 1].length == start)
+                destination[destination_count - 1].length += length;
+            else
+            {
+                destination[destination_count].start = start;
+                destination[destination_count].length = length;
+                ++destination_count;
+            }
+        }
+
+        position = run_end;
+    }
+
+    return destination_count;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The reverse copy for frames made of whole 32-bit samples, like interleaved
+ * float audio with any number of channels.  Each frame is moved one sample
+ * at a time in order, so the channels stay in order.
+ */
+static void CopyFramesReversed(unsigned char * destination,
+                               const unsigned char * source,
+                               unsigned long count, unsigned long words)
+{
+    unsigned long i = 0;
+    unsigned long word = 0;
+
+    for (i = 0; i < count; ++i)
+    {
+        const unsigned char * from = source - i * words * 4;
+        unsigned char * to = destination + i * words * 4;
+
+        for (word = 0; word < words; ++word)
+        {
+            uint32_t sample;
+            memcpy(&sample, from + word * 4, 4);
+            memcpy(to + word * 4, &sample, 4);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Heapsorts the runs by their start.  (qsort() can allocate memory, which
+ * real-time code must not do.)
+ */
+static void SortRuns(KiteRun * runs, unsigned long count)
+{
+    unsigned long end = count;
+    unsigned long start = count / 2;
+
+    while (end > 1)
+    {
+        // build the heap first, then move its top to the end, one at a time
+        if (start > 0)
+            --start;
+        else
+        {
+            --end;
+            KiteRun holder = runs[0];
+            runs[0] = runs[end];
+            runs[end] = holder;
+        }
+
+        // sift runs[start] down into place
+        unsigned long root = start;
+        while (2 * root + 1 < end)
+        {
+            unsigned long child = 2 * root + 1;
+            if (child + 1 < end && runs[child + 1].start > runs[child].start)
+                ++child;
+            if (runs[child].start <= runs[root].start)
+                break;
+            KiteRun holder = runs[root];
+            runs[root] = runs[child];
+            runs[child] = holder;
+            root = child;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Lists the plan's segments in input order in its tape (the start of each
+ * piece, with the segment number in the length field), which must already
+ * have room for them.  Returns ON if the pieces follow each other with no
+ * gaps or overlaps from the first input sample to the last, i.e. the plan
+ * is a rearrangement of the whole input.
+ */
+static short SortSources(KitePlan * plan)
+{
+    unsigned long count = plan->segment_count;
+    unsigned long next = 0;
+    unsigned long i = 0;
+
+    for (i = 0; i < count; ++i)
+    {
+        plan->tape[i].start = plan->segments[i].source_start;
+        plan->tape[i].length = i;
+    }
+    SortRuns(plan->tape, count);
+
+    for (i = 0; i < count; ++i)
+    {
+        if (plan->tape[i].start != next)
+            return OFF;
+        next += plan->segments[plan->tape[i].length].length;
+    }
+
+    return next == plan->total_samples ? ON : OFF;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Binary searches pieces sorted by SortSources() for the last one starting
+ * at or before 'position' (which is the one holding it).
+ */
+static unsigned long FindPiece(const KiteRun * pieces, unsigned long count,
+                               unsigned long position)
+{
+    unsigned long low = 0;
+    unsigned long high = count;
+
+    // pieces[low] starts at or before 'position'; pieces[high] after it
+    while (high - low > 1)
+    {
+        unsigned long middle = low + (high - low) / 2;
+        if (pieces[middle].start <= position)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * A cut at position p falls between samples p - 1 and p, and those are the
+ * two samples that end up next to a splice.  This scores every cut position
+ * from 'lowest' to 'highest' by how loud those two samples are (added up
+ * over all channels), and returns the quietest one.  At a zero crossing
+ * both samples are close to 0, so a crossing almost always wins; when there
+ * is none in the window, the lowest energy point does.  Ties go to the
+ * position nearest the original cut.
+ *
+ * The scores of planar channels are worked out 4 positions at a time with
+ * SSE, and 'highest' - 'lowest' is at most 2 * KITE_MAX_SNAP_WINDOW, so this
+ * takes a fixed worst-case time.  'lowest' must be at least 1.
+ */
+static unsigned long FindQuietestCut(const float * const * channels,
+                                     unsigned long channel_count,
+                                     unsigned long stride, unsigned long cut,
+                                     unsigned long lowest,
+                                     unsigned long highest)
+{
+    float scores[2 * KITE_MAX_SNAP_WINDOW + 1];
+    unsigned long candidates = highest - lowest + 1;
+    unsigned long channel = 0;
+    unsigned long i = 0;
+
+    memset(scores, 0, candidates * sizeof (float));
+
+    for (channel = 0; channel < channel_count; ++channel)
+    {
+        // the samples before and at each cut position
+        const float * before = channels[channel] + (lowest - 1) * stride;
+        const float * at = channels[channel] + lowest * stride;
+
+        i = 0;
+        if (stride != 1)
+        {
+            for (i = 0; i < candidates; ++i)
+                scores[i] += fabsf(before[i * stride]) +
+                        fabsf(at[i * stride]);
+            continue;
+        }
+#if defined(__SSE__)
+        // clearing the sign bit gives the absolute value
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        for (; i + 4 <= candidates; i += 4)
+        {
+            __m128 left = _mm_andnot_ps(sign, _mm_loadu_ps(before + i));
+            __m128 right = _mm_andnot_ps(sign, _mm_loadu_ps(at + i));
+            __m128 sum = _mm_add_ps(_mm_loadu_ps(scores + i),
+                                    _mm_add_ps(left, right));
+            _mm_storeu_ps(scores + i, sum);
+        }
+#endif
+        for (; i < candidates; ++i)
+            scores[i] += fabsf(before[i]) + fabsf(at[i]);
+    }
+
+    // the lowest score
+    float quietest = scores[0];
+    i = 0;
+#if defined(__SSE__)
+    if (candidates >= 4)
+    {
+        __m128 lowest_scores = _mm_loadu_ps(scores);
+        for (i = 4; i + 4 <= candidates; i += 4)
+            lowest_scores = _mm_min_ps(lowest_scores,
+                                       _mm_loadu_ps(scores + i));
+        float four[4];
+        _mm_storeu_ps(four, lowest_scores);
+        quietest = four[0];
+        unsigned long j = 0;
+        for (j = 1; j < 4; ++j)
+            if (four[j] < quietest)
+                quietest = four[j];
+    }
+#endif
+    for (; i < candidates; ++i)
+        if (scores[i] < quietest)
+            quietest = scores[i];
+
+    // and the position with that score nearest to the original cut
+    unsigned long distance = 0;
+    unsigned long center = cut - lowest;
+    for (distance = 0; distance < candidates; ++distance)
+    {
+        if (distance <= center && scores[center - distance] == quietest)
+            return cut - distance;
+        if (center + distance < candidates &&
+            scores[center + distance] == quietest)
+            return cut + distance;
+    }
+
+    return cut;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The bits of a float are a sign, 8 bits of exponent and 23 of mantissa; a
+ * half-precision float has a sign, 5 bits of exponent and 10 of mantissa.
+ * Numbers too big for a half become infinity, and numbers too small for a
+ * normal half become subnormal ones (whole numbers of 2^-24).  Ties round
+ * to the even mantissa, as the F16C instructions do.
+ */
+static uint16_t FloatToHalf(float value)
+{
+    uint32_t bits = 0;
+    memcpy(&bits, &value, sizeof (bits));
+    uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000);
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+
+    // infinity, and NaN, which stays a NaN (a quiet one, keeping the top of
+    // its payload, as F16C does)
+    if (magnitude > 0x7F800000)
+        return sign | 0x7E00 | (uint16_t) ((magnitude >> 13) & 0x03FF);
+    if (magnitude == 0x7F800000)
+        return sign | 0x7C00;
+    // 65520 and up round to infinity
+    if (magnitude >= 0x477FF000)
+        return sign | 0x7C00;
+    // under 2^-14: a count of 2^-24s (multiplying by 2^24 is exact)
+    if (magnitude < 0x38800000)
+    {
+        float absolute = 0.0f;
+        memcpy(&absolute, &magnitude, sizeof (absolute));
+        return sign | (uint16_t) lrintf(absolute * 16777216.0f);
+    }
+
+    // round away the low 13 bits of the mantissa (a carry into the
+    // exponent is still right), then move the exponent's bias from 127
+    // to 15
+    magnitude += 0x0FFF + ((magnitude >> 13) & 1);
+    magnitude -= (uint32_t) (127 - 15) << 23;
+    return sign | (uint16_t) (magnitude >> 13);
+}
+
+//-----------------------------------------------------------------------------
+
+
+static float HalfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x03FF;
+    uint32_t bits = 0;
+    float value = 0.0f;
+
+    if (exponent == 0)
+    {
+        // zero and the subnormals are whole numbers of 2^-24
+        value = (float) mantissa * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+
+    // a NaN comes back quiet, as F16C makes it
+    if (exponent == 0x1F)
+        bits = sign | 0x7F800000 | (mantissa << 13) |
+                (mantissa ? 0x00400000 : 0);
+    else
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    memcpy(&value, &bits, sizeof (value));
+    return value;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Returns ON if half-precision floats are to be converted with F16C,
+ * asking the CPU the first time (see KiteUseHalfInstructions()).  Two
+ * threads asking at once both come to the same answer.
+ */
+static short UseHalfInstructions(void)
+{
+    short use = __atomic_load_n(&half_instructions, __ATOMIC_RELAXED);
+
+    if (use < 0)
+        use = KiteUseHalfInstructions(ON);
+    return use;
+}
+
+//-----------------------------------------------------------------------------
+
+
+#if defined(KITE_HALF_INSTRUCTIONS)
+/*
+ * Converts floats to half-precision floats 8 at a time with F16C, rounding
+ * to the nearest (ties to even, like FloatToHalf()).
+ */
+static unsigned long EncodeHalves(uint16_t * destination,
+                                  const float * source, unsigned long count)
+{
+    unsigned long i = 0;
+
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i *) (destination + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(source + i),
+                                         _MM_FROUND_TO_NEAREST_INT));
+    return i;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Converts half-precision floats back to floats 8 at a time with F16C.
+ */
+static unsigned long DecodeHalves(float * destination,
+                                  const uint16_t * source, unsigned long count)
+{
+    unsigned long i = 0;
+
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(destination + i, _mm256_cvtph_ps(
+                _mm_loadu_si128((const __m128i *) (source + i))));
+    return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+
+
+static void ReverseFrames(float * frames, unsigned long count,
+                          unsigned long channels)
+{
+    unsigned long channel = 0;
+
+    if (count < 2)
+        return;
+
+    float * front = frames;
+    float * back = frames + (count - 1) * channels;
+
+    while (front < back)
+    {
+        for (channel = 0; channel < channels; ++channel)
+        {
+            float holder = front[channel];
+            front[channel] = back[channel];
+            back[channel] = holder;
+        }
+        front += channels;
+        back -= channels;
+    }
+}
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,396 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * The Kite engine.  This is the cut-and-splice algorithm of run_Kite() split
+ * into two steps so it can be used outside of a LADSPA host:
+ *
+ *   1. KiteGeneratePlan() decides where the tape gets cut and which pieces
+ *      get reversed, and writes the result into a segment table (a KitePlan).
+ *      It never touches any audio.
+ *   2. KiteExecutePlan() moves the samples from the input to the output as
+ *      the segment table says.  Or KiteReadStream() does it a piece at a
+ *      time, for output that is sent somewhere as it is made.
+ *
+ * Since Kite only ever moves samples around (it never does any arithmetic on
+ * them), step 2 does not care what the samples are.  It works on "frames" of
+ * any byte size, so 16-bit, packed 24-bit and half-precision float audio can
+ * be shuffled directly without converting to LADSPA_Data (floats) and back.
+ */
+
+#ifndef KITE_ENGINE_H
+#define KITE_ENGINE_H
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdint.h>
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// named switches (flags) for on/off
+#define ON 1
+#define OFF 0
+
+// return values of the engine functions that can fail
+#define KITE_OK 0
+#define KITE_ERROR -1
+
+// the farthest (in samples, either way) KiteSnapPlan() moves a cut
+#define KITE_MAX_SNAP_WINDOW 256
+
+// the sub-block lengths and reverse chance Kite has always used
+#define KITE_DEFAULT_MIN_SECONDS 0.25
+#define KITE_DEFAULT_MAX_SECONDS 2.0
+#define KITE_DEFAULT_REVERSE_CHANCE (1.0 / 3.0)
+// the shortest sub-blocks KiteMakeCutRules() allows, in seconds (so a plan
+// reserved for them is big enough for any rules)
+#define KITE_SHORTEST_SEGMENT_SECONDS 0.01
+
+// about how many bytes of the source KiteExecutePlans() reads at a time
+// (small enough to stay in the CPU's cache while it is copied out), unless
+// KiteTuneTiles() finds out how big the cache really is
+#define KITE_TILE_BYTES 65536
+
+// the most buckets a table of sub-block lengths can have (see
+// KiteMakeLengthTable())
+#define KITE_MAX_LENGTH_BUCKETS 64
+
+// the preset shapes of sub-block lengths (see KitePresetLengths()): every
+// length as likely as any other (the way Kite has always cut), mostly short
+// pieces with a long one now and then, mostly long pieces, and pieces that
+// are either very short or very long
+#define KITE_LENGTHS_EVEN 0
+#define KITE_LENGTHS_SHORT 1
+#define KITE_LENGTHS_LONG 2
+#define KITE_LENGTHS_EXTREMES 3
+#define KITE_LENGTH_SHAPES 4
+
+
+//-----------
+//-- TYPES --
+//-----------
+
+/*
+ * The sample formats the engine can move around, and store floats in (see
+ * KiteEncodeSamples()).  All of them are stored in the machine's native
+ * (little-endian) byte order, and the integer ones hold -1 to 1 as the
+ * biggest number they have and its negative (-32767 to 32767, say).
+ */
+typedef enum
+{
+    // 32-bit float, the same as LADSPA_Data
+    KITE_FORMAT_FLOAT32 = 0,
+    // 16-bit signed integer
+    KITE_FORMAT_INT16,
+    // 24-bit signed integer packed into 3 bytes (no padding byte)
+    KITE_FORMAT_INT24,
+    // IEEE 754 half-precision float
+    KITE_FORMAT_FLOAT16
+} KiteSampleFormat;
+
+/*
+ * The state of a random number generator.  Every user of the engine keeps
+ * its own, so the same seed always gives the same cuts.
+ */
+typedef struct
+{
+    uint64_t state;
+} KiteRandom;
+
+/*
+ * How likely each sub-block length is, as a Walker alias table.  The lengths
+ * from the shortest to the longest are split into 'count' buckets of the
+ * same width, each with its own weight.  The table turns that into 'count'
+ * columns of the same weight: column i is bucket i with a chance of
+ * keep[i] in 2^32, and bucket alias[i] otherwise.  So drawing a length takes
+ * one random number and two lookups, however many buckets there are (see
+ * KitePickLength()).  A 'count' of 0 is the even spread Kite has always cut
+ * with, drawn the way it always was.
+ */
+typedef struct
+{
+    unsigned long count;
+    uint32_t keep[KITE_MAX_LENGTH_BUCKETS];
+    uint32_t alias[KITE_MAX_LENGTH_BUCKETS];
+} KiteLengthTable;
+
+/*
+ * The rules the planner cuts by, as sample counts and whole numbers so
+ * nothing has to be worked out again while cutting.  Make them with
+ * KiteMakeCutRules() (or KiteDefaultCutRules()), and only again when the
+ * sample rate or the settings change.
+ */
+typedef struct
+{
+    // the shortest sub-block, and the farthest into the tape one may end
+    // (the MIN_BLOCK_START and MAX_BLOCK_END of run_Kite())
+    unsigned long min_block_start;
+    unsigned long max_block_end;
+    // a sub-block is reversed if a random number modulo reverse_modulus is
+    // less than reverse_threshold (the fraction is kept in lowest terms)
+    uint64_t reverse_modulus;
+    uint64_t reverse_threshold;
+    // how likely each sub-block length is (KiteMakeCutRules() makes it
+    // even; set it afterwards with KiteMakeLengthTable() or
+    // KitePresetLengths())
+    KiteLengthTable lengths;
+} KiteCutRules;
+
+/*
+ * One entry of the segment table: 'length' samples starting at input sample
+ * 'source_start' go to the output starting at 'dest_start'.  If 'reverse' is
+ * ON, the last input sample of the segment is the first one written out.
+ */
+typedef struct
+{
+    unsigned long source_start;
+    unsigned long dest_start;
+    unsigned long length;
+    short reverse;
+} KiteSegment;
+
+/*
+ * A run of untouched input samples.  The planner keeps the part of the input
+ * that has not been used yet (the "virtual tape") as a list of these.
+ */
+typedef struct
+{
+    unsigned long start;
+    unsigned long length;
+} KiteRun;
+
+/*
+ * A segment table covering 'total_samples' output samples, in output order.
+ * The tape fields are scratch space for KiteGeneratePlan() (and for
+ * KiteSnapPlan() and KiteExecutePlans(), which sort the segments with it).
+ */
+typedef struct
+{
+    KiteSegment * segments;
+    unsigned long segment_count;
+    unsigned long segment_capacity;
+    unsigned long total_samples;
+    KiteRun * tape;
+    KiteRun * spare_tape;
+    unsigned long tape_length;
+    unsigned long tape_capacity;
+} KitePlan;
+
+/*
+ * A cursor for reading a plan's output a piece at a time (see
+ * KiteReadStream()).  It points into the plan and the source, which must
+ * stay put (and unchanged) while it is in use; the output itself never
+ * exists anywhere but in the caller's buffers.
+ */
+typedef struct
+{
+    const KitePlan * plan;
+    const unsigned char * source;
+    unsigned long frame_size;
+    // how the source's samples are stored (KITE_FORMAT_FLOAT32 for frames
+    // that are copied as they are), and how many there are in a frame
+    KiteSampleFormat format;
+    unsigned long channels;
+    // the segment the next frame comes from, and how far into it that is
+    unsigned long segment;
+    unsigned long offset;
+    // the number of frames read so far
+    unsigned long position;
+} KiteStream;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// returns the number of bytes in one sample of the given format (0 if the
+// format is unknown)
+unsigned long KiteFormatSize(KiteSampleFormat format);
+
+// seeds a random number generator
+void KiteSeedRandom(KiteRandom * rng, uint64_t seed);
+
+// gets the next raw 64-bit random number
+uint64_t KiteRandomNext(KiteRandom * rng);
+
+// gets a random unsigned long integer from lower_bound to upper_bound
+// (both included)
+unsigned long KiteRandomNaturalNumber(KiteRandom * rng,
+                                      unsigned long lower_bound,
+                                      unsigned long upper_bound);
+
+// works out the cut rules for sub-blocks of 'min_seconds' to 'max_seconds'
+// long, reversed with a chance of 'reverse_chance' (0 to 1)
+void KiteMakeCutRules(KiteCutRules * rules, unsigned long sample_rate,
+                      double min_seconds, double max_seconds,
+                      double reverse_chance);
+
+// works out the cut rules Kite has always used
+void KiteDefaultCutRules(KiteCutRules * rules, unsigned long sample_rate);
+
+// compiles 'count' bucket weights (0 for the even spread) into an alias
+// table
+int KiteMakeLengthTable(KiteLengthTable * table, const double * weights,
+                        unsigned long count);
+
+// fills in the alias table of one of the KITE_LENGTHS_... shapes
+void KitePresetLengths(KiteLengthTable * table, int shape);
+
+// draws a sub-block length from 'shortest' to 'longest' (both included)
+unsigned long KitePickLength(KiteRandom * rng, const KiteLengthTable * table,
+                             unsigned long shortest, unsigned long longest);
+
+// picks the next sub-block to cut out of the remaining part of the tape
+void KitePickBlock(KiteRandom * rng, const KiteCutRules * rules,
+                   unsigned long samples_remaining,
+                   unsigned long * block_start, unsigned long * block_end);
+
+// sets up an empty plan with room for 'segment_capacity' segments
+int KiteInitPlan(KitePlan * plan, unsigned long segment_capacity);
+
+// frees the memory held by a plan
+void KiteFreePlan(KitePlan * plan);
+
+// makes room for at least 'needed' segments in the plan's segment table
+int KiteGrowPlan(KitePlan * plan, unsigned long needed);
+
+// decides whether a sub-block gets reversed
+short KitePickReverse(KiteRandom * rng, const KiteCutRules * rules);
+
+// makes sure a plan can be generated for 'total_samples' samples with the
+// given rules without allocating any more memory
+int KiteReservePlan(KitePlan * plan, const KiteCutRules * rules,
+                    unsigned long total_samples);
+
+// cuts 'total_samples' samples of tape into a new segment table
+int KiteGeneratePlan(KitePlan * plan, KiteRandom * rng,
+                     const KiteCutRules * rules, unsigned long total_samples);
+
+// moves the plan's cuts to the quietest points (zero crossings) within
+// 'window' samples ('stride' is the distance between a channel's samples)
+int KiteSnapPlan(KitePlan * plan, const float * const * channels,
+                 unsigned long channel_count, unsigned long stride,
+                 unsigned long window);
+
+// cuts output samples 'range_start' to 'range_end' of a plan again, leaving
+// the rest of it alone
+int KiteRegeneratePlan(KitePlan * plan, KiteRandom * rng,
+                       const KiteCutRules * rules, unsigned long range_start,
+                       unsigned long range_end);
+
+// copies only the output samples that 'new_plan' takes from a different
+// place than 'old_plan' did, and returns how many there were
+unsigned long KiteExecutePlanChanges(const KitePlan * old_plan,
+                                     const KitePlan * new_plan,
+                                     void * destination, const void * source,
+                                     unsigned long frame_size);
+
+// copies the segment table of 'source' into 'destination'
+int KiteCopyPlan(KitePlan * destination, const KitePlan * source);
+
+// checks that a segment table fills its output and stays inside its input
+int KiteCheckPlan(const KitePlan * plan);
+
+// copies 'count' frames of 'frame_size' bytes each, optionally reversed
+void KiteCopySamples(void * destination, const void * source,
+                     unsigned long count, short reverse,
+                     unsigned long frame_size);
+
+// copies 'count' floats spaced 'stride' apart into a row, optionally
+// reversed
+void KiteGatherSamples(float * destination, const float * source,
+                       unsigned long count, short reverse,
+                       unsigned long stride);
+
+// moves the frames of 'source' into 'destination' as the plan says
+void KiteExecutePlan(const KitePlan * plan, void * destination,
+                     const void * source, unsigned long frame_size);
+
+// gets a stream ready to read the output of 'plan' (from 'source') from the
+// beginning
+void KiteStartStream(KiteStream * stream, const KitePlan * plan,
+                     const void * source, unsigned long frame_size);
+
+// the same, for a source of 'channels' samples per frame stored in 'format'
+// (see KiteEncodeSamples()), read out as floats
+void KiteStartCompactStream(KiteStream * stream, const KitePlan * plan,
+                            const void * source, unsigned long channels,
+                            KiteSampleFormat format);
+
+// moves the stream to output frame 'position'
+int KiteSeekStream(KiteStream * stream, unsigned long position);
+
+// copies the next (up to) 'frames' output frames into 'destination', and
+// returns how many there were (0 once the stream has ended)
+unsigned long KiteReadStream(KiteStream * stream, void * destination,
+                             unsigned long frames);
+
+// stores 'count' floats in 'format'
+void KiteEncodeSamples(void * destination, const float * source,
+                       unsigned long count, KiteSampleFormat format);
+
+// turns 'count' samples stored in 'format' back into floats
+void KiteDecodeSamples(float * destination, const void * source,
+                       unsigned long count, KiteSampleFormat format);
+
+// converts half-precision floats with the CPU's F16C instructions (if 'on'
+// and the CPU has them) or in plain C; returns ON if F16C will be used
+short KiteUseHalfInstructions(short on);
+
+// picks the tile size from the size of the CPU's cache (call it once,
+// before any audio runs)
+void KiteTuneTiles(void);
+
+// the tile size KiteTuneTiles() picked (KITE_TILE_BYTES until then)
+unsigned long KiteTileBytes(void);
+
+// moves the frames of 'channels' sources into as many destinations with the
+// same plan, a cache-sized tile of the output at a time
+void KiteExecutePlanTiled(const KitePlan * plan, void * const * destinations,
+                          const void * const * sources,
+                          unsigned long channels, unsigned long frame_size,
+                          unsigned long tile_frames);
+
+// moves the frames of one source into several destinations, each with its
+// own plan, reading the source only once ('tile_frames' at a time)
+int KiteExecutePlans(KitePlan * const * plans, unsigned long plan_count,
+                     void * const * destinations, const void * source,
+                     unsigned long frame_size, unsigned long tile_frames);
+
+// adds 'count' frames of 'channels' floats times 'gain' to 'destination',
+// optionally reversed
+void KiteAddSamples(float * destination, const float * source,
+                    unsigned long count, short reverse,
+                    unsigned long channels, float gain);
+
+// adds the frames of 'source' times 'gain' to 'destination' as the plan says
+void KiteExecutePlanAdding(const KitePlan * plan, float * destination,
+                           const float * source, unsigned long channels,
+                           float gain);
+
+// adds the peak and sum of squares of every channel of 'frames' frames of
+// 'channels' floats to peaks[] and sums[]
+void KiteMeterSamples(const float * samples, unsigned long frames,
+                      unsigned long channels, float * peaks, double * sums);
+
+// KiteCopySamples() for float frames, metering them on the way through
+void KiteCopyMeteredSamples(float * destination, const float * source,
+                            unsigned long frames, short reverse,
+                            unsigned long channels, float * peaks,
+                            double * sums);
+
+// KiteExecutePlan() for float frames, metering them on the way through
+void KiteExecutePlanMetered(const KitePlan * plan, float * destination,
+                            const float * source, unsigned long channels,
+                            float * peaks, double * sums);
+
+#endif
+
+// ------------------------------- EOF ----------------------------------------
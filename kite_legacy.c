@@ -0,0 +1,197 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * The legacy Kite: the original run_Kite() loop.  See kite_legacy.h.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include "kite_legacy.h"
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// reverses the samples of a buffer from 'start' to 'end' (both included)
+static void ApplyReverse(float * buffer, unsigned long start,
+                         unsigned long end);
+
+// copies samples 'src_start' to 'src_end' (both included) of one buffer to
+// another, starting at 'dest_start'
+static void CopySubBlock(float * destination, unsigned long dest_start,
+                         const float * source, unsigned long src_start,
+                         unsigned long src_end);
+
+
+//---------------
+//-- FUNCTIONS --
+//---------------
+
+
+/*
+ * The loop of the original run_Kite(), with the random numbers coming from
+ * 'rng' instead of random(), and the sub-block lengths and reverse chance
+ * from 'rules' instead of constants (KiteDefaultCutRules() gives the
+ * original ones).  It has the same fixes as the engine (see
+ * KitePickBlock() and KiteMakeCutRules()), or the two couldn't be compared:
+ *
+ *   - the minimum sub-block length is at least 1 sample, even at sample
+ *     rates under 4 Hz.
+ *   - the random end position never goes past the last remaining sample.
+ *   - if there isn't a minimum length's worth of tape left after the random
+ *     start position, the sub-block runs to the end of the tape.
+ *
+ * Everything else (the order of the random numbers, reversing the
+ * sub-block in the input, and filling its hole from the end of the tape)
+ * is done the way it always was.
+ */
+void KiteLegacyRun(KiteRandom * rng, const KiteCutRules * rules,
+                   float * const * inputs, float * const * outputs,
+                   unsigned long channels, unsigned long total_samples)
+{
+    // the minimum index of the random sub-blocks (0.25 seconds by default)
+    const unsigned long MIN_BLOCK_START = rules->min_block_start;
+    // the maximum index of the random sub-block (2.25 seconds by default)
+    const unsigned long MAX_BLOCK_END = rules->max_block_end;
+    // buffer indexes
+    unsigned long out_index = 0;
+    // index points for the sub-blocks of random sizes
+    unsigned long block_start_position = 0;
+    unsigned long block_end_position = 0;
+    // random number upper and lower bounds
+    unsigned long rand_num_lower_bound = 0;
+    unsigned long rand_num_upper_bound = 0;
+    // the number of samples left to process (chop up into sub-blocks)
+    unsigned long samples_remaining = total_samples;
+    // for loop index
+    unsigned long channel = 0;
+
+    while (out_index < total_samples)
+    {
+        rand_num_lower_bound = MIN_BLOCK_START;
+        rand_num_upper_bound = MAX_BLOCK_END;
+
+        if (samples_remaining <= MIN_BLOCK_START * 2)
+        {
+            block_start_position = 0;
+            block_end_position = samples_remaining - 1;
+        }
+        else if (samples_remaining <= MAX_BLOCK_END)
+        {
+            rand_num_upper_bound = samples_remaining - MIN_BLOCK_START;
+            block_start_position = KiteRandomNaturalNumber(rng,
+                    rand_num_lower_bound, rand_num_upper_bound);
+            block_end_position = samples_remaining - 1;
+        }
+        else
+        {
+            block_start_position = KiteRandomNaturalNumber(rng,
+                    rand_num_lower_bound, rand_num_upper_bound);
+            rand_num_lower_bound = block_start_position + MIN_BLOCK_START;
+            if (samples_remaining < (block_start_position + MAX_BLOCK_END -
+                                     MIN_BLOCK_START))
+                rand_num_upper_bound = samples_remaining - 1;
+            else
+                rand_num_upper_bound = block_start_position + MAX_BLOCK_END -
+                    MIN_BLOCK_START - 1;
+
+            if (rand_num_lower_bound > rand_num_upper_bound)
+                block_end_position = samples_remaining - 1;
+            else
+                block_end_position = KiteRandomNaturalNumber(rng,
+                        rand_num_lower_bound, rand_num_upper_bound);
+        }
+
+        // by default 33% chance of reversal vs. 67% chance of not (a random
+        // number of 0, 1 or 2, reversed on 0)
+        short reverse = KiteRandomNaturalNumber(rng, 0,
+                rules->reverse_modulus - 1) < rules->reverse_threshold;
+
+        for (channel = 0; channel < channels; ++channel)
+        {
+            if (reverse)
+                ApplyReverse(inputs[channel], block_start_position,
+                             block_end_position);
+            CopySubBlock(outputs[channel], out_index, inputs[channel],
+                         block_start_position, block_end_position);
+        }
+
+        /*
+         * write over the sub-block just copied out with the same number of
+         * samples from the end of the remaining input (or everything after
+         * the sub-block, if there aren't that many).
+         */
+        unsigned long samples_copied = block_end_position -
+                block_start_position + 1;
+        unsigned long source_start = 0;
+        if (samples_remaining - samples_copied > block_end_position)
+            source_start = samples_remaining - samples_copied;
+        else
+            source_start = block_end_position + 1;
+
+        for (channel = 0; channel < channels; ++channel)
+            CopySubBlock(inputs[channel], block_start_position,
+                         inputs[channel], source_start, samples_remaining - 1);
+
+        out_index += samples_copied;
+        samples_remaining -= samples_copied;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Reverses a subsection of a buffer in place.  (The original swapped while
+ * start <= end, which runs off the front of the buffer when 'end' is 0.)
+ */
+static void ApplyReverse(float * buffer, unsigned long start,
+                         unsigned long end)
+{
+    float holder = 0.0f;
+
+    while (start < end)
+    {
+        holder = buffer[start];
+        buffer[start] = buffer[end];
+        buffer[end] = holder;
+        ++start;
+        --end;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Copies a section of one buffer into another (or the same) buffer, front
+ * to back, so a section can be moved towards the front of its own buffer.
+ *
+ * NOTE: the source endpoint IS copied.
+ */
+static void CopySubBlock(float * destination, unsigned long dest_start,
+                         const float * source, unsigned long src_start,
+                         unsigned long src_end)
+{
+    if ((destination == source && dest_start == src_start) ||
+        src_start > src_end)
+        return;
+
+    unsigned long dest_index = dest_start;
+    unsigned long src_index = 0;
+
+    for (src_index = src_start; src_index <= src_end; ++src_index)
+    {
+        destination[dest_index] = source[src_index];
+        ++dest_index;
+    }
+}
+
+// ------------------------------- EOF ----------------------------------------
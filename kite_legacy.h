@@ -0,0 +1,40 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * The legacy Kite
+ *
+ * This is the original run_Kite() loop (see kite_run.pseudo), which cuts
+ * the tape by actually moving samples around in the input buffers, kept as
+ * a reference for testing the engine against.  It is slow and it wrecks its
+ * input, so nothing but the unit test driver uses it.  Given a generator
+ * with the same seed, it must produce exactly the same output as the
+ * engine (KiteGeneratePlan() followed by KiteExecutePlan()).
+ */
+
+#ifndef KITE_LEGACY_H
+#define KITE_LEGACY_H
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include "kite_engine.h"
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// the original run_Kite() loop over 'channels' planar buffers, cutting by
+// 'rules'.  The inputs are used as the tape, so they are scrambled
+// afterwards
+void KiteLegacyRun(KiteRandom * rng, const KiteCutRules * rules,
+                   float * const * inputs, float * const * outputs,
+                   unsigned long channels, unsigned long total_samples);
+
+#endif
+
+// ------------------------------- EOF ----------------------------------------
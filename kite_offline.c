@@ -0,0 +1,737 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * Offline Kite
+ *
+ * Runs the Kite effect over a whole sound file without a LADSPA host.  The
+ * samples are shuffled in the file's own format (16-bit, packed 24-bit,
+ * half or single precision float), so nothing is ever converted to
+ * LADSPA_Data and back.
+ *
+ * WAV files are recognized by their header, which is copied to the output
+ * unchanged.  Anything else is taken to be raw interleaved samples, and the
+ * format, channel count and sample rate have to be given on the command line.
+ *
+ * With -C (and a seed), results are kept in a cache directory (see
+ * kite_cache.h), and a request that has been rendered before is answered
+ * from there.  The cuts are cached too, so a file of the same length cut with
+ * the same seed and rules skips the planner.
+ *
+ * With -j, the file is read and the samples are moved by that many worker
+ * threads (the cuts are still made by one, since each depends on the last).
+ * On a machine with several memory nodes (NUMA), one sweep over an hour of
+ * audio is limited by memory bandwidth, not by the CPU, so where the memory
+ * is matters: the workers are pinned to CPUs in order of their nodes, the
+ * buffers are mapped untouched (with huge pages when the system has them),
+ * and every worker is the first to touch its own part of them, so each
+ * part ends up on the node of the worker that uses it.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "kite_engine.h"
+#include "kite_cache.h"
+#include "kite_wav.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// default size limit of the render cache, in megabytes
+#define DEFAULT_CACHE_MEGABYTES 1024
+// the most worker threads -j can ask for
+#define MAX_WORKERS 256
+// the size of an explicit huge page (buffers this big or bigger ask for
+// them first, and fall back to transparent huge pages)
+#define HUGE_PAGE_BYTES 2097152
+// where Linux tells which memory node a CPU is on
+#define CPU_DIRECTORY "/sys/devices/system/cpu/cpu%d"
+
+
+//-----------
+//-- TYPES --
+//-----------
+
+/*
+ * A worker thread, and its part of the job: first a range of bytes of the
+ * file to read into the input buffer, then a range of frames of the output
+ * to make.
+ */
+typedef struct
+{
+    pthread_t thread;
+    // the CPU it is pinned to (-1 for none)
+    int cpu;
+    // reading: the file, the buffer, and the bytes this worker reads
+    int file;
+    unsigned char * buffer;
+    unsigned long read_start;
+    unsigned long read_end;
+    short read_failed;
+    // rendering: the plan, where its frames come from and go, and which
+    // frames (first_frame up to, not including, end_frame) this worker makes
+    const KitePlan * plan;
+    const unsigned char * source;
+    unsigned char * destination;
+    unsigned long frame_size;
+    unsigned long first_frame;
+    unsigned long end_frame;
+} KiteOfflineWorker;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// prints how to use the program
+void PrintUsage(const char * program);
+
+// turns a length shape number, or a file of bucket weights, into a table of
+// sub-block lengths
+int ParseLengths(const char * argument, KiteLengthTable * lengths);
+
+// reads a whole file into a new buffer, a part per worker
+unsigned char * ReadWholeFile(const char * path, KiteOfflineWorker * workers,
+                              int worker_count, unsigned long * size);
+
+// maps 'size' bytes of memory (with huge pages if it can) without touching it
+unsigned char * AllocateBuffer(unsigned long size);
+
+// unmaps a buffer from AllocateBuffer()
+void FreeBuffer(unsigned char * buffer, unsigned long size);
+
+// fills 'cpus' with the CPUs this process may run on, grouped by memory node
+int ListCpus(int * cpus, int most);
+
+// runs 'job' on every worker (on this thread, if there is just one)
+void RunWorkers(KiteOfflineWorker * workers, int worker_count,
+                void * (* job)(void *));
+
+// pins the calling thread to the worker's CPU
+void PinWorker(const KiteOfflineWorker * worker);
+
+// a worker's jobs: reading its part of the file, and making its part of
+// the output
+void * ReadPart(void * argument);
+void * RenderPart(void * argument);
+
+
+//----------
+//-- MAIN --
+//----------
+int main(int argc, char * argv[])
+{
+    KiteSoundLayout layout;
+    // these are only used for raw files
+    KiteSampleFormat raw_format = KITE_FORMAT_FLOAT32;
+    unsigned long raw_channels = 1;
+    unsigned long raw_sample_rate = 44100;
+    // seed the generator with the time unless the user gives a seed
+    struct timeval current_time;
+    gettimeofday(&current_time, NULL);
+    uint64_t seed = (uint64_t) (current_time.tv_usec * current_time.tv_sec);
+    short seeded = OFF;
+    // the cut rules (see KiteMakeCutRules())
+    double min_seconds = KITE_DEFAULT_MIN_SECONDS;
+    double max_seconds = KITE_DEFAULT_MAX_SECONDS;
+    double reverse_chance = KITE_DEFAULT_REVERSE_CHANCE;
+    KiteLengthTable lengths;
+    lengths.count = 0;
+    // render cache settings
+    const char * cache_directory = NULL;
+    uint64_t cache_megabytes = DEFAULT_CACHE_MEGABYTES;
+    short print_stats = OFF;
+    // the worker threads (-j)
+    static KiteOfflineWorker workers[MAX_WORKERS];
+    int worker_count = 1;
+    int cpus[MAX_WORKERS];
+    int cpu_count = 0;
+    int worker = 0;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "f:c:r:s:m:x:p:l:C:M:vj:")) != -1)
+    {
+        switch (option)
+        {
+            case 'f':
+                if (KiteParseFormat(optarg, &raw_format) != KITE_OK)
+                {
+                    fprintf(stderr, "Unknown sample format: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c':
+                raw_channels = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                raw_sample_rate = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                seeded = ON;
+                break;
+            case 'm':
+                min_seconds = strtod(optarg, NULL);
+                break;
+            case 'x':
+                max_seconds = strtod(optarg, NULL);
+                break;
+            case 'p':
+                reverse_chance = strtod(optarg, NULL);
+                break;
+            case 'l':
+                if (ParseLengths(optarg, &lengths) != KITE_OK)
+                {
+                    fprintf(stderr, "Bad piece lengths: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'C':
+                cache_directory = optarg;
+                break;
+            case 'M':
+                cache_megabytes = strtoull(optarg, NULL, 10);
+                break;
+            case 'v':
+                print_stats = ON;
+                break;
+            case 'j':
+                worker_count = atoi(optarg);
+                if (worker_count < 1)
+                    worker_count = 1;
+                if (worker_count > MAX_WORKERS)
+                    worker_count = MAX_WORKERS;
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // pin the workers to CPUs in order of memory node, so neighbouring
+    // parts of the buffers go to workers on the same node
+    cpu_count = worker_count > 1 ? ListCpus(cpus, MAX_WORKERS) : 0;
+    for (worker = 0; worker < worker_count; ++worker)
+        workers[worker].cpu = cpu_count > 0 ? cpus[worker % cpu_count] : -1;
+
+    unsigned long file_size = 0;
+    unsigned char * file = ReadWholeFile(argv[optind], workers, worker_count,
+                                         &file_size);
+    if (!file)
+    {
+        fprintf(stderr, "Could not read %s\n", argv[optind]);
+        return 1;
+    }
+
+    // use the WAV header if there is one, otherwise the whole file is samples
+    KiteSoundLayout raw_layout;
+    raw_layout.format = raw_format;
+    raw_layout.channels = raw_channels;
+    raw_layout.sample_rate = raw_sample_rate;
+    if (KiteReadSoundLayout(file, file_size, &raw_layout, &layout) != KITE_OK)
+    {
+        fprintf(stderr, "%s: unsupported WAV format\n", argv[optind]);
+        FreeBuffer(file, file_size);
+        return 1;
+    }
+
+    // the engine moves whole frames (one sample of every channel)
+    unsigned long frame_size = KiteFormatSize(layout.format) *
+            layout.channels;
+    if (frame_size == 0 || layout.sample_rate == 0)
+    {
+        fprintf(stderr, "Bad format, channel count or sample rate.\n");
+        FreeBuffer(file, file_size);
+        return 1;
+    }
+    unsigned long total_frames = layout.data_size / frame_size;
+    KiteCutRules rules;
+    KiteMakeCutRules(&rules, layout.sample_rate, min_seconds, max_seconds,
+                     reverse_chance);
+    rules.lengths = lengths;
+
+    /*
+     * the WAV header (and any leftover bytes of a partial frame) go out
+     * unchanged.  The sample data in between is left untouched until the
+     * workers write it.
+     */
+    unsigned long data_end = layout.data_offset + total_frames * frame_size;
+    unsigned char * output = AllocateBuffer(file_size);
+    KitePlan plan;
+    KiteRandom rng;
+    if (!output || KiteInitPlan(&plan, 0) != KITE_OK)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        FreeBuffer(output, file_size);
+        FreeBuffer(file, file_size);
+        return 1;
+    }
+    memcpy(output, file, layout.data_offset);
+    memcpy(output + data_end, file + data_end, file_size - data_end);
+
+    /*
+     * answer from the cache if this exact request has been rendered before.
+     * Without a seed the clock picks one, so the request can never come up
+     * again, and storing its render would only push out ones that can.
+     */
+    KiteCache cache;
+    uint64_t render_key = 0;
+    short cached = OFF;
+    short plan_cached = OFF;
+    if (cache_directory && !seeded)
+    {
+        if (print_stats)
+            fprintf(stderr, "Cache not used: no seed was given (-s)\n");
+        cache_directory = NULL;
+    }
+    if (cache_directory)
+    {
+        if (KiteOpenCache(&cache, cache_directory,
+                          cache_megabytes * 1024 * 1024) != KITE_OK)
+        {
+            fprintf(stderr, "Could not open cache %s\n", cache_directory);
+            cache_directory = NULL;
+        }
+        else
+        {
+            render_key = KiteRenderKey(KiteHash(file + layout.data_offset,
+                                                layout.data_size, 0),
+                                       seed, &rules, frame_size);
+            if (KiteCacheLoadRender(&cache, render_key,
+                                    output + layout.data_offset,
+                                    layout.data_size) == KITE_OK)
+                cached = ON;
+        }
+    }
+
+    /*
+     * on a miss, the cuts may still be cached: they only depend on the seed,
+     * the rules and the length, so another file of the same length cut the
+     * same way left them behind.
+     */
+    uint64_t plan_key = KitePlanKey(seed, &rules, total_frames);
+    if (cache_directory && !cached && total_frames > 0 &&
+        KiteCacheLoadPlan(&cache, plan_key, &plan) == KITE_OK &&
+        plan.total_samples == total_frames)
+        plan_cached = ON;
+
+    KiteSeedRandom(&rng, seed);
+    if (total_frames > 0 && !cached)
+    {
+        if (!plan_cached &&
+            KiteGeneratePlan(&plan, &rng, &rules, total_frames) != KITE_OK)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            KiteFreePlan(&plan);
+            FreeBuffer(output, file_size);
+            FreeBuffer(file, file_size);
+            return 1;
+        }
+        for (worker = 0; worker < worker_count; ++worker)
+        {
+            workers[worker].plan = &plan;
+            workers[worker].source = file + layout.data_offset;
+            workers[worker].destination = output + layout.data_offset;
+            workers[worker].frame_size = frame_size;
+            workers[worker].first_frame = total_frames * worker /
+                    worker_count;
+            workers[worker].end_frame = total_frames * (worker + 1) /
+                    worker_count;
+        }
+        RunWorkers(workers, worker_count, RenderPart);
+    }
+    if (cache_directory && !cached)
+    {
+        if (total_frames > 0 && !plan_cached)
+            KiteCacheStorePlan(&cache, plan_key, &plan);
+        KiteCacheStoreRender(&cache, render_key, output + layout.data_offset,
+                             layout.data_size);
+    }
+
+    int result = 0;
+    FILE * write_file = fopen(argv[optind + 1], "wb");
+    if (!write_file || fwrite(output, 1, file_size, write_file) != file_size)
+    {
+        fprintf(stderr, "Could not write %s\n", argv[optind + 1]);
+        result = 1;
+    }
+    if (write_file)
+        fclose(write_file);
+
+    if (cache_directory)
+    {
+        if (print_stats)
+        {
+            unsigned long hits = 0;
+            unsigned long misses = 0;
+            unsigned long evictions = 0;
+            KiteCacheTotals(&cache, &hits, &misses, &evictions);
+            fprintf(stderr, "Cache %s: hits %lu, misses %lu, evictions %lu\n",
+                    cached ? "hit" : plan_cached ? "hit (plan)" : "miss",
+                    hits, misses, evictions);
+        }
+        KiteCloseCache(&cache);
+    }
+
+    KiteFreePlan(&plan);
+    FreeBuffer(output, file_size);
+    FreeBuffer(file, file_size);
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Prints how to use the program.
+ */
+void PrintUsage(const char * program)
+{
+    fprintf(stderr, "Usage: %s [-f format] [-c channels] [-r sample rate]",
+            program);
+    fprintf(stderr, " [-s seed]\n");
+    fprintf(stderr, "       [-m min seconds] [-x max seconds]");
+    fprintf(stderr, " [-p reverse chance] [-l lengths]\n");
+    fprintf(stderr, "       [-C cache directory [-M cache megabytes] [-v]]");
+    fprintf(stderr, " [-j threads] input output\n");
+    fprintf(stderr, "  format is one of f32, s16, s24 or f16");
+    fprintf(stderr, " (only used for raw files, as are -c and -r)\n");
+    fprintf(stderr, "  -m and -x set how long the pieces are (0.25 to 2");
+    fprintf(stderr, " seconds), and -p\n  the chance (0 to 1) of a piece");
+    fprintf(stderr, " being reversed (1/3)\n");
+    fprintf(stderr, "  -l sets how likely each piece length is: 0 (all");
+    fprintf(stderr, " the same), 1 (mostly short),\n  2 (mostly long), 3");
+    fprintf(stderr, " (short or long), or a file of up to %d weights,\n",
+            KITE_MAX_LENGTH_BUCKETS);
+    fprintf(stderr, "  shortest lengths first\n");
+    fprintf(stderr, "  -j reads and shuffles the file with that many");
+    fprintf(stderr, " threads, pinned by memory node\n");
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Turns the argument of -l into a table of sub-block lengths: either the
+ * number of one of the KITE_LENGTHS_... shapes, or the name of a text file
+ * of weights (any number of them up to KITE_MAX_LENGTH_BUCKETS, separated by
+ * white space), one for each bucket of lengths from the shortest to the
+ * longest.  The weights are relative, so "4 2 1" makes the shortest third of
+ * the lengths four times as likely as the longest.
+ */
+int ParseLengths(const char * argument, KiteLengthTable * lengths)
+{
+    double weights[KITE_MAX_LENGTH_BUCKETS];
+    unsigned long count = 0;
+    char * end = NULL;
+    long shape = strtol(argument, &end, 10);
+
+    if (*argument != '\0' && *end == '\0')
+    {
+        if (shape < 0 || shape >= KITE_LENGTH_SHAPES)
+            return KITE_ERROR;
+        KitePresetLengths(lengths, (int) shape);
+        return KITE_OK;
+    }
+
+    FILE * file = fopen(argument, "r");
+    if (!file)
+        return KITE_ERROR;
+    while (count < KITE_MAX_LENGTH_BUCKETS &&
+           fscanf(file, "%lf", &weights[count]) == 1)
+        ++count;
+    // anything left over is either too many weights or not a number
+    short leftovers = fscanf(file, " %*c") != EOF;
+    fclose(file);
+
+    if (count == 0 || leftovers)
+        return KITE_ERROR;
+    return KiteMakeLengthTable(lengths, weights, count);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Reads a whole file into a buffer from AllocateBuffer(), each worker
+ * reading its own share of it, so the pages of the buffer are spread over
+ * the workers' memory nodes (the cuts read the input from everywhere, so
+ * no node is better for all of it).  Returns NULL if the file can't be read.
+ */
+unsigned char * ReadWholeFile(const char * path, KiteOfflineWorker * workers,
+                              int worker_count, unsigned long * size)
+{
+    struct stat status;
+    int worker = 0;
+    short failed = OFF;
+
+    int read_file = open(path, O_RDONLY);
+    if (read_file < 0)
+        return NULL;
+    if (fstat(read_file, &status) != 0 || status.st_size < 0)
+    {
+        close(read_file);
+        return NULL;
+    }
+    *size = (unsigned long) status.st_size;
+
+    unsigned char * buffer = AllocateBuffer(*size);
+    if (!buffer)
+    {
+        close(read_file);
+        return NULL;
+    }
+
+    for (worker = 0; worker < worker_count; ++worker)
+    {
+        workers[worker].file = read_file;
+        workers[worker].buffer = buffer;
+        workers[worker].read_start = *size * worker / worker_count;
+        workers[worker].read_end = *size * (worker + 1) / worker_count;
+        workers[worker].read_failed = OFF;
+    }
+    RunWorkers(workers, worker_count, ReadPart);
+    close(read_file);
+
+    for (worker = 0; worker < worker_count; ++worker)
+        if (workers[worker].read_failed)
+            failed = ON;
+    if (failed)
+    {
+        FreeBuffer(buffer, *size);
+        return NULL;
+    }
+
+    return buffer;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Maps 'size' bytes of memory without touching it, so each page is placed
+ * on the memory node of whoever touches it first.  Big buffers ask for
+ * explicit huge pages (which only work if the system has some set aside),
+ * then for transparent ones, so a sweep over an hour of audio doesn't keep
+ * missing the TLB.  Returns NULL if memory ran out.
+ */
+unsigned char * AllocateBuffer(unsigned long size)
+{
+    void * memory = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (size >= HUGE_PAGE_BYTES && size % HUGE_PAGE_BYTES == 0)
+        memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (memory != MAP_FAILED)
+        return (unsigned char *) memory;
+
+    // mmap() can't map nothing, so always ask for at least one byte
+    memory = mmap(NULL, size > 0 ? size : 1, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    if (size >= HUGE_PAGE_BYTES)
+        madvise(memory, size, MADV_HUGEPAGE);
+#endif
+
+    return (unsigned char *) memory;
+}
+
+//-----------------------------------------------------------------------------
+
+
+void FreeBuffer(unsigned char * buffer, unsigned long size)
+{
+    if (buffer)
+        munmap(buffer, size > 0 ? size : 1);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fills 'cpus' with (up to 'most' of) the CPUs this process may run on,
+ * those on memory node 0 first, then node 1, and so on, and returns how
+ * many there are.  Linux shows a CPU's node as a "nodeN" entry in its
+ * directory under /sys; a CPU without one counts as node 0.
+ */
+int ListCpus(int * cpus, int most)
+{
+    int nodes[MAX_WORKERS];
+    char path[64];
+    cpu_set_t allowed;
+    int count = 0;
+    int cpu = 0;
+
+    if (sched_getaffinity(0, sizeof (allowed), &allowed) != 0)
+        return 0;
+
+    for (cpu = 0; cpu < CPU_SETSIZE && count < most; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        int node = 0;
+        snprintf(path, sizeof (path), CPU_DIRECTORY, cpu);
+        DIR * directory = opendir(path);
+        struct dirent * entry = NULL;
+        while (directory && (entry = readdir(directory)))
+        {
+            if (strncmp(entry->d_name, "node", 4) == 0 &&
+                entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+            {
+                node = atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        if (directory)
+            closedir(directory);
+
+        // insert it after every CPU on the same or a lower node
+        int place = count;
+        while (place > 0 && nodes[place - 1] > node)
+        {
+            cpus[place] = cpus[place - 1];
+            nodes[place] = nodes[place - 1];
+            --place;
+        }
+        cpus[place] = cpu;
+        nodes[place] = node;
+        ++count;
+    }
+
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Runs 'job' on every worker, each on its own thread, and waits for them
+ * all.  A single worker just runs on this thread, unpinned, the way
+ * kite_offline always did.  If a thread can't be started, its job is done
+ * on this thread instead.
+ */
+void RunWorkers(KiteOfflineWorker * workers, int worker_count,
+                void * (* job)(void *))
+{
+    short started[MAX_WORKERS];
+    int worker = 0;
+
+    if (worker_count == 1)
+    {
+        job(&workers[0]);
+        return;
+    }
+
+    for (worker = 0; worker < worker_count; ++worker)
+        started[worker] = pthread_create(&workers[worker].thread, NULL, job,
+                                         &workers[worker]) == 0;
+    for (worker = 0; worker < worker_count; ++worker)
+    {
+        if (started[worker])
+            pthread_join(workers[worker].thread, NULL);
+        else
+            job(&workers[worker]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Pins the calling thread to the worker's CPU (if it has one).
+ */
+void PinWorker(const KiteOfflineWorker * worker)
+{
+    cpu_set_t cpu;
+
+    if (worker->cpu < 0)
+        return;
+    CPU_ZERO(&cpu);
+    CPU_SET(worker->cpu, &cpu);
+    pthread_setaffinity_np(pthread_self(), sizeof (cpu), &cpu);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Reads the worker's share of the file into the buffer.
+ */
+void * ReadPart(void * argument)
+{
+    KiteOfflineWorker * worker = (KiteOfflineWorker *) argument;
+    unsigned long position = worker->read_start;
+
+    PinWorker(worker);
+    while (position < worker->read_end)
+    {
+        ssize_t count = pread(worker->file, worker->buffer + position,
+                              worker->read_end - position, (off_t) position);
+        if (count <= 0)
+        {
+            worker->read_failed = ON;
+            break;
+        }
+        position += (unsigned long) count;
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Makes the worker's frames of the output.  A stream (see KiteReadStream())
+ * started at its first frame finds the segments that cover them.
+ */
+void * RenderPart(void * argument)
+{
+    KiteOfflineWorker * worker = (KiteOfflineWorker *) argument;
+    KiteStream stream;
+
+    PinWorker(worker);
+    if (worker->end_frame <= worker->first_frame)
+        return NULL;
+
+    KiteStartStream(&stream, worker->plan, worker->source,
+                    worker->frame_size);
+    if (KiteSeekStream(&stream, worker->first_frame) == KITE_OK)
+        KiteReadStream(&stream, worker->destination +
+                       worker->first_frame * worker->frame_size,
+                       worker->end_frame - worker->first_frame);
+
+    return NULL;
+}
+
+// ------------------------------- EOF ----------------------------------------
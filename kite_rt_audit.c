@@ -0,0 +1,506 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * Real-time safety audit.  See kite_rt_audit.h.
+ *
+ * Every function here has the same name as the libc function it replaces.
+ * Since the test program defines them, the dynamic linker hands them to the
+ * plugin instead of libc's.  They pass the call on to the real function
+ * (found with dlsym(RTLD_NEXT, ...), or glibc's __libc_* entry points for
+ * the allocator, since dlsym itself may allocate) after recording it if the
+ * calling thread is inside run().
+ *
+ * Recording a violation must not allocate either, so violations go into a
+ * fixed table, and backtrace() is called once up front (its first call loads
+ * libgcc, which allocates).
+ */
+
+#define _GNU_SOURCE
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include "kite_rt_audit.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// the most violations kept (any more are only counted)
+#define MAX_VIOLATIONS 64
+// the deepest backtrace kept for a violation
+#define MAX_FRAMES 32
+
+
+//------------------------
+//-- STRUCT DEFINITIONS --
+//------------------------
+
+typedef struct
+{
+    const char * function;
+    int frame_count;
+    void * frames[MAX_FRAMES];
+} Violation;
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+static Violation violations[MAX_VIOLATIONS];
+static int violation_count = 0;
+
+// how deep the current thread is inside run() calls
+static __thread int realtime_depth = 0;
+// set while a violation is being recorded, so recording can't recurse
+static __thread int recording = 0;
+
+// glibc's own allocator
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * pointer, size_t size);
+extern void * __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void * pointer);
+
+// the real versions of everything else
+static int (*real_vprintf)(const char *, va_list);
+static int (*real_vfprintf)(FILE *, const char *, va_list);
+static int (*real_puts)(const char *);
+static int (*real_putchar)(int);
+static int (*real_fputs)(const char *, FILE *);
+static int (*real_fputc)(int, FILE *);
+static size_t (*real_fwrite)(const void *, size_t, size_t, FILE *);
+static size_t (*real_fread)(void *, size_t, size_t, FILE *);
+static FILE * (*real_fopen)(const char *, const char *);
+static int (*real_fclose)(FILE *);
+static int (*real_fflush)(FILE *);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_read)(int, void *, size_t);
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_nanosleep)(const struct timespec *, struct timespec *);
+static int (*real_clock_nanosleep)(clockid_t, int, const struct timespec *,
+                                   struct timespec *);
+static int (*real_usleep)(useconds_t);
+static unsigned int (*real_sleep)(unsigned int);
+static void * (*real_mmap)(void *, size_t, int, int, int, off_t);
+static int (*real_munmap)(void *, size_t);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+static int (*real_select)(int, fd_set *, fd_set *, fd_set *,
+                          struct timeval *);
+static int (*real_sched_yield)(void);
+static int (*real_pthread_mutex_lock)(pthread_mutex_t *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void * (*real_aligned_alloc)(size_t, size_t);
+
+
+//---------------
+//-- FUNCTIONS --
+//---------------
+
+
+/*
+ * Looks up the real version of an interposed function.
+ */
+#define FIND_REAL(name) \
+    if (!real_##name) \
+        *(void **) (&real_##name) = dlsym(RTLD_NEXT, #name)
+
+void KiteAuditInit(void)
+{
+    void * frames[2];
+
+    FIND_REAL(vprintf);
+    FIND_REAL(vfprintf);
+    FIND_REAL(puts);
+    FIND_REAL(putchar);
+    FIND_REAL(fputs);
+    FIND_REAL(fputc);
+    FIND_REAL(fwrite);
+    FIND_REAL(fread);
+    FIND_REAL(fopen);
+    FIND_REAL(fclose);
+    FIND_REAL(fflush);
+    FIND_REAL(write);
+    FIND_REAL(read);
+    FIND_REAL(open);
+    FIND_REAL(close);
+    FIND_REAL(nanosleep);
+    FIND_REAL(clock_nanosleep);
+    FIND_REAL(usleep);
+    FIND_REAL(sleep);
+    FIND_REAL(mmap);
+    FIND_REAL(munmap);
+    FIND_REAL(poll);
+    FIND_REAL(select);
+    FIND_REAL(sched_yield);
+    FIND_REAL(pthread_mutex_lock);
+    FIND_REAL(posix_memalign);
+    FIND_REAL(aligned_alloc);
+
+    // warm up backtrace() so recording a violation never allocates
+    backtrace(frames, 2);
+}
+
+//-----------------------------------------------------------------------------
+
+
+void KiteAuditEnter(void)
+{
+    ++realtime_depth;
+}
+
+void KiteAuditLeave(void)
+{
+    if (realtime_depth > 0)
+        --realtime_depth;
+}
+
+int KiteAuditViolationCount(void)
+{
+    return __atomic_load_n(&violation_count, __ATOMIC_SEQ_CST);
+}
+
+void KiteAuditReset(void)
+{
+    __atomic_store_n(&violation_count, 0, __ATOMIC_SEQ_CST);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Prints the violations.  backtrace_symbols_fd() is used since it writes
+ * straight to the file descriptor without allocating.
+ */
+void KiteAuditReport(FILE * stream)
+{
+    int count = KiteAuditViolationCount();
+    int i = 0;
+
+    if (count == 0)
+        return;
+
+    fprintf(stream, "%d real-time safety violation(s) inside run():\n",
+            count);
+    for (i = 0; i < count && i < MAX_VIOLATIONS; ++i)
+    {
+        fprintf(stream, "\n  %s() called from:\n", violations[i].function);
+        fflush(stream);
+        backtrace_symbols_fd(violations[i].frames, violations[i].frame_count,
+                             fileno(stream));
+    }
+    if (count > MAX_VIOLATIONS)
+        fprintf(stream, "\n  (%d more not shown)\n", count - MAX_VIOLATIONS);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Writes down a call to 'function' if the current thread is inside run().
+ */
+static void Check(const char * function)
+{
+    if (realtime_depth == 0 || recording)
+        return;
+
+    recording = 1;
+    int index = __atomic_fetch_add(&violation_count, 1, __ATOMIC_SEQ_CST);
+    if (index < MAX_VIOLATIONS)
+    {
+        violations[index].function = function;
+        violations[index].frame_count = backtrace(violations[index].frames,
+                                                  MAX_FRAMES);
+    }
+    recording = 0;
+}
+
+//-----------------------------------------------------------------------------
+//-- memory allocation --------------------------------------------------------
+
+void * malloc(size_t size)
+{
+    Check("malloc");
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+    Check("calloc");
+    return __libc_calloc(count, size);
+}
+
+void * realloc(void * pointer, size_t size)
+{
+    Check("realloc");
+    return __libc_realloc(pointer, size);
+}
+
+void free(void * pointer)
+{
+    Check("free");
+    __libc_free(pointer);
+}
+
+void * memalign(size_t alignment, size_t size)
+{
+    Check("memalign");
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void ** pointer, size_t alignment, size_t size)
+{
+    Check("posix_memalign");
+    FIND_REAL(posix_memalign);
+    return real_posix_memalign(pointer, alignment, size);
+}
+
+void * aligned_alloc(size_t alignment, size_t size)
+{
+    Check("aligned_alloc");
+    FIND_REAL(aligned_alloc);
+    return real_aligned_alloc(alignment, size);
+}
+
+//-----------------------------------------------------------------------------
+//-- stdio --------------------------------------------------------------------
+
+int printf(const char * format, ...)
+{
+    va_list arguments;
+    int result = 0;
+
+    Check("printf");
+    FIND_REAL(vprintf);
+    va_start(arguments, format);
+    result = real_vprintf(format, arguments);
+    va_end(arguments);
+    return result;
+}
+
+int fprintf(FILE * stream, const char * format, ...)
+{
+    va_list arguments;
+    int result = 0;
+
+    Check("fprintf");
+    FIND_REAL(vfprintf);
+    va_start(arguments, format);
+    result = real_vfprintf(stream, format, arguments);
+    va_end(arguments);
+    return result;
+}
+
+int vprintf(const char * format, va_list arguments)
+{
+    Check("vprintf");
+    FIND_REAL(vprintf);
+    return real_vprintf(format, arguments);
+}
+
+int vfprintf(FILE * stream, const char * format, va_list arguments)
+{
+    Check("vfprintf");
+    FIND_REAL(vfprintf);
+    return real_vfprintf(stream, format, arguments);
+}
+
+int puts(const char * text)
+{
+    Check("puts");
+    FIND_REAL(puts);
+    return real_puts(text);
+}
+
+int putchar(int character)
+{
+    Check("putchar");
+    FIND_REAL(putchar);
+    return real_putchar(character);
+}
+
+int fputs(const char * text, FILE * stream)
+{
+    Check("fputs");
+    FIND_REAL(fputs);
+    return real_fputs(text, stream);
+}
+
+int fputc(int character, FILE * stream)
+{
+    Check("fputc");
+    FIND_REAL(fputc);
+    return real_fputc(character, stream);
+}
+
+size_t fwrite(const void * data, size_t size, size_t count, FILE * stream)
+{
+    Check("fwrite");
+    FIND_REAL(fwrite);
+    return real_fwrite(data, size, count, stream);
+}
+
+size_t fread(void * data, size_t size, size_t count, FILE * stream)
+{
+    Check("fread");
+    FIND_REAL(fread);
+    return real_fread(data, size, count, stream);
+}
+
+FILE * fopen(const char * path, const char * mode)
+{
+    Check("fopen");
+    FIND_REAL(fopen);
+    return real_fopen(path, mode);
+}
+
+int fclose(FILE * stream)
+{
+    Check("fclose");
+    FIND_REAL(fclose);
+    return real_fclose(stream);
+}
+
+int fflush(FILE * stream)
+{
+    Check("fflush");
+    FIND_REAL(fflush);
+    return real_fflush(stream);
+}
+
+//-----------------------------------------------------------------------------
+//-- system calls -------------------------------------------------------------
+
+ssize_t write(int fd, const void * data, size_t size)
+{
+    Check("write");
+    FIND_REAL(write);
+    return real_write(fd, data, size);
+}
+
+ssize_t read(int fd, void * data, size_t size)
+{
+    Check("read");
+    FIND_REAL(read);
+    return real_read(fd, data, size);
+}
+
+int open(const char * path, int flags, ...)
+{
+    va_list arguments;
+    mode_t mode = 0;
+
+    Check("open");
+    FIND_REAL(open);
+    if (flags & O_CREAT)
+    {
+        va_start(arguments, flags);
+        mode = va_arg(arguments, mode_t);
+        va_end(arguments);
+    }
+    return real_open(path, flags, mode);
+}
+
+int close(int fd)
+{
+    Check("close");
+    FIND_REAL(close);
+    return real_close(fd);
+}
+
+int nanosleep(const struct timespec * request, struct timespec * remaining)
+{
+    Check("nanosleep");
+    FIND_REAL(nanosleep);
+    return real_nanosleep(request, remaining);
+}
+
+int clock_nanosleep(clockid_t clock, int flags,
+                    const struct timespec * request,
+                    struct timespec * remaining)
+{
+    Check("clock_nanosleep");
+    FIND_REAL(clock_nanosleep);
+    return real_clock_nanosleep(clock, flags, request, remaining);
+}
+
+int usleep(useconds_t microseconds)
+{
+    Check("usleep");
+    FIND_REAL(usleep);
+    return real_usleep(microseconds);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+    Check("sleep");
+    FIND_REAL(sleep);
+    return real_sleep(seconds);
+}
+
+void * mmap(void * address, size_t length, int protection, int flags, int fd,
+            off_t offset)
+{
+    Check("mmap");
+    FIND_REAL(mmap);
+    return real_mmap(address, length, protection, flags, fd, offset);
+}
+
+int munmap(void * address, size_t length)
+{
+    Check("munmap");
+    FIND_REAL(munmap);
+    return real_munmap(address, length);
+}
+
+int poll(struct pollfd * fds, nfds_t count, int timeout)
+{
+    Check("poll");
+    FIND_REAL(poll);
+    return real_poll(fds, count, timeout);
+}
+
+int select(int count, fd_set * read_fds, fd_set * write_fds,
+           fd_set * error_fds, struct timeval * timeout)
+{
+    Check("select");
+    FIND_REAL(select);
+    return real_select(count, read_fds, write_fds, error_fds, timeout);
+}
+
+int sched_yield(void)
+{
+    Check("sched_yield");
+    FIND_REAL(sched_yield);
+    return real_sched_yield();
+}
+
+int pthread_mutex_lock(pthread_mutex_t * mutex)
+{
+    Check("pthread_mutex_lock");
+    FIND_REAL(pthread_mutex_lock);
+    return real_pthread_mutex_lock(mutex);
+}
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,44 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * Real-time safety audit
+ *
+ * Kite's descriptor claims LADSPA_PROPERTY_HARD_RT_CAPABLE, which means run()
+ * must never do anything that can block: no memory allocation, no stdio, no
+ * system calls.  Linking kite_rt_audit.c into a test program (with -rdynamic,
+ * so a dlopen'ed plugin sees them) replaces malloc(), printf(), write() and
+ * friends with versions that still work, but write down a violation (and a
+ * backtrace) whenever they are called by a thread that is between
+ * KiteAuditEnter() and KiteAuditLeave().
+ */
+
+#ifndef KITE_RT_AUDIT_H
+#define KITE_RT_AUDIT_H
+
+#include <stdio.h>
+
+// looks up the real functions; call once before anything else
+void KiteAuditInit(void);
+
+// marks the calling thread as being inside run() (these nest)
+void KiteAuditEnter(void);
+
+// marks the calling thread as having left run()
+void KiteAuditLeave(void);
+
+// the number of violations recorded so far
+int KiteAuditViolationCount(void);
+
+// prints every recorded violation with its backtrace
+void KiteAuditReport(FILE * stream);
+
+// forgets all recorded violations
+void KiteAuditReset(void);
+
+#endif
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,177 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * Finding the samples in a WAV file.  See kite_wav.h.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <string.h>
+#include "kite_wav.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// WAV format tags (from the fmt chunk)
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+
+//---------------
+//-- FUNCTIONS --
+//---------------
+
+
+/*
+ * Reads a little-endian 16 or 32-bit number out of a byte buffer.
+ */
+unsigned long KiteReadLittleEndian(const unsigned char * bytes, int byte_count)
+{
+    unsigned long value = 0;
+    int i = 0;
+    for (i = byte_count - 1; i >= 0; --i)
+        value = (value << 8) | bytes[i];
+    return value;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Walks the chunks of a RIFF/WAVE file looking for the "fmt " and "data"
+ * chunks, and fills in the layout from them.  Returns KITE_ERROR if the file
+ * isn't a WAV file, or has samples the engine doesn't know.
+ */
+int KiteReadWavLayout(const unsigned char * file, unsigned long size,
+                      KiteSoundLayout * layout)
+{
+    if (!KiteIsWavFile(file, size))
+        return KITE_ERROR;
+
+    short found_format = OFF;
+    unsigned long position = 12;
+
+    while (position + 8 <= size)
+    {
+        const unsigned char * chunk = file + position;
+        unsigned long chunk_size = KiteReadLittleEndian(chunk + 4, 4);
+        unsigned long body = position + 8;
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 &&
+            body + 16 <= size)
+        {
+            unsigned long tag = KiteReadLittleEndian(file + body, 2);
+            unsigned long bits = KiteReadLittleEndian(file + body + 14, 2);
+
+            // the real tag of an extensible WAV is the start of its GUID
+            if (tag == WAV_FORMAT_EXTENSIBLE && chunk_size >= 26 &&
+                body + 26 <= size)
+                tag = KiteReadLittleEndian(file + body + 24, 2);
+
+            if (tag == WAV_FORMAT_PCM && bits == 16)
+                layout->format = KITE_FORMAT_INT16;
+            else if (tag == WAV_FORMAT_PCM && bits == 24)
+                layout->format = KITE_FORMAT_INT24;
+            else if (tag == WAV_FORMAT_FLOAT && bits == 32)
+                layout->format = KITE_FORMAT_FLOAT32;
+            else if (tag == WAV_FORMAT_FLOAT && bits == 16)
+                layout->format = KITE_FORMAT_FLOAT16;
+            else
+                return KITE_ERROR;
+
+            layout->channels = KiteReadLittleEndian(file + body + 2, 2);
+            layout->sample_rate = KiteReadLittleEndian(file + body + 4, 4);
+            found_format = ON;
+        }
+        else if (memcmp(chunk, "data", 4) == 0 && found_format)
+        {
+            layout->data_offset = body;
+            // a truncated file only has the samples it has
+            layout->data_size = body + chunk_size <= size ? chunk_size :
+                    size - body;
+            return KITE_OK;
+        }
+
+        // chunks are padded to an even number of bytes
+        position = body + chunk_size + (chunk_size & 1);
+    }
+
+    return KITE_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Returns ON if the file has the RIFF/WAVE magic at the start.  A file that
+ * does is a WAV file even if KiteReadWavLayout() can't read it (8-bit or
+ * 32-bit integer samples, or a header cut short), and must not be taken for
+ * raw samples, or its header would be cut up into the sound.
+ */
+short KiteIsWavFile(const unsigned char * file, unsigned long size)
+{
+    if (size < 12 || memcmp(file, "RIFF", 4) != 0 ||
+        memcmp(file + 8, "WAVE", 4) != 0)
+        return OFF;
+    return ON;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Works out the layout of a sound file the way every Kite tool does: a WAV
+ * file's header says where its samples are and what they look like, and
+ * anything else is all samples, looking like 'raw' says (its data_offset and
+ * data_size are ignored).  Returns KITE_ERROR for a WAV file whose samples
+ * the engine doesn't know, rather than shuffling its header as if it were
+ * raw samples.
+ */
+int KiteReadSoundLayout(const unsigned char * file, unsigned long size,
+                        const KiteSoundLayout * raw,
+                        KiteSoundLayout * layout)
+{
+    if (KiteReadWavLayout(file, size, layout) == KITE_OK)
+        return KITE_OK;
+    if (KiteIsWavFile(file, size))
+        return KITE_ERROR;
+
+    *layout = *raw;
+    layout->data_offset = 0;
+    layout->data_size = size;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Turns the name of a raw sample format (f32, s16, s24 or f16, as given to
+ * kite_offline's -f and kite_daemon's format=) into a KiteSampleFormat.
+ */
+int KiteParseFormat(const char * name, KiteSampleFormat * format)
+{
+    if (strcmp(name, "f32") == 0)
+        *format = KITE_FORMAT_FLOAT32;
+    else if (strcmp(name, "s16") == 0)
+        *format = KITE_FORMAT_INT16;
+    else if (strcmp(name, "s24") == 0)
+        *format = KITE_FORMAT_INT24;
+    else if (strcmp(name, "f16") == 0)
+        *format = KITE_FORMAT_FLOAT16;
+    else
+        return KITE_ERROR;
+
+    return KITE_OK;
+}
+
+// ------------------------------- EOF ----------------------------------------
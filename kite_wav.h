@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * WAV files
+ *
+ * Kite never converts samples, so all it needs to know about a WAV file is
+ * where the samples are and what format they are in.  This walks the file's
+ * chunks to find out.  It is shared by kite_offline, kite_daemon and the
+ * sample bank (see kite_bank.h), along with the names the tools give raw
+ * sample formats.
+ */
+
+#ifndef KITE_WAV_H
+#define KITE_WAV_H
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include "kite_engine.h"
+
+
+//-----------
+//-- TYPES --
+//-----------
+
+/*
+ * Where the samples are in a sound file, and what they look like.
+ */
+typedef struct
+{
+    KiteSampleFormat format;
+    unsigned long channels;
+    unsigned long sample_rate;
+    // byte offset and byte length of the sample data in the file
+    unsigned long data_offset;
+    unsigned long data_size;
+} KiteSoundLayout;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// reads a little-endian number out of a byte buffer
+unsigned long KiteReadLittleEndian(const unsigned char * bytes,
+                                   int byte_count);
+
+// fills in the layout if the file is a WAV file the engine can shuffle
+int KiteReadWavLayout(const unsigned char * file, unsigned long size,
+                      KiteSoundLayout * layout);
+
+// returns ON if the file starts like a WAV file (whether or not the engine
+// can shuffle its samples)
+short KiteIsWavFile(const unsigned char * file, unsigned long size);
+
+// fills in the layout from the WAV header, or from 'raw' if the file isn't
+// a WAV file at all (fails on WAV files the engine can't shuffle)
+int KiteReadSoundLayout(const unsigned char * file, unsigned long size,
+                        const KiteSoundLayout * raw,
+                        KiteSoundLayout * layout);
+
+// turns a raw format name (f32, s16, s24 or f16) into a KiteSampleFormat
+int KiteParseFormat(const char * name, KiteSampleFormat * format);
+
+#endif
+
+// ------------------------------- EOF ----------------------------------------
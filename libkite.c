@@ -0,0 +1,1162 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * libkite: the Kite effect as a plain C library.  See libkite.h.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/time.h>
+#include "libkite.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// default for KiteSettings.max_samples (a big host buffer)
+#define DEFAULT_MAX_SAMPLES 8192
+// the most channels of an interleaved buffer the zero crossing search
+// listens to (the rest still get shuffled, of course)
+#define MAX_SNAP_CHANNELS 8
+// how many times a group member looks again for a plan another member (on
+// another thread) is in the middle of publishing, before giving up and
+// cutting its own
+#define GROUP_SPIN 4096
+
+
+//------------------------
+//-- STRUCT DEFINITIONS --
+//------------------------
+
+struct KiteEngine
+{
+    // the samples per second of the sound
+    unsigned long sample_rate;
+    KiteSettings settings;
+    // the cut rules worked out from the settings
+    KiteCutRules rules;
+    KiteRandom rng;
+    // the current segment table
+    KitePlan plan;
+    // ON if the plan was made by KiteMakePlan() and hasn't been used yet
+    short plan_ready;
+    // the plan before the last KiteReprocessRange()
+    KitePlan previous_plan;
+    // a copy of one input channel, for when the output is the same buffer
+    float * scratch;
+    unsigned long scratch_length;
+    // the plans of KiteProcessVariations(), and room for a list of them and
+    // of one output channel of each
+    KitePlan * variation_plans;
+    KitePlan ** variation_list;
+    void ** variation_outputs;
+    unsigned long variation_capacity;
+    // the group this Kite shares its plans with (0 for none), the sequence
+    // number of the group's plan it last used, and the copy of its own plan
+    // the rest of the group reads when it is the one that made it
+    unsigned long group;
+    uint64_t group_sequence;
+    KitePlan shared_plan;
+};
+
+/*
+ * A group of Kites cutting with the same plan (see KiteSetGroup()).  The
+ * plan is published like a seqlock: 'sequence' is odd while a member is
+ * publishing, and goes up by 2 with every plan, so a member copying the
+ * plan can tell if it changed under it.  It is only touched with atomic
+ * operations, so no member ever waits on a lock.
+ */
+typedef struct
+{
+    uint64_t sequence;
+    // the latest plan (a member's shared_plan), or NULL if there isn't one
+    const KitePlan * plan;
+    // the number of members copying the plan right now
+    unsigned long readers;
+} KiteGroup;
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+// every group in the process (group n is groups[n - 1])
+static KiteGroup groups[KITE_MAX_GROUPS];
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// makes sure the scratch buffer holds at least 'length' samples
+static int GrowScratch(KiteEngine * engine, unsigned long length);
+
+// gets the plan for the next 'total_samples' samples of 'inputs' ready
+// ('stride' is the distance between a channel's samples)
+static int PreparePlan(KiteEngine * engine, const float * const * inputs,
+                       unsigned long channels, unsigned long stride,
+                       unsigned long total_samples);
+
+// the same, for a buffer of interleaved frames
+static int PrepareInterleavedPlan(KiteEngine * engine, const float * input,
+                                  unsigned long channels,
+                                  unsigned long total_frames);
+
+// cuts a new plan for the next 'total_samples' samples, and moves the cuts
+// to zero crossings
+static int MakeSnappedPlan(KiteEngine * engine, const float * const * inputs,
+                           unsigned long channels, unsigned long stride,
+                           unsigned long total_samples);
+
+// PreparePlan() for a Kite in a group: uses the group's plan for this
+// cycle, or makes and publishes it
+static int PrepareGroupPlan(KiteEngine * engine,
+                            const float * const * inputs,
+                            unsigned long channels, unsigned long stride,
+                            unsigned long total_samples);
+
+// copies the group's plan with sequence number 'sequence' into the Kite's
+// plan, if it is for 'total_samples' samples and didn't change meanwhile
+static int CopyGroupPlan(KiteEngine * engine, KiteGroup * group,
+                         uint64_t sequence, unsigned long total_samples);
+
+// takes the Kite out of its group (without waiting for readers)
+static void LeaveGroup(KiteEngine * engine);
+
+// waits until no member of the group is copying a plan
+static void WaitForGroupReaders(unsigned long group);
+
+// makes sure there are plans (and lists) for at least 'count' variations
+static int GrowVariations(KiteEngine * engine, unsigned long count);
+
+// returns the input to read from, copying it aside if it is also the output
+static const float * SafeSource(KiteEngine * engine, const float * input,
+                                const float * output,
+                                unsigned long total_samples);
+
+// whether any of the input buffers is also one of the output buffers
+static short SharesBuffers(const float * const * inputs,
+                           float * const * outputs, unsigned long channels);
+
+
+//---------------
+//-- FUNCTIONS --
+//---------------
+
+
+/*
+ * Makes a new Kite with the default settings, seeded with the current time's
+ * seconds and microseconds.  Returns NULL if memory ran out.
+ */
+KiteEngine * KiteCreate(unsigned long sample_rate)
+{
+    if (sample_rate == 0)
+        return NULL;
+    KiteTuneTiles();
+
+    KiteEngine * engine = (KiteEngine *) calloc(1, sizeof (KiteEngine));
+    if (!engine)
+        return NULL;
+    engine->sample_rate = sample_rate;
+
+    if (KiteInitPlan(&engine->plan, 0) != KITE_OK)
+    {
+        free(engine);
+        return NULL;
+    }
+    if (KiteInitPlan(&engine->previous_plan, 0) != KITE_OK)
+    {
+        KiteFreePlan(&engine->plan);
+        free(engine);
+        return NULL;
+    }
+    if (KiteInitPlan(&engine->shared_plan, 0) != KITE_OK)
+    {
+        KiteFreePlan(&engine->previous_plan);
+        KiteFreePlan(&engine->plan);
+        free(engine);
+        return NULL;
+    }
+
+    KiteSettings settings;
+    KiteDefaultSettings(&settings);
+    if (KiteConfigure(engine, &settings) != KITE_OK)
+    {
+        KiteDestroy(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fills in the default settings.  The default seed comes from the clock, so
+ * every new Kite cuts differently unless it is given a seed.
+ */
+void KiteDefaultSettings(KiteSettings * settings)
+{
+    struct timeval current_time;
+
+    memset(settings, 0, sizeof (KiteSettings));
+
+    gettimeofday(&current_time, NULL);
+    settings->seed = (uint64_t) (current_time.tv_usec * current_time.tv_sec);
+    settings->max_samples = DEFAULT_MAX_SAMPLES;
+    settings->in_place = OFF;
+    settings->snap_window = 0;
+    settings->min_seconds = KITE_DEFAULT_MIN_SECONDS;
+    settings->max_seconds = KITE_DEFAULT_MAX_SECONDS;
+    settings->reverse_chance = KITE_DEFAULT_REVERSE_CHANCE;
+    settings->length_shape = KITE_LENGTHS_EVEN;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Applies new settings.  This re-seeds the generator, and allocates the plan
+ * (and the scratch space, for in-place use) for 'max_samples' samples, so it
+ * must not be called from a real-time thread.  The plan is made big enough
+ * for the shortest sub-blocks KiteSetCutRules() allows, so the cut rules can
+ * be changed later without allocating.
+ */
+int KiteConfigure(KiteEngine * engine, const KiteSettings * settings)
+{
+    KiteCutRules shortest;
+    unsigned long group = 0;
+
+    if (!engine || !settings)
+        return KITE_ERROR;
+
+    engine->settings = *settings;
+    KiteSetSnapWindow(engine, settings->snap_window);
+    KiteSetCutRules(engine, settings->min_seconds, settings->max_seconds,
+                    settings->reverse_chance);
+    KiteSetLengthShape(engine, settings->length_shape);
+    KiteSeedRandom(&engine->rng, settings->seed);
+    engine->plan_ready = OFF;
+
+    KiteMakeCutRules(&shortest, engine->sample_rate,
+                     KITE_SHORTEST_SEGMENT_SECONDS,
+                     KITE_SHORTEST_SEGMENT_SECONDS, 0.0);
+    if (KiteReservePlan(&engine->plan, &shortest,
+                        settings->max_samples) != KITE_OK)
+        return KITE_ERROR;
+
+    /*
+     * the copy the group reads is made as big as the plan.  Nobody in the
+     * group may be reading it while it moves, so the Kite steps out of its
+     * group for a moment.
+     */
+    group = engine->group;
+    LeaveGroup(engine);
+    WaitForGroupReaders(group);
+    if (KiteGrowPlan(&engine->shared_plan,
+                     engine->plan.segment_capacity) != KITE_OK)
+        return KITE_ERROR;
+    KiteSetGroup(engine, group);
+
+    if (settings->in_place)
+        return GrowScratch(engine, settings->max_samples);
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Cuts up the next 'total_samples' samples.  The plan is used by the next
+ * KiteProcess() call of the same length.  This only allocates memory if
+ * 'total_samples' is more than the configured max_samples.
+ */
+int KiteMakePlan(KiteEngine * engine, unsigned long total_samples)
+{
+    if (!engine)
+        return KITE_ERROR;
+
+    engine->plan_ready = OFF;
+    if (KiteGeneratePlan(&engine->plan, &engine->rng, &engine->rules,
+                         total_samples) != KITE_OK)
+        return KITE_ERROR;
+    engine->plan_ready = ON;
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+const KitePlan * KiteGetPlan(const KiteEngine * engine)
+{
+    return engine ? &engine->plan : NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Hands the Kite a plan that was made somewhere else (by another Kite on a
+ * worker thread, or loaded from a saved session).  It is checked first, and
+ * used by the next KiteProcess() call of the same length.  This only
+ * allocates if the plan is bigger than the configured max_samples.
+ */
+int KiteUsePlan(KiteEngine * engine, const KitePlan * plan)
+{
+    if (!engine || !plan || KiteCheckPlan(plan) != KITE_OK)
+        return KITE_ERROR;
+
+    engine->plan_ready = OFF;
+    if (KiteCopyPlan(&engine->plan, plan) != KITE_OK)
+        return KITE_ERROR;
+    engine->plan_ready = ON;
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Sets how far cuts may move to find a zero crossing.  This doesn't allocate
+ * anything, so it can be called from a real-time thread (e.g. when a plugin's
+ * control port changes).
+ */
+void KiteSetSnapWindow(KiteEngine * engine, unsigned long snap_window)
+{
+    if (!engine)
+        return;
+    if (snap_window > KITE_MAX_SNAP_WINDOW)
+        snap_window = KITE_MAX_SNAP_WINDOW;
+    engine->settings.snap_window = snap_window;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Sets the length of the sub-blocks (in seconds) and how likely they are to
+ * be reversed.  The sample counts and whole numbers the planner uses are
+ * worked out here, once, instead of every time a plan is made, and nothing
+ * is allocated, so this can be called from a real-time thread.  A plugin
+ * should still only call it when one of its control ports has changed.
+ */
+void KiteSetCutRules(KiteEngine * engine, double min_seconds,
+                     double max_seconds, double reverse_chance)
+{
+    if (!engine)
+        return;
+    engine->settings.min_seconds = min_seconds;
+    engine->settings.max_seconds = max_seconds;
+    engine->settings.reverse_chance = reverse_chance;
+
+    // the table of lengths isn't part of these rules, so it is kept
+    KiteLengthTable lengths = engine->rules.lengths;
+    KiteMakeCutRules(&engine->rules, engine->sample_rate, min_seconds,
+                     max_seconds, reverse_chance);
+    engine->rules.lengths = lengths;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Changes how likely each sub-block length is to one of the KITE_LENGTHS_...
+ * shapes.  The shape is compiled into an alias table here, once, so the
+ * planner draws each length in the same time whatever the shape; that takes
+ * a few dozen steps and allocates nothing, so it can be done on the audio
+ * thread.
+ */
+void KiteSetLengthShape(KiteEngine * engine, int shape)
+{
+    if (!engine)
+        return;
+    engine->settings.length_shape = shape;
+    KitePresetLengths(&engine->rules.lengths, shape);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Cuts with a table of sub-block lengths of the caller's own (see
+ * KiteMakeLengthTable()), or the even spread if 'table' is NULL.  The table
+ * is copied, and lasts until the next KiteSetLengthShape() or
+ * KiteConfigure().
+ */
+void KiteSetLengths(KiteEngine * engine, const KiteLengthTable * table)
+{
+    if (!engine)
+        return;
+    if (table)
+        engine->rules.lengths = *table;
+    else
+        engine->rules.lengths.count = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Re-seeds the generator, and forgets any plan KiteMakePlan() made with the
+ * old seed, so the next KiteProcess() cuts the way it would right after
+ * KiteConfigure() with this seed.  Nothing is allocated, so a Kite kept
+ * around for reuse (see the instance pool in sb_kite.c) can be made to cut
+ * like a new one without going through KiteConfigure() again.
+ */
+void KiteSetSeed(KiteEngine * engine, uint64_t seed)
+{
+    if (!engine)
+        return;
+    engine->settings.seed = seed;
+    KiteSeedRandom(&engine->rng, seed);
+    engine->plan_ready = OFF;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Puts the Kite in group 'group' (1 to KITE_MAX_GROUPS; 0 takes it out of
+ * any group).  The Kites in a group share one plan per cycle: the first of
+ * them to process a buffer cuts it and publishes it, and the rest copy it
+ * instead of cutting their own, so (given buffers of the same length) they
+ * all cut at the same places, zero crossing moves and all.  This is meant
+ * for stems of one mix that have to stay lined up.  A new cycle starts when
+ * a Kite that has already used the latest plan processes another buffer,
+ * so every member should process one buffer per cycle.  The group is only
+ * used by the KiteProcess...() functions that shuffle an input, and not
+ * while a plan from KiteMakePlan() or KiteUsePlan() is waiting.
+ *
+ * Groups are shared by every Kite in the process.  Nothing is allocated and
+ * no locks are taken, so this can be called from a real-time thread (e.g.
+ * when a plugin's control port changes).
+ */
+void KiteSetGroup(KiteEngine * engine, unsigned long group)
+{
+    if (!engine)
+        return;
+    if (group > KITE_MAX_GROUPS)
+        group = 0;
+    if (group == engine->group)
+        return;
+
+    LeaveGroup(engine);
+    engine->group = group;
+    // an odd number never matches a published plan, so the next buffer
+    // uses the group's latest plan
+    engine->group_sequence = 1;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Here is where the rubber hits the road.  Every channel is cut up with the
+ * same plan, so the channels stay lined up with each other.
+ */
+int KiteProcess(KiteEngine * engine, const float * const * inputs,
+                float * const * outputs, unsigned long channels,
+                unsigned long total_samples)
+{
+    return KiteProcessMetered(engine, inputs, outputs, channels,
+                              total_samples, NULL, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * KiteProcess(), also giving the peak and RMS level of every channel of the
+ * output in peaks[] and rms[] (unless they are NULL).  They are worked out
+ * by the copy itself (see KiteCopyMeteredSamples()), so a meter after Kite
+ * doesn't have to read the output over again.
+ */
+int KiteProcessMetered(KiteEngine * engine, const float * const * inputs,
+                       float * const * outputs, unsigned long channels,
+                       unsigned long total_samples, float * peaks,
+                       float * rms)
+{
+    unsigned long channel = 0;
+    short metered = peaks && rms;
+
+    if (!engine || !inputs || !outputs)
+        return KITE_ERROR;
+    if (total_samples == 0)
+        return KITE_OK;
+    if (PreparePlan(engine, inputs, channels, 1, total_samples) != KITE_OK)
+        return KITE_ERROR;
+
+    // with many channels, cut them all a cache-sized tile at a time, unless
+    // some input is also an output (then each needs its own SafeSource())
+    if (!metered && channels > 1 && !SharesBuffers(inputs, outputs, channels))
+    {
+        KiteExecutePlanTiled(&engine->plan, (void * const *) outputs,
+                             (const void * const *) inputs, channels,
+                             sizeof (float), 0);
+        return KITE_OK;
+    }
+
+    for (channel = 0; channel < channels; ++channel)
+    {
+        const float * source = SafeSource(engine, inputs[channel],
+                                          outputs[channel], total_samples);
+        if (!source)
+            return KITE_ERROR;
+        if (!metered)
+        {
+            KiteExecutePlan(&engine->plan, outputs[channel], source,
+                            sizeof (float));
+            continue;
+        }
+
+        double sum = 0.0;
+        peaks[channel] = 0.0f;
+        KiteExecutePlanMetered(&engine->plan, outputs[channel], source, 1,
+                               &peaks[channel], &sum);
+        rms[channel] = (float) sqrt(sum / total_samples);
+    }
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The same as KiteProcess(), but the shuffled samples (times 'gain') are
+ * added to what's already in the outputs.
+ */
+int KiteProcessAdding(KiteEngine * engine, const float * const * inputs,
+                      float * const * outputs, unsigned long channels,
+                      unsigned long total_samples, float gain)
+{
+    unsigned long channel = 0;
+
+    if (!engine || !inputs || !outputs)
+        return KITE_ERROR;
+    if (total_samples == 0)
+        return KITE_OK;
+    if (PreparePlan(engine, inputs, channels, 1, total_samples) != KITE_OK)
+        return KITE_ERROR;
+
+    for (channel = 0; channel < channels; ++channel)
+    {
+        const float * source = SafeSource(engine, inputs[channel],
+                                          outputs[channel], total_samples);
+        if (!source)
+            return KITE_ERROR;
+        KiteExecutePlanAdding(&engine->plan, outputs[channel], source, 1,
+                              gain);
+    }
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The same as KiteProcess(), but for one buffer of interleaved frames (the
+ * first sample of every channel, then the second of every channel, and so
+ * on) instead of a buffer per channel.  Kite cuts between frames anyway, so
+ * whole frames are moved at once (see KiteCopySamples()), which costs the
+ * same as the planar way and saves splitting the channels up and putting
+ * them back together.
+ */
+int KiteProcessInterleaved(KiteEngine * engine, const float * input,
+                           float * output, unsigned long channels,
+                           unsigned long total_frames)
+{
+    return KiteProcessInterleavedMetered(engine, input, output, channels,
+                                         total_frames, NULL, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * KiteProcessInterleaved(), also giving the peak and RMS level of every
+ * channel (see KiteProcessMetered()).  Metering works for up to
+ * KITE_MAX_METER_CHANNELS channels.
+ */
+int KiteProcessInterleavedMetered(KiteEngine * engine, const float * input,
+                                  float * output, unsigned long channels,
+                                  unsigned long total_frames, float * peaks,
+                                  float * rms)
+{
+    const float * source = NULL;
+    double sums[KITE_MAX_METER_CHANNELS];
+    unsigned long channel = 0;
+    short metered = peaks && rms;
+
+    if (!engine || !input || !output || channels == 0)
+        return KITE_ERROR;
+    if (metered && channels > KITE_MAX_METER_CHANNELS)
+        return KITE_ERROR;
+    if (total_frames == 0)
+        return KITE_OK;
+    if (PrepareInterleavedPlan(engine, input, channels, total_frames) !=
+        KITE_OK)
+        return KITE_ERROR;
+
+    source = SafeSource(engine, input, output, total_frames * channels);
+    if (!source)
+        return KITE_ERROR;
+    if (!metered)
+    {
+        KiteExecutePlan(&engine->plan, output, source,
+                        channels * sizeof (float));
+        return KITE_OK;
+    }
+
+    for (channel = 0; channel < channels; ++channel)
+    {
+        peaks[channel] = 0.0f;
+        sums[channel] = 0.0;
+    }
+    KiteExecutePlanMetered(&engine->plan, output, source, channels, peaks,
+                           sums);
+    for (channel = 0; channel < channels; ++channel)
+        rms[channel] = (float) sqrt(sums[channel] / total_frames);
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The same as KiteProcessInterleaved(), but the shuffled frames (times
+ * 'gain') are added to what's already in the output.
+ */
+int KiteProcessInterleavedAdding(KiteEngine * engine, const float * input,
+                                 float * output, unsigned long channels,
+                                 unsigned long total_frames, float gain)
+{
+    const float * source = NULL;
+
+    if (!engine || !input || !output || channels == 0)
+        return KITE_ERROR;
+    if (total_frames == 0)
+        return KITE_OK;
+    if (PrepareInterleavedPlan(engine, input, channels, total_frames) !=
+        KITE_OK)
+        return KITE_ERROR;
+
+    source = SafeSource(engine, input, output, total_frames * channels);
+    if (!source)
+        return KITE_ERROR;
+    KiteExecutePlanAdding(&engine->plan, output, source, channels, gain);
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The tape library mode: instead of shuffling an input, the output is made
+ * of pieces cut from anywhere in a sample bank (see kite_bank.h), copied
+ * straight out of the mapped files.  It uses the Kite's own generator and
+ * plan, so it is real-time safe the same way KiteProcess() is.
+ */
+int KiteProcessBank(KiteEngine * engine, const KiteBank * bank,
+                    float * const * outputs, unsigned long channels,
+                    unsigned long total_samples)
+{
+    if (!engine || !bank || !outputs)
+        return KITE_ERROR;
+    if (total_samples == 0)
+        return KITE_OK;
+
+    engine->plan_ready = OFF;
+    if (KiteGenerateBankPlan(&engine->plan, &engine->rng, &engine->rules,
+                             bank, total_samples) != KITE_OK)
+        return KITE_ERROR;
+    KiteExecuteBankPlan(&engine->plan, bank, outputs, channels);
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fan-out: makes a whole set of variations of one input in a single pass,
+ * instead of calling KiteProcess() once per variation and reading (and
+ * copying) the same input every time.  Variation v is cut with its own
+ * generator seeded with seeds[v], so it comes out exactly the same as
+ * KiteProcess() would make it right after KiteConfigure() with that seed
+ * (the Kite's own generator and plan are left alone).  The snap window
+ * applies as usual.
+ *
+ * All the plans are made first, then each channel of the input is copied
+ * out to every variation one cache-sized tile at a time by
+ * KiteExecutePlans(), so the input is read from memory about once instead
+ * of once per variation.  This allocates the plans the first time (or when
+ * there are more variations or samples than before), so it is meant for
+ * offline work, not a real-time thread.  The outputs must not be the
+ * inputs.
+ */
+int KiteProcessVariations(KiteEngine * engine, const uint64_t * seeds,
+                          unsigned long variation_count,
+                          const float * const * inputs,
+                          float * const * const * outputs,
+                          unsigned long channels,
+                          unsigned long total_samples)
+{
+    KiteRandom rng;
+    unsigned long variation = 0;
+    unsigned long channel = 0;
+
+    if (!engine || !seeds || !inputs || !outputs)
+        return KITE_ERROR;
+    if (total_samples == 0 || variation_count == 0)
+        return KITE_OK;
+    if (GrowVariations(engine, variation_count) != KITE_OK)
+        return KITE_ERROR;
+
+    for (variation = 0; variation < variation_count; ++variation)
+    {
+        KitePlan * plan = &engine->variation_plans[variation];
+
+        for (channel = 0; channel < channels; ++channel)
+        {
+            if (outputs[variation][channel] == inputs[channel])
+                return KITE_ERROR;
+        }
+
+        KiteSeedRandom(&rng, seeds[variation]);
+        if (KiteGeneratePlan(plan, &rng, &engine->rules,
+                             total_samples) != KITE_OK)
+            return KITE_ERROR;
+        if (KiteSnapPlan(plan, inputs, channels, 1,
+                         engine->settings.snap_window) != KITE_OK)
+            return KITE_ERROR;
+        engine->variation_list[variation] = plan;
+    }
+
+    for (channel = 0; channel < channels; ++channel)
+    {
+        for (variation = 0; variation < variation_count; ++variation)
+            engine->variation_outputs[variation] = outputs[variation][channel];
+        if (KiteExecutePlans(engine->variation_list, variation_count,
+                             engine->variation_outputs, inputs[channel],
+                             sizeof (float), 0) != KITE_OK)
+            return KITE_ERROR;
+    }
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * For editing long shuffles: after the Kite has made 'outputs' from
+ * 'inputs' with KiteProcess(), this cuts just output samples 'range_start'
+ * to 'range_end' (not included) again, with a generator seeded with
+ * 'seed', and keeps the rest of the cuts (see KiteRegeneratePlan()).  The
+ * old and new segment tables are then compared, and only the output
+ * samples that now come from somewhere else are copied, so the work done
+ * grows with the size of the edit, not of the whole output.  The inputs
+ * and outputs must be the same (separate) buffers KiteProcess() was given.
+ *
+ * The new cuts are not moved to zero crossings (moving them would change
+ * the lengths of the pieces next to the range, and shift everything after
+ * it).  The segment tables are copied, which can allocate if the plan has
+ * grown past what was reserved.
+ */
+int KiteReprocessRange(KiteEngine * engine, uint64_t seed,
+                       unsigned long range_start, unsigned long range_end,
+                       const float * const * inputs, float * const * outputs,
+                       unsigned long channels)
+{
+    KiteRandom rng;
+    unsigned long channel = 0;
+
+    if (!engine || !inputs || !outputs)
+        return KITE_ERROR;
+    for (channel = 0; channel < channels; ++channel)
+    {
+        if (inputs[channel] == outputs[channel])
+            return KITE_ERROR;
+    }
+
+    engine->plan_ready = OFF;
+    if (KiteCopyPlan(&engine->previous_plan, &engine->plan) != KITE_OK)
+        return KITE_ERROR;
+    KiteSeedRandom(&rng, seed);
+    if (KiteRegeneratePlan(&engine->plan, &rng, &engine->rules,
+                           range_start, range_end) != KITE_OK)
+        return KITE_ERROR;
+
+    for (channel = 0; channel < channels; ++channel)
+        KiteExecutePlanChanges(&engine->previous_plan, &engine->plan,
+                               outputs[channel], inputs[channel],
+                               sizeof (float));
+
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Frees a Kite and everything it holds.
+ */
+void KiteDestroy(KiteEngine * engine)
+{
+    unsigned long variation = 0;
+
+    if (!engine)
+        return;
+
+    // nobody in the group may still be reading this Kite's plan
+    unsigned long group = engine->group;
+    LeaveGroup(engine);
+    WaitForGroupReaders(group);
+
+    for (variation = 0; variation < engine->variation_capacity; ++variation)
+        KiteFreePlan(&engine->variation_plans[variation]);
+    free(engine->variation_plans);
+    free(engine->variation_list);
+    free(engine->variation_outputs);
+    KiteFreePlan(&engine->shared_plan);
+    KiteFreePlan(&engine->previous_plan);
+    KiteFreePlan(&engine->plan);
+    free(engine->scratch);
+    free(engine);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Uses the plan from KiteMakePlan() if there is one for this many samples,
+ * and makes a new one otherwise.  Either way the plan is used up.  This is
+ * also where the cuts are moved to zero crossings, since it's the first time
+ * the plan meets the audio.
+ */
+static int PreparePlan(KiteEngine * engine, const float * const * inputs,
+                       unsigned long channels, unsigned long stride,
+                       unsigned long total_samples)
+{
+    if (!engine->plan_ready || engine->plan.total_samples != total_samples)
+    {
+        engine->plan_ready = OFF;
+        if (engine->group)
+            return PrepareGroupPlan(engine, inputs, channels, stride,
+                                    total_samples);
+        return MakeSnappedPlan(engine, inputs, channels, stride,
+                               total_samples);
+    }
+    engine->plan_ready = OFF;
+
+    return KiteSnapPlan(&engine->plan, inputs, channels, stride,
+                        engine->settings.snap_window);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Cuts a plan for the buffer and moves its cuts to zero crossings.
+ */
+static int MakeSnappedPlan(KiteEngine * engine, const float * const * inputs,
+                           unsigned long channels, unsigned long stride,
+                           unsigned long total_samples)
+{
+    if (KiteMakePlan(engine, total_samples) != KITE_OK)
+        return KITE_ERROR;
+    engine->plan_ready = OFF;
+
+    return KiteSnapPlan(&engine->plan, inputs, channels, stride,
+                        engine->settings.snap_window);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Gets the plan of a Kite in a group ready.  If the group has published a
+ * plan this Kite hasn't used yet, it is copied (already snapped to the zero
+ * crossings of whoever made it).  Otherwise this Kite is the first of the
+ * group this cycle: it claims the group by making the sequence number odd,
+ * cuts the plan, copies it to its shared_plan, and publishes that.  If
+ * another member is publishing right then (on another thread), this waits
+ * for it for a little while, and if it takes too long (or the plan is for a
+ * different number of samples), the Kite just cuts its own.
+ */
+static int PrepareGroupPlan(KiteEngine * engine,
+                            const float * const * inputs,
+                            unsigned long channels, unsigned long stride,
+                            unsigned long total_samples)
+{
+    KiteGroup * group = &groups[engine->group - 1];
+    unsigned long spins = 0;
+    int result = KITE_OK;
+
+    for (spins = 0; spins < GROUP_SPIN; ++spins)
+    {
+        uint64_t sequence = __atomic_load_n(&group->sequence,
+                                            __ATOMIC_ACQUIRE);
+        // someone is publishing: look again
+        if (sequence & 1)
+            continue;
+
+        if (sequence != engine->group_sequence &&
+            CopyGroupPlan(engine, group, sequence, total_samples) == KITE_OK)
+        {
+            engine->group_sequence = sequence;
+            return KITE_OK;
+        }
+
+        // a new cycle: claim the group (unless another member just did)
+        if (!__atomic_compare_exchange_n(&group->sequence, &sequence,
+                                         sequence + 1, 0, __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED))
+            continue;
+
+        result = MakeSnappedPlan(engine, inputs, channels, stride,
+                                 total_samples);
+        // (the copy must not move while the group might be reading it)
+        if (result == KITE_OK && engine->plan.segment_count <=
+            engine->shared_plan.segment_capacity &&
+            KiteCopyPlan(&engine->shared_plan, &engine->plan) == KITE_OK)
+            __atomic_store_n(&group->plan, &engine->shared_plan,
+                             __ATOMIC_SEQ_CST);
+        else
+            __atomic_store_n(&group->plan, NULL, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&group->sequence, 1, __ATOMIC_RELEASE);
+        engine->group_sequence = sequence + 2;
+        return result;
+    }
+
+    return MakeSnappedPlan(engine, inputs, channels, stride, total_samples);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Copies the group's plan into the Kite's own.  The copy is checked against
+ * the sequence number afterwards, since the member that made the plan may
+ * have started on the next one meanwhile.  Nothing is allocated: a plan
+ * bigger than the Kite's is turned down.
+ */
+static int CopyGroupPlan(KiteEngine * engine, KiteGroup * group,
+                         uint64_t sequence, unsigned long total_samples)
+{
+    int result = KITE_ERROR;
+    unsigned long count = 0;
+
+    __atomic_fetch_add(&group->readers, 1, __ATOMIC_SEQ_CST);
+    const KitePlan * plan = __atomic_load_n(&group->plan, __ATOMIC_SEQ_CST);
+    if (plan && plan->total_samples == total_samples)
+    {
+        count = plan->segment_count;
+        if (count <= engine->plan.segment_capacity)
+        {
+            memcpy(engine->plan.segments, plan->segments,
+                   count * sizeof (KiteSegment));
+            result = KITE_OK;
+        }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&group->sequence, __ATOMIC_RELAXED) != sequence)
+        result = KITE_ERROR;
+    __atomic_fetch_sub(&group->readers, 1, __ATOMIC_SEQ_CST);
+
+    if (result == KITE_OK)
+    {
+        engine->plan.segment_count = count;
+        engine->plan.total_samples = total_samples;
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Takes a Kite out of its group.  If the group's plan is this Kite's, it is
+ * taken down, and the sequence number goes up so anyone in the middle of
+ * copying it knows to throw the copy away.  (It goes up by 2, so a member
+ * publishing at the same time still finishes on an even number.)
+ */
+static void LeaveGroup(KiteEngine * engine)
+{
+    if (!engine->group)
+        return;
+
+    KiteGroup * group = &groups[engine->group - 1];
+    const KitePlan * mine = &engine->shared_plan;
+    if (__atomic_compare_exchange_n(&group->plan, &mine, NULL, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        __atomic_fetch_add(&group->sequence, 2, __ATOMIC_SEQ_CST);
+    engine->group = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Waits for every member of a group to finish copying its plan (they only
+ * ever take as long as a memcpy()).  Only KiteDestroy() and KiteConfigure()
+ * wait like this, since they are about to free or move a plan the group
+ * might have been reading.
+ */
+static void WaitForGroupReaders(unsigned long group)
+{
+    if (group == 0 || group > KITE_MAX_GROUPS)
+        return;
+    while (__atomic_load_n(&groups[group - 1].readers, __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * PreparePlan() for an interleaved buffer: channel c's samples start at
+ * input[c], and are 'channels' floats apart.
+ */
+static int PrepareInterleavedPlan(KiteEngine * engine, const float * input,
+                                  unsigned long channels,
+                                  unsigned long total_frames)
+{
+    const float * starts[MAX_SNAP_CHANNELS];
+    unsigned long listened = channels < MAX_SNAP_CHANNELS ? channels :
+            MAX_SNAP_CHANNELS;
+    unsigned long channel = 0;
+
+    for (channel = 0; channel < listened; ++channel)
+        starts[channel] = input + channel;
+
+    return PreparePlan(engine, starts, listened, channels, total_frames);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The plan moves samples from one buffer into another, so if a host hands
+ * us the same buffer for input and output (in-place processing), the input
+ * is copied to the scratch buffer first and read from there.
+ */
+static const float * SafeSource(KiteEngine * engine, const float * input,
+                                const float * output,
+                                unsigned long total_samples)
+{
+    if (input != output)
+        return input;
+
+    if (GrowScratch(engine, total_samples) != KITE_OK)
+        return NULL;
+    memcpy(engine->scratch, input, total_samples * sizeof (float));
+
+    return engine->scratch;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Checks every input against every output, since KiteExecutePlanTiled()
+ * writes a tile of every channel before reading the next tile of any.
+ */
+static short SharesBuffers(const float * const * inputs,
+                           float * const * outputs, unsigned long channels)
+{
+    unsigned long input = 0;
+    unsigned long output = 0;
+
+    for (input = 0; input < channels; ++input)
+        for (output = 0; output < channels; ++output)
+            if (inputs[input] == outputs[output])
+                return ON;
+
+    return OFF;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Makes sure the scratch buffer holds at least 'length' samples.
+ */
+static int GrowScratch(KiteEngine * engine, unsigned long length)
+{
+    if (length <= engine->scratch_length)
+        return KITE_OK;
+
+    float * scratch = (float *) realloc(engine->scratch,
+                                        length * sizeof (float));
+    if (!scratch)
+        return KITE_ERROR;
+
+    engine->scratch = scratch;
+    engine->scratch_length = length;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Makes sure there are at least 'count' variation plans, and room to list
+ * them and one output channel of each.  New plans start out empty; they
+ * grow when they are first generated.
+ */
+static int GrowVariations(KiteEngine * engine, unsigned long count)
+{
+    unsigned long variation = 0;
+
+    if (count <= engine->variation_capacity)
+        return KITE_OK;
+
+    KitePlan * plans = (KitePlan *)
+            realloc(engine->variation_plans, count * sizeof (KitePlan));
+    if (!plans)
+        return KITE_ERROR;
+    engine->variation_plans = plans;
+
+    KitePlan ** list = (KitePlan **)
+            realloc(engine->variation_list, count * sizeof (KitePlan *));
+    if (!list)
+        return KITE_ERROR;
+    engine->variation_list = list;
+
+    void ** outputs = (void **)
+            realloc(engine->variation_outputs, count * sizeof (void *));
+    if (!outputs)
+        return KITE_ERROR;
+    engine->variation_outputs = outputs;
+
+    for (variation = engine->variation_capacity; variation < count;
+         ++variation)
+    {
+        if (KiteInitPlan(&plans[variation], 0) != KITE_OK)
+            return KITE_ERROR;
+        engine->variation_capacity = variation + 1;
+    }
+
+    return KITE_OK;
+}
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,200 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * libkite
+ *
+ * The Kite effect as a plain C library, with no LADSPA (or any other plugin
+ * API) in the way.  sb_kite.so is a thin LADSPA wrapper around it, and
+ * programs that just want to shuffle audio can link against libkite.a or
+ * libkite.so directly:
+ *
+ *     KiteEngine * engine = KiteCreate(44100);
+ *     KiteProcess(engine, inputs, outputs, 2, sample_count);
+ *     KiteDestroy(engine);
+ *
+ * The lower level pieces (segment tables, the sample moving kernels, the
+ * render cache and sample banks) are in kite_engine.h, kite_cache.h and
+ * kite_bank.h, which are part of the library too.
+ */
+
+#ifndef LIBKITE_H
+#define LIBKITE_H
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdint.h>
+#include "kite_engine.h"
+#include "kite_bank.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// the most channels KiteProcessInterleavedMetered() can meter
+#define KITE_MAX_METER_CHANNELS 8
+
+// the number of groups Kites can share their plans in (see KiteSetGroup())
+#define KITE_MAX_GROUPS 16
+
+
+//-----------
+//-- TYPES --
+//-----------
+
+/*
+ * A Kite.  What's inside is private to libkite.c.
+ */
+typedef struct KiteEngine KiteEngine;
+
+/*
+ * The things about a Kite that can be changed with KiteConfigure().  Always
+ * start from KiteDefaultSettings(), so fields added later get sane values.
+ */
+typedef struct
+{
+    // seed for the random cuts (the same seed always gives the same cuts)
+    uint64_t seed;
+    // the most samples KiteProcess() is expected to be called with.  Plans
+    // for up to this many samples are allocated up front, so KiteMakePlan()
+    // and KiteProcess() never allocate for them
+    unsigned long max_samples;
+    // ON if the inputs and outputs may be the same buffers.  In-place
+    // processing always works, but it needs a copy of the input, and this
+    // gets that space allocated up front too (for max_samples samples, so
+    // in-place interleaved buffers need max_samples set to frames x
+    // channels)
+    short in_place;
+    // how far (in samples, either way) each cut may move to land on a zero
+    // crossing, up to KITE_MAX_SNAP_WINDOW.  0 (the default) leaves the cuts
+    // where they fall.  See KiteSnapPlan() in kite_engine.h
+    unsigned long snap_window;
+    // the shortest and longest sub-blocks (in seconds), and the chance (0 to
+    // 1) of a sub-block being reversed.  See KiteMakeCutRules()
+    double min_seconds;
+    double max_seconds;
+    double reverse_chance;
+    // how likely each sub-block length between those two is, as one of the
+    // KITE_LENGTHS_... shapes (KITE_LENGTHS_EVEN, the default, is how Kite
+    // has always cut).  See KitePresetLengths()
+    int length_shape;
+} KiteSettings;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// makes a new Kite for the given sample rate, seeded from the clock
+KiteEngine * KiteCreate(unsigned long sample_rate);
+
+// fills in the default settings
+void KiteDefaultSettings(KiteSettings * settings);
+
+// applies new settings (allocates memory; not real-time safe)
+int KiteConfigure(KiteEngine * engine, const KiteSettings * settings);
+
+// cuts up the next 'total_samples' samples, without touching any audio
+int KiteMakePlan(KiteEngine * engine, unsigned long total_samples);
+
+// the plan made by the last KiteMakePlan() (or KiteProcess())
+const KitePlan * KiteGetPlan(const KiteEngine * engine);
+
+// uses a plan made elsewhere for the next KiteProcess() of its length
+int KiteUsePlan(KiteEngine * engine, const KitePlan * plan);
+
+// changes just the snap window (real-time safe, unlike KiteConfigure())
+void KiteSetSnapWindow(KiteEngine * engine, unsigned long snap_window);
+
+// changes just the cut rules (real-time safe, unlike KiteConfigure())
+void KiteSetCutRules(KiteEngine * engine, double min_seconds,
+                     double max_seconds, double reverse_chance);
+
+// changes just the shape of the sub-block lengths (real-time safe)
+void KiteSetLengthShape(KiteEngine * engine, int shape);
+
+// cuts with a table of sub-block lengths made by KiteMakeLengthTable(), or
+// NULL for the even spread (real-time safe)
+void KiteSetLengths(KiteEngine * engine, const KiteLengthTable * table);
+
+// re-seeds the Kite, as if KiteConfigure() had been given 'seed' (real-time
+// safe, unlike KiteConfigure())
+void KiteSetSeed(KiteEngine * engine, uint64_t seed);
+
+// puts the Kite in a group (1 to KITE_MAX_GROUPS, or 0 for none) whose
+// members all cut with the same plan (real-time safe)
+void KiteSetGroup(KiteEngine * engine, unsigned long group);
+
+// shuffles 'channels' planar buffers of 'total_samples' samples into the
+// outputs (which may be the same buffers as the inputs)
+int KiteProcess(KiteEngine * engine, const float * const * inputs,
+                float * const * outputs, unsigned long channels,
+                unsigned long total_samples);
+
+// the same, also putting each channel's peak and RMS level in peaks[] and
+// rms[] (metered during the copy, so the output isn't read again)
+int KiteProcessMetered(KiteEngine * engine, const float * const * inputs,
+                       float * const * outputs, unsigned long channels,
+                       unsigned long total_samples, float * peaks,
+                       float * rms);
+
+// the same as KiteProcess(), but adds the shuffled samples times 'gain' to
+// the outputs
+int KiteProcessAdding(KiteEngine * engine, const float * const * inputs,
+                      float * const * outputs, unsigned long channels,
+                      unsigned long total_samples, float gain);
+
+// shuffles one buffer of 'total_frames' interleaved frames of 'channels'
+// samples each into the output (which may be the same buffer)
+int KiteProcessInterleaved(KiteEngine * engine, const float * input,
+                           float * output, unsigned long channels,
+                           unsigned long total_frames);
+
+// the same, also putting each channel's peak and RMS level in peaks[] and
+// rms[] (for up to KITE_MAX_METER_CHANNELS channels)
+int KiteProcessInterleavedMetered(KiteEngine * engine, const float * input,
+                                  float * output, unsigned long channels,
+                                  unsigned long total_frames, float * peaks,
+                                  float * rms);
+
+// the same as KiteProcessInterleaved(), but adds the shuffled frames times
+// 'gain' to the output
+int KiteProcessInterleavedAdding(KiteEngine * engine, const float * input,
+                                 float * output, unsigned long channels,
+                                 unsigned long total_frames, float gain);
+
+// fills 'channels' planar outputs with 'total_samples' samples of pieces
+// cut from a sample bank, instead of from an input
+int KiteProcessBank(KiteEngine * engine, const KiteBank * bank,
+                    float * const * outputs, unsigned long channels,
+                    unsigned long total_samples);
+
+// makes 'variation_count' different shuffles of the same planar input at
+// once, one per seed, reading the input only once.  outputs[v][c] is
+// channel c of variation v
+int KiteProcessVariations(KiteEngine * engine, const uint64_t * seeds,
+                          unsigned long variation_count,
+                          const float * const * inputs,
+                          float * const * const * outputs,
+                          unsigned long channels,
+                          unsigned long total_samples);
+
+// cuts output samples 'range_start' to 'range_end' of the last
+// KiteProcess() again with a new seed, leaving the rest of the cuts alone,
+// and copies just the samples that changed into the (old) outputs
+int KiteReprocessRange(KiteEngine * engine, uint64_t seed,
+                       unsigned long range_start, unsigned long range_end,
+                       const float * const * inputs, float * const * outputs,
+                       unsigned long channels);
+
+// frees a Kite
+void KiteDestroy(KiteEngine * engine);
+
+#endif
+
+// ------------------------------- EOF ----------------------------------------
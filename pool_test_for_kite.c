@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ *
+ * Instance Pool Test Driver
+ *
+ * This builds the LADSPA plugin (sb_kite.c) right into the driver, so it can
+ * look at the instance pool from the inside.  Loading the plugin mustn't
+ * fill the pool; the first instance made must.  Then several threads make and
+ * clean up instances of the same descriptor as fast as they can, running
+ * each one once with its cut rule and group ports set, and checking that no
+ * pooled instance is handed to two of them at once.  Afterwards every slot
+ * must be back on the pool's free list.
+ *
+ * Last, an instance is cleaned up and made again (getting the same slot),
+ * and must come back like new: its cached port values unread, no group,
+ * and the next seed of the pool, so it cuts exactly like a fresh Kite with
+ * that seed.
+ */
+
+// the plugin's _init() and _fini() would clash with the program's own
+#define _init sb_kite_init
+#define _fini sb_kite_fini
+#include "sb_kite.c"
+#include <pthread.h>
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// the pool is smaller than the number of threads, so some instances are
+// made outside of it
+#define TEST_POOL_SIZE "4"
+// the sample rate every instance is made for (and so, being the first
+// instance's, the one the pool is made for)
+#define TEST_SAMPLE_RATE 48000
+#define THREAD_COUNT 8
+#define ROUNDS_PER_THREAD 2000
+// the buffer every instance is run with, and the one the reused instance
+// is checked with (long enough for dozens of pieces)
+#define TEST_FRAMES 256
+#define REUSE_FRAMES 4096
+// the group the old instance was in, and the one the reused one must not be
+#define TEST_GROUP 5
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+// ON for every pool slot a thread is using right now
+static short * slots_in_use = NULL;
+// the number of times a slot was handed out while it was in use
+static unsigned long handed_out_twice = 0;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// makes, runs and cleans up instances ROUNDS_PER_THREAD times
+void * StressPool(void * argument);
+
+// counts the slots on the pool's free list
+unsigned long CountFreeSlots(void);
+
+// checks that a reused instance comes back like new
+int CheckReusedInstance(void);
+
+
+//----------
+//-- MAIN --
+//----------
+int main(int argc, char * argv[])
+{
+    pthread_t threads[THREAD_COUNT];
+    unsigned long numbers[THREAD_COUNT];
+    unsigned long i = 0;
+    int failures = 0;
+
+    setenv(POOL_SIZE_VARIABLE, TEST_POOL_SIZE, 1);
+    unsetenv(POOL_SAMPLE_RATE_VARIABLE);
+    sb_kite_init();
+    if (!Kite_descriptor)
+    {
+        printf("\nCould not set up the plugin\n");
+        exit(-1);
+    }
+
+    printf("\nInstance pool test:\n");
+    if (pool_size != 0 || pool_slots)
+    {
+        printf("  the pool was filled when the plugin was loaded\n");
+        ++failures;
+    }
+    LADSPA_Handle first = Kite_descriptor->instantiate(Kite_descriptor,
+                                                       TEST_SAMPLE_RATE);
+    if (first)
+        Kite_descriptor->cleanup(first);
+    slots_in_use = calloc(pool_size + 1, sizeof (short));
+    if (!first || pool_size == 0 || !slots_in_use)
+    {
+        printf("\nCould not set up the pool\n");
+        exit(-1);
+    }
+    if (pool_slots[0].kite.sample_rate != TEST_SAMPLE_RATE)
+    {
+        printf("  the pool wasn't made for the first instance's rate\n");
+        ++failures;
+    }
+    unsigned long warm_size = CountFreeSlots();
+
+    for (i = 0; i < THREAD_COUNT; ++i)
+    {
+        numbers[i] = i;
+        if (pthread_create(&threads[i], NULL, StressPool, &numbers[i]) != 0)
+        {
+            printf("\nCould not start thread %lu\n", i);
+            exit(-1);
+        }
+    }
+    for (i = 0; i < THREAD_COUNT; ++i)
+        pthread_join(threads[i], NULL);
+
+    if (handed_out_twice)
+    {
+        printf("  a pooled instance was handed out twice (%lu times)\n",
+               handed_out_twice);
+        ++failures;
+    }
+    if (warm_size != pool_size || CountFreeSlots() != warm_size)
+    {
+        printf("  %lu of the pool's %lu slots are free, not %lu\n",
+               CountFreeSlots(), pool_size, warm_size);
+        ++failures;
+    }
+    failures += CheckReusedInstance();
+
+    sb_kite_fini();
+    free(slots_in_use);
+
+    if (failures)
+    {
+        printf("Instance pool test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("Instance pool test: passed\n");
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * One of the threads.  Every instance is run once with non-default cut
+ * rules and a group, like a host would use it, so the next user of its slot
+ * would notice if any of that stuck.
+ */
+void * StressPool(void * argument)
+{
+    unsigned long number = *(unsigned long *) argument;
+    float buffers[4][TEST_FRAMES];
+    float controls[KITE_LENGTH_SHAPE + 1];
+    unsigned long round = 0;
+    unsigned long port = 0;
+
+    memset(buffers, 0, sizeof (buffers));
+    memset(controls, 0, sizeof (controls));
+    controls[KITE_MIN_SECONDS] = 0.01f;
+    controls[KITE_MAX_SECONDS] = 0.02f;
+    controls[KITE_REVERSE_CHANCE] = 0.5f;
+    controls[KITE_GROUP] = (float) (1 + number % 3);
+    controls[KITE_LENGTH_SHAPE] = 1.0f;
+
+    for (round = 0; round < ROUNDS_PER_THREAD; ++round)
+    {
+        Kite * kite = (Kite *) Kite_descriptor->instantiate(
+                Kite_descriptor, TEST_SAMPLE_RATE);
+        if (!kite)
+            continue;
+
+        unsigned long slot = 0;
+        if (kite->pooled)
+        {
+            slot = (KiteSlot *) kite - pool_slots + 1;
+            if (__atomic_exchange_n(&slots_in_use[slot], ON,
+                                    __ATOMIC_ACQ_REL))
+                __atomic_fetch_add(&handed_out_twice, 1, __ATOMIC_RELAXED);
+        }
+
+        for (port = 0; port < 4; ++port)
+            Kite_descriptor->connect_port(kite, port, buffers[port]);
+        for (port = KITE_SNAP_WINDOW; port <= KITE_LENGTH_SHAPE; ++port)
+            Kite_descriptor->connect_port(kite, port, &controls[port]);
+        Kite_descriptor->run(kite, TEST_FRAMES);
+
+        if (slot)
+            __atomic_store_n(&slots_in_use[slot], OFF, __ATOMIC_RELEASE);
+        Kite_descriptor->cleanup(kite);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Walks the pool's free list (no more than pool_size steps, in case it has
+ * a loop in it) and returns how many slots are on it.
+ */
+unsigned long CountFreeSlots(void)
+{
+    uint64_t number = pool_head & POOL_SLOT_MASK;
+    unsigned long count = 0;
+
+    while (number && count <= pool_size)
+    {
+        ++count;
+        number = pool_slots[number - 1].next;
+    }
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Puts an instance in a group with changed cut rules, cleans it up, and
+ * makes a new one, which must get the same slot back (the free list is last
+ * in, first out) with its ports unread and the pool's next seed.  It is
+ * given other cut rules, and its engine is run straight after a Kite in
+ * the old group has published a plan; it must cut exactly like a fresh Kite
+ * with that seed and those rules, which it wouldn't if it had stayed in the
+ * group or missed the new rules.  Returns the number of failures.
+ */
+int CheckReusedInstance(void)
+{
+    float input[2][REUSE_FRAMES];
+    float output[2][REUSE_FRAMES];
+    float expected[2][REUSE_FRAMES];
+    float controls[KITE_LENGTH_SHAPE + 1];
+    const float * inputs[2] = { input[0], input[1] };
+    float * outputs[2] = { output[0], output[1] };
+    float * expected_outputs[2] = { expected[0], expected[1] };
+    unsigned long port = 0;
+    unsigned long i = 0;
+    int failures = 0;
+
+    for (i = 0; i < REUSE_FRAMES; ++i)
+    {
+        input[0][i] = (float) i;
+        input[1][i] = -(float) i;
+    }
+    memset(controls, 0, sizeof (controls));
+    controls[KITE_MIN_SECONDS] = 0.0005f;
+    controls[KITE_MAX_SECONDS] = 0.001f;
+    controls[KITE_REVERSE_CHANCE] = 1.0f;
+    controls[KITE_GROUP] = (float) TEST_GROUP;
+    float new_controls[KITE_LENGTH_SHAPE + 1];
+    memset(new_controls, 0, sizeof (new_controls));
+    new_controls[KITE_MIN_SECONDS] = 0.001f;
+    new_controls[KITE_MAX_SECONDS] = 0.002f;
+    new_controls[KITE_REVERSE_CHANCE] = 0.5f;
+
+    Kite * old_kite = (Kite *) Kite_descriptor->instantiate(
+            Kite_descriptor, TEST_SAMPLE_RATE);
+    if (!old_kite || !old_kite->pooled)
+    {
+        printf("  no pooled instance was handed out\n");
+        return 1;
+    }
+    Kite_descriptor->connect_port(old_kite, KITE_INPUT_LEFT, input[0]);
+    Kite_descriptor->connect_port(old_kite, KITE_INPUT_RIGHT, input[1]);
+    Kite_descriptor->connect_port(old_kite, KITE_OUTPUT_LEFT, output[0]);
+    Kite_descriptor->connect_port(old_kite, KITE_OUTPUT_RIGHT, output[1]);
+    for (port = KITE_SNAP_WINDOW; port <= KITE_LENGTH_SHAPE; ++port)
+        Kite_descriptor->connect_port(old_kite, port, &controls[port]);
+    Kite_descriptor->run(old_kite, REUSE_FRAMES);
+    Kite_descriptor->cleanup(old_kite);
+
+    uint64_t seed = pool_seed + pool_seeds_used;
+    Kite * kite = (Kite *) Kite_descriptor->instantiate(
+            Kite_descriptor, TEST_SAMPLE_RATE);
+    if (kite != old_kite)
+    {
+        printf("  the instance didn't get its old slot back\n");
+        if (kite)
+            Kite_descriptor->cleanup(kite);
+        return 1;
+    }
+    if (kite->min_seconds != CUT_RULES_UNREAD ||
+        kite->max_seconds != CUT_RULES_UNREAD ||
+        kite->reverse_chance != CUT_RULES_UNREAD ||
+        kite->length_shape != CUT_RULES_UNREAD || kite->Min_Seconds ||
+        kite->Group || kite->Snap_Window)
+    {
+        printf("  the reused instance kept its old ports\n");
+        ++failures;
+    }
+
+    // a Kite in the old group publishes a plan (the first buffer uses up
+    // the old instance's plan, the second starts a new cycle)
+    KiteSettings settings;
+    KiteDefaultSettings(&settings);
+    settings.min_seconds = new_controls[KITE_MIN_SECONDS];
+    settings.max_seconds = new_controls[KITE_MAX_SECONDS];
+    settings.reverse_chance = new_controls[KITE_REVERSE_CHANCE];
+    settings.seed = seed + 1;
+    KiteEngine * partner = KiteCreate(TEST_SAMPLE_RATE);
+    KiteEngine * fresh = KiteCreate(TEST_SAMPLE_RATE);
+    if (!partner || !fresh || KiteConfigure(partner, &settings) != KITE_OK)
+    {
+        printf("\nOut of memory.\n");
+        exit(-1);
+    }
+    KiteSetGroup(partner, TEST_GROUP);
+    KiteProcess(partner, inputs, expected_outputs, 2, REUSE_FRAMES);
+    KiteProcess(partner, inputs, expected_outputs, 2, REUSE_FRAMES);
+
+    // run() without reading the group port, so a stale group would show
+    for (port = KITE_MIN_SECONDS; port <= KITE_REVERSE_CHANCE; ++port)
+        Kite_descriptor->connect_port(kite, port, &new_controls[port]);
+    ReadSnapWindow(kite);
+    ReadCutRules(kite);
+    KiteProcess(kite->engine, inputs, outputs, 2, REUSE_FRAMES);
+
+    settings.seed = seed;
+    KiteConfigure(fresh, &settings);
+    KiteProcess(fresh, inputs, expected_outputs, 2, REUSE_FRAMES);
+    if (memcmp(output, expected, sizeof (output)) != 0)
+    {
+        printf("  the reused instance doesn't cut like a fresh one seeded");
+        printf(" with %llu\n", (unsigned long long) seed);
+        ++failures;
+    }
+
+    KiteDestroy(partner);
+    KiteDestroy(fresh);
+    Kite_descriptor->cleanup(kite);
+    return failures;
+}
+
+// ------------------------------- EOF ----------------------------------------
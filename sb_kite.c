@@ -24,8 +24,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <math.h>
+#include <pthread.h>
 #include <ladspa.h>
+#include "libkite.h"
 
 
 //-----------------------
@@ -42,6 +44,50 @@
 #define KITE_OUTPUT_LEFT 2
 // right channel output
 #define KITE_OUTPUT_RIGHT 3
+// how far cuts may move to find a zero crossing (control input)
+#define KITE_SNAP_WINDOW 4
+// the shortest and longest pieces, in seconds (control inputs)
+#define KITE_MIN_SECONDS 5
+#define KITE_MAX_SECONDS 6
+// how likely a piece is to be reversed, from 0 to 1 (control input)
+#define KITE_REVERSE_CHANCE 7
+// the peak and RMS levels of each output channel (control outputs)
+#define KITE_PEAK_LEFT 8
+#define KITE_PEAK_RIGHT 9
+#define KITE_RMS_LEFT 10
+#define KITE_RMS_RIGHT 11
+// the group of Kites this one cuts the same as (control input)
+#define KITE_GROUP 12
+// which of the KITE_LENGTHS_... shapes the piece lengths have (control input)
+#define KITE_LENGTH_SHAPE 13
+
+/*
+ * These are the port numbers for the interleaved version of the plugin,
+ * which takes both channels in one buffer (left, right, left, right...)
+ */
+#define INTERLEAVED_INPUT 0
+#define INTERLEAVED_OUTPUT 1
+#define INTERLEAVED_SNAP_WINDOW 2
+#define INTERLEAVED_MIN_SECONDS 3
+#define INTERLEAVED_MAX_SECONDS 4
+#define INTERLEAVED_REVERSE_CHANCE 5
+#define INTERLEAVED_PEAK_LEFT 6
+#define INTERLEAVED_PEAK_RIGHT 7
+#define INTERLEAVED_RMS_LEFT 8
+#define INTERLEAVED_RMS_RIGHT 9
+#define INTERLEAVED_GROUP 10
+#define INTERLEAVED_LENGTH_SHAPE 11
+
+/*
+ * These are the port numbers for the tape library version of the plugin,
+ * which has no inputs (its sound comes from a sample bank)
+ */
+#define TAPE_LIBRARY_OUTPUT_LEFT 0
+#define TAPE_LIBRARY_OUTPUT_RIGHT 1
+#define TAPE_LIBRARY_MIN_SECONDS 2
+#define TAPE_LIBRARY_MAX_SECONDS 3
+#define TAPE_LIBRARY_REVERSE_CHANCE 4
+#define TAPE_LIBRARY_LENGTH_SHAPE 5
 
 /*
  * Other constants
@@ -49,27 +95,49 @@
 // the plugin's unique ID given by Richard Furse (ladspa@muse.demon.co.uk)
 #define UNIQUE_ID 4304
 // number of ports involved
-#define PORT_COUNT 4
-
-
-//-------------------------
-//-- FUNCTION PROTOTYPES --
-//-------------------------
-
-// gets a random unsigned long integer
-unsigned long GetRandomNaturalNumber(unsigned long lower_bound,
-                                     unsigned long upper_bound);
-
-// reverses the given block of samples (block meaning an array of LADSPA_Data,
-// which are floats)
-void ApplyReverse(LADSPA_Data * buffer, unsigned long start,
-                  unsigned long end);
-
-// copies a subsection of an array of LADSPA_Data (floats) into a subsection of
-// another array
-void CopySubBlock(LADSPA_Data * destination, unsigned long dest_start,
-                  LADSPA_Data * source, unsigned long source_start,
-                  unsigned long source_end);
+#define PORT_COUNT 14
+// the unique ID and number of ports of the interleaved version.
+// NOTE: this ID was not given by Richard Furse.  LADSPA leaves IDs 1 to 1000
+// for plugins that haven't been given one (they are never handed out), so
+// it can't be taken by anybody's published plugin; it may clash with
+// another unpublished one, which is why hosts should find it by its label
+#define INTERLEAVED_UNIQUE_ID 435
+#define INTERLEAVED_PORT_COUNT 12
+// the number of channels in an interleaved frame
+#define INTERLEAVED_CHANNELS 2
+// the unique ID and number of ports of the tape library version (from the
+// same range as INTERLEAVED_UNIQUE_ID, see the note there)
+#define TAPE_LIBRARY_UNIQUE_ID 436
+#define TAPE_LIBRARY_PORT_COUNT 6
+// the environment variables that tell the tape library version where its
+// sample bank is, and how many channels raw files in it have (1 if unset)
+#define BANK_VARIABLE "KITE_BANK"
+#define BANK_CHANNELS_VARIABLE "KITE_BANK_CHANNELS"
+// the biggest buffer the plugin gets ready for when it is instantiated
+// (a host that sends more than this makes run() allocate memory)
+#define MAX_BLOCK_SIZE 1048576
+// the upper bounds of the piece length ports, in seconds
+#define MAX_MIN_SECONDS 1.0f
+#define MAX_MAX_SECONDS 8.0f
+// the upper bound of the reverse chance port.  LADSPA_HINT_DEFAULT_LOW is a
+// quarter of the way up, so this puts the default at Kite's 1 in 3; values
+// over 1 are taken as 1
+#define MAX_REVERSE_CHANCE (4.0f / 3.0f)
+// what the cut rule ports hold before run() has read them (no port can hold
+// this, so the first run() always passes them on to the engine)
+#define CUT_RULES_UNREAD -1.0f
+// the environment variables that set how many instances the instance pool
+// gets ready when the first one is made, and for which sample rate
+#define POOL_SIZE_VARIABLE "KITE_POOL_SIZE"
+#define POOL_SAMPLE_RATE_VARIABLE "KITE_POOL_SAMPLE_RATE"
+// the instance pool's size when it isn't set, and the most instances it
+// will hold
+#define DEFAULT_POOL_SIZE 8
+#define MAX_POOL_SIZE 4096
+// the size of a CPU cache line (each pooled instance gets its own)
+#define CACHE_LINE_BYTES 64
+// the part of the pool's free list head that holds a slot number
+#define POOL_SLOT_MASK 0xFFFFFFFFULL
 
 
 //--------------------------------
@@ -81,13 +149,81 @@ typedef struct
 {
     // the samples per second of the sound
     unsigned long sample_rate;
+    // the Kite itself (see libkite.h)
+    KiteEngine * engine;
+    // the gain run_adding() mixes with
+    LADSPA_Data run_adding_gain;
+    // the sample bank of the tape library version (NULL for the others)
+    KiteBank * bank;
     // data locations for the input & output audio ports
     LADSPA_Data * Input_Left;
     LADSPA_Data * Input_Right;
     LADSPA_Data * Output_Left;
     LADSPA_Data * Output_Right;
+    // data locations for the interleaved version's audio ports
+    LADSPA_Data * Input_Interleaved;
+    LADSPA_Data * Output_Interleaved;
+    // data location for the snap window control port
+    LADSPA_Data * Snap_Window;
+    // data locations for the cut rule control ports
+    LADSPA_Data * Min_Seconds;
+    LADSPA_Data * Max_Seconds;
+    LADSPA_Data * Reverse_Chance;
+    LADSPA_Data * Length_Shape;
+    // the cut rule port values the engine was last given (see ReadCutRules())
+    LADSPA_Data min_seconds;
+    LADSPA_Data max_seconds;
+    LADSPA_Data reverse_chance;
+    LADSPA_Data length_shape;
+    // data locations for the meter control ports
+    LADSPA_Data * Peak_Left;
+    LADSPA_Data * Peak_Right;
+    LADSPA_Data * Rms_Left;
+    LADSPA_Data * Rms_Right;
+    // data location for the group control port
+    LADSPA_Data * Group;
+    // ON if this instance lives in the instance pool (see PopKite())
+    short pooled;
 } Kite;
 
+/*
+ * A slot of the instance pool: a Kite (whose engine stays allocated while
+ * the slot is free) on a cache line of its own, so instances running on
+ * different threads never share one.
+ */
+typedef struct
+{
+    Kite kite;
+    // the number of the next free slot plus one (0 ends the list)
+    uint64_t next;
+} __attribute__((aligned(CACHE_LINE_BYTES))) KiteSlot;
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+/*
+ * The instance pool: one block of slots allocated when the first instance
+ * is made (see WarmPool()), and a list of the free ones.  The list's head holds the
+ * number of the first free slot plus one in its low 32 bits, and a count of
+ * the changes made to it in the high 32 bits, so a slot taken and put back
+ * by another thread between reading the head and swapping it can't fool
+ * PopKite().  It is only touched with atomic operations, so instantiate()
+ * and cleanup() on any number of threads never wait on a lock.
+ */
+static KiteSlot * pool_slots = NULL;
+static unsigned long pool_size = 0;
+static uint64_t pool_head = 0;
+// pooled instances are seeded with pool_seed plus a count, since reading the
+// clock for every instance is slower than handing out numbers
+static uint64_t pool_seed = 0;
+static uint64_t pool_seeds_used = 0;
+// ON once WarmPool() has run, and the lock that makes sure only one
+// instantiate() runs it
+static short pool_warmed = OFF;
+static pthread_mutex_t pool_warm_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 //---------------
 //-- FUNCTIONS --
@@ -95,35 +231,227 @@ typedef struct
 
 
 /*
- * Creates a plugin instance by allocating space for a plugin handle.
- * This function returns a LADSPA_Handle (which is a void * -- a pointer to
- * anything).
+ * Makes a Kite engine for a plugin instance.  It is seeded with the current
+ * time, so every instance cuts differently, and made ready for the biggest
+ * buffer we expect, so run() doesn't have to allocate any memory.  Returns
+ * NULL if memory ran out.
+ */
+KiteEngine * CreateEngine(unsigned long sample_rate)
+{
+    KiteEngine * engine = KiteCreate(sample_rate);
+    KiteSettings settings;
+    KiteDefaultSettings(&settings);
+    settings.max_samples = MAX_BLOCK_SIZE;
+    if (!engine || KiteConfigure(engine, &settings) != KITE_OK)
+    {
+        KiteDestroy(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Takes a free slot off the instance pool's list, or returns NULL if there
+ * are none left.
+ */
+Kite * PopKite()
+{
+    uint64_t head = __atomic_load_n(&pool_head, __ATOMIC_ACQUIRE);
+
+    while (head & POOL_SLOT_MASK)
+    {
+        KiteSlot * slot = &pool_slots[(head & POOL_SLOT_MASK) - 1];
+        uint64_t next = __atomic_load_n(&slot->next, __ATOMIC_RELAXED);
+        uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+        if (__atomic_compare_exchange_n(&pool_head, &head, new_head, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            return &slot->kite;
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Puts a pooled Kite's slot back on the instance pool's list.
+ */
+void PushKite(Kite * kite)
+{
+    uint64_t number = (KiteSlot *) kite - pool_slots + 1;
+    uint64_t head = __atomic_load_n(&pool_head, __ATOMIC_RELAXED);
+    uint64_t new_head = 0;
+
+    do
+    {
+        __atomic_store_n(&pool_slots[number - 1].next, head & POOL_SLOT_MASK,
+                         __ATOMIC_RELAXED);
+        new_head = (((head >> 32) + 1) << 32) | number;
+    } while (!__atomic_compare_exchange_n(&pool_head, &head, new_head, 1,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fills the instance pool with KITE_POOL_SIZE instances (DEFAULT_POOL_SIZE
+ * if it isn't set, 0 for no pool) with their engines made for
+ * KITE_POOL_SAMPLE_RATE ('sample_rate', the first instance's, if it isn't
+ * set).  Hosts that make and throw away instances all the time (a voice
+ * allocator, say) then don't go through malloc() and the engine's setup
+ * every time.  If memory runs out, the pool is just smaller.
+ *
+ * This is done by the first instantiate(), not when the plugin is loaded,
+ * since hosts load every plugin they find just to list them.  The engines
+ * are allocated one by one rather than inside the block of slots: an
+ * engine is private to libkite, and its plans grow (with realloc()) when a
+ * host sends a bigger buffer than it was made for or the cut rules get
+ * shorter, so a fixed part of the block couldn't hold it for long anyway.
+ */
+void WarmPool(unsigned long sample_rate)
+{
+    const char * size_text = getenv(POOL_SIZE_VARIABLE);
+    const char * rate_text = getenv(POOL_SAMPLE_RATE_VARIABLE);
+    unsigned long size = size_text ? strtoul(size_text, NULL, 10) :
+            DEFAULT_POOL_SIZE;
+    if (rate_text)
+        sample_rate = strtoul(rate_text, NULL, 10);
+    unsigned long slot = 0;
+    void * memory = NULL;
+    KiteSettings settings;
+
+    if (size > MAX_POOL_SIZE)
+        size = MAX_POOL_SIZE;
+    if (size == 0 || sample_rate == 0 ||
+        posix_memalign(&memory, CACHE_LINE_BYTES,
+                       size * sizeof (KiteSlot)) != 0)
+        return;
+
+    memset(memory, 0, size * sizeof (KiteSlot));
+    pool_slots = (KiteSlot *) memory;
+    pool_size = size;
+    KiteDefaultSettings(&settings);
+    pool_seed = settings.seed;
+
+    for (slot = 0; slot < size; ++slot)
+    {
+        Kite * kite = &pool_slots[slot].kite;
+        kite->pooled = ON;
+        kite->sample_rate = sample_rate;
+        kite->engine = CreateEngine(sample_rate);
+        if (kite->engine)
+            PushKite(kite);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Frees the instance pool (the host has cleaned up every instance by now).
+ */
+void FreePool()
+{
+    unsigned long slot = 0;
+
+    for (slot = 0; slot < pool_size; ++slot)
+        KiteDestroy(pool_slots[slot].kite.engine);
+    free(pool_slots);
+    pool_slots = NULL;
+    pool_size = 0;
+    pool_head = 0;
+    pool_warmed = OFF;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Creates a plugin instance.  This function returns a LADSPA_Handle (which
+ * is a void * -- a pointer to anything).  The first one fills the instance
+ * pool.  If the pool has a free slot made for this sample rate, that is all
+ * it takes: its engine is already allocated, so it only needs a new seed.
+ * Otherwise a slot (or, if the pool is empty, a newly allocated Kite) gets
+ * a new engine.
  */
 LADSPA_Handle instantiate_Kite(const LADSPA_Descriptor * Descriptor,
                                unsigned long sample_rate)
 {
-    Kite * kite;
+    if (!__atomic_load_n(&pool_warmed, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&pool_warm_lock);
+        if (!pool_warmed)
+        {
+            WarmPool(sample_rate);
+            __atomic_store_n(&pool_warmed, ON, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&pool_warm_lock);
+    }
 
-    // allocate space for a Kite struct instance
-    kite = (Kite *) malloc(sizeof (Kite));
-    // set the instance's sample rate
-    if (kite)
-        kite->sample_rate = sample_rate;
+    Kite * kite = PopKite();
 
-    // get the current time to seed the generator
-    struct timeval current_time;
+    if (kite && kite->sample_rate != sample_rate)
+    {
+        KiteDestroy(kite->engine);
+        kite->engine = NULL;
+    }
+    if (!kite)
+    {
+        // allocate space for a Kite struct instance
+        kite = (Kite *) malloc(sizeof (Kite));
+        if (!kite)
+            return NULL;
+        kite->engine = NULL;
+        kite->pooled = OFF;
+    }
 
-    // seed the Pseudo Random Number Generator
-    /*
-     * NOTE: the tv_sec and tv_usec members of the timeval struct are
-     * long integers that represent the current time in seconds and
-     * nanoseconds, respectively, since Jan. 1, 1970.  They are used
-     * here to seed the generator.
-     */
-    gettimeofday(&current_time, NULL);
-    srandom((unsigned long) (current_time.tv_usec * current_time.tv_sec));
+    // set the instance's sample rate
+    kite->sample_rate = sample_rate;
+    kite->run_adding_gain = 1.0f;
+    kite->bank = NULL;
+    kite->Input_Interleaved = NULL;
+    kite->Output_Interleaved = NULL;
+    kite->Snap_Window = NULL;
+    kite->Min_Seconds = NULL;
+    kite->Max_Seconds = NULL;
+    kite->Reverse_Chance = NULL;
+    kite->Length_Shape = NULL;
+    kite->min_seconds = CUT_RULES_UNREAD;
+    kite->max_seconds = CUT_RULES_UNREAD;
+    kite->reverse_chance = CUT_RULES_UNREAD;
+    kite->length_shape = CUT_RULES_UNREAD;
+    kite->Peak_Left = NULL;
+    kite->Peak_Right = NULL;
+    kite->Rms_Left = NULL;
+    kite->Rms_Right = NULL;
+    kite->Group = NULL;
+
+    if (kite->engine)
+    {
+        KiteSetSeed(kite->engine, pool_seed +
+                    __atomic_fetch_add(&pool_seeds_used, 1,
+                                       __ATOMIC_RELAXED));
+        return kite;
+    }
+
+    kite->engine = CreateEngine(sample_rate);
+    if (!kite->engine)
+    {
+        if (kite->pooled)
+            PushKite(kite);
+        else
+            free(kite);
+        return NULL;
+    }
 
-    // send the LADSPA_Handle to the host. If malloc failed, NULL is returned.
+    // send the LADSPA_Handle to the host
     return kite;
 }
 
@@ -158,17 +486,209 @@ void connect_port_to_Kite(LADSPA_Handle instance, unsigned long Port,
         case KITE_OUTPUT_RIGHT:
             kite->Output_Right = data_location;
             break;
+        case KITE_SNAP_WINDOW:
+            kite->Snap_Window = data_location;
+            break;
+        case KITE_MIN_SECONDS:
+            kite->Min_Seconds = data_location;
+            break;
+        case KITE_MAX_SECONDS:
+            kite->Max_Seconds = data_location;
+            break;
+        case KITE_REVERSE_CHANCE:
+            kite->Reverse_Chance = data_location;
+            break;
+        case KITE_PEAK_LEFT:
+            kite->Peak_Left = data_location;
+            break;
+        case KITE_PEAK_RIGHT:
+            kite->Peak_Right = data_location;
+            break;
+        case KITE_RMS_LEFT:
+            kite->Rms_Left = data_location;
+            break;
+        case KITE_RMS_RIGHT:
+            kite->Rms_Right = data_location;
+            break;
+        case KITE_GROUP:
+            kite->Group = data_location;
+            break;
+        case KITE_LENGTH_SHAPE:
+            kite->Length_Shape = data_location;
+            break;
     }
 }
 
 //-----------------------------------------------------------------------------
 
 
+/*
+ * Passes the snap window control port's value on to the engine (clamped to
+ * the port's range, since hosts don't always respect it).
+ */
+void ReadSnapWindow(Kite * kite)
+{
+    unsigned long snap_window = 0;
+
+    if (kite->Snap_Window && *kite->Snap_Window > 0.0f)
+    {
+        if (*kite->Snap_Window >= (LADSPA_Data) KITE_MAX_SNAP_WINDOW)
+            snap_window = KITE_MAX_SNAP_WINDOW;
+        else
+            snap_window = (unsigned long) (*kite->Snap_Window + 0.5f);
+    }
+    KiteSetSnapWindow(kite->engine, snap_window);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Passes the cut rule control ports' values on to the engine, but only if
+ * one of them has changed since the last run(), since the engine works out
+ * the sub-block lengths in samples and the reverse chance as a fraction from
+ * them.  An unconnected port counts as the engine's default.  The reverse
+ * chance port goes up to 4/3 (see MAX_REVERSE_CHANCE), so it is clamped to
+ * 1 here; the engine clamps everything else.
+ *
+ * The length shape port is read the same way.  A new shape is compiled into
+ * an alias table right here rather than in activate(), since LADSPA only
+ * lets run() read control ports; it takes a few dozen steps and allocates
+ * nothing, and after that every piece length costs the same to draw,
+ * whatever the shape (see KitePickLength()).
+ */
+void ReadCutRules(Kite * kite)
+{
+    LADSPA_Data min_seconds = kite->Min_Seconds ? *kite->Min_Seconds :
+            (LADSPA_Data) KITE_DEFAULT_MIN_SECONDS;
+    LADSPA_Data max_seconds = kite->Max_Seconds ? *kite->Max_Seconds :
+            (LADSPA_Data) KITE_DEFAULT_MAX_SECONDS;
+    LADSPA_Data reverse_chance = kite->Reverse_Chance ?
+            *kite->Reverse_Chance : (LADSPA_Data) KITE_DEFAULT_REVERSE_CHANCE;
+    if (reverse_chance > 1.0f)
+        reverse_chance = 1.0f;
+
+    LADSPA_Data length_shape = kite->Length_Shape ? *kite->Length_Shape :
+            (LADSPA_Data) KITE_LENGTHS_EVEN;
+
+    if (length_shape != kite->length_shape)
+    {
+        kite->length_shape = length_shape;
+        KiteSetLengthShape(kite->engine, (int) (length_shape + 0.5f));
+    }
+
+    if (min_seconds == kite->min_seconds &&
+        max_seconds == kite->max_seconds &&
+        reverse_chance == kite->reverse_chance)
+        return;
+
+    kite->min_seconds = min_seconds;
+    kite->max_seconds = max_seconds;
+    kite->reverse_chance = reverse_chance;
+    KiteSetCutRules(kite->engine, min_seconds, max_seconds, reverse_chance);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Passes the group control port's value on to the engine (nothing happens
+ * unless it changed).  Kites in the same group, in this plugin or in any
+ * other in the same host, cut their buffers the same way (see
+ * KiteSetGroup() in libkite.h).  0 (or an unconnected port) is no group.
+ */
+void ReadGroup(Kite * kite)
+{
+    unsigned long group = 0;
+
+    if (kite->Group && *kite->Group > 0.0f)
+    {
+        if (*kite->Group >= (LADSPA_Data) KITE_MAX_GROUPS)
+            group = KITE_MAX_GROUPS;
+        else
+            group = (unsigned long) (*kite->Group + 0.5f);
+    }
+    KiteSetGroup(kite->engine, group);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Returns ON if the host has connected any of the meter ports.  If it
+ * hasn't, run() doesn't meter at all.
+ */
+short IsMetered(Kite * kite)
+{
+    return kite->Peak_Left || kite->Peak_Right || kite->Rms_Left ||
+            kite->Rms_Right;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Writes the left and right channels' peak and RMS levels to whichever of
+ * the meter ports are connected.
+ */
+void WriteMeters(Kite * kite, const float * peaks, const float * rms)
+{
+    if (kite->Peak_Left)
+        *kite->Peak_Left = peaks[0];
+    if (kite->Peak_Right)
+        *kite->Peak_Right = peaks[1];
+    if (kite->Rms_Left)
+        *kite->Rms_Left = rms[0];
+    if (kite->Rms_Right)
+        *kite->Rms_Right = rms[1];
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The meters for run_adding(): the samples Kite adds are its input moved
+ * around and turned up or down by the gain, so the levels are the input's
+ * times the gain.  The input has to be read for this, since the mixing
+ * doesn't go through the metering copy.  'stride' is 1 for separate
+ * channels, or 2 if 'left' is an interleaved buffer ('right' is then
+ * ignored).
+ */
+void MeterAdding(Kite * kite, const float * left, const float * right,
+                 unsigned long stride, unsigned long frames)
+{
+    float peaks[2] = { 0.0f, 0.0f };
+    double sums[2] = { 0.0, 0.0 };
+    float rms[2] = { 0.0f, 0.0f };
+    float gain = fabsf(kite->run_adding_gain);
+    unsigned long channel = 0;
+
+    if (stride == 1)
+    {
+        KiteMeterSamples(left, frames, 1, &peaks[0], &sums[0]);
+        KiteMeterSamples(right, frames, 1, &peaks[1], &sums[1]);
+    }
+    else
+        KiteMeterSamples(left, frames, 2, peaks, sums);
+
+    for (channel = 0; channel < 2; ++channel)
+    {
+        peaks[channel] *= gain;
+        if (frames > 0)
+            rms[channel] = gain * (float) sqrt(sums[channel] / frames);
+    }
+    WriteMeters(kite, peaks, rms);
+}
+
+//-----------------------------------------------------------------------------
+
+
 /*
  * Here is where the rubber hits the road.  The actual sound manipulation
  * is done in run().
  * What is basically does is takes the block of samples and reorders them
- * in random order (sometimes reversing them).
+ * in random order (sometimes reversing them).  The cutting and splicing is
+ * done by the Kite engine (see libkite.h and kite_run.pseudo).
  */
 void run_Kite(LADSPA_Handle instance, unsigned long total_samples)
 {
@@ -178,193 +698,319 @@ void run_Kite(LADSPA_Handle instance, unsigned long total_samples)
      * NOTE: these special cases should never happen, but you never know--like
      * if someone is developing a host program and it has some bugs in it, it
      * might pass some bad data.
+     * NOTE: the plugin just quietly does nothing here.  Printing a message
+     * isn't allowed, since printf() can block, and run() must be real-time
+     * safe (see kite_rt_audit.h).
      */
-    if (total_samples <= 1)
-    {
-        printf("\nA sample count of 0 or 1 was sent to plugin.");
-        printf("\nPlugin not executed.\n");
+    if (total_samples == 0)
         return;
-    }
     if (!kite)
-    {
-        printf("\nPlugin received NULL pointer for plugin instance.");
-        printf("\nPlugin not executed.\n");
         return;
-    }
     if (kite->sample_rate == 0)
+        return;
+
+    const float * inputs[2] = { kite->Input_Left, kite->Input_Right };
+    float * outputs[2] = { kite->Output_Left, kite->Output_Right };
+
+    ReadSnapWindow(kite);
+    ReadCutRules(kite);
+    ReadGroup(kite);
+    if (IsMetered(kite))
     {
-        printf("\nA sample rate of 0 was sent to plugin.");
-        printf("\nPlugin not executed.\n");
+        float peaks[2];
+        float rms[2];
+        if (KiteProcessMetered(kite->engine, inputs, outputs, 2,
+                               total_samples, peaks, rms) == KITE_OK)
+            WriteMeters(kite, peaks, rms);
+    }
+    else
+        KiteProcess(kite->engine, inputs, outputs, 2, total_samples);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The same as run(), except the output is added to what is already in the
+ * output buffers (times the gain the host set with set_run_adding_gain()).
+ */
+void run_adding_Kite(LADSPA_Handle instance, unsigned long total_samples)
+{
+    Kite * kite = (Kite *) instance;
+
+    if (total_samples == 0 || !kite || kite->sample_rate == 0)
         return;
+
+    const float * inputs[2] = { kite->Input_Left, kite->Input_Right };
+    float * outputs[2] = { kite->Output_Left, kite->Output_Right };
+
+    ReadSnapWindow(kite);
+    ReadCutRules(kite);
+    ReadGroup(kite);
+    if (IsMetered(kite))
+        MeterAdding(kite, kite->Input_Left, kite->Input_Right, 1,
+                    total_samples);
+    KiteProcessAdding(kite->engine, inputs, outputs, 2, total_samples,
+                      kite->run_adding_gain);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The interleaved version's connect_port().  The ports are numbered
+ * differently, but the data ends up in the same Kite struct.
+ */
+void connect_port_to_Interleaved_Kite(LADSPA_Handle instance,
+                                      unsigned long Port,
+                                      LADSPA_Data * data_location)
+{
+    Kite * kite = (Kite *) instance;
+
+    switch (Port)
+    {
+        case INTERLEAVED_INPUT:
+            kite->Input_Interleaved = data_location;
+            break;
+        case INTERLEAVED_OUTPUT:
+            kite->Output_Interleaved = data_location;
+            break;
+        case INTERLEAVED_SNAP_WINDOW:
+            kite->Snap_Window = data_location;
+            break;
+        case INTERLEAVED_MIN_SECONDS:
+            kite->Min_Seconds = data_location;
+            break;
+        case INTERLEAVED_MAX_SECONDS:
+            kite->Max_Seconds = data_location;
+            break;
+        case INTERLEAVED_REVERSE_CHANCE:
+            kite->Reverse_Chance = data_location;
+            break;
+        case INTERLEAVED_PEAK_LEFT:
+            kite->Peak_Left = data_location;
+            break;
+        case INTERLEAVED_PEAK_RIGHT:
+            kite->Peak_Right = data_location;
+            break;
+        case INTERLEAVED_RMS_LEFT:
+            kite->Rms_Left = data_location;
+            break;
+        case INTERLEAVED_RMS_RIGHT:
+            kite->Rms_Right = data_location;
+            break;
+        case INTERLEAVED_GROUP:
+            kite->Group = data_location;
+            break;
+        case INTERLEAVED_LENGTH_SHAPE:
+            kite->Length_Shape = data_location;
+            break;
     }
+}
+
+//-----------------------------------------------------------------------------
 
-    // set the minimum index of the random sub-blocks to 0.25 seconds
-    const unsigned long MIN_BLOCK_START = (unsigned long)
-            (0.25 * kite->sample_rate);
-    // set the maximum index of the random sub-block to 2.25 seconds
-    const unsigned long MAX_BLOCK_END = MIN_BLOCK_START +
-            (2 * kite->sample_rate);
-    // buffer indexes
-    unsigned long out_index = 0;
-    // index points for the sub-blocks of random sizes
-    unsigned long block_start_position = 0;
-    unsigned long block_end_position = 0;
-    // random number upper and lower bounds
-    unsigned long rand_num_lower_bound = 0;
-    unsigned long rand_num_upper_bound = 0;
-    // the number of samples left to process (chop up into sub-blocks)
-    unsigned long samples_remaining = total_samples;
-
-    while (out_index < total_samples)
+
+/*
+ * The interleaved version's run().  The host sends one buffer holding both
+ * channels (left, right, left, right...), and 'total_samples' counts every
+ * sample in it, so there are half as many frames.  The frames are shuffled
+ * whole, so left and right stay together.  If the host sends an odd number
+ * of samples, the odd one at the end is passed through as it is.
+ */
+void run_Interleaved_Kite(LADSPA_Handle instance, unsigned long total_samples)
+{
+    Kite * kite = (Kite *) instance;
+
+    if (total_samples == 0 || !kite || kite->sample_rate == 0)
+        return;
+
+    unsigned long frames = total_samples / INTERLEAVED_CHANNELS;
+    unsigned long leftover = total_samples - frames * INTERLEAVED_CHANNELS;
+
+    ReadSnapWindow(kite);
+    ReadCutRules(kite);
+    ReadGroup(kite);
+    if (IsMetered(kite))
     {
-        // set the lower bound for the random starting position of the sub-block
-        // to 0.25 seconds worth of samples from the current point of the output
-        // buffer
-        rand_num_lower_bound = MIN_BLOCK_START;
-        // set the upper bound for the random end position of the sub-block to
-        // 2.25 seconds worth of samples from the current point of the output
-        // buffer
-        rand_num_upper_bound = MAX_BLOCK_END;
-
-        // just set the start and end positions of the sub-block to process to
-        // the start and end of the remaining buffer since it is less than 2
-        // times the minimum size to process.
-        // this takes care of the special case where the audio passed in from
-        // the host is smaller than a half-second (2 times the minimum length).
-        // NOTE: It is 2 times the minimum because otherwise if a sub-block was
-        // processed out of it, the remaining section would be less than the
-        // minimum length.
-        if (samples_remaining <= MIN_BLOCK_START * 2)
-        {
-            block_start_position = 0;
-            block_end_position = samples_remaining - 1;
-        }
+        float peaks[INTERLEAVED_CHANNELS];
+        float rms[INTERLEAVED_CHANNELS];
+        if (KiteProcessInterleavedMetered(kite->engine,
+                                          kite->Input_Interleaved,
+                                          kite->Output_Interleaved,
+                                          INTERLEAVED_CHANNELS, frames,
+                                          peaks, rms) == KITE_OK)
+            WriteMeters(kite, peaks, rms);
+    }
+    else
+        KiteProcessInterleaved(kite->engine, kite->Input_Interleaved,
+                               kite->Output_Interleaved,
+                               INTERLEAVED_CHANNELS, frames);
+    if (leftover)
+        kite->Output_Interleaved[total_samples - 1] =
+                kite->Input_Interleaved[total_samples - 1];
+}
 
-        // set the end position of the sub-block to process to the end of the
-        // whole block if the whole block ends before the maximum cutoff point
-        else if (samples_remaining <= MAX_BLOCK_END)
-        {
-            // set the upper bound for the random number to be used as the
-            // start position of the sub-block to minimum length (.25s) from
-            // the end of the remaining buffer
-            rand_num_upper_bound = samples_remaining - MIN_BLOCK_START;
-            // get a random start position for the sub-block
-            block_start_position = GetRandomNaturalNumber(rand_num_lower_bound,
-                                                          rand_num_upper_bound);
-            block_end_position = samples_remaining - 1;
-        }
+//-----------------------------------------------------------------------------
 
-            // get random start and end positions for the sub-block to process
-        else
-        {
-            // get a random number for the start position
-            block_start_position = GetRandomNaturalNumber(rand_num_lower_bound,
-                                                          rand_num_upper_bound);
-            // reset the lower bound for the random end position
-            rand_num_lower_bound = block_start_position + MIN_BLOCK_START;
-            /*
-             * reset the upper bound for the random end position depending on
-             * where the end of the remaining buffer lies.
-             */
-            // here it is set to the end of the remaining buffer if the end of
-            // the remaining buffer comes before the maximum sub-block size
-            // (2 seconds) after the recently acquired start position.
-            if (samples_remaining < (block_start_position + MAX_BLOCK_END -
-                                     MIN_BLOCK_START))
-                rand_num_upper_bound = samples_remaining;
-            // here the upper bound is set to the maximum sub-block size after
-            // the start position, because the end of the remaining buffer is
-            // beyond that point.
-            else
-                rand_num_upper_bound = block_start_position + MAX_BLOCK_END -
-                    MIN_BLOCK_START - 1;
-            // get a random number for the end position
-            block_end_position = GetRandomNaturalNumber(rand_num_lower_bound,
-                                                        rand_num_upper_bound);
-        }
 
-        // switch (or flag) for whether the sub-block should be reversed.
-        short reverse = 0;
-        // get a random state for reverse.  It receives 3 possible states:
-        // 0, 1, or 2.  The block will only be reversed if 'reverse' is equal to
-        // 0.  The reason for this is so the chances of being reversed is less
-        // than not, as in 33% chance of reversal vs. 67% chance of not.
-        reverse = (short) GetRandomNaturalNumber(0, 2);
+/*
+ * The interleaved version's run_adding().
+ */
+void run_adding_Interleaved_Kite(LADSPA_Handle instance,
+                                 unsigned long total_samples)
+{
+    Kite * kite = (Kite *) instance;
 
-        // reverse the sub-block if the reverse switch is 'on' (equals 0)
-        if (reverse == 0)
-        {
-            // reverse the sub-block left channel
-            ApplyReverse(kite->Input_Left, block_start_position,
-                         block_end_position);
-            // reverse the sub-block right channel
-            ApplyReverse(kite->Input_Right, block_start_position,
-                         block_end_position);
-        }
+    if (total_samples == 0 || !kite || kite->sample_rate == 0)
+        return;
 
-        // append the sub-block to the output buffer for the left channel
-        CopySubBlock(kite->Output_Left, out_index, kite->Input_Left,
-                     block_start_position, block_end_position);
+    unsigned long frames = total_samples / INTERLEAVED_CHANNELS;
+    unsigned long leftover = total_samples - frames * INTERLEAVED_CHANNELS;
+
+    ReadSnapWindow(kite);
+    ReadCutRules(kite);
+    ReadGroup(kite);
+    if (IsMetered(kite))
+        MeterAdding(kite, kite->Input_Interleaved, NULL,
+                    INTERLEAVED_CHANNELS, frames);
+    KiteProcessInterleavedAdding(kite->engine, kite->Input_Interleaved,
+                                 kite->Output_Interleaved,
+                                 INTERLEAVED_CHANNELS, frames,
+                                 kite->run_adding_gain);
+    if (leftover)
+        kite->Output_Interleaved[total_samples - 1] += kite->run_adding_gain *
+                kite->Input_Interleaved[total_samples - 1];
+}
 
-        // append the sub-block to the output buffer for the right channel
-        CopySubBlock(kite->Output_Right, out_index, kite->Input_Right,
-                     block_start_position, block_end_position);
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Sets the gain run_adding() mixes the output in with.
+ */
+void set_run_adding_gain_Kite(LADSPA_Handle instance, LADSPA_Data gain)
+{
+    Kite * kite = (Kite *) instance;
+
+    if (kite)
+        kite->run_adding_gain = gain;
+}
+
+//-----------------------------------------------------------------------------
 
-        /*
-         * copy the block at the end of the current valid input buffer (the 
-         * portion we are still working in--0 to samples remaining) (that is
-         * equal in length to the block just copied into the output buffer) to
-         * the section of the input buffer that was just copied.  In other
-         * words, write over the section of the input buffer that was just
-         * copied with the same number of samples that end the portion of the
-         * input buffer that is yet to be processed.
-         * Sometimes the number of samples left in the remaining input buffer
-         * is less than the number just copied.  In that case, the section
-         * copied over is just the remaining section of the input buffer
-         * immediately following the sub-block end position.
-         */
-        // get the number of samples copied
-        unsigned long samples_copied = block_end_position -
-                block_start_position + 1;
-        // set the start index to the end section of input buffer that is
-        // going to be copied over the used section
-        unsigned long source_start = 0;
-        // set the start index to the number of samples copied away from the
-        // end of the remaining input buffer if there are more than the number
-        // of samples copied left in the remaining input buffer
-        if (samples_remaining - samples_copied > block_end_position)
-            source_start = samples_remaining - samples_copied;
-            // set the start index to the next position after the sub-block end
-            // position if there are less than the number of samples copied left
-            // in the remaining input buffer
-        else
-            source_start = block_end_position + 1;
 
-        // write over used section of left channel input
-        CopySubBlock(kite->Input_Left, block_start_position,
-                     kite->Input_Left, source_start, samples_remaining - 1);
+/*
+ * Frees dynamic memory associated with the plugin instance.  A pooled
+ * instance goes back to the pool instead, engine and all (out of its group,
+ * so the rest of the group stops reading its plans).
+ */
+void cleanup_Kite(LADSPA_Handle instance)
+{
+    Kite * kite = (Kite *) instance;
 
-        // write over used section of right channel input
-        CopySubBlock(kite->Input_Right, block_start_position,
-                     kite->Input_Right, source_start, samples_remaining - 1);
+    if (!kite)
+        return;
 
-        // update the output index
-        out_index += samples_copied;
-        // update the number of samples remaining to be processed
-        samples_remaining -= samples_copied;
+    KiteCloseBank(kite->bank);
+    kite->bank = NULL;
+    if (kite->pooled)
+    {
+        KiteSetGroup(kite->engine, 0);
+        PushKite(kite);
+        return;
     }
+
+    KiteDestroy(kite->engine);
+    free(kite);
 }
 
 //-----------------------------------------------------------------------------
 
 
 /*
- * Frees dynamic memory associated with the plugin instance.
+ * The tape library version's instantiate().  It is a regular Kite, plus the
+ * sample bank named by the KITE_BANK environment variable (a sound file or
+ * a directory of them, see kite_bank.h).  LADSPA has no way to hand a plugin
+ * a file name, so this is how the host's user tells it.  Every instance
+ * shares the same mapped bank.  Without a usable bank there is no plugin.
  */
-void cleanup_Kite(LADSPA_Handle instance)
+LADSPA_Handle instantiate_Tape_Library_Kite(const LADSPA_Descriptor *
+                                            Descriptor,
+                                            unsigned long sample_rate)
 {
-    if (instance)
-        free(instance);
+    const char * bank_path = getenv(BANK_VARIABLE);
+    const char * bank_channels = getenv(BANK_CHANNELS_VARIABLE);
+    unsigned long raw_channels = bank_channels ?
+            strtoul(bank_channels, NULL, 10) : 1;
+
+    if (!bank_path)
+        return NULL;
+
+    Kite * kite = (Kite *) instantiate_Kite(Descriptor, sample_rate);
+    if (!kite)
+        return NULL;
+
+    kite->bank = KiteOpenBank(bank_path, raw_channels);
+    if (!kite->bank)
+    {
+        cleanup_Kite(kite);
+        return NULL;
+    }
+
+    return kite;
+}
+
+//-----------------------------------------------------------------------------
+
+
+void connect_port_to_Tape_Library_Kite(LADSPA_Handle instance,
+                                       unsigned long Port,
+                                       LADSPA_Data * data_location)
+{
+    Kite * kite = (Kite *) instance;
+
+    switch (Port)
+    {
+        case TAPE_LIBRARY_OUTPUT_LEFT:
+            kite->Output_Left = data_location;
+            break;
+        case TAPE_LIBRARY_OUTPUT_RIGHT:
+            kite->Output_Right = data_location;
+            break;
+        case TAPE_LIBRARY_MIN_SECONDS:
+            kite->Min_Seconds = data_location;
+            break;
+        case TAPE_LIBRARY_MAX_SECONDS:
+            kite->Max_Seconds = data_location;
+            break;
+        case TAPE_LIBRARY_REVERSE_CHANCE:
+            kite->Reverse_Chance = data_location;
+            break;
+        case TAPE_LIBRARY_LENGTH_SHAPE:
+            kite->Length_Shape = data_location;
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The tape library version's run(): fills the outputs with pieces cut from
+ * anywhere in the bank.
+ */
+void run_Tape_Library_Kite(LADSPA_Handle instance,
+                           unsigned long total_samples)
+{
+    Kite * kite = (Kite *) instance;
+
+    if (total_samples == 0 || !kite || !kite->bank)
+        return;
+
+    float * outputs[2] = { kite->Output_Left, kite->Output_Right };
+    ReadCutRules(kite);
+    KiteProcessBank(kite->engine, kite->bank, outputs, 2, total_samples);
 }
 
 //-----------------------------------------------------------------------------
@@ -375,6 +1021,261 @@ void cleanup_Kite(LADSPA_Handle instance)
  */
 LADSPA_Descriptor * Kite_descriptor = NULL;
 
+/*
+ * The same for the interleaved version of the plugin.
+ */
+LADSPA_Descriptor * Interleaved_Kite_descriptor = NULL;
+
+/*
+ * And for the tape library version.
+ */
+LADSPA_Descriptor * Tape_Library_Kite_descriptor = NULL;
+
+
+/*
+ * Fills in the three cut rule control ports (the shortest piece, the
+ * longest piece and the reverse chance), which every version of the plugin
+ * has, in that order from port 'first_port'.  All three default to a
+ * quarter of the way up their range, which is the engine's 0.25 and 2
+ * seconds and (with the reverse chance going up to 4/3) its 1 in 3.
+ */
+void InitCutRulePorts(LADSPA_PortDescriptor * port_descriptors,
+                      char ** port_names, LADSPA_PortRangeHint * hints,
+                      unsigned long first_port)
+{
+    unsigned long port = 0;
+
+    for (port = first_port; port < first_port + 3; ++port)
+    {
+        port_descriptors[port] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
+        // LADSPA_HINT_DEFAULT_LOW is a quarter of the way up the range
+        hints[port].HintDescriptor = LADSPA_HINT_BOUNDED_BELOW |
+                LADSPA_HINT_BOUNDED_ABOVE | LADSPA_HINT_DEFAULT_LOW;
+        hints[port].LowerBound = 0.0f;
+    }
+
+    // anything under KITE_SHORTEST_SEGMENT_SECONDS is taken as that
+    port_names[first_port] = strdup("Shortest Piece (seconds)");
+    hints[first_port].UpperBound = MAX_MIN_SECONDS;
+    // anything under the shortest piece is taken as that
+    port_names[first_port + 1] = strdup("Longest Piece (seconds)");
+    hints[first_port + 1].UpperBound = MAX_MAX_SECONDS;
+    port_names[first_port + 2] = strdup("Reverse Chance");
+    // anything over 1 is taken as 1
+    hints[first_port + 2].UpperBound = MAX_REVERSE_CHANCE;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fills in the length shape control port: a whole number picking one of the
+ * KITE_LENGTHS_... shapes, from 0 (every length as likely as any other, the
+ * default) to 3.
+ */
+void InitLengthShapePort(LADSPA_PortDescriptor * port_descriptors,
+                         char ** port_names, LADSPA_PortRangeHint * hints,
+                         unsigned long port)
+{
+    port_descriptors[port] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
+    port_names[port] =
+            strdup("Piece Lengths (even, short, long, extremes)");
+    hints[port].HintDescriptor = LADSPA_HINT_BOUNDED_BELOW |
+            LADSPA_HINT_BOUNDED_ABOVE | LADSPA_HINT_INTEGER |
+            LADSPA_HINT_DEFAULT_0;
+    hints[port].LowerBound = 0.0f;
+    hints[port].UpperBound = KITE_LENGTH_SHAPES - 1;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fills in the four meter control ports (the left and right peak levels,
+ * then the left and right RMS levels) from port 'first_port' on.  They are
+ * outputs: run() writes the levels of the block it just made into them.
+ */
+void InitMeterPorts(LADSPA_PortDescriptor * port_descriptors,
+                    char ** port_names, LADSPA_PortRangeHint * hints,
+                    unsigned long first_port)
+{
+    unsigned long port = 0;
+
+    for (port = first_port; port < first_port + 4; ++port)
+    {
+        port_descriptors[port] = LADSPA_PORT_OUTPUT | LADSPA_PORT_CONTROL;
+        hints[port].HintDescriptor = LADSPA_HINT_BOUNDED_BELOW;
+        hints[port].LowerBound = 0.0f;
+    }
+
+    port_names[first_port] = strdup("Peak Left");
+    port_names[first_port + 1] = strdup("Peak Right");
+    port_names[first_port + 2] = strdup("RMS Left");
+    port_names[first_port + 3] = strdup("RMS Right");
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Fills in the group control port: a whole number from 0 (no group, the
+ * default) to KITE_MAX_GROUPS.
+ */
+void InitGroupPort(LADSPA_PortDescriptor * port_descriptors,
+                   char ** port_names, LADSPA_PortRangeHint * hints,
+                   unsigned long port)
+{
+    port_descriptors[port] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
+    port_names[port] = strdup("Group (0 for none)");
+    hints[port].HintDescriptor = LADSPA_HINT_BOUNDED_BELOW |
+            LADSPA_HINT_BOUNDED_ABOVE | LADSPA_HINT_INTEGER |
+            LADSPA_HINT_DEFAULT_0;
+    hints[port].LowerBound = 0.0f;
+    hints[port].UpperBound = KITE_MAX_GROUPS;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Sets up the descriptor of the interleaved version of Kite.  It is the same
+ * plugin as the one _init() describes (see there for what all the fields
+ * mean), but with one audio port each way for both channels.  It is meant
+ * for hosts (like audio servers) that keep their audio interleaved, and
+ * would otherwise have to split the channels up before run() and put them
+ * back together after.
+ */
+void InitInterleavedDescriptor()
+{
+    Interleaved_Kite_descriptor = (LADSPA_Descriptor *)
+            calloc(1, sizeof (LADSPA_Descriptor));
+    if (!Interleaved_Kite_descriptor)
+        return;
+
+    LADSPA_PortDescriptor * port_descriptors = (LADSPA_PortDescriptor *)
+            calloc(INTERLEAVED_PORT_COUNT, sizeof (LADSPA_PortDescriptor));
+    char ** port_names = (char **) calloc(INTERLEAVED_PORT_COUNT,
+                                          sizeof (char *));
+    LADSPA_PortRangeHint * hints = (LADSPA_PortRangeHint *)
+            calloc(INTERLEAVED_PORT_COUNT, sizeof (LADSPA_PortRangeHint));
+
+    Interleaved_Kite_descriptor->UniqueID = INTERLEAVED_UNIQUE_ID;
+    Interleaved_Kite_descriptor->Label = strdup("Kite_Interleaved");
+    // the output must not be the input (see _init())
+    Interleaved_Kite_descriptor->Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE |
+            LADSPA_PROPERTY_INPLACE_BROKEN;
+    Interleaved_Kite_descriptor->Name = strdup("Kite (interleaved stereo)");
+    Interleaved_Kite_descriptor->Maker = strdup("Tyler Hayes (tgh@pdx.edu)");
+    Interleaved_Kite_descriptor->Copyright = strdup("GPL");
+    Interleaved_Kite_descriptor->PortCount = INTERLEAVED_PORT_COUNT;
+    Interleaved_Kite_descriptor->PortDescriptors =
+            (const LADSPA_PortDescriptor *) port_descriptors;
+    Interleaved_Kite_descriptor->PortNames = (const char **) port_names;
+    Interleaved_Kite_descriptor->PortRangeHints =
+            (const LADSPA_PortRangeHint *) hints;
+
+    if (port_descriptors && port_names && hints)
+    {
+        port_descriptors[INTERLEAVED_INPUT] = LADSPA_PORT_INPUT |
+                LADSPA_PORT_AUDIO;
+        port_descriptors[INTERLEAVED_OUTPUT] = LADSPA_PORT_OUTPUT |
+                LADSPA_PORT_AUDIO;
+        port_descriptors[INTERLEAVED_SNAP_WINDOW] = LADSPA_PORT_INPUT |
+                LADSPA_PORT_CONTROL;
+
+        port_names[INTERLEAVED_INPUT] = strdup("Input (Interleaved Stereo)");
+        port_names[INTERLEAVED_OUTPUT] =
+                strdup("Output (Interleaved Stereo)");
+        port_names[INTERLEAVED_SNAP_WINDOW] =
+                strdup("Zero Crossing Search (samples)");
+
+        hints[INTERLEAVED_SNAP_WINDOW].HintDescriptor =
+                LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE |
+                LADSPA_HINT_INTEGER | LADSPA_HINT_DEFAULT_0;
+        hints[INTERLEAVED_SNAP_WINDOW].LowerBound = 0;
+        hints[INTERLEAVED_SNAP_WINDOW].UpperBound = KITE_MAX_SNAP_WINDOW;
+
+        InitCutRulePorts(port_descriptors, port_names, hints,
+                         INTERLEAVED_MIN_SECONDS);
+        InitMeterPorts(port_descriptors, port_names, hints,
+                       INTERLEAVED_PEAK_LEFT);
+        InitGroupPort(port_descriptors, port_names, hints, INTERLEAVED_GROUP);
+        InitLengthShapePort(port_descriptors, port_names, hints,
+                            INTERLEAVED_LENGTH_SHAPE);
+    }
+
+    Interleaved_Kite_descriptor->instantiate = instantiate_Kite;
+    Interleaved_Kite_descriptor->connect_port =
+            connect_port_to_Interleaved_Kite;
+    Interleaved_Kite_descriptor->run = run_Interleaved_Kite;
+    Interleaved_Kite_descriptor->run_adding = run_adding_Interleaved_Kite;
+    Interleaved_Kite_descriptor->set_run_adding_gain =
+            set_run_adding_gain_Kite;
+    Interleaved_Kite_descriptor->cleanup = cleanup_Kite;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Sets up the descriptor of the tape library version of Kite, which plays
+ * pieces of a sample bank instead of shuffling its input (so it has output
+ * ports only).  See instantiate_Tape_Library_Kite().
+ */
+void InitTapeLibraryDescriptor()
+{
+    Tape_Library_Kite_descriptor = (LADSPA_Descriptor *)
+            calloc(1, sizeof (LADSPA_Descriptor));
+    if (!Tape_Library_Kite_descriptor)
+        return;
+
+    LADSPA_PortDescriptor * port_descriptors = (LADSPA_PortDescriptor *)
+            calloc(TAPE_LIBRARY_PORT_COUNT, sizeof (LADSPA_PortDescriptor));
+    char ** port_names = (char **) calloc(TAPE_LIBRARY_PORT_COUNT,
+                                          sizeof (char *));
+    LADSPA_PortRangeHint * hints = (LADSPA_PortRangeHint *)
+            calloc(TAPE_LIBRARY_PORT_COUNT, sizeof (LADSPA_PortRangeHint));
+
+    Tape_Library_Kite_descriptor->UniqueID = TAPE_LIBRARY_UNIQUE_ID;
+    Tape_Library_Kite_descriptor->Label = strdup("Kite_Tape_Library");
+    Tape_Library_Kite_descriptor->Properties =
+            LADSPA_PROPERTY_HARD_RT_CAPABLE;
+    Tape_Library_Kite_descriptor->Name = strdup("Kite (tape library)");
+    Tape_Library_Kite_descriptor->Maker = strdup("Tyler Hayes (tgh@pdx.edu)");
+    Tape_Library_Kite_descriptor->Copyright = strdup("GPL");
+    Tape_Library_Kite_descriptor->PortCount = TAPE_LIBRARY_PORT_COUNT;
+    Tape_Library_Kite_descriptor->PortDescriptors =
+            (const LADSPA_PortDescriptor *) port_descriptors;
+    Tape_Library_Kite_descriptor->PortNames = (const char **) port_names;
+    Tape_Library_Kite_descriptor->PortRangeHints =
+            (const LADSPA_PortRangeHint *) hints;
+
+    if (port_descriptors && port_names && hints)
+    {
+        port_descriptors[TAPE_LIBRARY_OUTPUT_LEFT] = LADSPA_PORT_OUTPUT |
+                LADSPA_PORT_AUDIO;
+        port_descriptors[TAPE_LIBRARY_OUTPUT_RIGHT] = LADSPA_PORT_OUTPUT |
+                LADSPA_PORT_AUDIO;
+
+        port_names[TAPE_LIBRARY_OUTPUT_LEFT] = strdup("Output Left Channel");
+        port_names[TAPE_LIBRARY_OUTPUT_RIGHT] =
+                strdup("Output Right Channel");
+
+        InitCutRulePorts(port_descriptors, port_names, hints,
+                         TAPE_LIBRARY_MIN_SECONDS);
+        InitLengthShapePort(port_descriptors, port_names, hints,
+                            TAPE_LIBRARY_LENGTH_SHAPE);
+    }
+
+    Tape_Library_Kite_descriptor->instantiate = instantiate_Tape_Library_Kite;
+    Tape_Library_Kite_descriptor->connect_port =
+            connect_port_to_Tape_Library_Kite;
+    Tape_Library_Kite_descriptor->run = run_Tape_Library_Kite;
+    Tape_Library_Kite_descriptor->cleanup = cleanup_Kite;
+}
+
+//-----------------------------------------------------------------------------
+
 
 /*
  * The _init() function is called whenever this plugin is first loaded
@@ -410,8 +1311,13 @@ void _init()
          * LADSPA_PROPERTY_INPLACE_BROKEN, and LADSPA_PROPERTY_HARD_RT_CAPABLE.
          * They are just ints (1, 2, and 4, respectively).  See ladspa.h for
          * what they actually mean.
+         * NOTE: Kite reads its input in random order while writing the output,
+         * so it needs separate input and output buffers.  (The engine can
+         * cope with shared ones, but only by copying the input first, which
+         * would need memory allocated in run().)
          */
-        Kite_descriptor->Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE;
+        Kite_descriptor->Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE |
+                LADSPA_PROPERTY_INPLACE_BROKEN;
 
         // assign the plugin name
         Kite_descriptor->Name = strdup("Kite");
@@ -473,6 +1379,13 @@ void _init()
         temp_descriptor_array[KITE_OUTPUT_RIGHT] = LADSPA_PORT_OUTPUT |
                 LADSPA_PORT_AUDIO;
 
+        /*
+         * the snap window is a control port: one number the user sets,
+         * instead of a stream of samples.
+         */
+        temp_descriptor_array[KITE_SNAP_WINDOW] = LADSPA_PORT_INPUT |
+                LADSPA_PORT_CONTROL;
+
         /*
          * set temp_descriptor_array to NULL for housekeeping--we don't need
          * that local variable anymore.
@@ -503,6 +1416,10 @@ void _init()
         temp_port_names[KITE_OUTPUT_LEFT] = strdup("Output Left Channel");
         temp_port_names[KITE_OUTPUT_RIGHT] = strdup("Output Right Channel");
 
+        // set the name of the control port
+        temp_port_names[KITE_SNAP_WINDOW] =
+                strdup("Zero Crossing Search (samples)");
+
         // reset temp variable to NULL for housekeeping
         temp_port_names = NULL;
 
@@ -531,6 +1448,49 @@ void _init()
         temp_hints[KITE_OUTPUT_LEFT].HintDescriptor = 0;
         temp_hints[KITE_OUTPUT_RIGHT].HintDescriptor = 0;
 
+        /*
+         * the snap window is a whole number of samples, from 0 (off, the
+         * default) to the engine's limit.
+         */
+        temp_hints[KITE_SNAP_WINDOW].HintDescriptor =
+                LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE |
+                LADSPA_HINT_INTEGER | LADSPA_HINT_DEFAULT_0;
+        temp_hints[KITE_SNAP_WINDOW].LowerBound = 0;
+        temp_hints[KITE_SNAP_WINDOW].UpperBound = KITE_MAX_SNAP_WINDOW;
+
+        /*
+         * the cut rule control ports (see InitCutRulePorts()).
+         */
+        InitCutRulePorts((LADSPA_PortDescriptor *)
+                         Kite_descriptor->PortDescriptors,
+                         (char **) Kite_descriptor->PortNames, temp_hints,
+                         KITE_MIN_SECONDS);
+
+        /*
+         * and the meter ports, which are control ports run() writes to (see
+         * InitMeterPorts()).
+         */
+        InitMeterPorts((LADSPA_PortDescriptor *)
+                       Kite_descriptor->PortDescriptors,
+                       (char **) Kite_descriptor->PortNames, temp_hints,
+                       KITE_PEAK_LEFT);
+
+        /*
+         * and the group port (see InitGroupPort()).
+         */
+        InitGroupPort((LADSPA_PortDescriptor *)
+                      Kite_descriptor->PortDescriptors,
+                      (char **) Kite_descriptor->PortNames, temp_hints,
+                      KITE_GROUP);
+
+        /*
+         * and the length shape port (see InitLengthShapePort()).
+         */
+        InitLengthShapePort((LADSPA_PortDescriptor *)
+                            Kite_descriptor->PortDescriptors,
+                            (char **) Kite_descriptor->PortNames, temp_hints,
+                            KITE_LENGTH_SHAPE);
+
         // reset temp variable to NULL for housekeeping
         temp_hints = NULL;
 
@@ -539,11 +1499,15 @@ void _init()
         Kite_descriptor->connect_port = connect_port_to_Kite;
         Kite_descriptor->activate = NULL;
         Kite_descriptor->run = run_Kite;
-        Kite_descriptor->run_adding = NULL;
-        Kite_descriptor->set_run_adding_gain = NULL;
+        Kite_descriptor->run_adding = run_adding_Kite;
+        Kite_descriptor->set_run_adding_gain = set_run_adding_gain_Kite;
         Kite_descriptor->deactivate = NULL;
         Kite_descriptor->cleanup = cleanup_Kite;
     }
+
+    // and the interleaved and tape library versions
+    InitInterleavedDescriptor();
+    InitTapeLibraryDescriptor();
 }
 
 //-----------------------------------------------------------------------------
@@ -559,6 +1523,10 @@ const LADSPA_Descriptor * ladspa_descriptor(unsigned long index)
 {
     if (index == 0)
         return Kite_descriptor;
+    else if (index == 1)
+        return Interleaved_Kite_descriptor;
+    else if (index == 2)
+        return Tape_Library_Kite_descriptor;
     else
         return NULL;
 }
@@ -567,32 +1535,27 @@ const LADSPA_Descriptor * ladspa_descriptor(unsigned long index)
 
 
 /*
- * This is called automatically when the host quits (when this dynamic library
- * is unloaded).  It frees all dynamically allocated memory associated with
- * the descriptor.
+ * Frees a descriptor made by _init(), InitInterleavedDescriptor() or
+ * InitTapeLibraryDescriptor(), and everything in it.
  */
-void _fini()
+void FreeDescriptor(LADSPA_Descriptor * descriptor)
 {
-    if (Kite_descriptor)
+    if (descriptor)
     {
-        free((char *) Kite_descriptor->Label);
-        free((char *) Kite_descriptor->Name);
-        free((char *) Kite_descriptor->Maker);
-        free((char *) Kite_descriptor->Copyright);
-        free((LADSPA_PortDescriptor *) Kite_descriptor->PortDescriptors);
+        free((char *) descriptor->Label);
+        free((char *) descriptor->Name);
+        free((char *) descriptor->Maker);
+        free((char *) descriptor->Copyright);
+        free((LADSPA_PortDescriptor *) descriptor->PortDescriptors);
 
-        /*
-         * the for loop here is kind of unnecessary since the number of ports
-         * was hard coded for this plugin as 2, but whatever.
-         */
         int i = 0;
-        for (i = 0; i < Kite_descriptor->PortCount; ++i)
-            free((char *) (Kite_descriptor->PortNames[i]));
+        for (i = 0; descriptor->PortNames && i < descriptor->PortCount; ++i)
+            free((char *) (descriptor->PortNames[i]));
 
-        free((char **) Kite_descriptor->PortNames);
-        free((LADSPA_PortRangeHint *) Kite_descriptor->PortRangeHints);
+        free((char **) descriptor->PortNames);
+        free((LADSPA_PortRangeHint *) descriptor->PortRangeHints);
 
-        free(Kite_descriptor);
+        free(descriptor);
     }
 }
 
@@ -600,71 +1563,19 @@ void _fini()
 
 
 /*
- * This function uses random() to get a random unsigned long integer.  It is
- * seeded with the current time's seconds and nanoseconds in the instantiate()
- * function.
- */
-unsigned long GetRandomNaturalNumber(unsigned long lower_bound,
-                                     unsigned long upper_bound)
-{
-    unsigned long rand_num = 0;
-    // reduce the random number to between 0 and the sample size
-    rand_num = random() % (upper_bound - lower_bound + 1);
-    // force the random number to at least the lower bound
-    rand_num += lower_bound;
-
-    return rand_num;
-}
-
-//-----------------------------------------------------------------------------
-
-
-/*
- * This procedure takes a buffer (an array of floats) and resorts a subsection
- * of the array in reverse order based on the start and end indexes passed in.
+ * This is called automatically when the host quits (when this dynamic library
+ * is unloaded).  It frees all dynamically allocated memory associated with
+ * the descriptors.
  */
-void ApplyReverse(LADSPA_Data * buffer, unsigned long start, unsigned long end)
+void _fini()
 {
-    // a temporary holder of a value so the values in the indexes can be swapped
-    LADSPA_Data holder = 0.0f;
-    //swap the values in the indexes until the indexes meet in the middle
-    while (start <= end)
-    {
-        holder = buffer[start];
-        buffer[start] = buffer[end];
-        buffer[end] = holder;
-        ++start;
-        --end;
-    }
+    FreeDescriptor(Kite_descriptor);
+    FreeDescriptor(Interleaved_Kite_descriptor);
+    FreeDescriptor(Tape_Library_Kite_descriptor);
+    FreePool();
 }
 
 //-----------------------------------------------------------------------------
 
 
-/*
- * This procedure copies a section of an array of LADSPA_Data (floats) into a
- * section of another array.
- *
- * NOTE: the source endpoint IS copied.
- *
- * ASSUMPTIONS: the destination array does not end before the source section
- * ends.
- */
-void CopySubBlock(LADSPA_Data * destination, unsigned long dest_start,
-                  LADSPA_Data * source, unsigned long src_start,
-                  unsigned long src_end)
-{
-    if (dest_start == src_start || src_start > src_end)
-        return;
-
-    unsigned long dest_index = dest_start;
-    unsigned long src_index = 0;
-
-    for (src_index = src_start; src_index <= src_end; ++src_index)
-    {
-        destination[dest_index] = source[src_index];
-        ++dest_index;
-    }
-}
-
 // ------------------------------- EOF ----------------------------------------
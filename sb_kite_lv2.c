@@ -0,0 +1,740 @@
+/*
+ * Copyright © 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ * [This program is licensed under the GPL version 3 or later.]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ *
+ * The LV2 version of the Kite plugin (see sb_kite.c for the LADSPA one).  Both
+ * are thin wrappers around libkite, so they cut up sound the same way.
+ *
+ * The LV2 version does two things the LADSPA one can't:
+ *
+ * - It uses the LV2 worker extension to cut up the next buffer on a
+ *   non-real-time thread, while the current buffer is being played.  The
+ *   audio thread then only has to move the samples around.  If the host has
+ *   no worker (or the buffer size changes), run() just makes the plan
+ *   itself, which is still real-time safe.
+ * - It saves its seed and the plan it is using with the LV2 state extension,
+ *   so a saved session comes back cutting the same way.
+ *
+ * It also handles in-place processing (a host passing the same buffer for an
+ * input and an output), so unlike the LADSPA version it does not declare
+ * lv2:inPlaceBroken.  The ports and properties are described to hosts in
+ * sb_kite.lv2/sb_kite.ttl.
+ */
+
+
+//----------------
+//-- INCLUSIONS --
+//----------------
+#include <stdlib.h>
+#include <string.h>
+#include <lv2/core/lv2.h>
+#include <lv2/urid/urid.h>
+#include <lv2/atom/atom.h>
+#include <lv2/worker/worker.h>
+#include <lv2/state/state.h>
+#include "libkite.h"
+
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+/*
+ * These are the port numbers for the plugin (the same as sb_kite.c, and the
+ * lv2:index values in sb_kite.ttl)
+ */
+#define KITE_INPUT_LEFT 0
+#define KITE_INPUT_RIGHT 1
+#define KITE_OUTPUT_LEFT 2
+#define KITE_OUTPUT_RIGHT 3
+#define KITE_SNAP_WINDOW 4
+#define KITE_MIN_SECONDS 5
+#define KITE_MAX_SECONDS 6
+#define KITE_REVERSE_CHANCE 7
+#define KITE_PEAK_LEFT 8
+#define KITE_PEAK_RIGHT 9
+#define KITE_RMS_LEFT 10
+#define KITE_RMS_RIGHT 11
+#define KITE_GROUP 12
+#define KITE_LENGTH_SHAPE 13
+
+/*
+ * The URIs of the plugin and of the things it saves in its state
+ */
+#define KITE_URI "http://github.com/tgh/Kite"
+#define KITE__seed KITE_URI "#seed"
+#define KITE__plan KITE_URI "#plan"
+
+/*
+ * Other constants
+ */
+// the biggest buffer the plugin gets ready for when it is instantiated
+// (a host that sends more than this makes run() allocate memory)
+#define MAX_BLOCK_SIZE 1048576
+// the number of numbers per segment in a saved plan (see save_Kite())
+#define SAVED_SEGMENT_FIELDS 4
+// what the cut rule ports hold before run() has read them (no port can hold
+// this, so the first run() always passes them on to the engines)
+#define CUT_RULES_UNREAD -1.0f
+
+
+//-----------------------------
+//-- MESSAGES FOR THE WORKER --
+//-----------------------------
+
+/*
+ * What run() asks the worker for, and what the worker answers.  The
+ * generation is the Kite's generation when the request was made; a
+ * restored state starts a new one, so a plan cut before the restore is
+ * recognised (and thrown away) when it arrives after it.
+ */
+typedef struct
+{
+    uint32_t total_samples;
+    uint32_t generation;
+} WorkRequest;
+
+typedef struct
+{
+    int32_t result;
+    uint32_t generation;
+} WorkResponse;
+
+
+//--------------------------------
+//-- STRUCT FOR PORT CONNECTION --
+//--------------------------------
+
+
+typedef struct
+{
+    // the seed both Kite engines were last seeded from (saved in the state)
+    uint64_t seed;
+    // the Kite that moves the samples, on the audio thread
+    KiteEngine * engine;
+    // the Kite that cuts up the next buffer, on the worker thread
+    KiteEngine * planner;
+    // the host's worker (NULL if it doesn't have one)
+    LV2_Worker_Schedule * schedule;
+    // ON while the worker is making a plan
+    short work_pending;
+    // ON when the worker has made a plan that hasn't been used yet
+    short planner_ready;
+    // bumped by every restore, so the worker's answers to requests made
+    // before it can be told apart (see work_response_Kite())
+    uint32_t generation;
+    // ON when a restore happened while the worker was busy, so the planner
+    // still has to be re-seeded (run() does it once the worker is idle)
+    short planner_seed_stale;
+    // the URIDs (numbers the host gives URIs) used in the saved state
+    LV2_URID seed_key;
+    LV2_URID plan_key;
+    LV2_URID atom_Long;
+    LV2_URID atom_Vector;
+    // data locations for the input & output audio ports
+    const float * Input_Left;
+    const float * Input_Right;
+    float * Output_Left;
+    float * Output_Right;
+    // data location for the snap window control port
+    const float * Snap_Window;
+    // data locations for the cut rule control ports
+    const float * Min_Seconds;
+    const float * Max_Seconds;
+    const float * Reverse_Chance;
+    const float * Length_Shape;
+    // the cut rule port values the engines were last given
+    float min_seconds;
+    float max_seconds;
+    float reverse_chance;
+    float length_shape;
+    // ON when the planner hasn't been given the latest cut rules yet
+    short planner_rules_stale;
+    // data locations for the meter control ports (outputs)
+    float * Peak_Left;
+    float * Peak_Right;
+    float * Rms_Left;
+    float * Rms_Right;
+    // data location for the group control port
+    const float * Group;
+} Kite;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// seeds and sets up both Kite engines
+static int ConfigureKite(Kite * kite, uint64_t seed);
+
+// seeds and sets up the audio engine only
+static int ConfigureEngine(Kite * kite, uint64_t seed);
+
+// frees a Kite and its engines
+static void cleanup_Kite(LV2_Handle instance);
+
+// passes the cut rule ports on to the engines, if they have changed
+static void ReadCutRules(Kite * kite);
+
+
+//---------------
+//-- FUNCTIONS --
+//---------------
+
+
+/*
+ * Creates a plugin instance.  The host must give us its URID map (for the
+ * saved state); the worker is optional.
+ */
+static LV2_Handle instantiate_Kite(const LV2_Descriptor * descriptor,
+                                   double sample_rate,
+                                   const char * bundle_path,
+                                   const LV2_Feature * const * features)
+{
+    LV2_URID_Map * map = NULL;
+    LV2_Worker_Schedule * schedule = NULL;
+    int i = 0;
+
+    for (i = 0; features && features[i]; ++i)
+    {
+        if (strcmp(features[i]->URI, LV2_URID__map) == 0)
+            map = (LV2_URID_Map *) features[i]->data;
+        else if (strcmp(features[i]->URI, LV2_WORKER__schedule) == 0)
+            schedule = (LV2_Worker_Schedule *) features[i]->data;
+    }
+    if (!map || sample_rate < 1.0)
+        return NULL;
+
+    Kite * kite = (Kite *) calloc(1, sizeof (Kite));
+    if (!kite)
+        return NULL;
+
+    kite->schedule = schedule;
+    kite->seed_key = map->map(map->handle, KITE__seed);
+    kite->plan_key = map->map(map->handle, KITE__plan);
+    kite->atom_Long = map->map(map->handle, LV2_ATOM__Long);
+    kite->atom_Vector = map->map(map->handle, LV2_ATOM__Vector);
+
+    /*
+     * create the Kite engines.  Like the LADSPA version, a new instance is
+     * seeded with the current time (until a saved state says otherwise).
+     */
+    KiteSettings settings;
+    KiteDefaultSettings(&settings);
+    kite->engine = KiteCreate((unsigned long) sample_rate);
+    kite->planner = KiteCreate((unsigned long) sample_rate);
+    if (!kite->engine || !kite->planner ||
+        ConfigureKite(kite, settings.seed) != KITE_OK)
+    {
+        cleanup_Kite(kite);
+        return NULL;
+    }
+
+    return kite;
+}
+
+//-----------------------------------------------------------------------------
+
+
+static void connect_port_to_Kite(LV2_Handle instance, uint32_t port,
+                                 void * data_location)
+{
+    Kite * kite = (Kite *) instance;
+
+    switch (port)
+    {
+        case KITE_INPUT_LEFT:
+            kite->Input_Left = (const float *) data_location;
+            break;
+        case KITE_INPUT_RIGHT:
+            kite->Input_Right = (const float *) data_location;
+            break;
+        case KITE_OUTPUT_LEFT:
+            kite->Output_Left = (float *) data_location;
+            break;
+        case KITE_OUTPUT_RIGHT:
+            kite->Output_Right = (float *) data_location;
+            break;
+        case KITE_SNAP_WINDOW:
+            kite->Snap_Window = (const float *) data_location;
+            break;
+        case KITE_MIN_SECONDS:
+            kite->Min_Seconds = (const float *) data_location;
+            break;
+        case KITE_MAX_SECONDS:
+            kite->Max_Seconds = (const float *) data_location;
+            break;
+        case KITE_REVERSE_CHANCE:
+            kite->Reverse_Chance = (const float *) data_location;
+            break;
+        case KITE_PEAK_LEFT:
+            kite->Peak_Left = (float *) data_location;
+            break;
+        case KITE_PEAK_RIGHT:
+            kite->Peak_Right = (float *) data_location;
+            break;
+        case KITE_RMS_LEFT:
+            kite->Rms_Left = (float *) data_location;
+            break;
+        case KITE_RMS_RIGHT:
+            kite->Rms_Right = (float *) data_location;
+            break;
+        case KITE_GROUP:
+            kite->Group = (const float *) data_location;
+            break;
+        case KITE_LENGTH_SHAPE:
+            kite->Length_Shape = (const float *) data_location;
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Shuffles the buffer, using the plan the worker made for it if there is
+ * one, and then asks the worker to cut up the next buffer (guessing it will
+ * be the same size as this one, which it almost always is).
+ */
+static void run_Kite(LV2_Handle instance, uint32_t total_samples)
+{
+    Kite * kite = (Kite *) instance;
+
+    if (total_samples == 0)
+        return;
+
+    ReadCutRules(kite);
+
+    /*
+     * the group of Kites to cut the same as (0, or an unconnected port, is
+     * none).  A Kite in a group takes its plans from the group instead of
+     * the worker.
+     */
+    float group = kite->Group ? *kite->Group : 0.0f;
+    if (group > (float) KITE_MAX_GROUPS)
+        group = (float) KITE_MAX_GROUPS;
+    unsigned long group_number = group > 0.0f ?
+            (unsigned long) (group + 0.5f) : 0;
+    KiteSetGroup(kite->engine, group_number);
+
+    /*
+     * the worker's plan can only be read here, between its response and the
+     * next request, since the worker thread is done with it.  If the buffer
+     * size or the cut rules changed it is no good to us, and the engine
+     * makes its own.
+     */
+    if (kite->planner_rules_stale || kite->planner_seed_stale ||
+        group_number != 0)
+        kite->planner_ready = OFF;
+    if (kite->planner_ready)
+    {
+        const KitePlan * plan = KiteGetPlan(kite->planner);
+        if (plan->total_samples == total_samples)
+            KiteUsePlan(kite->engine, plan);
+        kite->planner_ready = OFF;
+    }
+
+    // how far cuts may move to find a zero crossing (0 if unconnected)
+    float snap_window = kite->Snap_Window ? *kite->Snap_Window : 0.0f;
+    if (snap_window > (float) KITE_MAX_SNAP_WINDOW)
+        snap_window = (float) KITE_MAX_SNAP_WINDOW;
+    KiteSetSnapWindow(kite->engine, snap_window > 0.0f ?
+                      (unsigned long) (snap_window + 0.5f) : 0);
+
+    const float * inputs[2] = { kite->Input_Left, kite->Input_Right };
+    float * outputs[2] = { kite->Output_Left, kite->Output_Right };
+
+    // the meters are worked out by the copy, if anything is listening
+    if (kite->Peak_Left || kite->Peak_Right || kite->Rms_Left ||
+        kite->Rms_Right)
+    {
+        float peaks[2];
+        float rms[2];
+        if (KiteProcessMetered(kite->engine, inputs, outputs, 2,
+                               total_samples, peaks, rms) == KITE_OK)
+        {
+            if (kite->Peak_Left)
+                *kite->Peak_Left = peaks[0];
+            if (kite->Peak_Right)
+                *kite->Peak_Right = peaks[1];
+            if (kite->Rms_Left)
+                *kite->Rms_Left = rms[0];
+            if (kite->Rms_Right)
+                *kite->Rms_Right = rms[1];
+        }
+    }
+    else
+        KiteProcess(kite->engine, inputs, outputs, 2, total_samples);
+
+    if (kite->schedule && !kite->work_pending && group_number == 0)
+    {
+        // the worker is idle, so the planner can be changed now
+        if (kite->planner_seed_stale)
+        {
+            KiteSetSeed(kite->planner, kite->seed);
+            kite->planner_seed_stale = OFF;
+        }
+        if (kite->planner_rules_stale)
+        {
+            KiteSetCutRules(kite->planner, kite->min_seconds,
+                            kite->max_seconds, kite->reverse_chance);
+            KiteSetLengthShape(kite->planner,
+                               (int) (kite->length_shape + 0.5f));
+            kite->planner_rules_stale = OFF;
+        }
+
+        WorkRequest request;
+        request.total_samples = total_samples;
+        request.generation = kite->generation;
+        if (kite->schedule->schedule_work(kite->schedule->handle,
+                                          sizeof (request), &request) ==
+            LV2_WORKER_SUCCESS)
+            kite->work_pending = ON;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Passes the cut rule control ports' values on to the audio engine, but only
+ * if one of them has changed since the last run(), since the engine works
+ * out the sub-block lengths in samples and the reverse chance as a fraction
+ * from them.  The planner belongs to the worker thread while it is working,
+ * so it is only marked as needing the new rules; run() gives them to it
+ * before asking the worker for the next plan.  An unconnected port counts
+ * as the engine's default.  The length shape port is read the same way, and
+ * compiled into an alias table (see KiteSetLengthShape()) only when it
+ * changes.
+ */
+static void ReadCutRules(Kite * kite)
+{
+    float min_seconds = kite->Min_Seconds ? *kite->Min_Seconds :
+            (float) KITE_DEFAULT_MIN_SECONDS;
+    float max_seconds = kite->Max_Seconds ? *kite->Max_Seconds :
+            (float) KITE_DEFAULT_MAX_SECONDS;
+    float reverse_chance = kite->Reverse_Chance ? *kite->Reverse_Chance :
+            (float) KITE_DEFAULT_REVERSE_CHANCE;
+    float length_shape = kite->Length_Shape ? *kite->Length_Shape :
+            (float) KITE_LENGTHS_EVEN;
+
+    if (min_seconds == kite->min_seconds &&
+        max_seconds == kite->max_seconds &&
+        reverse_chance == kite->reverse_chance &&
+        length_shape == kite->length_shape)
+        return;
+
+    if (length_shape != kite->length_shape)
+        KiteSetLengthShape(kite->engine, (int) (length_shape + 0.5f));
+    kite->min_seconds = min_seconds;
+    kite->max_seconds = max_seconds;
+    kite->reverse_chance = reverse_chance;
+    kite->length_shape = length_shape;
+    KiteSetCutRules(kite->engine, min_seconds, max_seconds, reverse_chance);
+    kite->planner_rules_stale = ON;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Frees dynamic memory associated with the plugin instance.
+ */
+static void cleanup_Kite(LV2_Handle instance)
+{
+    Kite * kite = (Kite *) instance;
+
+    if (kite)
+    {
+        KiteDestroy(kite->engine);
+        KiteDestroy(kite->planner);
+        free(kite);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Runs on the host's worker thread: cuts up the number of samples run()
+ * asked for.  The plan stays in the planner until run() picks it up.  The
+ * request's generation is passed back with the answer.
+ */
+static LV2_Worker_Status work_Kite(LV2_Handle instance,
+                                   LV2_Worker_Respond_Function respond,
+                                   LV2_Worker_Respond_Handle handle,
+                                   uint32_t size, const void * data)
+{
+    Kite * kite = (Kite *) instance;
+    WorkRequest request;
+    WorkResponse response;
+
+    if (size != sizeof (request))
+        return LV2_WORKER_ERR_UNKNOWN;
+    memcpy(&request, data, sizeof (request));
+
+    response.result = KiteMakePlan(kite->planner, request.total_samples);
+    response.generation = request.generation;
+
+    return respond(handle, sizeof (response), &response);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Runs on the audio thread when the worker is done.  Either way the worker
+ * has let go of the planner, but a plan asked for before the last restore
+ * was cut with the old seed, so it is not used.
+ */
+static LV2_Worker_Status work_response_Kite(LV2_Handle instance,
+                                            uint32_t size, const void * body)
+{
+    Kite * kite = (Kite *) instance;
+    WorkResponse response;
+
+    response.result = KITE_ERROR;
+    response.generation = kite->generation;
+    if (size == sizeof (response))
+        memcpy(&response, body, sizeof (response));
+
+    kite->work_pending = OFF;
+    kite->planner_ready = response.result == KITE_OK &&
+            response.generation == kite->generation ? ON : OFF;
+
+    return LV2_WORKER_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Saves the seed, and the plan the engine is using, as a vector of 64-bit
+ * numbers: the plan's sample count, and then the source start, destination
+ * start, length and reverse flag of every segment.
+ * NOTE: this reads the engine's plan, so hosts must not call it at the same
+ * time as run() (none of the common ones do; they save between cycles).
+ */
+static LV2_State_Status save_Kite(LV2_Handle instance,
+                                  LV2_State_Store_Function store,
+                                  LV2_State_Handle handle, uint32_t flags,
+                                  const LV2_Feature * const * features)
+{
+    Kite * kite = (Kite *) instance;
+    const KitePlan * plan = KiteGetPlan(kite->engine);
+    unsigned long i = 0;
+
+    int64_t seed = (int64_t) kite->seed;
+    LV2_State_Status status = store(handle, kite->seed_key, &seed,
+                                    sizeof (seed), kite->atom_Long,
+                                    LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+    if (status != LV2_STATE_SUCCESS)
+        return status;
+
+    unsigned long count = 1 + SAVED_SEGMENT_FIELDS * plan->segment_count;
+    size_t size = sizeof (LV2_Atom_Vector_Body) + count * sizeof (int64_t);
+    LV2_Atom_Vector_Body * vector = (LV2_Atom_Vector_Body *) malloc(size);
+    if (!vector)
+        return LV2_STATE_ERR_NO_SPACE;
+
+    vector->child_size = sizeof (int64_t);
+    vector->child_type = kite->atom_Long;
+    int64_t * numbers = (int64_t *) (vector + 1);
+    numbers[0] = (int64_t) plan->total_samples;
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
+        int64_t * saved = numbers + 1 + SAVED_SEGMENT_FIELDS * i;
+        saved[0] = (int64_t) segment->source_start;
+        saved[1] = (int64_t) segment->dest_start;
+        saved[2] = (int64_t) segment->length;
+        saved[3] = (int64_t) segment->reverse;
+    }
+
+    status = store(handle, kite->plan_key, vector, size, kite->atom_Vector,
+                   LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+    free(vector);
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Restores what save_Kite() saved.  The engines are re-seeded with the saved
+ * seed, and the saved plan (if it is usable) is used for the next buffer of
+ * its size.  A missing or broken plan is not an error; the Kite just makes a
+ * new one.  The host doesn't call this during run(), but the worker may
+ * still be cutting a plan with the planner, so the planner is only
+ * re-seeded here if the worker is idle; otherwise run() does it once the
+ * worker has answered (see work_response_Kite()).
+ */
+static LV2_State_Status restore_Kite(LV2_Handle instance,
+                                     LV2_State_Retrieve_Function retrieve,
+                                     LV2_State_Handle handle, uint32_t flags,
+                                     const LV2_Feature * const * features)
+{
+    Kite * kite = (Kite *) instance;
+    size_t size = 0;
+    uint32_t type = 0;
+    uint32_t value_flags = 0;
+    unsigned long i = 0;
+
+    const void * value = retrieve(handle, kite->seed_key, &size, &type,
+                                  &value_flags);
+    if (value && type == kite->atom_Long && size == sizeof (int64_t))
+    {
+        int64_t seed = 0;
+        memcpy(&seed, value, sizeof (seed));
+        ++kite->generation;
+        if (ConfigureEngine(kite, (uint64_t) seed) != KITE_OK)
+            return LV2_STATE_ERR_UNKNOWN;
+        if (kite->work_pending)
+            kite->planner_seed_stale = ON;
+        else
+        {
+            KiteSetSeed(kite->planner, kite->seed);
+            kite->planner_seed_stale = OFF;
+        }
+    }
+
+    value = retrieve(handle, kite->plan_key, &size, &type, &value_flags);
+    if (!value || type != kite->atom_Vector ||
+        size < sizeof (LV2_Atom_Vector_Body) + sizeof (int64_t))
+        return LV2_STATE_SUCCESS;
+
+    const LV2_Atom_Vector_Body * vector = (const LV2_Atom_Vector_Body *)
+            value;
+    unsigned long count = (size - sizeof (LV2_Atom_Vector_Body)) /
+            sizeof (int64_t);
+    if (vector->child_size != sizeof (int64_t) ||
+        vector->child_type != kite->atom_Long ||
+        (count - 1) % SAVED_SEGMENT_FIELDS != 0)
+        return LV2_STATE_SUCCESS;
+
+    const int64_t * numbers = (const int64_t *) (vector + 1);
+    KitePlan plan;
+    if (KiteInitPlan(&plan, (count - 1) / SAVED_SEGMENT_FIELDS) != KITE_OK)
+        return LV2_STATE_ERR_NO_SPACE;
+
+    plan.total_samples = (unsigned long) numbers[0];
+    plan.segment_count = (count - 1) / SAVED_SEGMENT_FIELDS;
+    for (i = 0; i < plan.segment_count; ++i)
+    {
+        const int64_t * saved = numbers + 1 + SAVED_SEGMENT_FIELDS * i;
+        plan.segments[i].source_start = (unsigned long) saved[0];
+        plan.segments[i].dest_start = (unsigned long) saved[1];
+        plan.segments[i].length = (unsigned long) saved[2];
+        plan.segments[i].reverse = saved[3] ? ON : OFF;
+    }
+    // KiteUsePlan() checks the plan, and ignores it if it's broken
+    KiteUsePlan(kite->engine, &plan);
+    KiteFreePlan(&plan);
+
+    return LV2_STATE_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Tells the host about the worker and state interfaces.
+ */
+static const void * extension_data_Kite(const char * uri)
+{
+    static const LV2_Worker_Interface worker = { work_Kite,
+                                                 work_response_Kite, NULL };
+    static const LV2_State_Interface state = { save_Kite, restore_Kite };
+
+    if (strcmp(uri, LV2_WORKER__interface) == 0)
+        return &worker;
+    if (strcmp(uri, LV2_STATE__interface) == 0)
+        return &state;
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Seeds both engines and gets them ready for the biggest buffer we expect,
+ * so neither run() nor the worker has to allocate memory.  This is only
+ * called before the worker has been given anything to do.
+ */
+static int ConfigureKite(Kite * kite, uint64_t seed)
+{
+    KiteSettings settings;
+
+    KiteDefaultSettings(&settings);
+    settings.max_samples = MAX_BLOCK_SIZE;
+    settings.seed = seed;
+    if (KiteConfigure(kite->planner, &settings) != KITE_OK)
+        return KITE_ERROR;
+
+    return ConfigureEngine(kite, seed);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * (Re-)seeds the audio engine and gets it ready for the biggest buffer we
+ * expect.  It only cuts buffers itself when the worker's plan doesn't fit,
+ * and it gets a different seed from the planner so it doesn't repeat the
+ * worker's cuts.  It is also given scratch space for in-place processing.
+ */
+static int ConfigureEngine(Kite * kite, uint64_t seed)
+{
+    KiteSettings settings;
+
+    KiteDefaultSettings(&settings);
+    settings.max_samples = MAX_BLOCK_SIZE;
+    settings.seed = seed + 1;
+    settings.in_place = ON;
+    if (KiteConfigure(kite->engine, &settings) != KITE_OK)
+        return KITE_ERROR;
+
+    kite->seed = seed;
+    kite->planner_ready = OFF;
+    // the engine is back to the default cut rules, so the ports need
+    // reading again (which passes them on to the planner too)
+    kite->min_seconds = CUT_RULES_UNREAD;
+    kite->max_seconds = CUT_RULES_UNREAD;
+    kite->reverse_chance = CUT_RULES_UNREAD;
+    kite->length_shape = CUT_RULES_UNREAD;
+    return KITE_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * The plugin's descriptor.  Unlike LADSPA, LV2 describes the ports in the
+ * .ttl files, so this is all the host needs from the .so.
+ */
+static const LV2_Descriptor Kite_descriptor =
+{
+    KITE_URI,
+    instantiate_Kite,
+    connect_port_to_Kite,
+    NULL,
+    run_Kite,
+    NULL,
+    cleanup_Kite,
+    extension_data_Kite
+};
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Returns the descriptor of the plugin (there is only one).
+ */
+LV2_SYMBOL_EXPORT const LV2_Descriptor * lv2_descriptor(uint32_t index)
+{
+    return index == 0 ? &Kite_descriptor : NULL;
+}
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ *
+ * Deadline Soak Test Driver
+ *
+ * This is a long-running driver that loads a Kite plugin like a host would,
+ * makes a bunch of instances at several sample rates, and calls their run()
+ * over and over with buffer sizes that jitter around like a real host's do
+ * (from 16 to 4096 frames, with the odd 0 or 1 sample call thrown in to hit
+ * the early returns).
+ *
+ * Every call is timed against its real-time deadline, which is how long the
+ * buffer takes to play (frames / sample rate).  At the end it prints a
+ * histogram of how much of the deadline the calls used, the number of missed
+ * deadlines, and the parameters of the worst call, since the worst case (not
+ * the average) is what causes dropouts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <ladspa.h>
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+// largest buffer a call can get
+#define MAX_FRAMES 4096
+// defaults for the command line arguments
+#define DEFAULT_SECONDS 60
+#define DEFAULT_INSTANCES 64
+// out of this many calls, one is a 0 or 1 sample call
+#define TINY_CALL_ODDS 100
+// number of histogram buckets (see BUCKET_LIMITS)
+#define BUCKET_COUNT 8
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+// the sample rates the instances are spread over
+static const unsigned long SAMPLE_RATES[] = { 22050, 44100, 48000, 88200,
+                                              96000, 192000 };
+#define RATE_COUNT (sizeof (SAMPLE_RATES) / sizeof (unsigned long))
+
+// the nominal host buffer sizes; each call jitters below one of these
+static const unsigned long BUFFER_SIZES[] = { 16, 32, 64, 128, 256, 512,
+                                              1024, 2048, 4096 };
+#define SIZE_COUNT (sizeof (BUFFER_SIZES) / sizeof (unsigned long))
+
+// upper limits of the histogram buckets, as a fraction of the deadline.
+// the last bucket is everything over the deadline (a miss)
+static const double BUCKET_LIMITS[BUCKET_COUNT - 1] = { 0.001, 0.01, 0.05,
+                                                        0.10, 0.25, 0.50,
+                                                        1.00 };
+
+
+//------------------------
+//-- STRUCT DEFINITIONS --
+//------------------------
+
+typedef struct
+{
+    LADSPA_Handle handle;
+    unsigned long sample_rate;
+    // one buffer per port (control ports only use the first value)
+    LADSPA_Data ** buffers;
+} Instance;
+
+// the worst call seen so far
+typedef struct
+{
+    double ratio;
+    double seconds;
+    unsigned long instance;
+    unsigned long sample_rate;
+    unsigned long frames;
+} WorstCall;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// seconds on the monotonic clock
+double Now(void);
+
+// the value a host gives a control port that it hasn't been told to set
+LADSPA_Data DefaultValue(const LADSPA_PortRangeHint * hint,
+                         unsigned long sample_rate);
+
+// sets up an instance of the plugin, with its own buffers
+int CreateInstance(const LADSPA_Descriptor * descriptor, Instance * instance,
+                   unsigned long sample_rate);
+
+// frees an instance and its buffers
+void DestroyInstance(const LADSPA_Descriptor * descriptor,
+                     Instance * instance);
+
+
+//----------
+//-- MAIN --
+//----------
+/*
+ * takes the plugin .so, and optionally the number of seconds to run for, the
+ * number of instances and a seed for the random buffer sizes.
+ */
+int main(int argc, char * argv[])
+{
+    if (argc < 2 || argc > 5)
+    {
+        printf("\nUsage: %s plugin.so [seconds [instances [seed]]]\n",
+               argv[0]);
+        exit(-1);
+    }
+
+    double seconds = argc > 2 ? atof(argv[2]) : DEFAULT_SECONDS;
+    unsigned long instance_count = argc > 3 ? strtoul(argv[3], NULL, 10) :
+            DEFAULT_INSTANCES;
+    unsigned long seed = argc > 4 ? strtoul(argv[4], NULL, 10) :
+            (unsigned long) time(NULL);
+    if (instance_count == 0)
+        instance_count = 1;
+    srandom(seed);
+
+    // load the plugin
+    void * library = dlopen(argv[1], RTLD_NOW);
+    if (!library)
+    {
+        printf("\nCould not load %s: %s\n", argv[1], dlerror());
+        exit(-1);
+    }
+    LADSPA_Descriptor_Function get_descriptor = (LADSPA_Descriptor_Function)
+            dlsym(library, "ladspa_descriptor");
+    const LADSPA_Descriptor * descriptor = get_descriptor ?
+            get_descriptor(0) : NULL;
+    if (!descriptor)
+    {
+        printf("\n%s has no plugin descriptor\n", argv[1]);
+        exit(-1);
+    }
+
+    // make the instances, spread evenly over the sample rates
+    Instance * instances = calloc(instance_count, sizeof (Instance));
+    if (!instances)
+        exit(-1);
+    unsigned long i = 0;
+    for (i = 0; i < instance_count; ++i)
+    {
+        if (CreateInstance(descriptor, &instances[i],
+                           SAMPLE_RATES[i % RATE_COUNT]) != 0)
+        {
+            printf("\nCould not create instance %lu\n", i);
+            exit(-1);
+        }
+    }
+
+    unsigned long histogram[BUCKET_COUNT];
+    memset(histogram, 0, sizeof (histogram));
+    WorstCall worst;
+    memset(&worst, 0, sizeof (worst));
+    unsigned long calls = 0;
+    double busy_seconds = 0.0;
+    double audio_seconds = 0.0;
+
+    printf("\nSoaking %s: %lu instances, %.0f seconds, seed %lu\n",
+           descriptor->Label, instance_count, seconds, seed);
+
+    double end_time = Now() + seconds;
+    while (Now() < end_time)
+    {
+        // a host cycle: every instance gets the same buffer size
+        unsigned long frames = BUFFER_SIZES[random() % SIZE_COUNT];
+        // hosts with odd period sizes hand out anything up to the nominal
+        // size
+        frames -= random() % (frames / 2 + 1);
+        // and once in a while a buggy host sends 0 or 1 samples
+        if (random() % TINY_CALL_ODDS == 0)
+            frames = random() % 2;
+
+        for (i = 0; i < instance_count; ++i)
+        {
+            Instance * instance = &instances[i];
+            // the time the buffer takes to play (at least 1 sample's worth)
+            double deadline = (double) (frames ? frames : 1) /
+                    instance->sample_rate;
+
+            double start = Now();
+            descriptor->run(instance->handle, frames);
+            double elapsed = Now() - start;
+
+            double ratio = elapsed / deadline;
+            unsigned long bucket = 0;
+            while (bucket < BUCKET_COUNT - 1 && ratio > BUCKET_LIMITS[bucket])
+                ++bucket;
+            ++histogram[bucket];
+
+            if (ratio > worst.ratio)
+            {
+                worst.ratio = ratio;
+                worst.seconds = elapsed;
+                worst.instance = i;
+                worst.sample_rate = instance->sample_rate;
+                worst.frames = frames;
+            }
+
+            ++calls;
+            busy_seconds += elapsed;
+            audio_seconds += (double) frames / instance->sample_rate;
+        }
+    }
+
+    // print the report
+    printf("\n%lu calls, %.3f s of audio in %.3f s of run() (%.3f%% load)\n",
+           calls, audio_seconds, busy_seconds,
+           audio_seconds > 0 ? 100.0 * busy_seconds / audio_seconds : 0.0);
+    printf("\nShare of deadline used per call:\n");
+    for (i = 0; i < BUCKET_COUNT; ++i)
+    {
+        if (i < BUCKET_COUNT - 1)
+            printf("  <= %6.1f%% : %lu\n", 100.0 * BUCKET_LIMITS[i],
+                   histogram[i]);
+        else
+            printf("  MISSED    : %lu\n", histogram[i]);
+    }
+    printf("\nWorst call: %.1f%% of deadline (%.1f us), instance %lu, ",
+           100.0 * worst.ratio, worst.seconds * 1e6, worst.instance);
+    printf("%lu Hz, %lu frames\n", worst.sample_rate, worst.frames);
+
+    for (i = 0; i < instance_count; ++i)
+        DestroyInstance(descriptor, &instances[i]);
+    free(instances);
+    dlclose(library);
+
+    return histogram[BUCKET_COUNT - 1] ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Returns the monotonic clock in seconds.
+ */
+double Now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Works out a control port's default the way a host does from its hints
+ * (LADSPA_HINT_DEFAULT_LOW is a quarter of the way up the range, or of the
+ * way up its logarithm for a logarithmic port, and bounds marked
+ * LADSPA_HINT_SAMPLE_RATE are multiplied by it).  A port with no default
+ * gets its lower bound, or 0 if it has none.
+ */
+LADSPA_Data DefaultValue(const LADSPA_PortRangeHint * hint,
+                         unsigned long sample_rate)
+{
+    LADSPA_PortRangeHintDescriptor hints = hint->HintDescriptor;
+    double lower = hint->LowerBound;
+    double upper = hint->UpperBound;
+    double fraction = 0.0;
+
+    if (LADSPA_IS_HINT_SAMPLE_RATE(hints))
+    {
+        lower *= sample_rate;
+        upper *= sample_rate;
+    }
+
+    switch (hints & LADSPA_HINT_DEFAULT_MASK)
+    {
+        case LADSPA_HINT_DEFAULT_MINIMUM:
+            return (LADSPA_Data) lower;
+        case LADSPA_HINT_DEFAULT_LOW:
+            fraction = 0.25;
+            break;
+        case LADSPA_HINT_DEFAULT_MIDDLE:
+            fraction = 0.5;
+            break;
+        case LADSPA_HINT_DEFAULT_HIGH:
+            fraction = 0.75;
+            break;
+        case LADSPA_HINT_DEFAULT_MAXIMUM:
+            return (LADSPA_Data) upper;
+        case LADSPA_HINT_DEFAULT_0:
+            return 0.0f;
+        case LADSPA_HINT_DEFAULT_1:
+            return 1.0f;
+        case LADSPA_HINT_DEFAULT_100:
+            return 100.0f;
+        case LADSPA_HINT_DEFAULT_440:
+            return 440.0f;
+        default:
+            return LADSPA_IS_HINT_BOUNDED_BELOW(hints) ?
+                    (LADSPA_Data) lower : 0.0f;
+    }
+
+    if (LADSPA_IS_HINT_LOGARITHMIC(hints) && lower > 0.0 && upper > 0.0)
+        return (LADSPA_Data) exp(log(lower) * (1.0 - fraction) +
+                                 log(upper) * fraction);
+    return (LADSPA_Data) (lower * (1.0 - fraction) + upper * fraction);
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Instantiates the plugin, gives every port its own buffer, fills the audio
+ * inputs with noise, sets control inputs to their defaults (see
+ * DefaultValue()), as a host would, and activates it.  Returns 0 on
+ * success.
+ */
+int CreateInstance(const LADSPA_Descriptor * descriptor, Instance * instance,
+                   unsigned long sample_rate)
+{
+    unsigned long port = 0;
+    unsigned long i = 0;
+
+    instance->sample_rate = sample_rate;
+    instance->handle = descriptor->instantiate(descriptor, sample_rate);
+    instance->buffers = calloc(descriptor->PortCount, sizeof (LADSPA_Data *));
+    if (!instance->handle || !instance->buffers)
+        return -1;
+
+    for (port = 0; port < descriptor->PortCount; ++port)
+    {
+        LADSPA_PortDescriptor kind = descriptor->PortDescriptors[port];
+        const LADSPA_PortRangeHint * hint = &descriptor->PortRangeHints[port];
+
+        instance->buffers[port] = calloc(MAX_FRAMES, sizeof (LADSPA_Data));
+        if (!instance->buffers[port])
+            return -1;
+
+        if (LADSPA_IS_PORT_AUDIO(kind) && LADSPA_IS_PORT_INPUT(kind))
+            for (i = 0; i < MAX_FRAMES; ++i)
+                instance->buffers[port][i] = (LADSPA_Data) random() /
+                        RAND_MAX * 2.0f - 1.0f;
+        else if (LADSPA_IS_PORT_CONTROL(kind) && LADSPA_IS_PORT_INPUT(kind))
+            instance->buffers[port][0] = DefaultValue(hint, sample_rate);
+
+        descriptor->connect_port(instance->handle, port,
+                                 instance->buffers[port]);
+    }
+
+    if (descriptor->activate)
+        descriptor->activate(instance->handle);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Deactivates and cleans up an instance, and frees its buffers.
+ */
+void DestroyInstance(const LADSPA_Descriptor * descriptor,
+                     Instance * instance)
+{
+    unsigned long port = 0;
+
+    if (descriptor->deactivate)
+        descriptor->deactivate(instance->handle);
+    descriptor->cleanup(instance->handle);
+
+    for (port = 0; port < descriptor->PortCount; ++port)
+        free(instance->buffers[port]);
+    free(instance->buffers);
+}
+
+// ------------------------------- EOF ----------------------------------------
@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) 2009 Tyler Hayes
+ * ALL RIGHTS RESERVED
+ *
+ * LV2 State Test Driver
+ *
+ * Loads the LV2 Kite like a host would, with a fake URID map, a worker that
+ * runs when the driver says so (between run() calls, the way a host's
+ * worker thread answers), and a state store kept in memory.
+ *
+ * One instance is run for a few buffers, its state is saved, and the state
+ * is restored into it while the worker is still busy with a plan asked for
+ * before the save (which it then finishes, late).  The same state is
+ * restored into a fresh instance.  Given the same input, both must then put
+ * out the buffer the first instance put out when it was saved, and after
+ * that the same buffers as each other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <lv2/core/lv2.h>
+#include <lv2/urid/urid.h>
+#include <lv2/worker/worker.h>
+#include <lv2/state/state.h>
+
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
+
+#define SAMPLE_RATE 44100
+#define FRAMES 4096
+// buffers run before the state is saved, and compared after the restore
+#define BUFFERS_BEFORE 4
+#define BUFFERS_AFTER 8
+// the most URIs and saved properties the fake host keeps
+#define MAX_URIS 16
+#define MAX_PROPERTIES 8
+// the biggest worker message the fake host passes on
+#define MAX_MESSAGE 64
+// the port numbers (the lv2:index values in sb_kite.ttl)
+#define PORT_COUNT 14
+#define INPUT_LEFT 0
+#define INPUT_RIGHT 1
+#define OUTPUT_LEFT 2
+#define OUTPUT_RIGHT 3
+#define SNAP_WINDOW 4
+#define MIN_SECONDS 5
+#define MAX_SECONDS 6
+#define REVERSE_CHANCE 7
+#define GROUP 12
+#define LENGTH_SHAPE 13
+
+
+//------------------------
+//-- STRUCT DEFINITIONS --
+//------------------------
+
+// one property saved by the plugin
+typedef struct
+{
+    uint32_t key;
+    uint32_t type;
+    size_t size;
+    void * value;
+} Property;
+
+// the fake host's side of one plugin instance
+typedef struct
+{
+    LV2_Handle handle;
+    LV2_Worker_Schedule schedule;
+    // the request the worker hasn't run yet, and its answer
+    unsigned char request[MAX_MESSAGE];
+    uint32_t request_size;
+    short request_waiting;
+    unsigned char response[MAX_MESSAGE];
+    uint32_t response_size;
+    // the ports
+    float inputs[2][FRAMES];
+    float outputs[2][FRAMES];
+    float controls[PORT_COUNT];
+} Instance;
+
+
+//----------------------
+//-- GLOBAL VARIABLES --
+//----------------------
+
+// the fake URID map
+static const char * uris[MAX_URIS];
+static unsigned long uri_count = 0;
+
+// the saved state
+static Property properties[MAX_PROPERTIES];
+static unsigned long property_count = 0;
+
+
+//-------------------------
+//-- FUNCTION PROTOTYPES --
+//-------------------------
+
+// the fake host's URID map
+LV2_URID MapUri(LV2_URID_Map_Handle handle, const char * uri);
+
+// the fake host's worker: keeps a request until RunWorker() is called
+LV2_Worker_Status ScheduleWork(LV2_Worker_Schedule_Handle handle,
+                               uint32_t size, const void * data);
+LV2_Worker_Status Respond(LV2_Worker_Respond_Handle handle, uint32_t size,
+                          const void * data);
+
+// runs the waiting request (if any) and hands the answer to the plugin
+void RunWorker(const LV2_Worker_Interface * worker, Instance * instance);
+
+// the fake host's state store
+LV2_State_Status StoreProperty(LV2_State_Handle handle, uint32_t key,
+                               const void * value, size_t size,
+                               uint32_t type, uint32_t flags);
+const void * RetrieveProperty(LV2_State_Handle handle, uint32_t key,
+                              size_t * size, uint32_t * type,
+                              uint32_t * flags);
+
+// instantiates the plugin and connects its ports
+int CreateInstance(const LV2_Descriptor * descriptor, LV2_URID_Map * map,
+                   Instance * instance);
+
+// fills the inputs with the noise for buffer number 'buffer'
+void FillInputs(Instance * instance, unsigned long buffer);
+
+
+//----------
+//-- MAIN --
+//----------
+/*
+ * takes the LV2 Kite's .so
+ */
+int main(int argc, char * argv[])
+{
+    if (argc != 2)
+    {
+        printf("\nUsage: %s sb_kite.lv2/sb_kite.so\n", argv[0]);
+        exit(-1);
+    }
+
+    void * library = dlopen(argv[1], RTLD_NOW);
+    if (!library)
+    {
+        printf("\nCould not load %s: %s\n", argv[1], dlerror());
+        exit(-1);
+    }
+    LV2_Descriptor_Function get_descriptor = (LV2_Descriptor_Function)
+            dlsym(library, "lv2_descriptor");
+    const LV2_Descriptor * descriptor = get_descriptor ?
+            get_descriptor(0) : NULL;
+    const LV2_Worker_Interface * worker = descriptor ?
+            descriptor->extension_data(LV2_WORKER__interface) : NULL;
+    const LV2_State_Interface * state = descriptor ?
+            descriptor->extension_data(LV2_STATE__interface) : NULL;
+    if (!worker || !state)
+    {
+        printf("\n%s has no worker or state interface\n", argv[1]);
+        exit(-1);
+    }
+
+    LV2_URID_Map map = { NULL, MapUri };
+    Instance * first = calloc(1, sizeof (Instance));
+    Instance * second = calloc(1, sizeof (Instance));
+    float * saved_outputs = calloc(2 * FRAMES, sizeof (float));
+    if (!first || !second || !saved_outputs ||
+        CreateInstance(descriptor, &map, first) != 0)
+    {
+        printf("\nCould not create the first instance\n");
+        exit(-1);
+    }
+
+    printf("\nLV2 state test:\n");
+    int failures = 0;
+    unsigned long buffer = 0;
+
+    // a few buffers, each with the worker answering before the next run()
+    for (buffer = 0; buffer < BUFFERS_BEFORE; ++buffer)
+    {
+        FillInputs(first, buffer);
+        descriptor->run(first->handle, FRAMES);
+        RunWorker(worker, first);
+    }
+
+    // one more, and save while the worker hasn't answered yet
+    FillInputs(first, BUFFERS_BEFORE);
+    descriptor->run(first->handle, FRAMES);
+    memcpy(saved_outputs, first->outputs, 2 * FRAMES * sizeof (float));
+    if (!first->request_waiting ||
+        state->save(first->handle, StoreProperty, NULL, 0, NULL) !=
+        LV2_STATE_SUCCESS)
+    {
+        printf("  the state could not be saved\n");
+        exit(1);
+    }
+
+    /*
+     * restore into the same instance with the worker still busy, and let
+     * the worker answer afterwards, like a host whose worker thread is
+     * slow; then restore into a fresh instance
+     */
+    if (state->restore(first->handle, RetrieveProperty, NULL, 0, NULL) !=
+        LV2_STATE_SUCCESS)
+    {
+        printf("  the state could not be restored\n");
+        exit(1);
+    }
+    RunWorker(worker, first);
+    if (CreateInstance(descriptor, &map, second) != 0 ||
+        state->restore(second->handle, RetrieveProperty, NULL, 0, NULL) !=
+        LV2_STATE_SUCCESS)
+    {
+        printf("  the state could not be restored into a new instance\n");
+        exit(1);
+    }
+
+    // the restored buffer, and the ones after it
+    for (buffer = BUFFERS_BEFORE; buffer <= BUFFERS_BEFORE + BUFFERS_AFTER;
+         ++buffer)
+    {
+        FillInputs(first, buffer);
+        FillInputs(second, buffer);
+        descriptor->run(first->handle, FRAMES);
+        descriptor->run(second->handle, FRAMES);
+        RunWorker(worker, first);
+        RunWorker(worker, second);
+
+        if (buffer == BUFFERS_BEFORE &&
+            (memcmp(first->outputs, saved_outputs,
+                    2 * FRAMES * sizeof (float)) != 0 ||
+             memcmp(second->outputs, saved_outputs,
+                    2 * FRAMES * sizeof (float)) != 0))
+        {
+            printf("  the restored buffer is not the saved one\n");
+            ++failures;
+        }
+        if (memcmp(first->outputs, second->outputs,
+                   2 * FRAMES * sizeof (float)) != 0)
+        {
+            printf("  buffer %lu differs between the restored instances\n",
+                   buffer);
+            ++failures;
+        }
+    }
+
+    descriptor->cleanup(first->handle);
+    descriptor->cleanup(second->handle);
+    free(first);
+    free(second);
+    free(saved_outputs);
+    for (buffer = 0; buffer < property_count; ++buffer)
+        free(properties[buffer].value);
+    dlclose(library);
+
+    if (failures)
+    {
+        printf("LV2 state test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("LV2 state test: passed\n");
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Gives every URI its own number (from 1, since 0 means no URID).
+ */
+LV2_URID MapUri(LV2_URID_Map_Handle handle, const char * uri)
+{
+    unsigned long i = 0;
+
+    for (i = 0; i < uri_count; ++i)
+        if (strcmp(uris[i], uri) == 0)
+            return (LV2_URID) (i + 1);
+    if (uri_count == MAX_URIS)
+        return 0;
+    uris[uri_count++] = uri;
+    return (LV2_URID) uri_count;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Keeps the request for RunWorker().  The plugin only asks for one plan at a
+ * time, so there is room for one.
+ */
+LV2_Worker_Status ScheduleWork(LV2_Worker_Schedule_Handle handle,
+                               uint32_t size, const void * data)
+{
+    Instance * instance = (Instance *) handle;
+
+    if (instance->request_waiting || size > MAX_MESSAGE)
+        return LV2_WORKER_ERR_NO_SPACE;
+    memcpy(instance->request, data, size);
+    instance->request_size = size;
+    instance->request_waiting = 1;
+    return LV2_WORKER_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+
+LV2_Worker_Status Respond(LV2_Worker_Respond_Handle handle, uint32_t size,
+                          const void * data)
+{
+    Instance * instance = (Instance *) handle;
+
+    if (size > MAX_MESSAGE)
+        return LV2_WORKER_ERR_NO_SPACE;
+    memcpy(instance->response, data, size);
+    instance->response_size = size;
+    return LV2_WORKER_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Does what a host's worker thread would do with the waiting request, and
+ * then what the host's audio thread does with the answer.
+ */
+void RunWorker(const LV2_Worker_Interface * worker, Instance * instance)
+{
+    if (!instance->request_waiting)
+        return;
+    instance->request_waiting = 0;
+    instance->response_size = 0;
+    worker->work(instance->handle, Respond, instance, instance->request_size,
+                 instance->request);
+    worker->work_response(instance->handle, instance->response_size,
+                          instance->response);
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Saves a copy of a property (replacing one with the same key).
+ */
+LV2_State_Status StoreProperty(LV2_State_Handle handle, uint32_t key,
+                               const void * value, size_t size,
+                               uint32_t type, uint32_t flags)
+{
+    unsigned long i = 0;
+
+    for (i = 0; i < property_count; ++i)
+        if (properties[i].key == key)
+            break;
+    if (i == MAX_PROPERTIES)
+        return LV2_STATE_ERR_NO_SPACE;
+
+    void * copy = malloc(size);
+    if (!copy)
+        return LV2_STATE_ERR_NO_SPACE;
+    memcpy(copy, value, size);
+    if (i == property_count)
+        ++property_count;
+    else
+        free(properties[i].value);
+
+    properties[i].key = key;
+    properties[i].type = type;
+    properties[i].size = size;
+    properties[i].value = copy;
+    return LV2_STATE_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+
+const void * RetrieveProperty(LV2_State_Handle handle, uint32_t key,
+                              size_t * size, uint32_t * type,
+                              uint32_t * flags)
+{
+    unsigned long i = 0;
+
+    for (i = 0; i < property_count; ++i)
+    {
+        if (properties[i].key == key)
+        {
+            *size = properties[i].size;
+            *type = properties[i].type;
+            *flags = LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE;
+            return properties[i].value;
+        }
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Instantiates the plugin with the fake host's features, and connects every
+ * port (the meters included, so the metered copy is used).  The cut rules
+ * are short enough for a buffer to hold several sub-blocks.  Returns 0 on
+ * success.
+ */
+int CreateInstance(const LV2_Descriptor * descriptor, LV2_URID_Map * map,
+                   Instance * instance)
+{
+    unsigned long port = 0;
+
+    instance->schedule.handle = instance;
+    instance->schedule.schedule_work = ScheduleWork;
+    LV2_Feature map_feature = { LV2_URID__map, map };
+    LV2_Feature schedule_feature = { LV2_WORKER__schedule,
+                                     &instance->schedule };
+    const LV2_Feature * features[] = { &map_feature, &schedule_feature,
+                                       NULL };
+
+    instance->handle = descriptor->instantiate(descriptor, SAMPLE_RATE, ".",
+                                               features);
+    if (!instance->handle)
+        return -1;
+
+    // no zero crossing moves: the saved plan has had its cuts moved already,
+    // and moving them again for the restored buffer could shift them
+    instance->controls[SNAP_WINDOW] = 0.0f;
+    instance->controls[MIN_SECONDS] = 0.01f;
+    instance->controls[MAX_SECONDS] = 0.03f;
+    instance->controls[REVERSE_CHANCE] = 0.5f;
+    instance->controls[GROUP] = 0.0f;
+    instance->controls[LENGTH_SHAPE] = 1.0f;
+
+    descriptor->connect_port(instance->handle, INPUT_LEFT,
+                             instance->inputs[0]);
+    descriptor->connect_port(instance->handle, INPUT_RIGHT,
+                             instance->inputs[1]);
+    descriptor->connect_port(instance->handle, OUTPUT_LEFT,
+                             instance->outputs[0]);
+    descriptor->connect_port(instance->handle, OUTPUT_RIGHT,
+                             instance->outputs[1]);
+    for (port = SNAP_WINDOW; port < PORT_COUNT; ++port)
+        descriptor->connect_port(instance->handle, port,
+                                 &instance->controls[port]);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * The same noise for the same buffer number, whichever instance it is for.
+ */
+void FillInputs(Instance * instance, unsigned long buffer)
+{
+    unsigned long i = 0;
+
+    srandom(buffer + 1);
+    for (i = 0; i < FRAMES; ++i)
+    {
+        instance->inputs[0][i] = (float) random() / RAND_MAX * 2.0f - 1.0f;
+        instance->inputs[1][i] = (float) random() / RAND_MAX * 2.0f - 1.0f;
+    }
+}
+
+// ------------------------------- EOF ----------------------------------------
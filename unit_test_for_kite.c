@@ -4,68 +4,92 @@
  *
  * Unit Test Driver
  *
- * This is a driver for unit testing the run() function of my sb_kite
- * LADSPA plugin.
+ * This is a driver for unit testing the Kite engine that the run() function
+ * of my sb_kite LADSPA plugin uses (see libkite.h).  It links against the
+ * same libkite as the plugin, so it always tests the real code.
+ *
+ * With --differential, it runs the engine side by side with the original
+ * run_Kite() loop (kite_legacy.h) over many buffer sizes and sample rates,
+ * and checks that they agree sample for sample and that the output is a
+ * proper shuffle of the input.
+ *
+ * With --cache, it checks the render cache (kite_cache.h): lookups, keys,
+ * damaged entries, the statistics and eviction.
  *
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-#include "../ladspa.h"
-#include "../xorgens.h"
-
-// named switches (flags) for on/off (used in the unit tested)
-#define ON 1
-#define OFF 0
-
-//---------------------------
-//-- FUNCTION DECLARATIONS --
-//---------------------------
+#include <math.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <ladspa.h>
+#include "libkite.h"
+#include "kite_cache.h"
+#include "kite_legacy.h"
 
-// the unit to be tested
-void run_Kite(LADSPA_Handle instance, unsigned long total_samples);
+#ifdef KITE_RT_AUDIT
+#include <dlfcn.h>
+#include "kite_rt_audit.h"
+#endif
 
-/*
- * These next functions are called by the unit being tested
- */
-// gets a random unsigned long integer
-unsigned long GetRandomNaturalNumber(unsigned long lower_bound,
-                                     unsigned long upper_bound);
+//-----------------------
+//-- DEFINED CONSTANTS --
+//-----------------------
 
-// reverses the given block of samples (block meaning an array of LADSPA_Data,
-// which are floats)
-void ApplyReverse(LADSPA_Data * buffer, unsigned long start, unsigned long end);
+// how many random cases --differential runs by default
+#define DIFFERENTIAL_ITERATIONS 200
+// how long (in seconds) the random cases of --differential are at most
+#define DIFFERENTIAL_MAX_SECONDS 10
+// the snap window --differential also tries (see KiteSnapPlan())
+#define DIFFERENTIAL_SNAP_WINDOW 64
+// how many lengths --differential draws from a table of lengths to see if
+// they come up as often as they should, and how far off (as a fraction of
+// all the draws) a bucket may be
+#define LENGTH_DRAWS 1000000
+#define LENGTH_TOLERANCE 0.005
+// how many pieces CheckBankLengths() cuts out of a sample bank, and how
+// many frames the bank has
+#define BANK_PIECES 250000
+#define BANK_TEST_FRAMES 100000
+// the step between the float bit patterns CheckHalfInstructions() converts
+// (a prime, so every exponent and many mantissas come up)
+#define HALF_TEST_STEP 4099
+// the most variations CheckVariations() makes at once, and the longest case
+// it is run on (longer ones only check a single variation)
+#define VARIATION_MOST 8
+#define VARIATION_MAX_SAMPLES 262144
+// the samples in each render the cache test stores, the size of the header
+// in front of them (see KiteCacheStoreRender()), the longest path it builds,
+// and how long it waits so two file times can't be the same
+#define CACHE_TEST_SAMPLES 4096
+#define CACHE_RENDER_HEADER_BYTES 16
+#define CACHE_PATH_LENGTH 256
+#define CACHE_TICK_MICROSECONDS 50000
 
-// copies a subsection of an array of LADSPA_Data (floats) into a subsection
-// of another array
-void CopySubBlock(LADSPA_Data * destination, unsigned long dest_start,
-                  LADSPA_Data * source, unsigned long source_start,
-                  unsigned long source_end, FILE * file);
 
+//---------------------------
+//-- FUNCTION DECLARATIONS --
+//---------------------------
 
-//------------------------
-//-- STRUCT DEFINITIONS --
-//------------------------
-
-typedef struct {
-    // the samples per second of the sound
-    unsigned long sample_rate;
-    // data locations for the input & output audio ports
-    LADSPA_Data * Input_Left;
-    LADSPA_Data * Input_Right;
-    LADSPA_Data * Output_Left;
-    LADSPA_Data * Output_Right;
-} Kite;
+// writes the plan and the samples it produced to the test results file
+void WriteResults(FILE * file, unsigned long sample_rate,
+                  const KitePlan * plan, const LADSPA_Data * input_left,
+                  const LADSPA_Data * output_left,
+                  const LADSPA_Data * output_right);
 
+// runs the engine and the legacy run_Kite() loop side by side over
+// 'iterations' random cases (plus the edge cases), starting from 'seed'
+int RunDifferentialTest(unsigned long iterations, uint64_t seed);
 
-//----------------------
-//-- GLOBAL VARIABLES --
-//----------------------
+// checks the render cache (kite_cache.h) in a directory of its own
+int RunCacheTest(void);
 
-// to hold the filename passed in by the user through the command line
-char * filename;
+#ifdef KITE_RT_AUDIT
+// runs every descriptor of a plugin .so under the real-time safety audit
+int RunRealtimeAudit(const char * plugin_path);
+#endif
 
 
 //----------
@@ -73,463 +97,1768 @@ char * filename;
 //----------
 /*
  * takes three arguments, the sample rate, the number of samples, and
- * a file name to which the test data will be stored in.
+ * a file name to which the test data will be stored in.  An optional fourth
+ * argument seeds the generator, so a test can be repeated exactly.
  */
 int main(int argc, char * argv[])
 {
-    // exit if run without 3 arguments
-    if (argc != 4)
+#ifdef KITE_RT_AUDIT
+    // the audit build can also check the real plugin: --rt-audit <plugin.so>
+    if (argc == 3 && strcmp(argv[1], "--rt-audit") == 0)
+        return RunRealtimeAudit(argv[2]);
+#endif
+    // --differential [iterations [seed]] checks the engine against the
+    // legacy loop
+    if (argc >= 2 && argc <= 4 && strcmp(argv[1], "--differential") == 0)
+        return RunDifferentialTest(argc > 2 ? strtoul(argv[2], NULL, 10) :
+                                   DIFFERENTIAL_ITERATIONS,
+                                   argc > 3 ? strtoull(argv[3], NULL, 10) : 1);
+
+    // --cache checks the render cache
+    if (argc == 2 && strcmp(argv[1], "--cache") == 0)
+        return RunCacheTest();
+
+    // exit if run without 3 (or 4) arguments
+    if (argc != 4 && argc != 5)
     {
         printf("\nNeed 3 arguments: sample rate, number of samples,");
         printf(" and filename");
-        printf(" for test results (in that order).\n");
+        printf(" for test results (in that order),");
+        printf(" and optionally a seed.\n");
         exit(-1);
     }
 
-    // get the file name
-    filename = malloc(sizeof(char) * strlen(argv[3]));
-    if (!filename)
-        exit(-1);
-    strcpy(filename, argv[3]);
-
     // set the appropriate constants from the command line arguments
-    const LADSPA_Data SAMPLE_RATE = (const LADSPA_Data) atof(argv[1]);
+    const unsigned long SAMPLE_RATE = (unsigned long) atol(argv[1]);
     const unsigned long BUFFER_SIZE = (unsigned long) atol(argv[2]);
+    const char * filename = argv[3];
 
-    // create a pseudo Reverse instance
-    Kite * kite = malloc(sizeof(Kite));
+    // create the Kite to be tested
+    KiteEngine * kite = KiteCreate(SAMPLE_RATE);
     if (!kite)
     {
-        free(filename);
+        printf("\nCould not create a Kite at %lu Hz.\n", SAMPLE_RATE);
         exit(-1);
     }
-
-    kite->sample_rate = SAMPLE_RATE;
+    if (argc == 5)
+    {
+        KiteSettings settings;
+        KiteDefaultSettings(&settings);
+        settings.seed = strtoull(argv[4], NULL, 10);
+        KiteConfigure(kite, &settings);
+    }
 
     /*
      * create psuedo input buffers of audio samples for the left and right
-     * channels.
+     * channels, and output buffers initialized to all zeroes.
      * the sample values are arbitrary, but they are sequential in order
-     * to read the output easier.
+     * to read the output easier: the left channel counts up from 0 and the
+     * right channel counts down from 0.
      */
-    // setup the left channel input buffer
-    kite->Input_Left = malloc(sizeof(LADSPA_Data) * BUFFER_SIZE);
-    // exit if malloc failed
-    if (!kite->Input_Left)
+    LADSPA_Data * input_left = calloc(BUFFER_SIZE + 1, sizeof (LADSPA_Data));
+    LADSPA_Data * input_right = calloc(BUFFER_SIZE + 1, sizeof (LADSPA_Data));
+    LADSPA_Data * output_left = calloc(BUFFER_SIZE + 1, sizeof (LADSPA_Data));
+    LADSPA_Data * output_right = calloc(BUFFER_SIZE + 1, sizeof (LADSPA_Data));
+    // exit if calloc failed
+    if (!input_left || !input_right || !output_left || !output_right)
     {
-        free(filename);
-        free(kite);
+        free(input_left);
+        free(input_right);
+        free(output_left);
+        free(output_right);
+        KiteDestroy(kite);
         exit(-1);
     }
     // for loop index
-    int i = 0;
-    // arbitrary value to be put into the input buffers
-    LADSPA_Data sample_val = 0.0f;
-    // fill the left channel input buffer with sequential positive numbers
+    unsigned long i = 0;
     for (i = 0; i < BUFFER_SIZE; ++i)
     {
-        kite->Input_Left[i] = sample_val;
-        sample_val += 1.0f;
+        input_left[i] = (LADSPA_Data) i;
+        input_right[i] = -(LADSPA_Data) i;
     }
-    
-    // setup right channel input buffer
-    kite->Input_Right = malloc(sizeof(LADSPA_Data) * BUFFER_SIZE);
-    // exit if malloc failed
-    if (!kite->Input_Right)
+
+    // add this test to the test log file
+    FILE * fd = NULL;
+    fd = fopen("test_log.txt", "a");
+    if (fd)
     {
-        free(filename);
-        free(kite->Input_Left);
-        free(kite);
-        exit(-1);
+        fprintf(fd, "\nTest : %lu sample rate, %ld samples\n", SAMPLE_RATE,
+                BUFFER_SIZE);
+        fprintf(fd, "\tResult:");
+        fclose(fd);
     }
-    // fill the right channel input buffer with sequential negative numbers
-    sample_val = 0.0f;
-    for(i = 0; i < BUFFER_SIZE; ++i)
+
+    // run the unit to be tested: cut up the buffer, then apply the cuts
+    const float * inputs[2] = { input_left, input_right };
+    float * outputs[2] = { output_left, output_right };
+    int result = KiteMakePlan(kite, BUFFER_SIZE);
+    if (result == KITE_OK)
+        result = KiteProcess(kite, inputs, outputs, 2, BUFFER_SIZE);
+
+    // write the test results
+    FILE * write_file = fopen(filename, "w");
+    if (!write_file)
+        printf("\n**Error: fail to create file %s\n", filename);
+    else
     {
-        kite->Input_Right[i] = sample_val;
-        sample_val -= 1.0f;
+        if (result == KITE_OK)
+            WriteResults(write_file, SAMPLE_RATE, KiteGetPlan(kite),
+                         input_left, output_left, output_right);
+        else
+            fprintf(write_file, "Kite failed to process the buffer.\n");
+        fclose(write_file);
     }
 
-    /*
-     * create the output buffers and initialize them to all zeroes
-     */
-    // setup the left channel output buffer
-    kite->Output_Left = malloc(sizeof(LADSPA_Data) * BUFFER_SIZE);
-    // exit if malloc failed
-    if (!kite->Output_Left)
-    {
-        free(filename);
-        free(kite->Input_Left);
-        free(kite->Input_Right);
-        free(kite);
-        exit(-1);
+    // free dynamic memory and exit
+    free(input_left);
+    free(input_right);
+    free(output_left);
+    free(output_right);
+    KiteDestroy(kite);
+
+    return result == KITE_OK ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * Writes the test results: every sub-block of the plan (where it came from in
+ * the input, how long it is and whether it was reversed), followed by the
+ * sample values it produced in the output for both channels.
+ */
+void WriteResults(FILE * file, unsigned long sample_rate,
+                  const KitePlan * plan, const LADSPA_Data * input_left,
+                  const LADSPA_Data * output_left,
+                  const LADSPA_Data * output_right)
+{
+    unsigned long i = 0;
+    unsigned long j = 0;
+
+    fprintf(file, "Sample Rate: %ld", sample_rate);
+    fprintf(file, "\nSample Count: %ld\n", plan->total_samples);
+
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
+
+        fprintf(file, "\nSub-block sample size: %ld", segment->length);
+        fprintf(file, "\nInput start: %ld (first value %f)",
+                segment->source_start, input_left[segment->source_start]);
+        fprintf(file, "\nReverse: %d\n\n", segment->reverse);
+
+        fprintf(file, "\nSample values for LEFT CHANNEL:\n\n");
+        for (j = 0; j < segment->length; ++j)
+            fprintf(file, "\n\t%f", output_left[segment->dest_start + j]);
+
+        fprintf(file, "\n\nSample values for RIGHT CHANNEL:\n\n");
+        for (j = 0; j < segment->length; ++j)
+            fprintf(file, "\n\t%f", output_right[segment->dest_start + j]);
+        fprintf(file, "\n");
     }
-    // fill the left channel output buffer to zeroes
-    for (i = 0; i < BUFFER_SIZE; ++i)
-        kite->Output_Left[i] = 0.0f;
-    
-    // setup the right channel output buffer
-    kite->Output_Right = malloc(sizeof(LADSPA_Data) * BUFFER_SIZE);
-    // exit if malloc failed
-    if (!kite->Output_Right)
-    {
-        free(filename);
-        free(kite->Input_Left);
-        free(kite->Input_Right);
-        free(kite->Output_Left);
-        free(kite);
-        exit(-1);
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * The sample rates the differential test uses.  The tiny ones make every
+ * sub-block a sample or two long, which is where off-by-one mistakes show.
+ */
+static const unsigned long DIFFERENTIAL_SAMPLE_RATES[] = { 1, 3, 4, 8000,
+                                                           22050, 44100,
+                                                           96000 };
+#define DIFFERENTIAL_RATE_COUNT (sizeof (DIFFERENTIAL_SAMPLE_RATES) / \
+                                 sizeof (unsigned long))
+
+/*
+ * Checks the contract of a Kite output made from ramp inputs (the left
+ * channel counting up from 0 and the right counting down from 0, as in
+ * main()), so the value of every output sample says which input sample it
+ * came from:
+ *
+ *   - the plan fills the output in order and stays inside the input.
+ *   - every segment is a run of consecutive input samples, forwards or
+ *     backwards, and is 'max_length' samples long at most (the longest
+ *     sub-block, plus the snap window's reach).
+ *   - every input sample ends up in the output exactly once.
+ *   - both channels were cut the same way.
+ *
+ * 'used' is scratch space for 'total_samples' flags.  Returns the number
+ * of broken rules (0 if the output is fine), and describes the first one.
+ */
+static unsigned long CheckRampOutput(const KitePlan * plan,
+                                     const float * left, const float * right,
+                                     unsigned long total_samples,
+                                     unsigned long max_length, char * used)
+{
+    unsigned long i = 0;
+    unsigned long j = 0;
+
+    if (plan->total_samples != total_samples || KiteCheckPlan(plan) != KITE_OK)
+    {
+        printf("\n\tthe segment table doesn't fill the output");
+        return 1;
     }
-    // fill the right channel output buffer to zeroes
-    for (i = 0; i < BUFFER_SIZE; ++i)
-      kite->Output_Right[i] = 0.0f;
 
-    // add this test to the test log file
-    FILE * fd = NULL;
-    fd = fopen("test_log.txt", "a");
-    fprintf(fd, "\nTest : %f sample rate, %ld samples\n", SAMPLE_RATE,
-            BUFFER_SIZE);
-    fprintf(fd, "\tResult:");
-    fclose(fd);
+    memset(used, 0, total_samples);
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
 
-    // run the unit to be tested
-    run_Kite(kite, BUFFER_SIZE);
+        if (segment->length > max_length)
+        {
+            printf("\n\tsegment %lu is %lu samples long (at most %lu)", i,
+                   segment->length, max_length);
+            return 1;
+        }
+        for (j = 0; j < segment->length; ++j)
+        {
+            unsigned long out = segment->dest_start + j;
+            unsigned long in = segment->reverse ?
+                    segment->source_start + segment->length - 1 - j :
+                    segment->source_start + j;
 
-    // free dynamic memory and exit
-    free(kite->Input_Left);
-    free(kite->Input_Right);
-    free(kite->Output_Left);
-    free(kite->Output_Right);
-    free(kite);
-    free(filename);
+            if (left[out] != (float) in || right[out] != -(float) in)
+            {
+                printf("\n\toutput sample %lu is %f/%f, not input sample %lu",
+                       out, left[out], right[out], in);
+                return 1;
+            }
+            if (used[in])
+            {
+                printf("\n\tinput sample %lu is used twice", in);
+                return 1;
+            }
+            used[in] = ON;
+        }
+    }
 
     return 0;
 }
 
 //-----------------------------------------------------------------------------
 
+
 /*
- * Here is where the rubber hits the road.  The actual sound manipulation
- * is done in run().
- * What is basically does is takes the block of samples and reorders them
- * in random order (sometimes reversing them).
+ * Checks the two channels' meters against the peaks and sums of squares
+ * KiteMeterSamples() found in the input.  The peaks must be exact, but the
+ * metering copy adds up the squares in a different order (and partly in
+ * single precision), so the RMS levels only have to be close.  Returns the
+ * number of failures.
  */
-void run_Kite(LADSPA_Handle instance, unsigned long total_samples)
+static unsigned long CheckMeters(const char * name, const float * peaks,
+                                 const float * rms,
+                                 const float * expected_peaks,
+                                 const double * expected_sums,
+                                 unsigned long total_samples)
 {
-    Kite * kite = (Kite *) instance;
+    unsigned long channel = 0;
 
-    /*
-     * NOTE: these special cases should never happen, but you never know--like
-     * if someone is developing a host program and it has some bugs in it, it
-     * might pass some bad data.
-     */
-    if (total_samples <= 1)
+    for (channel = 0; channel < 2; ++channel)
     {
-        printf("\nA sample count of 0 or 1 was sent to plugin.");
-        printf("\nPlugin not executed.\n");
-        return;
+        double expected_rms = sqrt(expected_sums[channel] / total_samples);
+        if (peaks[channel] != expected_peaks[channel] ||
+            fabs(rms[channel] - expected_rms) > 1e-4 * expected_rms)
+        {
+            printf("\n\t%s meters %g/%g on channel %lu, not %g/%g", name,
+                   peaks[channel], rms[channel], channel,
+                   expected_peaks[channel], expected_rms);
+            return 1;
+        }
     }
-    if (!kite)
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+
+/*
+ * Checks a compact (half-precision, 16-bit and 24-bit) stream of the plan
+ * over two channels of a sine that goes a little past -1 and 1.  Read a random number
+ * of frames at a time, it has to give exactly what KiteExecutePlan() on the
+ * compact samples, turned back into floats, gives; and the samples have to
+ * come back within what KiteEncodeSamples() promises (give or take the
+ * rounding of the float arithmetic).  Returns the number of failures.
+ */
+static unsigned long CheckCompactStream(const KitePlan * plan,
+                                        unsigned long total_samples,
+                                        uint64_t seed)
+{
+    const KiteSampleFormat formats[3] = { KITE_FORMAT_FLOAT16,
+                                          KITE_FORMAT_INT16,
+                                          KITE_FORMAT_INT24 };
+    unsigned long n = 2 * total_samples;
+    float * samples = calloc(3 * n, sizeof (float));
+    // room for two copies of the samples in the biggest format
+    unsigned char * compact = calloc(2 * n, 3);
+    unsigned long failures = 0;
+    unsigned long f = 0;
+    unsigned long i = 0;
+
+    if (!samples || !compact)
     {
-        printf("\nPlugin received NULL pointer for plugin instance.");
-        printf("\nPlugin not executed.\n");
-        return;
+        free(samples);
+        free(compact);
+        return 1;
     }
 
-    // set the minimum index of the random sub-blocks to 0.25 seconds
-    const unsigned long MIN_BLOCK_START = (unsigned long)
-                                          (0.25 * kite->sample_rate);
-    // set the maximum index of the random sub-block to 2.25 seconds
-    const unsigned long MAX_BLOCK_END = MIN_BLOCK_START +
-                                        (2 * kite->sample_rate);
-    // buffer pointers
-    LADSPA_Data * input = NULL;
-    LADSPA_Data * output = NULL;
-    // buffer indexes
-    unsigned long out_index = 0;
-    // index points for the sub-blocks of random sizes
-    unsigned long block_start_position = 0;
-    unsigned long block_end_position = 0;
-    // random number upper and lower bounds
-    unsigned long rand_num_lower_bound = 0;
-    unsigned long rand_num_upper_bound = 0;
-    // the number of samples left to process (chop up into sub-blocks)
-    unsigned long samples_remaining = total_samples;
-
-//----------------FILE INITIATION FOR TEST RESULTS-----------------------------
-    FILE * write_file = NULL;
-    write_file = fopen(filename, "w");
-    if (!write_file)
+    float * expected = samples + n;
+    float * output = samples + 2 * n;
+    for (i = 0; i < n; ++i)
+        samples[i] = 1.2f * (float) sin(0.001 * i + (i & 1));
+
+    for (f = 0; f < 3; ++f)
     {
-      printf("\n**Error: fail to create file %s\n", filename);
-      return;
+        KiteStream stream;
+        KiteRandom chunk_rng;
+        unsigned long frames_read = 0;
+        unsigned long size = KiteFormatSize(formats[f]);
+
+        KiteEncodeSamples(compact, samples, n, formats[f]);
+        KiteExecutePlan(plan, compact + n * size, compact, 2 * size);
+        KiteDecodeSamples(expected, compact + n * size, n, formats[f]);
+
+        KiteSeedRandom(&chunk_rng, seed);
+        KiteStartCompactStream(&stream, plan, compact, 2, formats[f]);
+        while (frames_read < total_samples)
+        {
+            unsigned long chunk = KiteReadStream(&stream,
+                    output + 2 * frames_read,
+                    KiteRandomNaturalNumber(&chunk_rng, 1, 4096));
+            if (chunk == 0)
+                break;
+            frames_read += chunk;
+        }
+        if (frames_read != total_samples ||
+            memcmp(output, expected, n * sizeof (float)) != 0)
+        {
+            printf("\n\tthe compact stream (format %d) doesn't match",
+                   formats[f]);
+            ++failures;
+        }
+
+        KiteDecodeSamples(output, compact, n, formats[f]);
+        for (i = 0; i < n; ++i)
+        {
+            float error = fabsf(output[i] - samples[i]);
+            // the integer formats promise half a step, but a float near 1
+            // is only good to about half a 24-bit step itself, so 24-bit
+            // samples get a whole one
+            if (formats[f] != KITE_FORMAT_FLOAT16)
+            {
+                float clipped = samples[i] > 1.0f ? 1.0f :
+                        samples[i] < -1.0f ? -1.0f : samples[i];
+                error = fabsf(output[i] - clipped) *
+                        (formats[f] == KITE_FORMAT_INT16 ? 65534.0f :
+                         8388607.0f);
+            }
+            else if (fabsf(samples[i]) >= 1.0f / 16384.0f)
+                error *= 2048.0f / fabsf(samples[i]);
+            if (error > 1.01f)
+            {
+                printf("\n\tsample %lu (%g) came back as %g (format %d)", i,
+                       samples[i], output[i], formats[f]);
+                ++failures;
+                break;
+            }
+        }
     }
-    fprintf(write_file, "Sample Rate: %ld", kite->sample_rate);
-    fprintf(write_file, "\nSample Count: %ld\n", total_samples);
+
+    free(samples);
+    free(compact);
+    return failures;
+}
+
 //-----------------------------------------------------------------------------
-    
-    while (out_index < total_samples)
-    {
-        // set the lower bound for the random starting position of the sub-block
-        // to 0.25 seconds worth of samples from the current point of the output
-        // buffer
-        rand_num_lower_bound = MIN_BLOCK_START;
-        // set the upper bound for the random end position of the sub-block to
-        // 2.25 seconds worth of samples from the current point of the output
-        // buffer
-        rand_num_upper_bound = MAX_BLOCK_END;
-        
-        // just set the start and end positions of the sub-block to process to
-        // the start and end of the remaining buffer since it is less than 2
-        // times the minimum size to process.
-        // this takes care of the special case where the audio passed in from
-        // the host is smaller than a half-second (2 times the minimum length).
-        // NOTE: It is 2 times the minimum because otherwise if a sub-block was
-        // processed out of it, the remaining section would be less than the
-        // minimum length.
-        if (samples_remaining <= MIN_BLOCK_START * 2)
-        {
-            block_start_position = 0;
-            block_end_position = samples_remaining - 1;
-        }
-        
-        // set the end position of the sub-block to process to the end of the
-        // whole block if the whole block ends before the maximum cutoff point
-        else if (samples_remaining <= MAX_BLOCK_END)
-        {
-            // set the upper bound for the random number to be used as the
-            // start position of the sub-block to minimum length (.25s) from
-            // the end of the remaining buffer
-            rand_num_upper_bound = samples_remaining - MIN_BLOCK_START;
-            // get a random start position for the sub-block
-            block_start_position = GetRandomNaturalNumber(rand_num_lower_bound,
-                    rand_num_upper_bound);
-            block_end_position = samples_remaining - 1;
-        }
-        
-        // get random start and end positions for the sub-block to process
-        else
+
+
+/*
+ * Converts floats to half-precision floats and back with the F16C
+ * instructions and then in plain C (see KiteUseHalfInstructions()), and
+ * checks that both give exactly the same bits: every HALF_TEST_STEPth
+ * float bit pattern (NaNs, infinities and subnormals included) one way,
+ * and every half-precision float the other.  If the CPU has no F16C, only
+ * the plain C is there, and there is nothing to compare.  Returns the
+ * number of failures.
+ */
+static unsigned long CheckHalfInstructions(void)
+{
+    unsigned long count = 0xFFFFFFFFUL / HALF_TEST_STEP + 1;
+    unsigned long failures = 0;
+    unsigned long i = 0;
+    float * floats = calloc(count, sizeof (float));
+    uint16_t * halves = calloc(2 * count, sizeof (uint16_t));
+    float * decoded = calloc(2 * 65536, sizeof (float));
+    uint16_t * all_halves = calloc(65536, sizeof (uint16_t));
+
+    if (!floats || !halves || !decoded || !all_halves)
+    {
+        printf("\nOut of memory.\n");
+        failures = 1;
+    }
+    else if (!KiteUseHalfInstructions(ON))
+        printf("\n(no F16C on this CPU; half-precision checked in C only)");
+    else
+    {
+        for (i = 0; i < count; ++i)
         {
-            // get a random number for the start position
-            block_start_position = GetRandomNaturalNumber(rand_num_lower_bound,
-                    rand_num_upper_bound);
-            // reset the lower bound for the random end position
-            rand_num_lower_bound = block_start_position + MIN_BLOCK_START;
-            /*
-            * reset the upper bound for the random end position depending on
-            * where the end of the remaining buffer lies.
-            */
-            // here it is set to the end of the remaining buffer if the end of
-            // the remaining buffer comes before the maximum sub-block size
-            // (2 seconds) after the recently acquired start position.
-            if (samples_remaining < (block_start_position + MAX_BLOCK_END -
-                MIN_BLOCK_START))
-                rand_num_upper_bound = samples_remaining;
-            // here the upper bound is set to the maximum sub-block size after
-            // the start position, because the end of the remaining buffer is
-            // beyond that point.
-            else
-                rand_num_upper_bound = block_start_position + MAX_BLOCK_END -
-                        MIN_BLOCK_START - 1;
-            // get a random number for the end position
-            block_end_position = GetRandomNaturalNumber(rand_num_lower_bound,
-                    rand_num_upper_bound);
-        }
-        
-        // switch (or flag) for whether the sub-block should be reversed
-        // (I wish C had boolean types)
-        short reverse = OFF;
-        // get a random state for reverse (on or off, which is 0 or 1)
-        reverse = (short) GetRandomNaturalNumber(0, 1);
-
-        // reverse the sub-block if the reverse switch is on
-        if (reverse == ON)
-        {
-            // reverse the sub-block left channel
-            ApplyReverse(kite->Input_Left, block_start_position,
-                         block_end_position);
-            // reverse the sub-block right channel
-            ApplyReverse(kite->Input_Right, block_start_position,
-                         block_end_position);
-        }
-        
-//-----------------------------------------------------------------------------
-        fprintf(write_file, "\nSub-block sample size: %ld", block_end_position -
-                block_start_position + 1);
-        fprintf(write_file, "\nReverse: %d\n\n", reverse);
-        fprintf(write_file, "\nSample values for LEFT CHANNEL:\n\n");
-//-----------------------------------------------------------------------------
-        
-        // append the sub-block to the output buffer for the left channel
-        CopySubBlock(kite->Output_Left, out_index, kite->Input_Left,
-                     block_start_position, block_end_position, write_file);
+            uint32_t bits = (uint32_t) (i * HALF_TEST_STEP);
+            memcpy(&floats[i], &bits, sizeof (float));
+        }
+        for (i = 0; i < 65536; ++i)
+            all_halves[i] = (uint16_t) i;
+
+        KiteEncodeSamples(halves, floats, count, KITE_FORMAT_FLOAT16);
+        KiteDecodeSamples(decoded, all_halves, 65536, KITE_FORMAT_FLOAT16);
+        KiteUseHalfInstructions(OFF);
+        KiteEncodeSamples(halves + count, floats, count, KITE_FORMAT_FLOAT16);
+        KiteDecodeSamples(decoded + 65536, all_halves, 65536,
+                          KITE_FORMAT_FLOAT16);
+        KiteUseHalfInstructions(ON);
+
+        for (i = 0; i < count; ++i)
+        {
+            if (halves[i] != halves[count + i])
+            {
+                printf("\n\tF16C turns float bits %08lx into %04x, C into",
+                       (unsigned long) (i * HALF_TEST_STEP) & 0xFFFFFFFFUL,
+                       halves[i]);
+                printf(" %04x", halves[count + i]);
+                ++failures;
+                break;
+            }
+        }
+        if (memcmp(decoded, decoded + 65536, 65536 * sizeof (float)) != 0)
+        {
+            printf("\n\tF16C and C turn half-precision floats back into");
+            printf(" different floats");
+            ++failures;
+        }
+    }
+
+    free(floats);
+    free(halves);
+    free(decoded);
+    free(all_halves);
+    return failures;
+}
 
 //-----------------------------------------------------------------------------
-        fprintf(write_file, "\n\nSample values for RIGHT CHANNEL:\n\n");
+
+
+/*
+ * Checks a table of lengths (see KiteMakeLengthTable()) with uneven weights,
+ * including buckets that must never come up: LENGTH_DRAWS lengths are drawn
+ * from it, and each bucket has to get its share of them, give or take
+ * LENGTH_TOLERANCE, with every length inside the range.  Bad weights have to
+ * be turned down.  Returns the number of failures.
+ */
+static unsigned long CheckLengthTable(uint64_t seed)
+{
+    static const double weights[] = { 1.0, 0.0, 3.0, 0.5, 4.0, 0.0, 1.5 };
+    const unsigned long count = sizeof (weights) / sizeof (double);
+    // each bucket is 'width' lengths wide, starting at 'shortest'
+    const unsigned long shortest = 1000;
+    const unsigned long width = 100;
+    const double negative[] = { 1.0, -1.0 };
+    const double nothing[] = { 0.0, 0.0 };
+    unsigned long drawn[sizeof (weights) / sizeof (double)];
+    KiteLengthTable table;
+    KiteRandom rng;
+    double total = 0.0;
+    unsigned long i = 0;
+
+    if (KiteMakeLengthTable(&table, negative, 2) != KITE_ERROR ||
+        KiteMakeLengthTable(&table, nothing, 2) != KITE_ERROR ||
+        KiteMakeLengthTable(&table, weights, KITE_MAX_LENGTH_BUCKETS + 1) !=
+        KITE_ERROR || table.count != 0)
+    {
+        printf("\n\tKiteMakeLengthTable() took bad weights");
+        return 1;
+    }
+    if (KiteMakeLengthTable(&table, weights, count) != KITE_OK)
+    {
+        printf("\n\tKiteMakeLengthTable() turned down good weights");
+        return 1;
+    }
+
+    KiteSeedRandom(&rng, seed);
+    memset(drawn, 0, sizeof (drawn));
+    for (i = 0; i < LENGTH_DRAWS; ++i)
+    {
+        unsigned long length = KitePickLength(&rng, &table, shortest,
+                                              shortest + count * width - 1);
+        if (length < shortest || length >= shortest + count * width)
+        {
+            printf("\n\tKitePickLength() drew %lu", length);
+            return 1;
+        }
+        ++drawn[(length - shortest) / width];
+    }
+
+    for (i = 0; i < count; ++i)
+        total += weights[i];
+    for (i = 0; i < count; ++i)
+    {
+        double share = (double) drawn[i] / LENGTH_DRAWS;
+        if ((weights[i] == 0.0 && drawn[i] != 0) ||
+            share < weights[i] / total - LENGTH_TOLERANCE ||
+            share > weights[i] / total + LENGTH_TOLERANCE)
+        {
+            printf("\n\tbucket %lu of the lengths came up %g of the time,",
+                   i, share);
+            printf(" not %g", weights[i] / total);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 //-----------------------------------------------------------------------------
 
-        // append the sub-block to the output buffer for the right channel
-        CopySubBlock(kite->Output_Right, out_index, kite->Input_Right,
-                     block_start_position, block_end_position, write_file);
-        
-        /*
-         * copy the block at the end of the current valid input buffer (the 
-         * portion we are still working in--0 to samples remaining) (that is
-         * equal in length to the block just copied into the output buffer) to
-         * the section of the input buffer that was just copied.  In other
-         * words, write over the section of the input buffer that was just
-         * copied with the same number of samples that end the portion of the
-         * input buffer that is yet to be processed.
-         * Sometimes the number of samples left in the remaining input buffer
-         * is less than the number just copied.  In that case, the section
-         * copied over is just the remaining section of the input buffer
-         * immediately following the sub-block end position.
-         */
-        // get the number of samples copied
-        unsigned long samples_copied = block_end_position - 
-                                       block_start_position + 1;
-        // set the start index to the end section of input buffer that is
-        // going to be copied over the used section
-        unsigned long source_start = 0;
-        // set the start index to the number of samples copied away from the
-        // end of the remaining input buffer if there are more than the number
-        // of samples copied left in the remaining input buffer
-        if (samples_remaining - samples_copied > block_end_position)
-            source_start = samples_remaining - samples_copied;
-        // set the start index to the next position after the sub-block end
-        // position if there are less than the number of samples copied left
-        // in the remaining input buffer
-        else
-            source_start = block_end_position + 1;
-        
+
+/*
+ * Checks that the tape library's plans (see KiteGenerateBankPlan()) draw
+ * their piece lengths from the rules' table of lengths too: BANK_PIECES
+ * pieces are cut out of a bank of silence, and every length has to be in
+ * range and each bucket has to get its share of them, give or take
+ * LENGTH_TOLERANCE.  (The last piece is left out, since it is cut short at
+ * the end of the output.)  Opening the bank again has to share it, unless
+ * the raw files are read with another channel count.  Returns the number of
+ * failures.
+ */
+static unsigned long CheckBankLengths(uint64_t seed)
+{
+    static const double weights[] = { 0.0, 2.0, 1.0, 0.0, 5.0 };
+    const unsigned long count = sizeof (weights) / sizeof (double);
+    // each bucket is 'width' lengths wide, starting at 'shortest'
+    const unsigned long shortest = 500;
+    const unsigned long width = 300;
+    char bank_path[] = "/tmp/kite_bank_lengths_XXXXXX";
+    unsigned long drawn[sizeof (weights) / sizeof (double)];
+    KiteCutRules rules;
+    KitePlan plan;
+    KiteRandom rng;
+    double total = 0.0;
+    unsigned long i = 0;
+
+    // a bank of silence, long enough that no piece is cut short by it
+    int file = mkstemp(bank_path);
+    FILE * bank_file = file >= 0 ? fdopen(file, "wb") : NULL;
+    if (!bank_file)
+    {
+        printf("\n\tcould not write a sample bank");
+        return 1;
+    }
+    float * silence = (float *) calloc(BANK_TEST_FRAMES, sizeof (float));
+    if (!silence || fwrite(silence, sizeof (float), BANK_TEST_FRAMES,
+                           bank_file) != BANK_TEST_FRAMES)
+    {
+        printf("\n\tcould not write a sample bank");
+        free(silence);
+        fclose(bank_file);
+        unlink(bank_path);
+        return 1;
+    }
+    free(silence);
+    fclose(bank_file);
+    KiteBank * bank = KiteOpenBank(bank_path, 1);
+    KiteBank * same_bank = KiteOpenBank(bank_path, 1);
+    KiteBank * stereo_bank = KiteOpenBank(bank_path, 2);
+    unlink(bank_path);
+    short shared = bank && same_bank == bank && stereo_bank &&
+            stereo_bank != bank &&
+            stereo_bank->total_frames == BANK_TEST_FRAMES / 2;
+    KiteCloseBank(same_bank);
+    KiteCloseBank(stereo_bank);
+    if (bank && !shared)
+    {
+        printf("\n\tKiteOpenBank() shared a bank it shouldn't have");
+        printf(" (or didn't share one it should)");
+        KiteCloseBank(bank);
+        return 1;
+    }
+
+    // the bank draws from min_block_start to max_block_end - min_block_start
+    KiteDefaultCutRules(&rules, 1000);
+    rules.min_block_start = shortest;
+    rules.max_block_end = 2 * shortest + count * width - 1;
+    if (!bank || KiteMakeLengthTable(&rules.lengths, weights, count) !=
+        KITE_OK || KiteInitPlan(&plan, BANK_PIECES) != KITE_OK)
+    {
+        printf("\n\tcould not set up the sample bank");
+        KiteCloseBank(bank);
+        return 1;
+    }
+
+    KiteSeedRandom(&rng, seed);
+    if (KiteGenerateBankPlan(&plan, &rng, &rules, bank,
+                             BANK_PIECES * shortest) != KITE_OK)
+    {
+        printf("\n\tKiteGenerateBankPlan() failed");
+        KiteFreePlan(&plan);
+        KiteCloseBank(bank);
+        return 1;
+    }
+    KiteCloseBank(bank);
+
+    memset(drawn, 0, sizeof (drawn));
+    for (i = 0; i + 1 < plan.segment_count; ++i)
+    {
+        unsigned long length = plan.segments[i].length;
+        if (length < shortest || length >= shortest + count * width)
+        {
+            printf("\n\tKiteGenerateBankPlan() cut a piece %lu long", length);
+            KiteFreePlan(&plan);
+            return 1;
+        }
+        ++drawn[(length - shortest) / width];
+    }
+    unsigned long pieces = plan.segment_count - 1;
+    KiteFreePlan(&plan);
+
+    for (i = 0; i < count; ++i)
+        total += weights[i];
+    for (i = 0; i < count; ++i)
+    {
+        double share = (double) drawn[i] / pieces;
+        if ((weights[i] == 0.0 && drawn[i] != 0) ||
+            share < weights[i] / total - LENGTH_TOLERANCE ||
+            share > weights[i] / total + LENGTH_TOLERANCE)
+        {
+            printf("\n\tbucket %lu of the bank's lengths came up %g of the",
+                   i, share);
+            printf(" time, not %g", weights[i] / total);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 //-----------------------------------------------------------------------------
-        fprintf(write_file, "\n\nOverwriting values for LEFT CHANNEL:\n\n");
+
+
+/*
+ * Returns ON if two segments move the same samples the same way.
+ */
+static short SameSegment(const KiteSegment * a, const KiteSegment * b)
+{
+    return a->source_start == b->source_start &&
+           a->dest_start == b->dest_start && a->length == b->length &&
+           a->reverse == b->reverse;
+}
+
 //-----------------------------------------------------------------------------
-        
-        // write over used section of left channel input
-        CopySubBlock(kite->Input_Left, block_start_position,
-                     kite->Input_Left, source_start, samples_remaining - 1,
-                     write_file);
+
+
+/*
+ * Writes down, for every output sample of a plan, which input sample it
+ * comes from and whether its segment is reversed.
+ */
+static void MapPlan(const KitePlan * plan, unsigned long * sources,
+                    char * reversed)
+{
+    unsigned long i = 0;
+    unsigned long j = 0;
+
+    for (i = 0; i < plan->segment_count; ++i)
+    {
+        const KiteSegment * segment = &plan->segments[i];
+        for (j = 0; j < segment->length; ++j)
+        {
+            sources[segment->dest_start + j] = segment->reverse ?
+                    segment->source_start + segment->length - 1 - j :
+                    segment->source_start + j;
+            reversed[segment->dest_start + j] = segment->reverse;
+        }
+    }
+}
 
 //-----------------------------------------------------------------------------
-        fprintf(write_file, "\n\nOverwriting values for RIGHT CHANNEL:\n\n");
+
+
+/*
+ * Checks KiteReprocessRange() (and the KiteRegeneratePlan() and
+ * KiteExecutePlanChanges() under it) on a Kite configured with 'settings',
+ * which has just shuffled 'total_samples' samples of ramp input.  A range
+ * at the start, one at the end and one across a cut between two segments
+ * are cut again, one after another, and each time:
+ *
+ *   - the output is still a proper shuffle (see CheckRampOutput()).
+ *   - the output samples outside the range haven't changed.
+ *   - KiteExecutePlanChanges() brings a copy of the old output up to date,
+ *     and says it copied exactly the samples whose input sample (or
+ *     direction) changed.
+ *
+ * Last, cutting the whole output again has to give the same plan as
+ * KiteGeneratePlan() with the same seed.  Returns the number of failures.
+ */
+static unsigned long CheckReprocessRange(KiteEngine * kite,
+                                         const KiteCutRules * rules,
+                                         const float * const * inputs,
+                                         float * const * outputs,
+                                         unsigned long total_samples,
+                                         unsigned long max_length,
+                                         char * used, uint64_t seed)
+{
+    unsigned long failures = 0;
+    unsigned long n = total_samples;
+    unsigned long range = 0;
+    unsigned long i = 0;
+    KitePlan old_plan;
+    KitePlan generated;
+    KiteRandom rng;
+    float * before = calloc(3 * n, sizeof (float));
+    unsigned long * sources = calloc(2 * n, sizeof (unsigned long));
+    char * reversed = calloc(2 * n, 1);
+
+    if (!before || !sources || !reversed ||
+        KiteInitPlan(&old_plan, 1) != KITE_OK)
+    {
+        printf("\nOut of memory.\n");
+        free(before);
+        free(sources);
+        free(reversed);
+        return 1;
+    }
+    if (KiteInitPlan(&generated, 1) != KITE_OK)
+    {
+        printf("\nOut of memory.\n");
+        KiteFreePlan(&old_plan);
+        free(before);
+        free(sources);
+        free(reversed);
+        return 1;
+    }
+    float * updated = before + 2 * n;
+    KiteSeedRandom(&rng, seed);
+
+    for (range = 0; range < 3; ++range)
+    {
+        const KitePlan * plan = KiteGetPlan(kite);
+        unsigned long width = KiteRandomNaturalNumber(&rng, 1, n);
+        unsigned long range_start = 0;
+        unsigned long range_end = width;
+        if (range == 1)
+        {
+            range_start = n - width;
+            range_end = n;
+        }
+        else if (range == 2)
+        {
+            // around the cut at the start of the middle segment
+            if (plan->segment_count < 2)
+                continue;
+            unsigned long cut = plan->segments[plan->segment_count / 2].
+                    dest_start;
+            width = KiteRandomNaturalNumber(&rng, 1, rules->min_block_start);
+            range_start = cut > width ? cut - width : 0;
+            range_end = cut + width < n ? cut + width : n;
+        }
+
+        KiteCopyPlan(&old_plan, plan);
+        memcpy(before, outputs[0], n * sizeof (float));
+        memcpy(before + n, outputs[1], n * sizeof (float));
+        if (KiteReprocessRange(kite, KiteRandomNext(&rng), range_start,
+                               range_end, inputs, outputs, 2) != KITE_OK)
+        {
+            printf("\n\tKiteReprocessRange() turned down %lu to %lu",
+                   range_start, range_end);
+            ++failures;
+            continue;
+        }
+
+        plan = KiteGetPlan(kite);
+        failures += CheckRampOutput(plan, outputs[0], outputs[1], n,
+                                    max_length, used);
+        if (memcmp(outputs[0], before, range_start * sizeof (float)) != 0 ||
+            memcmp(outputs[1], before + n, range_start * sizeof (float)) !=
+            0 ||
+            memcmp(outputs[0] + range_end, before + range_end,
+                   (n - range_end) * sizeof (float)) != 0 ||
+            memcmp(outputs[1] + range_end, before + n + range_end,
+                   (n - range_end) * sizeof (float)) != 0)
+        {
+            printf("\n\tKiteReprocessRange() of %lu to %lu changed samples",
+                   range_start, range_end);
+            printf(" outside it");
+            ++failures;
+        }
+
+        // the samples that really changed, against what was copied
+        unsigned long changed = 0;
+        MapPlan(&old_plan, sources, reversed);
+        MapPlan(plan, sources + n, reversed + n);
+        for (i = 0; i < n; ++i)
+            if (sources[i] != sources[n + i] || reversed[i] != reversed[n + i])
+                ++changed;
+        memcpy(updated, before, n * sizeof (float));
+        unsigned long copied = KiteExecutePlanChanges(&old_plan, plan,
+                                                      updated, inputs[0],
+                                                      sizeof (float));
+        if (copied != changed ||
+            memcmp(updated, outputs[0], n * sizeof (float)) != 0)
+        {
+            printf("\n\tKiteExecutePlanChanges() copied %lu samples of %lu",
+                   copied, changed);
+            printf(" to %lu", range_end);
+            ++failures;
+        }
+    }
+
+    // the whole output cut again is a new plan
+    uint64_t whole_seed = KiteRandomNext(&rng);
+    KiteSeedRandom(&rng, whole_seed);
+    if (KiteReprocessRange(kite, whole_seed, 0, n, inputs, outputs, 2) !=
+        KITE_OK ||
+        KiteGeneratePlan(&generated, &rng, rules, n) != KITE_OK)
+        ++failures;
+    else
+    {
+        const KitePlan * plan = KiteGetPlan(kite);
+        short same = plan->segment_count == generated.segment_count;
+        for (i = 0; same && i < plan->segment_count; ++i)
+            same = SameSegment(&plan->segments[i], &generated.segments[i]);
+        if (!same)
+        {
+            printf("\n\tcutting the whole output again doesn't match");
+            printf(" KiteGeneratePlan()");
+            ++failures;
+        }
+        failures += CheckRampOutput(plan, outputs[0], outputs[1], n,
+                                    max_length, used);
+    }
+
+    KiteFreePlan(&old_plan);
+    KiteFreePlan(&generated);
+    free(before);
+    free(sources);
+    free(reversed);
+    return failures;
+}
+
 //-----------------------------------------------------------------------------
 
-        // write over used section of right channel input
-        CopySubBlock(kite->Input_Right, block_start_position,
-                     kite->Input_Right, source_start, samples_remaining - 1,
-                     write_file);
-        
-        // update the output index
-        out_index += samples_copied;
-        // update the number of samples remaining to be processed
-        samples_remaining -= samples_copied;
-    }
-    
+
+/*
+ * Makes 2, 3 and then 8 variations of 'total_samples' samples of noise at
+ * once with KiteProcessVariations(), first with 'settings' and then with a
+ * shape of lengths and a snap window as well, and checks that every one of
+ * them is what KiteProcess() makes on a fresh Kite configured with that
+ * variation's seed.  Returns the number of failures.
+ */
+static unsigned long CheckVariations(unsigned long sample_rate,
+                                     const KiteSettings * settings,
+                                     unsigned long total_samples,
+                                     uint64_t seed)
+{
+    static const unsigned long counts[] = { 2, 3, VARIATION_MOST };
+    unsigned long failures = 0;
+    unsigned long n = total_samples;
+    unsigned long shaped = 0;
+    unsigned long count = 0;
+    unsigned long v = 0;
+    unsigned long i = 0;
+    // the input, the reference, and every variation's output
+    float * memory = calloc((4 + 2 * VARIATION_MOST) * n, sizeof (float));
+    KiteEngine * kite = KiteCreate(sample_rate);
+    KiteEngine * fresh = KiteCreate(sample_rate);
+
+    if (!memory || !kite || !fresh)
+    {
+        printf("\nOut of memory.\n");
+        free(memory);
+        KiteDestroy(kite);
+        KiteDestroy(fresh);
+        return 1;
+    }
+
+    // noise, so there are zero crossings for the snap window to find
+    KiteRandom rng;
+    KiteSeedRandom(&rng, seed);
+    for (i = 0; i < 2 * n; ++i)
+        memory[i] = (float) KiteRandomNaturalNumber(&rng, 0, 2000) / 1000.0f -
+                1.0f;
+    const float * inputs[2] = { memory, memory + n };
+    float * reference[2] = { memory + 2 * n, memory + 3 * n };
+    float * channels[VARIATION_MOST][2];
+    float * const * outputs[VARIATION_MOST];
+    uint64_t seeds[VARIATION_MOST];
+    for (v = 0; v < VARIATION_MOST; ++v)
+    {
+        channels[v][0] = memory + (4 + 2 * v) * n;
+        channels[v][1] = memory + (5 + 2 * v) * n;
+        outputs[v] = channels[v];
+    }
+
+    for (shaped = 0; shaped < 2; ++shaped)
+    {
+        KiteSettings case_settings = *settings;
+        if (shaped)
+        {
+            case_settings.length_shape = 1 + seed % (KITE_LENGTH_SHAPES - 1);
+            case_settings.snap_window = DIFFERENTIAL_SNAP_WINDOW;
+        }
+
+        for (count = 0; count < sizeof (counts) / sizeof (counts[0]); ++count)
+        {
+            for (v = 0; v < counts[count]; ++v)
+                seeds[v] = KiteRandomNext(&rng);
+            KiteConfigure(kite, &case_settings);
+            if (KiteProcessVariations(kite, seeds, counts[count], inputs,
+                                      outputs, 2, n) != KITE_OK)
+            {
+                printf("\n\tKiteProcessVariations() failed (%lu variations)",
+                       counts[count]);
+                ++failures;
+                continue;
+            }
+
+            for (v = 0; v < counts[count]; ++v)
+            {
+                case_settings.seed = seeds[v];
+                KiteConfigure(fresh, &case_settings);
+                if (KiteProcess(fresh, inputs, reference, 2, n) != KITE_OK ||
+                    memcmp(channels[v][0], reference[0],
+                           n * sizeof (float)) != 0 ||
+                    memcmp(channels[v][1], reference[1],
+                           n * sizeof (float)) != 0)
+                {
+                    printf("\n\tvariation %lu of %lu (shape %d, snap %lu)",
+                           v + 1, counts[count], case_settings.length_shape,
+                           case_settings.snap_window);
+                    printf(" doesn't match KiteProcess() with its seed");
+                    ++failures;
+                }
+            }
+        }
+    }
+
+    free(memory);
+    KiteDestroy(kite);
+    KiteDestroy(fresh);
+    return failures;
+}
+
 //-----------------------------------------------------------------------------
-    fclose(write_file);
+
+
+/*
+ * Runs one case of the differential test: 'total_samples' samples of ramp
+ * input at 'sample_rate', cut with the given sub-block lengths and reverse
+ * chance, with the generators seeded with 'seed'.  The legacy loop's output
+ * is the reference, and the engine has to match it exactly through
+ * KiteProcess(), KiteProcessInterleaved() and KiteProcessVariations(),
+ * and several variations at once have to match KiteProcess() with their
+ * seeds (see CheckVariations()).  Parts of the output are then cut again
+ * (see CheckReprocessRange()).  With a shape of lengths or a snap window the cuts move, so there is
+ * nothing to match, but the output still has to follow the rules of
+ * CheckRampOutput().  Returns the number of failures.
+ */
+static unsigned long RunDifferentialCase(unsigned long sample_rate,
+                                         unsigned long total_samples,
+                                         double min_seconds,
+                                         double max_seconds,
+                                         double reverse_chance, uint64_t seed)
+{
+    unsigned long failures = 0;
+    unsigned long i = 0;
+    KiteCutRules rules;
+    KiteMakeCutRules(&rules, sample_rate, min_seconds, max_seconds,
+                     reverse_chance);
+    // the longest a sub-block can be (the whole tape, once there are less
+    // than two minimum lengths of it left)
+    unsigned long max_length = rules.max_block_end - rules.min_block_start;
+    if (max_length < 2 * rules.min_block_start)
+        max_length = 2 * rules.min_block_start;
+    // one allocation holds all the buffers
+    unsigned long n = total_samples;
+    float * memory = calloc(12 * n + 1, sizeof (float));
+    char * used = calloc(n + 1, 1);
+    KiteEngine * kite = KiteCreate(sample_rate);
+
+    if (!memory || !used || !kite)
+    {
+        printf("\nOut of memory.\n");
+        free(memory);
+        free(used);
+        KiteDestroy(kite);
+        return 1;
+    }
+
+    float * input_left = memory;
+    float * input_right = memory + n;
+    float * tape_left = memory + 2 * n;
+    float * tape_right = memory + 3 * n;
+    float * legacy_left = memory + 4 * n;
+    float * legacy_right = memory + 5 * n;
+    float * output_left = memory + 6 * n;
+    float * output_right = memory + 7 * n;
+    float * interleaved_input = memory + 8 * n;
+    float * interleaved_output = memory + 10 * n;
+    for (i = 0; i < n; ++i)
+    {
+        input_left[i] = tape_left[i] = (float) i;
+        input_right[i] = tape_right[i] = -(float) i;
+        interleaved_input[2 * i] = input_left[i];
+        interleaved_input[2 * i + 1] = input_right[i];
+    }
+
+    // the reference
+    KiteRandom rng;
+    float * tapes[2] = { tape_left, tape_right };
+    float * legacy_outputs[2] = { legacy_left, legacy_right };
+    KiteSeedRandom(&rng, seed);
+    KiteLegacyRun(&rng, &rules, tapes, legacy_outputs, 2, n);
+
+    const float * inputs[2] = { input_left, input_right };
+    float * outputs[2] = { output_left, output_right };
+    KiteSettings settings;
+    KiteDefaultSettings(&settings);
+    settings.seed = seed;
+    settings.max_samples = 2 * n;
+    settings.min_seconds = min_seconds;
+    settings.max_seconds = max_seconds;
+    settings.reverse_chance = reverse_chance;
+
+    // what the meters should say (the output is the input moved around)
+    float expected_peaks[2] = { 0.0f, 0.0f };
+    double expected_sums[2] = { 0.0, 0.0 };
+    float peaks[2];
+    float rms[2];
+    KiteMeterSamples(interleaved_input, n, 2, expected_peaks, expected_sums);
+
+    // the planar engine has to match the reference, and follow the rules
+    KiteConfigure(kite, &settings);
+    if (KiteProcessMetered(kite, inputs, outputs, 2, n, peaks, rms) !=
+        KITE_OK ||
+        memcmp(output_left, legacy_left, n * sizeof (float)) != 0 ||
+        memcmp(output_right, legacy_right, n * sizeof (float)) != 0)
+    {
+        printf("\n\tKiteProcess() doesn't match the legacy loop");
+        ++failures;
+    }
+    failures += CheckRampOutput(KiteGetPlan(kite), output_left, output_right,
+                                n, max_length, used);
+    failures += CheckMeters("KiteProcessMetered()", peaks, rms,
+                            expected_peaks, expected_sums, n);
+
+    // a Kite with another seed cuts the same as this one when they are in
+    // a group, and so does this one when the other goes first
+    KiteEngine * partner = KiteCreate(sample_rate);
+    float * partner_outputs[2] = { interleaved_output, interleaved_output + n };
+    unsigned long cycle = 0;
+    if (!partner)
+        ++failures;
+    for (cycle = 0; partner && cycle < 2; ++cycle)
+    {
+        KiteEngine * first = cycle == 0 ? kite : partner;
+        KiteEngine * second = cycle == 0 ? partner : kite;
+        settings.seed = seed + cycle;
+        KiteConfigure(first, &settings);
+        settings.seed = seed + 2;
+        KiteConfigure(second, &settings);
+        KiteSetGroup(first, 1);
+        KiteSetGroup(second, 1);
+        if (KiteProcess(first, inputs, outputs, 2, n) != KITE_OK ||
+            KiteProcess(second, inputs, partner_outputs, 2, n) != KITE_OK ||
+            memcmp(partner_outputs[0], output_left, n * sizeof (float)) != 0 ||
+            memcmp(partner_outputs[1], output_right, n * sizeof (float)) != 0)
+        {
+            printf("\n\tgrouped Kites cut differently (cycle %lu)", cycle);
+            ++failures;
+        }
+        KiteSetGroup(first, 0);
+        KiteSetGroup(second, 0);
+    }
+    settings.seed = seed;
+    KiteDestroy(partner);
+
+    // so does the interleaved one (re-seeded without KiteConfigure(), the
+    // way the plugin's instance pool does it)
+    KiteSetSeed(kite, seed);
+    if (KiteProcessInterleavedMetered(kite, interleaved_input,
+                                      interleaved_output, 2, n, peaks, rms) !=
+        KITE_OK)
+        ++failures;
+    failures += CheckMeters("KiteProcessInterleavedMetered()", peaks, rms,
+                            expected_peaks, expected_sums, n);
+    for (i = 0; i < n; ++i)
+    {
+        if (interleaved_output[2 * i] != legacy_left[i] ||
+            interleaved_output[2 * i + 1] != legacy_right[i])
+        {
+            printf("\n\tKiteProcessInterleaved() doesn't match at sample %lu",
+                   i);
+            ++failures;
+            break;
+        }
+    }
+
+    // streaming the same plan a random number of frames at a time gives
+    // the same output, and so does starting the stream partway in
+    KiteStream stream;
+    KiteRandom chunk_rng;
+    unsigned long frames_read = 0;
+    unsigned long start = n > 1 ? KiteRandomNaturalNumber(&rng, 0, n - 1) : 0;
+    KiteSeedRandom(&chunk_rng, seed);
+    memset(interleaved_output, 0, 2 * n * sizeof (float));
+    KiteStartStream(&stream, KiteGetPlan(kite), interleaved_input,
+                    2 * sizeof (float));
+    if (KiteSeekStream(&stream, start) != KITE_OK)
+        ++failures;
+    while (frames_read < n - start)
+    {
+        unsigned long chunk = KiteReadStream(&stream,
+                interleaved_output + 2 * (start + frames_read),
+                KiteRandomNaturalNumber(&chunk_rng, 1, 4096));
+        if (chunk == 0)
+            break;
+        frames_read += chunk;
+    }
+    if (frames_read != n - start ||
+        KiteReadStream(&stream, interleaved_output, 1) != 0)
+    {
+        printf("\n\tKiteReadStream() read %lu frames from %lu, not %lu",
+               frames_read, start, n - start);
+        ++failures;
+    }
+    for (i = start; i < n; ++i)
+    {
+        if (interleaved_output[2 * i] != legacy_left[i] ||
+            interleaved_output[2 * i + 1] != legacy_right[i])
+        {
+            printf("\n\tKiteReadStream() doesn't match at sample %lu", i);
+            ++failures;
+            break;
+        }
+    }
+
+    // cutting both channels a few frames of output at a time gives the
+    // same output too (KiteProcess() does it with cache-sized tiles)
+    memset(output_left, 0, n * sizeof (float));
+    memset(output_right, 0, n * sizeof (float));
+    KiteExecutePlanTiled(KiteGetPlan(kite), (void * const *) outputs,
+                         (const void * const *) inputs, 2, sizeof (float),
+                         KiteRandomNaturalNumber(&chunk_rng, 1, 64));
+    if (memcmp(output_left, legacy_left, n * sizeof (float)) != 0 ||
+        memcmp(output_right, legacy_right, n * sizeof (float)) != 0)
+    {
+        printf("\n\tKiteExecutePlanTiled() doesn't match the legacy loop");
+        ++failures;
+    }
+
+    // a compact stream gives the same frames, turned back into floats
+    failures += CheckCompactStream(KiteGetPlan(kite), n, seed);
+
+    // and the fan-out one
+    float * const * variation_outputs[1] = { outputs };
+    memset(output_left, 0, n * sizeof (float));
+    memset(output_right, 0, n * sizeof (float));
+    if (KiteProcessVariations(kite, &seed, 1, inputs, variation_outputs, 2,
+                              n) != KITE_OK ||
+        memcmp(output_left, legacy_left, n * sizeof (float)) != 0 ||
+        memcmp(output_right, legacy_right, n * sizeof (float)) != 0)
+    {
+        printf("\n\tKiteProcessVariations() doesn't match the legacy loop");
+        ++failures;
+    }
+    if (n <= VARIATION_MAX_SAMPLES)
+        failures += CheckVariations(sample_rate, &settings, n, seed);
+
+    // cutting parts of the output again leaves the rest of it alone
+    KiteConfigure(kite, &settings);
+    if (KiteProcess(kite, inputs, outputs, 2, n) != KITE_OK)
+        ++failures;
+    failures += CheckReprocessRange(kite, &rules, inputs, outputs, n,
+                                    max_length, used, seed);
+
+    // a shape of lengths changes which lengths come up, but not how long
+    // they can be
+    settings.length_shape = 1 + seed % (KITE_LENGTH_SHAPES - 1);
+    KiteConfigure(kite, &settings);
+    if (KiteProcess(kite, inputs, outputs, 2, n) != KITE_OK)
+        ++failures;
+    failures += CheckRampOutput(KiteGetPlan(kite), output_left, output_right,
+                                n, max_length, used);
+    settings.length_shape = KITE_LENGTHS_EVEN;
+
+    // moving the cuts to zero crossings only bends the length rule
+    settings.snap_window = DIFFERENTIAL_SNAP_WINDOW;
+    KiteConfigure(kite, &settings);
+    if (KiteProcess(kite, inputs, outputs, 2, n) != KITE_OK)
+        ++failures;
+    failures += CheckRampOutput(KiteGetPlan(kite), output_left, output_right,
+                                n, max_length + 2 * DIFFERENTIAL_SNAP_WINDOW,
+                                used);
+
+    free(memory);
+    free(used);
+    KiteDestroy(kite);
+    return failures;
+}
+
 //-----------------------------------------------------------------------------
+
+
+/*
+ * The differential test.  Every sample rate is tried with the buffer sizes
+ * where the planner changes its mind (around 2 x 0.25 seconds and 2.25
+ * seconds, where it switches between its three ways of picking a
+ * sub-block), then 'iterations' cases of random size and rate are run, half
+ * of them with random sub-block lengths and reverse chances, and last the
+ * table of lengths is checked (see CheckLengthTable() and
+ * CheckBankLengths()).  Each case gets its
+ * own seed, which is printed if the case fails, so it can be run again.
+ * Returns 0 if every case passed, 1 otherwise.
+ */
+int RunDifferentialTest(unsigned long iterations, uint64_t seed)
+{
+    KiteRandom rng;
+    KiteCutRules rules;
+    unsigned long cases = 0;
+    unsigned long failed = 0;
+    unsigned long rate = 0;
+    unsigned long i = 0;
+
+    KiteSeedRandom(&rng, seed);
+
+    for (rate = 0; rate < DIFFERENTIAL_RATE_COUNT; ++rate)
+    {
+        unsigned long sample_rate = DIFFERENTIAL_SAMPLE_RATES[rate];
+        KiteDefaultCutRules(&rules, sample_rate);
+        unsigned long min_block = rules.min_block_start;
+        unsigned long max_block_end = rules.max_block_end;
+        unsigned long edges[] = { 1, 2, 3, 2 * min_block - 1, 2 * min_block,
+                                  2 * min_block + 1, max_block_end - 1,
+                                  max_block_end, max_block_end + 1,
+                                  2 * max_block_end };
+
+        for (i = 0; i < sizeof (edges) / sizeof (unsigned long); ++i)
+        {
+            uint64_t case_seed = KiteRandomNext(&rng);
+            if (edges[i] == 0)
+                continue;
+            ++cases;
+            if (RunDifferentialCase(sample_rate, edges[i],
+                                    KITE_DEFAULT_MIN_SECONDS,
+                                    KITE_DEFAULT_MAX_SECONDS,
+                                    KITE_DEFAULT_REVERSE_CHANCE,
+                                    case_seed) > 0)
+            {
+                printf("\nFAILED: %lu samples at %lu Hz, seed %llu\n",
+                       edges[i], sample_rate, (unsigned long long) case_seed);
+                ++failed;
+            }
+        }
+    }
+
+    for (i = 0; i < iterations; ++i)
+    {
+        unsigned long sample_rate = DIFFERENTIAL_SAMPLE_RATES[
+                KiteRandomNaturalNumber(&rng, 0, DIFFERENTIAL_RATE_COUNT - 1)];
+        unsigned long total_samples = KiteRandomNaturalNumber(&rng, 1,
+                DIFFERENTIAL_MAX_SECONDS * sample_rate + 1);
+        double min_seconds = KITE_DEFAULT_MIN_SECONDS;
+        double max_seconds = KITE_DEFAULT_MAX_SECONDS;
+        double reverse_chance = KITE_DEFAULT_REVERSE_CHANCE;
+        if (i % 2 == 1)
+        {
+            // from 0.01 to 1 second, up to 4 seconds, and 0 to 100%
+            min_seconds = KiteRandomNaturalNumber(&rng, 1, 100) / 100.0;
+            max_seconds = KiteRandomNaturalNumber(&rng, 1, 400) / 100.0;
+            reverse_chance = KiteRandomNaturalNumber(&rng, 0, 10) / 10.0;
+        }
+        uint64_t case_seed = KiteRandomNext(&rng);
+
+        ++cases;
+        if (RunDifferentialCase(sample_rate, total_samples, min_seconds,
+                                max_seconds, reverse_chance, case_seed) > 0)
+        {
+            printf("\nFAILED: %lu samples at %lu Hz, seed %llu", total_samples,
+                   sample_rate, (unsigned long long) case_seed);
+            printf(" (%g to %g seconds, reverse chance %g)\n", min_seconds,
+                   max_seconds, reverse_chance);
+            ++failed;
+        }
+    }
+
+    // and the alias table behind the shapes draws what it was given
+    ++cases;
+    if (CheckLengthTable(seed) > 0)
+    {
+        printf("\nFAILED: the table of lengths, seed %llu\n",
+               (unsigned long long) seed);
+        ++failed;
+    }
+
+    // and the tape library's plans draw from the table too
+    ++cases;
+    if (CheckBankLengths(seed) > 0)
+    {
+        printf("\nFAILED: the sample bank's lengths, seed %llu\n",
+               (unsigned long long) seed);
+        ++failed;
+    }
+
+    // and both ways of converting half-precision floats agree
+    ++cases;
+    if (CheckHalfInstructions() > 0)
+    {
+        printf("\nFAILED: the half-precision conversions\n");
+        ++failed;
+    }
+
+    printf("\nDifferential test: %lu of %lu cases passed\n", cases - failed,
+           cases);
+    return failed ? 1 : 0;
 }
 
 //-----------------------------------------------------------------------------
 
+
 /*
- * This function uses Richard Brent's uniform random number generator (see
- * comments in the function) to get a random unsigned long integer.  It is
- * seeded with the current time's seconds and nanoseconds.
+ * Deletes the files in a directory, and then the directory.
  */
-unsigned long GetRandomNaturalNumber(unsigned long lower_bound,
-                                     unsigned long upper_bound)
+static void RemoveDirectory(const char * path)
 {
-    // get the current time to seed the generator
-    struct timeval current_time;
-    gettimeofday(&current_time, NULL);
+    DIR * directory = opendir(path);
+    struct dirent * item = NULL;
 
-    /*
-     * This next line uses a uniform random number generator by Richard Brent.
-     * (http://wwwmaths.anu.edu.au/~brent/random.html)
-     * which is licensed under the GNU Public License v2.
-     * See xorgens.c and xorgens.h for the source code.  Many thanks
-     * to Richard Brent.
-     *
-     * NOTE: the tv_sec and tv_usec members of the timeval struct are
-     * long integers that represent the current time in seconds and
-     * nanoseconds, respectively, since Jan. 1, 1970.  They are used
-     * here to seed the generator.  The generator is called with
-     * xor4096i(), which, unlike the C standard generator, is seeded
-     * and returns a number with the same call.
-     */
-    unsigned long rand_num = 0;
-    // seed the generator and retrieve a random number
-    rand_num = xor4096i((unsigned long)(current_time.tv_usec *
-                        current_time.tv_sec));
-    // reduce the random number to between 0 and the sample size
-    rand_num = rand_num % (upper_bound - lower_bound + 1);
-    // force the random number to at least the lower bound
-    rand_num += lower_bound;
-    
-    return rand_num;
+    if (directory)
+    {
+        while ((item = readdir(directory)) != NULL)
+            if (strcmp(item->d_name, ".") != 0 &&
+                strcmp(item->d_name, "..") != 0)
+                unlinkat(dirfd(directory), item->d_name, 0);
+        closedir(directory);
+    }
+    rmdir(path);
 }
 
 //-----------------------------------------------------------------------------
 
+
 /*
- * This procedure takes a buffer (an array of floats) and resorts a subsection
- * of the array in reverse order based on the start and end indexes passed in.
+ * Changes one byte of a cache entry ('offset' bytes into it), or cuts the
+ * entry short at 'offset' if 'truncate_it' is ON.
  */
-void ApplyReverse(LADSPA_Data * buffer, unsigned long start, unsigned long end)
+static void DamageCacheEntry(const char * directory, uint64_t key,
+                             const char * extension, long offset,
+                             short truncate_it)
 {
-    // a temporary holder of a value so the values in the indexes can be swapped
-    LADSPA_Data holder = 0.0f;
-    //swap the values in the indexes until the indexes meet in the middle
-    while (start <= end)
+    char path[CACHE_PATH_LENGTH];
+    snprintf(path, sizeof (path), "%s/%016llx.%s", directory,
+             (unsigned long long) key, extension);
+
+    if (truncate_it)
     {
-        holder = buffer[start];
-        buffer[start] = buffer[end];
-        buffer[end] = holder;
-        ++start;
-        --end;
+        if (truncate(path, offset) != 0)
+            printf("\n\tcould not truncate %s", path);
+        return;
     }
+
+    FILE * file = fopen(path, "r+b");
+    if (!file)
+        return;
+    fseek(file, offset, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, offset, SEEK_SET);
+    fputc(byte ^ 0x40, file);
+    fclose(file);
 }
 
 //-----------------------------------------------------------------------------
 
+
 /*
- * This procedure copies a section of an array of LADSPA_Data (floats) into a
- * section of another array.
+ * The render cache test (see kite_cache.h), in a new directory under /tmp:
  *
- * NOTE: the source endpoint IS copied.
+ *   - a stored render and a stored plan load back as they were.
+ *   - changing the seed, a cut rule, the length shape or one input sample
+ *     changes the key, and the lookup misses.
+ *   - an entry that has been cut short or changed is turned down, and the
+ *     output buffer is left alone.
+ *   - the hit/miss counts of two KiteOpenCache()/KiteCloseCache() cycles add
+ *     up in the stats file.
+ *   - going over the size limit throws out the least recently used entry
+ *     (a hit counts as a use).
  *
- * ASSUMPTIONS: the destination array does not end before the source section
- * ends.
+ * Returns 0 if everything passed, 1 otherwise.
  */
-void CopySubBlock(LADSPA_Data * destination, unsigned long dest_start,
-                  LADSPA_Data * source, unsigned long src_start,
-                  unsigned long src_end, FILE * file)
+int RunCacheTest(void)
 {
-    if (dest_start == src_start || src_start > src_end)
-//-----------------------------------------------------------------------------
+    char directory[] = "/tmp/kite_cache_test.XXXXXX";
+    char lru_directory[CACHE_PATH_LENGTH];
+    float input[CACHE_TEST_SAMPLES];
+    float output[CACHE_TEST_SAMPLES];
+    float loaded[CACHE_TEST_SAMPLES];
+    unsigned long failures = 0;
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    unsigned long evictions = 0;
+    unsigned long i = 0;
+    KiteCutRules rules;
+    KiteCutRules other_rules;
+    KiteRandom rng;
+    KitePlan plan;
+    KitePlan loaded_plan;
+    KiteCache cache;
+
+    if (!mkdtemp(directory))
     {
-        fprintf(file, "No need to overwrite.\n\n");
-//-----------------------------------------------------------------------------
-        return;
-//-----------------------------------------------------------------------------
+        printf("\nCould not make a directory for the cache test.\n");
+        return 1;
     }
+    snprintf(lru_directory, sizeof (lru_directory), "%s/lru", directory);
+
+    for (i = 0; i < CACHE_TEST_SAMPLES; ++i)
+    {
+        input[i] = (float) i;
+        output[i] = -(float) i;
+    }
+    KiteDefaultCutRules(&rules, 44100);
+    KiteSeedRandom(&rng, 7);
+    if (KiteInitPlan(&plan, 0) != KITE_OK ||
+        KiteInitPlan(&loaded_plan, 0) != KITE_OK ||
+        KiteGeneratePlan(&plan, &rng, &rules, 10 * 44100) != KITE_OK ||
+        KiteOpenCache(&cache, directory, 1 << 24) != KITE_OK)
+    {
+        printf("\nCould not set up the cache test.\n");
+        RemoveDirectory(directory);
+        return 1;
+    }
+
+    uint64_t input_hash = KiteHash(input, sizeof (input), 0);
+    uint64_t render_key = KiteRenderKey(input_hash, 7, &rules,
+                                        sizeof (float));
+    uint64_t plan_key = KitePlanKey(7, &rules, plan.total_samples);
+
+    // what goes in comes back out
+    if (KiteCacheStoreRender(&cache, render_key, output,
+                             sizeof (output)) != KITE_OK ||
+        KiteCacheLoadRender(&cache, render_key, loaded,
+                            sizeof (loaded)) != KITE_OK ||
+        memcmp(loaded, output, sizeof (output)) != 0)
+    {
+        printf("\n\ta stored render didn't load back");
+        ++failures;
+    }
+    short same = OFF;
+    if (KiteCacheStorePlan(&cache, plan_key, &plan) == KITE_OK &&
+        KiteCacheLoadPlan(&cache, plan_key, &loaded_plan) == KITE_OK &&
+        loaded_plan.total_samples == plan.total_samples &&
+        loaded_plan.segment_count == plan.segment_count)
+    {
+        same = ON;
+        for (i = 0; i < plan.segment_count; ++i)
+            if (!SameSegment(&loaded_plan.segments[i], &plan.segments[i]))
+                same = OFF;
+    }
+    if (!same)
+    {
+        printf("\n\ta stored plan didn't load back");
+        ++failures;
+    }
+
+    // anything that changes the output changes the key
+    KiteMakeCutRules(&other_rules, 44100, 0.5, KITE_DEFAULT_MAX_SECONDS,
+                     KITE_DEFAULT_REVERSE_CHANCE);
+    uint64_t other_keys[4];
+    other_keys[0] = KiteRenderKey(input_hash, 8, &rules, sizeof (float));
+    other_keys[1] = KiteRenderKey(input_hash, 7, &other_rules,
+                                  sizeof (float));
+    input[CACHE_TEST_SAMPLES / 2] += 1.0f;
+    other_keys[2] = KiteRenderKey(KiteHash(input, sizeof (input), 0), 7,
+                                  &rules, sizeof (float));
+    input[CACHE_TEST_SAMPLES / 2] -= 1.0f;
+    KitePresetLengths(&other_rules.lengths, KITE_LENGTHS_SHORT);
+    other_rules.min_block_start = rules.min_block_start;
+    other_keys[3] = KiteRenderKey(input_hash, 7, &other_rules,
+                                  sizeof (float));
+    for (i = 0; i < 4; ++i)
+    {
+        if (other_keys[i] == render_key ||
+            KiteCacheLoadRender(&cache, other_keys[i], loaded,
+                                sizeof (loaded)) == KITE_OK)
+        {
+            printf("\n\tchanged request %lu hit the cache", i);
+            ++failures;
+        }
+    }
+    if (KitePlanKey(8, &rules, plan.total_samples) == plan_key ||
+        KitePlanKey(7, &other_rules, plan.total_samples) == plan_key ||
+        KitePlanKey(7, &rules, plan.total_samples + 1) == plan_key ||
+        KiteCacheLoadPlan(&cache, KitePlanKey(8, &rules,
+                                              plan.total_samples),
+                          &loaded_plan) == KITE_OK)
+    {
+        printf("\n\ta changed plan request hit the cache");
+        ++failures;
+    }
+
+    // damaged entries are misses, and don't touch the output
+    long damage[][2] = { { sizeof (output), ON }, { 20, OFF }, { 3, OFF } };
+    for (i = 0; i < sizeof (damage) / sizeof (damage[0]); ++i)
+    {
+        KiteCacheStoreRender(&cache, render_key, output, sizeof (output));
+        DamageCacheEntry(directory, render_key, "render", damage[i][0],
+                         damage[i][1]);
+        memset(loaded, 0, sizeof (loaded));
+        if (KiteCacheLoadRender(&cache, render_key, loaded,
+                                sizeof (loaded)) == KITE_OK ||
+            loaded[0] != 0.0f || loaded[CACHE_TEST_SAMPLES - 1] != 0.0f)
+        {
+            printf("\n\ta damaged render was loaded (damage %lu)", i);
+            ++failures;
+        }
+
+        KiteCacheStorePlan(&cache, plan_key, &plan);
+        DamageCacheEntry(directory, plan_key, "plan",
+                         damage[i][1] ? 40 : 8 * damage[i][0], damage[i][1]);
+        if (KiteCacheLoadPlan(&cache, plan_key, &loaded_plan) == KITE_OK)
+        {
+            printf("\n\ta damaged plan was loaded (damage %lu)", i);
+            ++failures;
+        }
+    }
+
+    // the counts of two cycles add up
+    unsigned long first_hits = cache.hits;
+    unsigned long first_misses = cache.misses;
+    KiteCloseCache(&cache);
+    KiteOpenCache(&cache, directory, 1 << 24);
+    KiteCacheStoreRender(&cache, render_key, output, sizeof (output));
+    KiteCacheLoadRender(&cache, render_key, loaded, sizeof (loaded));
+    KiteCacheLoadRender(&cache, other_keys[0], loaded, sizeof (loaded));
+    KiteCloseCache(&cache);
+    KiteOpenCache(&cache, directory, 1 << 24);
+    KiteCacheTotals(&cache, &hits, &misses, &evictions);
+    if (hits != first_hits + 1 || misses != first_misses + 1 ||
+        evictions != 0)
+    {
+        printf("\n\tthe stats file says %lu hits and %lu misses, not %lu and",
+               hits, misses, first_hits + 1);
+        printf(" %lu", first_misses + 1);
+        ++failures;
+    }
+    KiteCloseCache(&cache);
+
+    /*
+     * room for two renders but not three: after A, B, a hit on A and then
+     * C, B is the least recently used.  The pauses are longer than the
+     * file system's clock tick, so the times come out in order.
+     */
+    uint64_t entry_bytes = sizeof (output) + CACHE_RENDER_HEADER_BYTES;
+    KiteOpenCache(&cache, lru_directory, 2 * entry_bytes + entry_bytes / 2);
+    KiteCacheStoreRender(&cache, 1, output, sizeof (output));
+    usleep(CACHE_TICK_MICROSECONDS);
+    KiteCacheStoreRender(&cache, 2, output, sizeof (output));
+    usleep(CACHE_TICK_MICROSECONDS);
+    KiteCacheLoadRender(&cache, 1, loaded, sizeof (loaded));
+    usleep(CACHE_TICK_MICROSECONDS);
+    KiteCacheStoreRender(&cache, 3, output, sizeof (output));
+    if (cache.evictions != 1 ||
+        KiteCacheLoadRender(&cache, 2, loaded, sizeof (loaded)) == KITE_OK ||
+        KiteCacheLoadRender(&cache, 1, loaded, sizeof (loaded)) != KITE_OK ||
+        KiteCacheLoadRender(&cache, 3, loaded, sizeof (loaded)) != KITE_OK)
+    {
+        printf("\n\tthe size limit didn't evict the least recently used");
+        printf(" entry (%lu evictions)", cache.evictions);
+        ++failures;
+    }
+    KiteCloseCache(&cache);
+
+    KiteFreePlan(&plan);
+    KiteFreePlan(&loaded_plan);
+    RemoveDirectory(lru_directory);
+    RemoveDirectory(directory);
+
+    printf("\nCache test: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
 //-----------------------------------------------------------------------------
-    
-    unsigned long dest_index = dest_start;
-    unsigned long src_index = 0;
-    
-    for (src_index = src_start; src_index <= src_end; ++src_index)
-    {
-        destination[dest_index] = source[src_index];
-        
-//-----------------------------------------------------------------------------
-        fprintf(file, "\n\t%f", source[src_index]);
-//-----------------------------------------------------------------------------
-        
-        ++dest_index;
+
+#ifdef KITE_RT_AUDIT
+
+/*
+ * The sample rates and sample counts the audit runs every descriptor with.
+ * 0 and 1 take run()'s early return, the middle ones are typical host buffer
+ * sizes, and the last ones are long enough to be cut into several sub-blocks.
+ */
+static const unsigned long AUDIT_SAMPLE_RATES[] = { 8000, 44100, 192000 };
+static const unsigned long AUDIT_SAMPLE_COUNTS[] = { 0, 1, 2, 16, 64, 256,
+                                                     1024, 4096, 8192, 65536,
+                                                     1000000 };
+#define AUDIT_RATE_COUNT (sizeof (AUDIT_SAMPLE_RATES) / sizeof (unsigned long))
+#define AUDIT_SIZE_COUNT (sizeof (AUDIT_SAMPLE_COUNTS) / sizeof (unsigned long))
+// the largest entry of AUDIT_SAMPLE_COUNTS
+#define AUDIT_MAX_SAMPLES 1000000
+// the length of the sample bank made for the tape library version
+#define AUDIT_BANK_FRAMES 1000000
+
+/*
+ * The tape library version of the plugin needs a sample bank (see
+ * kite_bank.h).  Unless KITE_BANK already names one, this writes a temporary
+ * raw file of noise and points KITE_BANK at it.  Returns the file's name if
+ * it made one, so it can be deleted afterwards.
+ */
+static char * MakeAuditBank(void)
+{
+    static char bank_path[] = "/tmp/kite_audit_bank_XXXXXX";
+    unsigned long i = 0;
+
+    if (getenv("KITE_BANK"))
+        return NULL;
+
+    int file = mkstemp(bank_path);
+    FILE * bank = file >= 0 ? fdopen(file, "wb") : NULL;
+    if (!bank)
+        return NULL;
+    for (i = 0; i < AUDIT_BANK_FRAMES; ++i)
+    {
+        float sample = (float) random() / RAND_MAX * 2.0f - 1.0f;
+        fwrite(&sample, sizeof (sample), 1, bank);
     }
+    fclose(bank);
+
+    setenv("KITE_BANK", bank_path, 1);
+    return bank_path;
 }
 
+/*
+ * Loads the plugin like a host would, and calls run() (and run_adding(), if
+ * the plugin has one) of every descriptor with every sample rate and sample
+ * count above, while the audit watches for allocation, stdio and system
+ * calls.  Everything a host would do outside of run() (allocating buffers,
+ * instantiating, connecting ports) is done before entering the audit.
+ * Returns 0 if run() stayed real-time safe, 1 otherwise.
+ */
+int RunRealtimeAudit(const char * plugin_path)
+{
+    KiteAuditInit();
+    char * bank_path = MakeAuditBank();
+
+    void * library = dlopen(plugin_path, RTLD_NOW);
+    if (!library)
+    {
+        printf("\nCould not load %s: %s\n", plugin_path, dlerror());
+        return 1;
+    }
+    LADSPA_Descriptor_Function get_descriptor = (LADSPA_Descriptor_Function)
+            dlsym(library, "ladspa_descriptor");
+    if (!get_descriptor)
+    {
+        printf("\n%s has no ladspa_descriptor()\n", plugin_path);
+        dlclose(library);
+        return 1;
+    }
+
+    int failures = 0;
+    unsigned long index = 0;
+    const LADSPA_Descriptor * descriptor = NULL;
+
+    for (index = 0; (descriptor = get_descriptor(index)) != NULL; ++index)
+    {
+        // one buffer per port; control ports only use the first value
+        LADSPA_Data ** buffers = calloc(descriptor->PortCount,
+                                        sizeof (LADSPA_Data *));
+        unsigned long port = 0;
+        for (port = 0; buffers && port < descriptor->PortCount; ++port)
+        {
+            buffers[port] = calloc(AUDIT_MAX_SAMPLES, sizeof (LADSPA_Data));
+            if (!buffers[port])
+            {
+                printf("\nOut of memory.\n");
+                return 1;
+            }
+        }
+
+        unsigned long rate = 0;
+        for (rate = 0; rate < AUDIT_RATE_COUNT; ++rate)
+        {
+            LADSPA_Handle instance = descriptor->instantiate(descriptor,
+                    AUDIT_SAMPLE_RATES[rate]);
+            if (!instance)
+            {
+                printf("\n%s: instantiate failed\n", descriptor->Label);
+                ++failures;
+                continue;
+            }
+
+            for (port = 0; port < descriptor->PortCount; ++port)
+            {
+                const LADSPA_PortRangeHint * hint =
+                        &descriptor->PortRangeHints[port];
+                // start control inputs at their lower bound (or 0)
+                if (LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[port]))
+                    buffers[port][0] = LADSPA_IS_HINT_BOUNDED_BELOW(
+                            hint->HintDescriptor) ? hint->LowerBound : 0.0f;
+                descriptor->connect_port(instance, port, buffers[port]);
+            }
+            if (descriptor->activate)
+                descriptor->activate(instance);
+
+            unsigned long size = 0;
+            for (size = 0; size < AUDIT_SIZE_COUNT; ++size)
+            {
+                unsigned long count = AUDIT_SAMPLE_COUNTS[size];
+
+                // fill the audio inputs with a ramp (like main() does)
+                for (port = 0; port < descriptor->PortCount; ++port)
+                {
+                    LADSPA_PortDescriptor kind =
+                            descriptor->PortDescriptors[port];
+                    unsigned long i = 0;
+                    if (LADSPA_IS_PORT_AUDIO(kind) &&
+                        LADSPA_IS_PORT_INPUT(kind))
+                        for (i = 0; i < count; ++i)
+                            buffers[port][i] = (LADSPA_Data) i;
+                }
+
+                KiteAuditEnter();
+                descriptor->run(instance, count);
+                KiteAuditLeave();
+
+                if (descriptor->run_adding)
+                {
+                    KiteAuditEnter();
+                    descriptor->run_adding(instance, count);
+                    KiteAuditLeave();
+                }
+
+                if (KiteAuditViolationCount() > 0)
+                {
+                    printf("\n%s: %lu samples at %lu Hz:\n",
+                           descriptor->Label, count, AUDIT_SAMPLE_RATES[rate]);
+                    KiteAuditReport(stdout);
+                    KiteAuditReset();
+                    ++failures;
+                }
+            }
+
+            if (descriptor->deactivate)
+                descriptor->deactivate(instance);
+            descriptor->cleanup(instance);
+        }
+
+        for (port = 0; buffers && port < descriptor->PortCount; ++port)
+            free(buffers[port]);
+        free(buffers);
+    }
+
+    printf("\nReal-time audit of %s: %s\n", plugin_path,
+           failures ? "FAILED" : "passed");
+
+    dlclose(library);
+    if (bank_path)
+        unlink(bank_path);
+    return failures ? 1 : 0;
+}
+
+#endif
+
 // ------------------------------- EOF ----------------------------------------